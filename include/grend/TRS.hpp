@@ -23,11 +23,18 @@ static inline struct TRS addTRS(const struct TRS& a, const struct TRS& b) {
 	};
 }
 
-static inline struct TRS mixtrs(struct TRS& a, struct TRS& b, float amount) {
+// normalized lerp, cheaper than slerp and close enough for blending,
+// takes the shortest path
+static inline glm::quat nlerp(const glm::quat& a, const glm::quat& b, float amount) {
+	glm::quat c = (glm::dot(a, b) < 0)? -b : b;
+	return glm::normalize(a*(1.f - amount) + c*amount);
+}
+
+static inline struct TRS mixtrs(const struct TRS& a, const struct TRS& b, float amount) {
 	struct TRS ret;
 
 	ret.position = glm::mix(a.position, b.position, amount);
-	ret.rotation = glm::mix(a.rotation, b.rotation, amount);
+	ret.rotation = nlerp(a.rotation, b.rotation, amount);
 	ret.scale    = glm::mix(a.scale, b.scale, amount);
 
 	return ret;
@@ -6,6 +6,7 @@
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <tuple>
 #include <stddef.h>
@@ -20,6 +21,9 @@ class spointers {
 
 class animationGroup;
 class animationCollection;
+class animationClip;
+class sceneNode;
+class jobQueue;
 
 class animation {
 	public:
@@ -41,7 +45,9 @@ class animationChannel {
 		typedef std::shared_ptr<animationChannel> ptr;
 		typedef std::weak_ptr<animationChannel>   weakptr;
 
-		void applyTransform(struct TRS& thing, float delta, float endtime);
+		// weight mixes the animated transform with the one passed in
+		void applyTransform(struct TRS& thing, float delta, float endtime,
+		                    float weight = 1.0);
 		std::vector<animation::ptr> animations;
 };
 
@@ -57,6 +63,15 @@ class animationMap
 		typedef std::weak_ptr<animationMap>   weakptr;
 
 		float endtime = 0.0;
+
+		// flattened copy of the map for animationInstance, built on the
+		// first call
+		// XXX: not rebuilt if channels are changed after that
+		std::shared_ptr<animationClip> clip(void);
+
+	private:
+		std::shared_ptr<animationClip> compiled;
+		std::once_flag compiledOnce;
 };
 
 class animationCollection
@@ -97,5 +112,179 @@ class animationScale : public animation {
 		std::vector<glm::vec3> scales;
 };
 
+// Flattened, read-only copy of an animationMap. Keyframes of all tracks are
+// stored in shared arrays and tracks are grouped by type, so sampling is a
+// few tight loops rather than a virtual call and a search per track.
+class animationClip {
+	public:
+		typedef std::shared_ptr<animationClip> ptr;
+		typedef std::weak_ptr<animationClip>   weakptr;
+
+		animationClip(const animationMap& anim);
+
+		struct track {
+			uint32_t target; // index into channels
+			uint32_t keys;   // first keyframe time in times
+			uint32_t values; // first value in vectors or quats
+			uint32_t count;  // number of keyframes
+		};
+
+		std::vector<track> translations;
+		std::vector<track> rotations;
+		std::vector<track> scales;
+
+		std::vector<float>     times;
+		std::vector<glm::vec3> vectors; // translation and scale keyframes
+		std::vector<glm::quat> quats;   // rotation keyframes
+
+		// animChannel hashes of the nodes the clip animates
+		std::vector<uint32_t> channels;
+		float endtime = 0.0;
+};
+
+// Playback state of a clip on one node tree. Keeps a cursor with the last
+// keyframe of each track, so playing forward only has to look at the next
+// keyframe instead of searching for it.
+class animationInstance {
+	public:
+		typedef std::shared_ptr<animationInstance> ptr;
+		typedef std::weak_ptr<animationInstance>   weakptr;
+
+		// binds channels to the nodes under root with matching animChannel
+		// hashes, see load_gltf_scene_nodes()
+		animationInstance(animationClip::ptr clip,
+		                  std::shared_ptr<sceneNode> root);
+
+		void advance(float delta);
+		void seek(float newtime);
+		// sample the clip at the current time into the pose arrays,
+		// doesn't touch the bound nodes
+		void sample(void);
+		// set bound node transforms from the pose
+		void apply(void);
+
+		animationClip::ptr clip;
+		float time  = 0.0;
+		float speed = 1.0;
+		bool  loop  = true;
+		bool  playing = true;
+
+		// pose for each of clip->channels, initialized to the original node
+		// transforms, so channels that only animate some of translation,
+		// rotation or scale keep the rest
+		std::vector<glm::vec3> positions;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+
+		// bound node for each channel, null if the tree doesn't have one
+		std::vector<std::shared_ptr<sceneNode>> nodes;
+
+	private:
+		// last keyframe of each track, translations then rotations then scales
+		std::vector<uint32_t> cursors;
+};
+
+// Blends several clips on one node tree, each clip is sampled once per
+// update and mixed from the instance pose arrays.
+//
+// Blend layers are averaged by weight, with the rest pose filling in when
+// the weights add up to less than 1. Additive layers then add their
+// difference from the rest pose on top. Rotations are mixed with nlerp.
+class animationMixer {
+	public:
+		typedef std::shared_ptr<animationMixer> ptr;
+		typedef std::weak_ptr<animationMixer>   weakptr;
+
+		enum blendMode {
+			Blend,
+			Additive,
+		};
+
+		struct layer {
+			animationInstance::ptr instance;
+			blendMode mode = blendMode::Blend;
+			float weight = 1.0;
+
+			// weight moves towards target at rate per second, see fade()
+			float target = 1.0;
+			float rate   = 0.0;
+			bool  removeFaded = false;
+
+			// weight multiplier for each of the instance's channels
+			std::vector<float> mask;
+			// mixer channel for each of the instance's channels
+			std::vector<uint32_t> remap;
+		};
+
+		animationMixer(std::shared_ptr<sceneNode> root);
+
+		animationInstance::ptr add(animationClip::ptr clip,
+		                           float weight = 1.0,
+		                           blendMode mode = blendMode::Blend);
+		void remove(animationInstance::ptr inst);
+
+		// move a layer's weight to target over duration seconds,
+		// optionally removing the layer once it reaches 0
+		void fade(animationInstance::ptr inst, float target, float duration,
+		          bool removeFaded = false);
+		// fade inst in, and every other blend layer out (and remove them)
+		void crossfade(animationInstance::ptr inst, float duration);
+		// per-joint weights for a layer, keyed by animChannel hash,
+		// see jointMask()
+		void setMask(animationInstance::ptr inst,
+		             const std::unordered_map<uint32_t, float>& mask,
+		             float defaultWeight = 0.0);
+
+		// advance and sample all layers, blend, then set node transforms
+		void update(float delta);
+
+		std::vector<layer> layers;
+
+		// union of the channels of all layers
+		std::vector<uint32_t> channels;
+		std::vector<std::shared_ptr<sceneNode>> nodes;
+		std::vector<TRS> rest;
+
+		// blended pose
+		std::vector<glm::vec3> positions;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+
+	private:
+		layer *find(const animationInstance::ptr& inst);
+		uint32_t channelFor(uint32_t hash);
+
+		std::shared_ptr<sceneNode> root;
+		std::unordered_map<uint32_t, std::shared_ptr<sceneNode>> bound;
+		std::unordered_map<uint32_t, uint32_t> channelIndex;
+		std::vector<float> weights;
+};
+
+// mask for animationMixer::setMask() covering joint and everything under it
+std::unordered_map<uint32_t, float>
+jointMask(std::shared_ptr<sceneNode> joint, float weight = 1.0);
+
+// Plays a set of instances and mixers, updating all of them in one pass,
+// split between the calling thread and the job queue's workers if one
+// is given.
+//
+// Everything is updated in parallel, so instances and mixers shouldn't
+// share bound nodes. Instances used as mixer layers are updated by the
+// mixer, don't add those here.
+class animationPlayer {
+	public:
+		typedef std::shared_ptr<animationPlayer> ptr;
+		typedef std::weak_ptr<animationPlayer>   weakptr;
+
+		void add(animationInstance::ptr inst);
+		void add(animationMixer::ptr mixer);
+		void remove(animationInstance::ptr inst);
+		void remove(animationMixer::ptr mixer);
+		void update(float delta, jobQueue *jobs = nullptr);
+
+		std::vector<animationInstance::ptr> instances;
+		std::vector<animationMixer::ptr>    mixers;
+};
+
 // namespace grendx;
 }
@@ -4,6 +4,7 @@
 #include <grend/sdlContext.hpp>
 #include <grend/glmIncludes.hpp>
 #include <grend/camera.hpp>
+#include <grend/audioResampler.hpp>
 
 #include <memory>
 #include <utility>
@@ -11,13 +12,37 @@
 #include <vector>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <limits.h>
+
+// defined in stb_vorbis
+struct stb_vorbis;
 
 namespace grendx {
 
+// stereo frames mixed at a time, see audioMixer::mixBlock()
+#define AUDIO_BLOCK_SIZE 256
+
 class audioBuffer : public std::vector<int16_t> {
 	public:
 		typedef std::shared_ptr<audioBuffer> ptr;
 		typedef std::weak_ptr<audioBuffer> weakptr;
+
+		// for the resampler, wraps around when looping, silence
+		// past the ends otherwise
+		float sampleAt(ptrdiff_t i, bool loop) const {
+			ptrdiff_t len = size();
+
+			if (i >= 0 && i < len) {
+				return (*this)[i];
+			}
+
+			return (loop && len > 0)? (*this)[(i % len + len) % len] : 0.f;
+		}
+
+		unsigned sampleRate = 44100;
 };
 
 typedef audioBuffer::ptr monoBuffer;
@@ -40,19 +65,56 @@ class audioChannel {
 			Ended,
 		};
 
+		// voice categories, each with its own priority and voice limit,
+		// see audioMixer::setCategory(), games can use numbers past these
+		enum categories {
+			Effects,
+			Ambience,
+			Music,
+			Dialogue,
+		};
+
 		typedef std::shared_ptr<audioChannel> ptr;
 		typedef std::weak_ptr<audioChannel> weakptr;
 		audioChannel(enum mode m) : loopMode(m) {};
 		virtual ~audioChannel();
 
 		virtual std::pair<int16_t, int16_t> getSample(camera::ptr cam) = 0;
+		// fill left and right with the next frames (at most AUDIO_BLOCK_SIZE)
+		// stereo frames, in 16 bit sample units, default calls getSample()
+		// for each frame, subclasses should override this
+		virtual void getBlock(float *left, float *right, size_t frames,
+		                      camera::ptr cam);
 		virtual void restart(void);
+		// rough gain at the listener, used by the mixer to pick which
+		// voices to mix, default is just the volume
+		virtual float audibility(camera::ptr cam);
+		// advance playback without producing output, for virtualized
+		// voices, default mixes into a scratch buffer
+		virtual void skip(size_t frames);
 
 		enum mode loopMode;
 		enum state playState = state::Playing;
 
 		size_t audioPosition = 0;
 		glm::vec3 worldPosition = glm::vec3(0);
+
+		float volume = 1.f;
+		// importance relative to other channels in the same category
+		float priority = 1.f;
+		unsigned category = categories::Effects;
+		// set by the mixer, whether the channel was skipped last block
+		bool virtualized = false;
+
+		// rate of the device, set by audioMixer::add()
+		unsigned outputRate = 44100;
+		// playback rate multiplier, changes the pitch
+		float pitch = 1.f;
+		audioResampler resampler;
+
+	protected:
+		// fractional part of audioPosition, when resampling
+		double positionFrac = 0;
 };
 
 class stereoAudioChannel : public audioChannel {
@@ -65,6 +127,9 @@ class stereoAudioChannel : public audioChannel {
 		virtual ~stereoAudioChannel();
 
 		virtual std::pair<int16_t, int16_t> getSample(camera::ptr cam);
+		virtual void getBlock(float *left, float *right, size_t frames,
+		                      camera::ptr cam);
+		virtual void skip(size_t frames);
 
 		stereoBuffer bufs;
 };
@@ -79,9 +144,112 @@ class spatialAudioChannel : public audioChannel {
 		virtual ~spatialAudioChannel();
 
 		virtual std::pair<int16_t, int16_t> getSample(camera::ptr cam);
+		virtual void getBlock(float *left, float *right, size_t frames,
+		                      camera::ptr cam);
+		virtual float audibility(camera::ptr cam);
+		virtual void skip(size_t frames);
 
 		// mono input
 		monoBuffer buf;
+
+		// 0 is unobstructed, 1 is fully behind something, set by the game
+		// (eg. from raycasts), muffles and quiets the sound
+		float occlusion = 0.f;
+		// pitch shift from the distance to the listener changing
+		bool doppler = true;
+
+		// spatializer parameters, computed once per block and
+		// interpolated across it, see spatialAudioChannel.cpp
+		struct spatialParams {
+			float gain[2];    // left, right
+			float delay[2];   // interaural delay, in samples
+			float lowpass[2]; // one-pole filter coefficients
+			float rate;       // playback rate, from doppler
+		};
+
+	private:
+		// power of two, longer than the longest delay
+		static constexpr size_t historySize = 1024;
+
+		spatialParams last;
+		bool  haveLast = false;
+		float lastDistance = 0.f;
+
+		float history[historySize] = {0};
+		size_t historyPos = 0;
+		float filtered[2] = {0, 0};
+};
+
+/**
+ * Stereo channel that decodes an ogg vorbis file incrementally on a
+ * background thread, for music and long ambience loops that would be
+ * expensive to keep fully decoded in memory.
+ *
+ * The decoder keeps a ring buffer a second or so ahead of playback, an
+ * underrun plays silence rather than blocking the audio thread.
+ */
+class streamingAudioChannel : public audioChannel {
+	public:
+		typedef std::shared_ptr<streamingAudioChannel> ptr;
+		typedef std::weak_ptr<streamingAudioChannel> weakptr;
+
+		streamingAudioChannel(std::string filename,
+		                      enum audioChannel::mode m = mode::OneShot);
+		virtual ~streamingAudioChannel();
+
+		virtual std::pair<int16_t, int16_t> getSample(camera::ptr cam);
+		virtual void getBlock(float *left, float *right, size_t frames,
+		                      camera::ptr cam);
+		virtual void restart(void);
+
+		// position in frames, takes effect once the decoder gets to it
+		void seek(size_t frame);
+		bool good(void) const { return stream != nullptr; };
+
+		size_t   length = 0;     // in frames
+		unsigned sampleRate = 0;
+		unsigned channels = 0;
+
+	private:
+		// power of two, in stereo frames
+		static constexpr size_t ringSize = 1 << 16;
+
+		// everything the decoder thread touches, shared with it so the
+		// channel can be freed without waiting for the thread to finish,
+		// the last reference is often dropped in the audio callback
+		struct decoderState {
+			~decoderState();
+
+			std::vector<float> ring;
+
+			// total frames written/read, indexes into ring modulo ringSize,
+			// written only by the decoder/audio thread respectively, frames
+			// are kept around a bit after being read for the resampler
+			std::atomic<uint64_t> writePos = 0;
+			std::atomic<uint64_t> readPos  = 0;
+			// frames written before a seek are skipped by the reader
+			std::atomic<uint64_t> discardUntil = 0;
+			// file position of the frame at discardUntil
+			std::atomic<uint64_t> seekBase = 0;
+			std::atomic<int64_t>  seekTarget = -1;
+			std::atomic<bool>     finished = false;
+			std::atomic<bool>     stop = false;
+			// copied from loopMode by the audio thread
+			std::atomic<bool>     loop = false;
+
+			stb_vorbis *vorbis = nullptr;
+			size_t   length = 0;
+			unsigned channels = 0;
+
+			std::mutex wakeMtx;
+			std::condition_variable wake;
+		};
+
+		static void decode(std::shared_ptr<decoderState> state);
+
+		std::shared_ptr<decoderState> stream;
+		// read position in ring frames, only touched by the audio thread
+		double readFrame = 0;
 };
 
 class audioMixer : public IoC::Service {
@@ -92,15 +260,64 @@ class audioMixer : public IoC::Service {
 		audioMixer(context& ctx);
 
 		void setCamera(camera::ptr cam);
-		std::pair<int16_t, int16_t> getSample(camera::ptr cam);
 		size_t add(audioChannel::ptr channel);
 		void   remove(size_t id);
 
+		// only the most audible voices (scaled by category and channel
+		// priority) are mixed, the rest keep playing silently until
+		// they're important enough again
+		struct voiceCategory {
+			float    priority  = 1.f;
+			unsigned maxVoices = UINT_MAX;
+		};
+
+		void setCategory(unsigned category, float priority, unsigned maxVoices);
+
+		// mix frames of interleaved stereo into out, called from the
+		// audio callback
+		void mixBlock(int16_t *out, size_t frames);
+
 		std::map<size_t, audioChannel::ptr> channels;
 		size_t chanids = 0;
 		camera::ptr currentCam;
 		glm::vec3 currentPos;
 		std::mutex mtx;
+
+		// output is scaled down smoothly when the mix would clip, peaks
+		// are kept under this (fraction of full scale)
+		float limiterCeiling = 0.95;
+		// device rate, what everything is resampled to
+		unsigned outputRate;
+		// total number of voices mixed at once
+		unsigned maxVoices = 32;
+		// channels quieter than this are never mixed
+		float minAudibility = 0.001;
+
+	private:
+		struct voice {
+			audioChannel *chan;
+			float audibility;
+			float score;
+			bool  real;
+		};
+
+		void assignVoices(camera::ptr cam);
+
+		// indexed by category, categories past the end use the defaults
+		std::vector<voiceCategory> categories;
+
+		// everything here is only touched by the audio thread
+		std::vector<audioChannel::ptr> mixing;
+		std::vector<voiceCategory> activeCategories;
+		std::vector<unsigned> categoryVoices;
+		std::vector<voice> voices;
+		unsigned activeMaxVoices;
+		float activeMinAudibility;
+		float limiterGain = 1.0;
+		float mixLeft[AUDIO_BLOCK_SIZE];
+		float mixRight[AUDIO_BLOCK_SIZE];
+		float chanLeft[AUDIO_BLOCK_SIZE];
+		float chanRight[AUDIO_BLOCK_SIZE];
 };
 
 channelBuffers_ptr openAudio(std::string filename);
@@ -110,6 +327,10 @@ spatialAudioChannel::ptr openSpatialLoop(std::string filename);
 spatialAudioChannel::ptr openSpatialChannel(std::string filename);
 stereoAudioChannel::ptr  openStereoLoop(std::string filename);
 stereoAudioChannel::ptr  openStereoChannel(std::string filename);
+// music, ambience, anything long that's only played once at a time
+streamingAudioChannel::ptr openAudioStream(std::string filename,
+                                           enum audioChannel::mode m
+                                               = audioChannel::mode::Loop);
 
 // namespace grendx
 }
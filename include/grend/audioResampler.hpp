@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stddef.h>
+#include <math.h>
+
+namespace grendx {
+
+/**
+ * Sample rate conversion for audio channels, done while the mixer pulls
+ * blocks so assets can be any rate and the mixer runs at whatever the
+ * device wants. The read rate can change across a block, which is also how
+ * pitch shifting and doppler are done.
+ *
+ * Sources are read through a callable taking a source frame index (which
+ * can be negative or past the end near the edges), so looping, ring buffers
+ * and sample formats are up to the caller.
+ *
+ * Sinc mode is a windowed sinc, precomputed for a fixed number of
+ * fractional offsets (phases) and interpolated between them, with the
+ * cutoff lowered when downsampling. Linear is much cheaper, fine for
+ * most effects.
+ */
+class audioResampler {
+	public:
+		enum mode {
+			Linear,
+			Sinc,
+		};
+
+		// source frames used on either side of the read position
+		static constexpr unsigned halfTaps = 8;
+		static constexpr unsigned taps     = 2*halfTaps;
+		static constexpr unsigned phases   = 32;
+
+		audioResampler(enum mode m = mode::Sinc) : resampleMode(m) {};
+
+		// writes up to frames samples to out, reading from pos (in source
+		// frames) and advancing it by a rate interpolated from rateStart to
+		// rateEnd, stops early if pos reaches limit, returns the number
+		// of samples written
+		template <typename F>
+		size_t resample(float *out, size_t frames, double& pos,
+		                float rateStart, float rateEnd, double limit,
+		                F source);
+
+		// source frames needed past the read position
+		unsigned lookahead(void) const {
+			return (resampleMode == mode::Sinc)? halfTaps : 1;
+		}
+
+		enum mode resampleMode;
+
+	private:
+		void buildKernel(float cutoff);
+
+		// one extra phase, so interpolating past the last one
+		// doesn't need to wrap around to the next frame
+		float kernel[phases + 1][taps];
+		float kernelCutoff = 0;
+};
+
+template <typename F>
+size_t audioResampler::resample(float *out,
+                                size_t frames,
+                                double& pos,
+                                float rateStart,
+                                float rateEnd,
+                                double limit,
+                                F source)
+{
+	if (frames == 0) {
+		return 0;
+	}
+
+	ptrdiff_t base = floor(pos);
+
+	// same rate, lined up on a frame, plain copy
+	if (rateStart == 1.f && rateEnd == 1.f && pos == double(base)) {
+		size_t n = frames;
+
+		if (limit - pos < double(frames)) {
+			n = (limit > pos)? size_t(ceil(limit - pos)) : 0;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			out[i] = source(base + i);
+		}
+
+		pos += n;
+		return n;
+	}
+
+	float step = (rateEnd - rateStart) / frames;
+
+	if (resampleMode == mode::Sinc) {
+		// filter out anything over the output nyquist when reading faster,
+		// quantized so doppler changes don't rebuild the kernel constantly
+		float rate   = (rateStart > rateEnd)? rateStart : rateEnd;
+		float cutoff = (rate > 1.f)? 1.f / rate : 1.f;
+		cutoff = fmaxf(1.f/16, floorf(cutoff * 16.f) / 16.f);
+
+		if (cutoff != kernelCutoff) {
+			buildKernel(cutoff);
+		}
+	}
+
+	for (size_t i = 0; i < frames; i++) {
+		if (pos >= limit) {
+			return i;
+		}
+
+		base = floor(pos);
+		float frac = pos - base;
+
+		if (resampleMode == mode::Linear) {
+			float a = source(base);
+			out[i] = a + (source(base + 1) - a)*frac;
+
+		} else {
+			float p = frac * phases;
+			unsigned ph = p;
+			float t = p - ph;
+			const float *a = kernel[ph];
+			const float *b = kernel[ph + 1];
+			ptrdiff_t first = base - halfTaps + 1;
+			float sum = 0;
+
+			for (unsigned k = 0; k < taps; k++) {
+				sum += (a[k] + (b[k] - a[k])*t) * source(first + k);
+			}
+
+			out[i] = sum;
+		}
+
+		pos += rateStart + step*(i + 1);
+	}
+
+	return frames;
+}
+
+// namespace grendx
+}
@@ -4,6 +4,8 @@
 #include <grend/sceneModel.hpp>
 #include <grend/octree.hpp>
 #include <grend/physics.hpp>
+#include <grend/lockFreeQueue.hpp>
+#include <grend/bulletShapeCache.hpp>
 #include <grend/TRS.hpp>
 
 #include <unordered_map>
@@ -16,6 +18,9 @@
 #include "btBulletDynamicsCommon.h"
 #include "LinearMath/btIDebugDraw.h"
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
 #include <condition_variable>
 
 namespace grendx {
@@ -41,6 +46,7 @@ class bulletObject : public physicsObject {
 		virtual glm::vec3 getVelocity(void);
 		virtual glm::vec3 getAcceleration(void);
 		virtual float     getAngularFactor(void);
+		virtual uint32_t  getID(void) { return id; };
 
 		virtual void removeSelf(void);
 
@@ -48,11 +54,25 @@ class bulletObject : public physicsObject {
 		sceneNode::weakptr obj;
 		bulletPhysics *runtime = nullptr;
 
-		btRigidBody *body;
-		btCollisionShape *shape;
+		// owned by the simulation once added, only used from the
+		// game thread to create the body, null after removal
+		btRigidBody *body = nullptr;
+		// handed to the simulation with the body on removal
+		std::shared_ptr<btCollisionShape> shape;
 		btDefaultMotionState *motionState;
 		float mass;
 		void *data;
+
+		// index into the published body states, and an id to tell
+		// apart objects that reused the same slot
+		uint32_t slot;
+		uint32_t id;
+
+		// last transform set from the game side, returned until the
+		// simulation has caught up with it
+		TRS      lastTransform;
+		uint64_t transformCommand = 0;
+		float    angularFactor = 1.f;
 };
 
 #include <grend/glManager.hpp>
@@ -155,16 +175,164 @@ class bulletPhysics : public physics {
 		virtual void filterCollisions(void);
 		virtual void stepSimulation(float delta);
 
+		virtual void raycast(const std::vector<physicsRay>& rays,
+		                     std::vector<physicsHit>& hits,
+		                     jobQueue *jobs = nullptr);
+		virtual void sweepSpheres(const std::vector<physicsSweep>& sweeps,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr);
+		virtual void overlapSpheres(const std::vector<physicsSphere>& spheres,
+		                            std::vector<physicsHit>& hits,
+		                            jobQueue *jobs = nullptr);
+		virtual void overlapBoxes(const std::vector<physicsBox>& boxes,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr);
+
+		// simulate on a separate thread, stepSimulation() then only
+		// hands time to the thread and picks up whatever it published
+		void startThread(void);
+		void stopThread(void);
+
+		// fixed steps per second, set before starting the thread
+		float stepRate = 60.f;
+
 	private:
+		friend class bulletObject;
+
+		// everything that changes the world goes through here, applied
+		// in order at the start of the next step
+		struct command {
+			enum type {
+				Add,
+				Remove,
+				SetTransform,
+				SetVelocity,
+				ApplyForce,
+				SetAngularFactor,
+			} type;
+
+			uint32_t     slot;
+			uint32_t     id;
+			btRigidBody *body;
+			btDefaultMotionState *motionState;
+			// released once the body is gone
+			std::shared_ptr<btCollisionShape> shape;
+			glm::vec3    vec;
+			glm::quat    rot;
+			float        amount;
+			uint64_t     seq;
+		};
+
+		struct bodyState {
+			uint32_t  id;
+			glm::vec3 lastPosition;
+			glm::quat lastRotation;
+			glm::vec3 position;
+			glm::quat rotation;
+			glm::vec3 velocity;
+		};
+
+		struct contactState {
+			uint32_t  slotA, slotB;
+			uint32_t  idA, idB;
+			glm::vec3 positionA, positionB;
+			glm::vec3 normalB;
+			float     depth;
+		};
+
+		// body states after a step, plus the ones before it, for
+		// interpolating
+		struct snapshot {
+			std::vector<bodyState>    bodies;
+			std::vector<contactState> contacts;
+			double   time = 0;
+			uint64_t commandsApplied = 0;
+		};
+
+		// game side
+		uint64_t submit(command cmd);
+		uint32_t allocSlot(bulletObject *obj);
+		physicsObject::ptr addBody(bulletObject::ptr obj, const btTransform& trans);
+		const bodyState *currentState(const bulletObject *obj);
+		TRS  interpolate(const bulletObject *obj);
+		void acquireSnapshot(void);
+
+		// simulation side
+		void applyCommands(void);
+		void tick(void);
+		void publish(void);
+		void simulationThread(void);
+
 		btDefaultCollisionConfiguration *collisionConfig;
 		btCollisionDispatcher *dispatcher;
 		btBroadphaseInterface *pairCache;
 		btSequentialImpulseConstraintSolver *solver;
 		btDiscreteDynamicsWorld *world;
 
-		std::map<bulletObject *, physicsObject::weakptr> objects;
-		std::mutex bulletMutex;
+		// triangle mesh shapes, shared between instances
+		bulletShapeCache shapeCache;
+
+		// game side, objects by slot
+		struct objectSlot {
+			physicsObject::weakptr obj;
+			void *data;
+			uint32_t id;
+		};
+
+		std::vector<objectSlot> objects;
+		std::vector<uint32_t>   freeSlots;
+		size_t   liveObjects = 0;
+		uint32_t nextID = 1;
+		uint64_t commandSeq = 0;
+		bool     contactsPending = false;
+		float    alpha = 1.f;
+
+		// touching pairs from the last filterCollisions(), sorted by key,
+		// diffed with the new ones for begin/persist/end events
+		struct contactPair {
+			// idA << 32 | idB, with idA < idB
+			uint64_t  key;
+			uint32_t  slotA, slotB;
+			glm::vec3 positionA, positionB;
+			glm::vec3 normalB;
+			float     depth;
+		};
 
+		std::vector<contactPair> pairs;
+		std::vector<contactPair> lastPairs;
+
+		lockFreeQueue<command> commands {4096};
+
+		// triple buffered snapshots, the simulation fills back and swaps
+		// it with middle, the game swaps middle with front when there's
+		// something new
+		static constexpr unsigned snapshotFresh = 4;
+		snapshot snapshots[3];
+		unsigned back = 0;
+		unsigned front = 1;
+		std::atomic<unsigned> middle = 2;
+
+		// simulation side, bodies by slot
+		std::vector<btRigidBody*> simBodies;
+		std::vector<uint32_t>     simIDs;
+		std::vector<bodyState>    lastStates;
+		uint64_t simCommandsApplied = 0;
+		double   simTime = 0;
+		bool     carryContacts = false;
+
+		// time handed to the simulation, simulated time only moves
+		// up to this, so pausing the game pauses physics
+		std::atomic<double> requestedTime = 0;
+		std::atomic<bool>   running = false;
+		std::thread simThread;
+		std::mutex wakeMtx;
+		std::condition_variable wake;
+
+		// held exclusively while stepping, shared by queries
+		std::shared_mutex worldMtx;
+
+		// only held while drawing debug lines
+		std::mutex debugMtx;
 		bulletDebugDrawer debugDrawer;
 };
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <grend/glmIncludes.hpp>
+#include <grend/sceneModel.hpp>
+
+#include "btBulletDynamicsCommon.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace grendx {
+
+/**
+ * Triangle mesh collision shapes, shared between every instance of the same
+ * (model, mesh) pair. Instances get their scale from a
+ * btScaledBvhTriangleMeshShape wrapping the shared shape, since scaling a
+ * btBvhTriangleMeshShape directly rebuilds its BVH.
+ *
+ * Built BVHs are written next to the model's source file, and mapped back in
+ * on later loads if the mesh data still matches, rather than rebuilt.
+ *
+ * Only used from the game thread, returned shapes can be released from
+ * anywhere.
+ */
+class bulletShapeCache {
+	public:
+		// keeps the shared shape alive for as long as the returned pointer is
+		std::shared_ptr<btCollisionShape>
+			getMesh(sceneModel::ptr model,
+			        sceneMesh::ptr mesh,
+			        glm::vec3 scale = glm::vec3(1));
+
+		// drops entries whose shapes are no longer used
+		void purge(void);
+		size_t size(void) { return cache.size(); };
+
+		// write and read serialized BVHs, on by default
+		bool useDiskCache = true;
+
+	private:
+		struct meshShape {
+			~meshShape();
+
+			// only the vertices the mesh uses, packed, so the shape
+			// doesn't depend on the model's vertex data staying around
+			std::vector<btScalar> positions;
+			std::vector<int>      indices;
+			uint64_t hash = 0;
+
+			std::unique_ptr<btTriangleIndexVertexArray> indexArray;
+			std::unique_ptr<btBvhTriangleMeshShape>     shape;
+
+			// serialized BVH, if the shape was loaded from disk
+			void  *mapped = nullptr;
+			size_t mappedSize = 0;
+		};
+
+		struct entry {
+			// to tell if the key addresses have been reused
+			sceneModel::weakptr model;
+			sceneMesh::weakptr  mesh;
+			std::weak_ptr<meshShape> shape;
+		};
+
+		std::shared_ptr<meshShape> build(sceneModel::ptr model,
+		                                 sceneMesh::ptr mesh);
+		bool loadBVH(meshShape *shape, const std::string& path);
+		void saveBVH(meshShape *shape, const std::string& path);
+
+		std::map<std::pair<sceneModel*, sceneMesh*>, entry> cache;
+};
+
+// namespace grendx
+}
@@ -56,6 +56,8 @@ class camera {
 		bool onScreen(glm::vec4 pos);
 
 		bool sphereInFrustum(const BSphere& sphere);
+		// approximate on-screen diameter of a sphere, in pixels
+		float screenSize(const BSphere& sphere, unsigned height);
 		bool boxInFrustum(const struct AABB& box);
 		bool boxInFrustum(const struct OBB& box);
 
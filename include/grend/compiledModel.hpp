@@ -17,6 +17,12 @@ class compiledMaterial {
 
 		~compiledMaterial();
 
+		// residency tracking, forwards to the textures at most once
+		// per frame (per size change), see textureResidency.hpp
+		void markUsed(float size = 0.f);
+		uint64_t lastUsed = 0;
+		float screenSize = 0;
+
 		material::materialFactors factors;
 		struct loadedTextures {
 			Texture::ptr diffuse;
@@ -36,8 +42,27 @@ class compiledMesh {
 
 		~compiledMesh();
 
+		// index ranges in the element buffer for each level of detail,
+		// first level is the full mesh
+		struct lodRange {
+			size_t offset; // in indices
+			size_t count;
+			float  error;  // see sceneMesh::lodLevel
+		};
+
+		/**
+		 * Pick the coarsest level of detail that looks the same as the
+		 * full mesh, within some error.
+		 *
+		 * @param screenSize Projected bounding sphere diameter, in pixels.
+		 * @param maxError   Largest acceptable error, in pixels.
+		 *                   0 always picks the full mesh.
+		 */
+		unsigned selectLOD(float screenSize, float maxError) const;
+
 		Vao::ptr vao;
 		Buffer::ptr elements;
+		std::vector<lodRange> lods;
 		compiledMaterial::ptr mat;
 		material::blend_mode blend;
 };
@@ -53,6 +78,7 @@ class compiledModel {
 		Vao::ptr vao;
 		std::map<std::string, compiledMesh::ptr> meshes;
 		Buffer::ptr vertices;
+		size_t numVertices = 0;
 
 		bool haveJoints = false;
 		Buffer::ptr joints;
@@ -63,7 +89,11 @@ compiledMaterial::ptr matcache(material::ptr mat);
 compiledMesh::ptr compileMesh(std::shared_ptr<sceneMesh>& mesh);
 compiledModel::ptr compileModel(std::string name, std::shared_ptr<sceneModel> mod);
 void compileModels(const std::map<std::string, std::shared_ptr<sceneModel>>& models);
-Vao::ptr preloadMeshVao(compiledModel::ptr obj, compiledMesh::ptr mesh);
+// vertices overrides the model's vertex buffer, for drawing vertices that
+// were already skinned (see computeSkinning.hpp), joints aren't bound then
+Vao::ptr preloadMeshVao(compiledModel::ptr obj,
+                        compiledMesh::ptr mesh,
+                        Buffer::ptr vertices = nullptr);
 Vao::ptr preloadModelVao(compiledModel::ptr obj);
 void bindModel(std::shared_ptr<sceneModel> model);
 
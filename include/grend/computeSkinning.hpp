@@ -0,0 +1,27 @@
+#pragma once
+
+#include <grend/renderQueue.hpp>
+
+namespace grendx {
+
+/**
+ * Skin the models of every skinned mesh in the queue with compute shaders,
+ * once per frame, so that flush() can draw them with the plain shaders in
+ * every pass (depth prepass, shadow maps, probes, lighting).
+ *
+ * Output is cached per skin and model, and only recomputed when the skin's
+ * palette changed. Needs core 4.3, does nothing otherwise, and meshes that
+ * weren't skinned here are drawn with the skinned shaders as before.
+ *
+ * @return The number of models skinned.
+ */
+unsigned skinMeshes(renderQueue& queue);
+
+/**
+ * @return VAO drawing mesh with the vertices skinMeshes() produced for skin
+ *         this frame, or nullptr if it should be skinned in the vertex shader.
+ */
+Vao::ptr skinnedMeshVao(sceneSkin::ptr skin, sceneMesh::ptr mesh);
+
+// namespace grendx
+}
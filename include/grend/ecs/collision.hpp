@@ -31,6 +31,17 @@ class entitySystemCollision : public entitySystem {
 
 		virtual ~entitySystemCollision();
 		virtual void update(entityManager *manager, float delta);
+
+	private:
+		struct dispatch {
+			entity  *self;
+			entity  *other;
+			uint32_t index;
+			bool     flipped;
+		};
+
+		// reused between updates
+		std::vector<dispatch> queue;
 };
 
 // namespace grendx::ecs
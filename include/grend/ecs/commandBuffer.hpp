@@ -0,0 +1,99 @@
+#pragma once
+
+#include <grend/ecs/ecs.hpp>
+
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace grendx::ecs {
+
+/**
+ * Structural changes recorded for later, see entityManager::deferred().
+ *
+ * Systems and components can record creating, destroying, attaching and
+ * detaching from any thread, or while iterating over entities, without
+ * touching the manager's maps. The manager plays back every thread's
+ * buffer at once in entityManager::update(), after updaters have run and
+ * before add/remove events, sorted so changes to the same entity are
+ * applied together.
+ *
+ * Each buffer belongs to one thread, so its lock is only ever contended
+ * by playback taking what's been recorded, which can happen while the
+ * thread is still recording from a job.
+ */
+class commandBuffer {
+	friend class entityManager;
+
+	public:
+		typedef std::function<entity*(entityManager*)> createFunc;
+		typedef std::function<void(entityManager*, entity*)> attachFunc;
+
+		// construct<T>(args...) and add() at playback
+		template <typename T, typename... Args>
+		void create(Args... args) {
+			std::lock_guard lock(mtx);
+			recorded.creates.push_back([=] (entityManager *manager) -> entity* {
+				return manager->construct<T>(args...);
+			});
+		}
+
+		// for entities that need more setup than constructor arguments,
+		// the returned entity is added, nullptr is ignored
+		void create(createFunc make) {
+			std::lock_guard lock(mtx);
+			recorded.creates.push_back(make);
+		}
+
+		// construct<T>(ent, args...) at playback, dropped if the entity
+		// is destroyed in the same batch
+		template <typename T, typename... Args>
+		void attach(entity *ent, Args... args) {
+			std::lock_guard lock(mtx);
+			recorded.attaches.push_back({ent, [=] (entityManager *manager, entity *e) {
+				(void)manager->construct<T>(e, args...);
+			}});
+		}
+
+		void detach(entity *ent, component *comp) {
+			std::lock_guard lock(mtx);
+			recorded.detaches.push_back({ent, comp});
+		}
+
+		// same as entityManager::remove(), freed at the end of the update
+		void destroy(entity *ent) {
+			std::lock_guard lock(mtx);
+			recorded.destroys.push_back(ent);
+		}
+
+		bool empty(void) {
+			std::lock_guard lock(mtx);
+			return recorded.empty();
+		}
+
+		void clear(void) {
+			std::lock_guard lock(mtx);
+			recorded = {};
+		}
+
+	private:
+		struct commands {
+			std::vector<createFunc> creates;
+			std::vector<std::pair<entity*, attachFunc>> attaches;
+			std::vector<std::pair<entity*, component*>> detaches;
+			std::vector<entity*> destroys;
+
+			bool empty(void) const {
+				return creates.empty() && attaches.empty()
+					&& detaches.empty() && destroys.empty();
+			}
+		};
+
+		// everything recorded since the last playback
+		commands recorded;
+		std::mutex mtx;
+};
+
+// namespace grendx::ecs
+};
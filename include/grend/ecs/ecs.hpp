@@ -5,6 +5,8 @@
 #include <grend/sceneNode.hpp>
 #include <grend/physics.hpp>
 #include <grend/IoC.hpp>
+#include <grend/ecs/spatialIndex.hpp>
+#include <grend/ecs/queryView.hpp>
 
 #include <iostream>
 #include <map>
@@ -12,6 +14,7 @@
 #include <set>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <initializer_list>
 
 #include <nlohmann/json.hpp>
@@ -28,6 +31,9 @@ class entity;
 class entityManager;
 class entitySystem;
 class entityEventSystem;
+class commandBuffer;
+
+namespace messaging { class endpoint; }
 
 template <typename T>
 const char *getTypeName() {
@@ -113,7 +119,7 @@ class entityManager : public IoC::Service {
 		typedef std::shared_ptr<entityManager> ptr;
 		typedef std::weak_ptr<entityManager>   weakptr;
 
-		entityManager(gameMain *_engine) : engine(_engine) {};
+		entityManager(gameMain *_engine);
 		~entityManager();
 
 		// TODO: might be a good idea for state to be private
@@ -137,6 +143,20 @@ class entityManager : public IoC::Service {
 		std::set<entity*> added;
 		std::set<entity*> condemned;
 
+		// positions of added entities, for findNearest() and other
+		// proximity queries, refreshed at the start of update()
+		spatialIndex spatial{this};
+
+		// persistent query views, by sorted component names
+		std::map<std::vector<const char *>, queryView::ptr> views;
+		// component name -> views including that name
+		std::map<const char *, std::vector<queryView*>> tagViews;
+
+		// for systems and components to talk to each other, see message.hpp,
+		// published messages go out once per update(), after the deferred
+		// commands are played back
+		std::shared_ptr<messaging::endpoint> messages;
+
 		// TODO: might be a good idea to rename constructComponent and constructEntity,
 		//       would be annoyingly verbose though...
 		//       makeComponent, makeEntity?
@@ -186,6 +206,16 @@ class entityManager : public IoC::Service {
 			return searchEntities<T...>(this);
 		}
 
+		// same results as search<T...>(), but kept up to date as components
+		// are added and removed rather than searched for each time, store
+		// the returned pointer or call this every frame, either is cheap
+		template <typename... T>
+		queryView::ptr view() {
+			return getView({ getTypeName<T>()... });
+		}
+
+		queryView::ptr getView(std::vector<const char *> tags);
+
 		template <typename... T>
 		bool hasComponents(entity *ent) {
 			return matchesType<T...>{}(ent, getEntityComponents(ent));
@@ -200,6 +230,12 @@ class entityManager : public IoC::Service {
 		void freeEntity(entity *ent);
 		void clearFreedEntities(void);
 
+		// command buffer for the calling thread, see commandBuffer.hpp,
+		// recorded changes are applied in playbackCommands(), which
+		// update() calls after running updaters
+		commandBuffer& deferred(void);
+		void playbackCommands(void);
+
 		// TODO: "unsafe" or "internal" namespace for untemplated queries
 		//       can't really make it private
 		std::set<component*>& getComponents(const char *name) {
@@ -214,11 +250,6 @@ class entityManager : public IoC::Service {
 			return (components.count(name))? components[name] : nullret;
 		}
 
-		// TODO: should this be similar to inputHandlerSystem, with
-		//       onCollision components?
-		std::shared_ptr<std::vector<collision>> collisions
-			= std::make_shared<std::vector<collision>>();
-
 		// XXX
 		gameMain *engine;
 
@@ -227,6 +258,15 @@ class entityManager : public IoC::Service {
 		                          component *ptr,
 		                          const regArgs& t);
 		void registerInterface(entity *ent, const char *name, void *ptr);
+		void removeFromViews(entity *ent);
+
+		static uint64_t allocateSerial(void);
+
+		uint64_t serial = allocateSerial();
+		// one per thread that's recorded anything, lock only needed to add
+		// buffers and to take their contents for playback
+		std::mutex commandMtx;
+		std::vector<std::unique_ptr<commandBuffer>> commandBuffers;
 };
 
 template <typename T>
@@ -1,142 +1,264 @@
 #pragma once
 
 #include <grend/ecs/ecs.hpp>
+#include <grend/lockFreeQueue.hpp>
 
+#include <atomic>
 #include <memory>
 #include <vector>
-#include <list>
+#include <string>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+#include <stdint.h>
 
 namespace grendx::ecs::messaging {
 
 struct message;
 class mailbox;
 class endpoint;
+class frameArena;
+
+// message types are looked up by name once, and passed around as
+// integers after that, 0 is "undefined"
+typedef uint32_t channelID;
+
+channelID getChannel(const std::string& name);
+const std::string& getChannelName(channelID id);
+
+// one channel per payload type
+template <typename T>
+channelID getChannel(void) {
+	static channelID id = getChannel(getTypeName<T>());
+	return id;
+}
 
 struct message {
-	std::string type = "undefined";
+	channelID type = 0;
 
 	entity    *ent  = nullptr;
 	component *comp = nullptr;
 
-	// TODO: will this be needed?
-	//       could be useful for attaching arbitrary data to be
-	//       dynamic_casted<>, but could be a pain with lifetime
-	//       management...
+	// payload from endpoint::publish<T>(), in the endpoint's frame
+	// arena, valid until the deliver() after the one that delivered it,
+	// see payload<T>()
 	void *data = nullptr;
+	// arena data points into and its generation when published, null
+	// for messages that manage their own data, the endpoint has to
+	// outlive its messages for payload<T>() to check it
+	const frameArena *arena = nullptr;
+	uint32_t generation = 0;
 
 	// for general info, eg. level... for more storage I guess you'd
 	// use the data pointer above, lackluster as it may be
 	int tag = 0;
 };
 
-// should be far beyond what's needed in practice
-static const unsigned maxMessages = 1024;
+// per mailbox unless asked for otherwise, enough for most things that read
+// their mail every frame, ones that expect bursts should pass more
+static const unsigned defaultMailboxSize = 64;
+// messages published between deliveries, across all threads
+static const unsigned maxPending = 8192;
+// payload storage per frame, per endpoint
+static const size_t arenaSize = 256*1024;
+
+// delivered to by endpoint::deliver(), read by whoever owns it, can be on
+// different threads, messages past capacity are dropped
 class mailbox {
 	public:
 		typedef std::shared_ptr<mailbox> ptr;
 		typedef std::weak_ptr<mailbox>   weakptr;
 
-		bool haveMessage(void) { return !messages.empty(); };
+		mailbox(size_t capacity = defaultMailboxSize) : messages(capacity) {};
 
-		message get(void) {
-			if (messages.empty()) { return {}; };
+		bool haveMessage(void) {
+			return pending.load(std::memory_order_acquire) > 0;
+		};
 
-			message ret = messages.front();
-			messages.pop_front();
+		// type is 0 if there's nothing waiting
+		message get(void) {
+			message ret;
+			get(ret);
 			return ret;
 		}
 
-		void add(const message& m) {
-			if (messages.size() >= maxMessages) {
-				// TODO: warning
-				//       (what happened to the TODO about implementing
-				//        a proper logger? Need todo that)
-				return;
+		bool get(message& m) {
+			if (!messages.pop(m)) {
+				return false;
+			}
+
+			pending.fetch_sub(1, std::memory_order_release);
+			return true;
+		}
+
+		// appends everything waiting, returns how many
+		size_t getAll(std::vector<message>& out) {
+			size_t count = 0;
+			message m;
+
+			while (get(m)) {
+				out.push_back(m);
+				count++;
+			}
+
+			return count;
+		}
+
+		bool add(const message& m) {
+			if (!messages.push(m)) {
+				return false;
 			}
 
-			messages.push_back(m);
+			pending.fetch_add(1, std::memory_order_release);
+			return true;
 		}
 
-		std::list<message> messages;
+	private:
+		lockFreeQueue<message> messages;
+		std::atomic<size_t> pending = 0;
 };
 
-#include <grend/sdlContext.hpp>
+/**
+ * Bump allocator for message payloads, allocating is a single atomic add
+ * so it's safe from any thread. Reset all at once when nothing refers to
+ * anything in it anymore.
+ */
+class frameArena {
+	public:
+		frameArena(size_t size = arenaSize)
+			: buffer(new std::max_align_t[size / sizeof(std::max_align_t) + 1]),
+			  capacity(size) {};
+
+		// nullptr when full
+		void *allocate(size_t size, size_t align);
+
+		void reset(void) {
+			used.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1, std::memory_order_release);
+		};
+
+		// bumped by reset(), anything allocated before that is gone
+		std::atomic<uint32_t> generation = 0;
+
+	private:
+		std::unique_ptr<std::max_align_t[]> buffer;
+		size_t capacity;
+		std::atomic<size_t> used = 0;
+};
+
+// nullptr if the message isn't on T's channel, or if its payload was
+// reset since, which happens to mailboxes read less than every other
+// delivery, eg. ones owned by inactive entities
+template <typename T>
+const T *payload(const message& m) {
+	if (m.type != getChannel<T>()) {
+		return nullptr;
+	}
+
+	if (m.arena
+	    && m.arena->generation.load(std::memory_order_acquire) != m.generation)
+	{
+		return nullptr;
+	}
+
+	return static_cast<const T*>(m.data);
+}
+
+/**
+ * Routes messages to subscribed mailboxes.
+ *
+ * publish() can be called from any thread, it only queues the message.
+ * Everything published since the last call goes out to subscribers when
+ * deliver() is called, once per frame, from the thread that also
+ * subscribes and unsubscribes, while nothing is publishing. Mailboxes
+ * that have been freed are dropped from the subscriber lists then.
+ *
+ * entityManager::messages is delivered in entityManager::update(), other
+ * endpoints need to be delivered by whoever owns them.
+ */
 class endpoint {
 	public:
 		typedef std::shared_ptr<endpoint> ptr;
 		typedef std::weak_ptr<endpoint>   weakptr;
 
-		void subscribe(mailbox::ptr mbox, std::string type) {
-			subscribers[type].push_back(mbox);
+		endpoint() : queued(maxPending) {};
 
-			if (debug) {
-				SDL_Log("[SUB] %s", type.c_str());
-			}
-		}
+		void subscribe(mailbox::ptr mbox, channelID type);
+		void unsubscribe(const mailbox *mbox, channelID type);
+		void unsubscribe(const mailbox *mbox);
 
-		void unsubscribe(const mailbox *mbox, std::string type) {
-			if (subscribers.find(type) == subscribers.end()) {
-				return;
-			}
+		void subscribe(mailbox::ptr mbox, const std::string& type) {
+			subscribe(mbox, getChannel(type));
+		}
 
-			// TODO: not O(N)
-			auto& v = subscribers[type];
-			for (auto it = v.begin(); it != v.end();) {
-				if (auto ptr = it->lock()) {
-					it = (ptr.get() == mbox)? v.erase(it) : std::next(it);
+		void unsubscribe(mailbox::ptr mbox, const std::string& type) {
+			unsubscribe(mbox.get(), getChannel(type));
+		}
 
-				} else {
-					it++;
-				}
-			}
+		void unsubscribe(mailbox::ptr mbox) {
+			unsubscribe(mbox.get());
 		}
 
-		void unsubscribe(mailbox::ptr mbox, std::string type) {
-			unsubscribe(mbox.get(), type);
+		template <typename T>
+		void subscribe(mailbox::ptr mbox) {
+			subscribe(mbox, getChannel<T>());
 		}
 
+		template <typename T>
 		void unsubscribe(mailbox::ptr mbox) {
-			// TODO
+			unsubscribe(mbox.get(), getChannel<T>());
 		}
 
-		void publish(const message& message) {
-			if (debug) {
-				SDL_Log("[PUB] (%s:%s) %s",
-						message.ent?  message.ent->typeString()  : "_",
-						message.comp? message.comp->typeString() : "_",
-						message.type.c_str());
-			}
+		// returns false if the queue is full and the message was dropped
+		bool publish(const message& m);
 
-			if (subscribers.find(message.type) == subscribers.end()) {
-				// no mailboxes waiting for this message type,
-				// nothing to do
-				if (debug) {
-					SDL_Log("      (No subscribers, dropped)");
-				}
-				return;
-			}
+		// copies the payload into this frame's arena, on the channel
+		// for T
+		template <typename T>
+		bool publish(const T& data,
+		             entity *ent = nullptr,
+		             component *comp = nullptr,
+		             int tag = 0)
+		{
+			static_assert(std::is_trivially_copyable<T>::value
+			              && std::is_trivially_destructible<T>::value,
+			              "Payloads are copied into an arena and never destroyed");
+
+			frameArena& arena = arenas[current.load(std::memory_order_acquire)];
+			void *mem = arena.allocate(sizeof(T), alignof(T));
 
-			for (auto& mbox : subscribers[message.type]) {
-				if (auto ptr = mbox.lock()) {
-				//auto ptr = mbox;
-					ptr->add(message);
-					if (debug) {
-						SDL_Log("      -> sent to subscriber");
-					}
-
-				} else {
-					if (debug) {
-						SDL_Log("      -> couldn't lock subscriber");
-					}
-					// TODO: remove subscriber from list
-				}
+			if (!mem) {
+				// TODO: warning
+				return false;
 			}
+
+			return publish({
+				.type       = getChannel<T>(),
+				.ent        = ent,
+				.comp       = comp,
+				.data       = new (mem) T(data),
+				.arena      = &arena,
+				.generation = arena.generation.load(std::memory_order_relaxed),
+				.tag        = tag,
+			});
 		}
 
+		// sends out everything published so far, and starts a new arena
+		void deliver(void);
+
 		// TODO: toggleable debug levels
 		bool debug = false;
-		std::map<std::string, std::list<mailbox::weakptr>> subscribers;
-		std::map<const mailbox*, std::set<std::string>> subscribedTypes;
+
+	private:
+		lockFreeQueue<message> queued;
+		// by channel ID
+		std::vector<std::vector<mailbox::weakptr>> subscribers;
+		std::map<const mailbox*, std::vector<channelID>> subscribedTypes;
+
+		// payloads are published into one while the other holds the
+		// ones delivered last frame
+		frameArena arenas[2];
+		std::atomic<unsigned> current = 0;
 };
 
 // namespace grend::ecs::messaging
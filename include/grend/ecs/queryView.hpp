@@ -0,0 +1,64 @@
+#pragma once
+
+#include <unordered_map>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+namespace grendx {
+	class jobQueue;
+}
+
+namespace grendx::ecs {
+
+class entity;
+class entityManager;
+
+/**
+ * Persistent result of a component search.
+ *
+ * Views are created once per component signature with
+ * entityManager::view<T...>(), and kept up to date by the manager as
+ * components are registered and unregistered, so iterating one is just a
+ * walk over a dense array. Members are the same as search<T...>() would
+ * return: every entity with all of the components, active or not, in no
+ * particular order.
+ *
+ * Members shouldn't be added or removed while iterating, any components
+ * attached or freed during iteration change the array underneath it.
+ */
+class queryView {
+	friend class entityManager;
+
+	public:
+		typedef std::shared_ptr<queryView> ptr;
+		typedef std::weak_ptr<queryView>   weakptr;
+
+		queryView(std::vector<const char *> _tags) : tags(_tags) {};
+
+		const std::vector<const char *>& getTags(void) const { return tags; };
+		bool contains(entity *ent) const { return index.count(ent); };
+		size_t size(void) const { return members.size(); };
+		bool empty(void) const { return members.empty(); };
+
+		std::vector<entity*>::const_iterator begin(void) const { return members.begin(); };
+		std::vector<entity*>::const_iterator end(void) const { return members.end(); };
+		entity *operator[](size_t i) const { return members[i]; };
+
+		// calls func for each member, split into chunks over jobs if given,
+		// returns once every member has been visited
+		void forEach(jobQueue *jobs, const std::function<void(entity*)>& func);
+
+	private:
+		void insert(entity *ent);
+		void erase(entity *ent);
+
+		std::vector<const char *> tags;
+		std::vector<entity*> members;
+		// entity -> index in members
+		std::unordered_map<entity*, uint32_t> index;
+};
+
+// namespace grendx::ecs
+};
@@ -30,15 +30,6 @@ class rigidBody
 			}
 		}
 
-		void registerCollisionQueue(std::shared_ptr<std::vector<collision>> queue) {
-			if (phys) {
-				phys->collisionQueue = queue;
-			}
-
-			cachedQueue = queue;
-			// TODO: should show warning if there's no physics object
-		}
-
 		virtual void initBody(entityManager *manager, entity *ent) {
 			// class needs to be instantiable for serialization,
 			// so this can't be an abstract function, so note that
@@ -52,7 +43,6 @@ class rigidBody
 				initBody(manager, ent);
 				// TODO: cached angular factor
 				phys->setAngularFactor(cachedAngularFactor);
-				phys->collisionQueue = cachedQueue;
 			}
 		}
 
@@ -60,7 +50,6 @@ class rigidBody
 			if (phys) {
 				// TODO: cache angular factor
 				position = phys->getTransform().position;
-				cachedQueue = phys->collisionQueue;
 				cachedAngularFactor = phys->getAngularFactor();
 				phys->removeSelf();
 				phys = nullptr;
@@ -71,7 +60,6 @@ class rigidBody
 		float mass = 0.f;
 		float cachedAngularFactor = 1.f;
 		glm::vec3 position;
-		std::shared_ptr<std::vector<collision>> cachedQueue = nullptr;
 
 		// serialization stuff
 		virtual const char* typeString(void) const { return getTypeName(*this); };
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <grend/glmIncludes.hpp>
+#include <grend/camera.hpp>
+
+#include <unordered_map>
+#include <initializer_list>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+
+namespace grendx {
+	class sceneNode;
+}
+
+namespace grendx::ecs {
+
+class entity;
+class entityManager;
+
+/**
+ * Hashed grid over entity node positions, for proximity queries.
+ *
+ * Owned and maintained by the entityManager: entities are inserted when
+ * added, dropped when freed, and refresh() re-buckets entities whose node
+ * transform changed, once per frame at the start of entityManager::update().
+ * Positions are as of the last refresh, or insertion for new entities.
+ *
+ * Queries are filtered by component tags, the same as searchEntities(),
+ * and skip inactive entities.
+ */
+class spatialIndex {
+	public:
+		using tagList = std::initializer_list<const char *>;
+
+		spatialIndex(entityManager *_manager, float _cellSize = 8.f /* meters */)
+			: manager(_manager), cellSize(_cellSize) {};
+
+		void insert(entity *ent);
+		void remove(entity *ent);
+		void refresh(void);
+		void clear(void);
+		size_t size(void) const { return entries.size(); };
+
+		// nullptr if nothing matching is within maxDist
+		entity *nearest(glm::vec3 position,
+		                tagList tags,
+		                float maxDist = HUGE_VALF);
+		// up to k entities, closest first
+		void nearest(glm::vec3 position,
+		             unsigned k,
+		             tagList tags,
+		             std::vector<entity*>& out,
+		             float maxDist = HUGE_VALF);
+		// unordered
+		void radius(glm::vec3 position,
+		            float dist,
+		            tagList tags,
+		            std::vector<entity*>& out);
+		// entities with positions inside the camera frustum, unordered
+		void frustum(camera::ptr cam,
+		             tagList tags,
+		             std::vector<entity*>& out);
+
+	private:
+		struct entry {
+			entity    *ent;
+			// node and version at the last refresh, nodes can be swapped
+			// out from under entities
+			sceneNode *node;
+			unsigned   version;
+			glm::vec3  position;
+			uint64_t   cell;
+		};
+
+		uint64_t cellKey(glm::ivec3 cell) const;
+		glm::ivec3 cellCoord(glm::vec3 position) const;
+		void addToCell(uint32_t idx);
+		void removeFromCell(uint32_t idx);
+		bool matches(const entry& e, tagList tags);
+
+		entityManager *manager;
+		float cellSize;
+
+		std::vector<entry> entries;
+		std::unordered_map<entity*, uint32_t> lookup;
+		// indices into entries, empty cells are erased
+		std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+};
+
+// namespace grendx::ecs
+};
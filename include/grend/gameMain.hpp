@@ -42,6 +42,7 @@ class gameMain {
 
 		struct {
 			unsigned drawnMeshes = 0;
+			unsigned occludedMeshes = 0;
 		} metrics;
 };
 
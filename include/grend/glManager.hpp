@@ -23,6 +23,11 @@
 // TODO: expose this config somehow
 #define ENABLE_MIPMAPS 1
 #define ENABLE_FACE_CULLING 1
+// mip levels at or below this size are uploaded immediately when buffering
+// a texture with a precomputed mip chain, larger levels are streamed in
+#define TEXTURE_STREAM_IMMEDIATE_SIZE 128
+// upload budget for streamTextures(), per call
+#define TEXTURE_STREAM_BYTES_PER_FRAME (8 << 20)
 
 namespace grendx {
 
@@ -130,6 +135,9 @@ enum {
 inline size_t dbgGlmanBuffered = 0;
 inline size_t dbgGlmanTexturesBuffered = 0;
 
+// frame counter for texture residency, see textureResidency.hpp
+inline uint64_t glmanCurrentFrame = 0;
+
 static inline size_t glmanDbgUpdateBuffered(size_t old, size_t thenew) {
 	dbgGlmanBuffered -= old;
 	dbgGlmanBuffered += thenew;
@@ -254,7 +262,7 @@ class Buffer : public Obj {
 		void buffer(const std::vector<glm::vec3>& vec);
 };
 
-class Texture : public Obj {
+class Texture : public Obj, public std::enable_shared_from_this<Texture> {
 	public:
 		typedef std::shared_ptr<Texture> ptr;
 		typedef std::weak_ptr<Texture> weakptr;
@@ -266,7 +274,59 @@ class Texture : public Obj {
 			glBindTexture(target, obj);
 		}
 
+		// uploads the next larger mip level of a texture that's still
+		// streaming in, returns true if there are more levels to upload
+		bool streamNextLevel(void);
+		bool streaming(void) const { return pending != nullptr; };
+
+		// stream levels back in from a reloaded copy of the source texture,
+		// down to (and including) `level`
+		void streamFrom(materialTexture::ptr tex, unsigned level);
+		// free all mip levels larger than `level`
+		void dropLevels(unsigned level);
+
+		unsigned residentLevel(void) const { return baseLevel; };
+		unsigned levels(void) const { return levelSizes.size(); };
+
+		// residency tracking, keeps the largest on-screen size
+		// (in pixels) the texture was used at in the current frame
+		void markUsed(float size = 0.f) {
+			if (lastUsed != glmanCurrentFrame) {
+				lastUsed   = glmanCurrentFrame;
+				screenSize = size;
+
+			} else if (size > screenSize) {
+				screenSize = size;
+			}
+		}
+
+		uint64_t lastUsed = 0;
+		float screenSize = 0;
+
+		// full-size dimensions
+		int width = 0, height = 0;
+		// container the texture was loaded from, empty if it can't be reloaded
+		std::string sourceFile;
+		bool reloading = false;
+
 		materialTexture::imageType type;
+
+	private:
+		void uploadLevel(unsigned level);
+
+		// source texture for levels that haven't been uploaded yet,
+		// released once streaming reaches targetLevel
+		materialTexture::ptr pending;
+		bool pendingSrgb = false;
+		// smallest level index currently uploaded
+		unsigned baseLevel = 0;
+		unsigned targetLevel = 0;
+
+		// bytes used by each level, 0 if not resident
+		std::vector<size_t> levelSizes;
+		GLenum internalFormat = GL_RGBA;
+		GLenum dataFormat = GL_RGBA;
+		bool blockCompressed = false;
 };
 
 class Shader : public Obj {
@@ -307,6 +367,8 @@ class Program : public Obj {
 		std::string log(void);
 
 		Shader::ptr vertex, fragment;
+		// only set for compute programs, see loadComputeProgram()
+		Shader::ptr compute;
 		void bind(void) {
 			glUseProgram(obj);
 		}
@@ -363,6 +425,12 @@ class Framebuffer : public Obj {
 };
 
 Texture::ptr texcache(materialTexture::ptr tex, bool srgb = false);
+// upload pending mip levels for streaming textures, larger levels are
+// uploaded last, should be called once per frame from the main thread
+void streamTextures(size_t maxBytes = TEXTURE_STREAM_BYTES_PER_FRAME);
+// whether the GPU can sample the given block compression format directly,
+// loaders fall back to uncompressed images otherwise
+bool haveCompressedFormat(materialTexture::blockFormat format);
 
 void initializeOpengl(void);
 
@@ -477,6 +545,13 @@ Program::ptr loadProgram(std::string vert,
                          std::string frag,
                          const Shader::parameters& opts);
 
+#if GLSL_VERSION >= 430
+// compute programs have nothing to bind before linking, so unlike
+// loadProgram() this also links the program
+Program::ptr loadComputeProgram(std::string comp,
+                                const Shader::parameters& opts);
+#endif
+
 GLenum surfaceGlFormat(SDL_Surface *surf);
 GLenum surfaceGlFormat(int channels);
 GLenum surfaceGlFormat(const materialTexture& tex);
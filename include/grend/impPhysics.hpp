@@ -14,6 +14,8 @@
 
 namespace grendx {
 
+class impPhysics;
+
 class impObject : public physicsObject {
 	friend class impPhysics;
 
@@ -21,26 +23,19 @@ class impObject : public physicsObject {
 		typedef std::shared_ptr<impObject> ptr;
 		typedef std::weak_ptr<impObject>   weakptr;
 
+		virtual ~impObject();
+
 		enum type {
 			Static,
 			Sphere,
+			// XXX: boxes don't rotate, they're always axis aligned
 			Box,
 			Mesh,
 		};
 
-		struct sphere {
-			float radius;
-		};
-
-		struct box {
-			float length;
-			float width;
-			float height;
-			// TODO: rotation, for boxes that closely fit the mesh
-		};
-
 		enum type type;
-		union { struct sphere usphere; struct box ubox; };
+		float     radius = 0;
+		glm::vec3 extent = {0, 0, 0};
 
 		virtual void setTransform(const TRS& transform);
 		virtual TRS  getTransform(void);
@@ -51,9 +46,12 @@ class impObject : public physicsObject {
 		virtual void setAngularFactor(float amount);
 		virtual glm::vec3 getVelocity(void);
 		virtual glm::vec3 getAcceleration(void);
-		virtual void removeSelf(void) {};
+		virtual float     getAngularFactor(void);
+		virtual uint32_t  getID(void) { return id; };
+		virtual void removeSelf(void);
 
 	protected:
+		impPhysics *runtime = nullptr;
 		void *data;
 		//std::string model_name;
 		glm::vec3 position = {0, 0, 0};
@@ -64,6 +62,19 @@ class impObject : public physicsObject {
 		float inverseMass = 0;
 		float drag_s = 0.9;
 		float gravity = -15.f;
+		// fraction of the velocity into a surface kept after hitting it
+		float restitution = 0.1f;
+		float friction = 0.5f;
+
+		uint32_t id = 0;
+		// index in impPhysics::bodies
+		uint32_t index = 0;
+		// sleeping bodies aren't integrated or solved until something
+		// touches them or they're moved
+		bool     awake = true;
+		float    restingTime = 0;
+		// index in the union-find while building islands
+		uint32_t island = 0;
 };
 
 class impPhysics : public physics {
@@ -71,14 +82,26 @@ class impPhysics : public physics {
 		typedef std::shared_ptr<impPhysics> ptr;
 		typedef std::weak_ptr<impPhysics>   weakptr;
 
+		virtual ~impPhysics();
+
 		// each return physics object ID
 		// non-moveable geometry, collisions with octree
-		virtual physicsObject::ptr
+		virtual void
 			addStaticModels(void *data,
 		                    sceneNode::ptr obj,
-		                    glm::mat4 transform = glm::mat4(1));
+		                    const TRS& transform,
+		                    std::vector<physicsObject::ptr>& collector,
+		                    std::string propFilter = "");
 
-		// dynamic geometry, collisions with AABB tree
+		// added to the octree, doesn't return an object, static
+		// geometry can only be removed all at once with clear()
+		virtual physicsObject::ptr
+			addStaticMesh(void *data,
+			              const TRS& transform,
+			              sceneModel::ptr model,
+			              sceneMesh::ptr mesh);
+
+		// dynamic geometry, collisions with the broadphase
 		virtual physicsObject::ptr
 			addSphere(void *data, glm::vec3 pos,
 		              float mass, float r);
@@ -89,28 +112,122 @@ class impPhysics : public physics {
 			       float mass,
 				   AABBExtent& box);
 
+		// XXX: cylinders and capsules are boxes around them
+		virtual physicsObject::ptr
+			addCylinder(void *data,
+			            glm::vec3 position,
+			            float mass,
+			            AABBExtent& box);
+
 		virtual physicsObject::ptr
-			addMesh(void *data,
-			        glm::vec3 position,
-			        float mass,
-			        sceneModel::ptr model,
-			        sceneMesh::ptr mesh);
+			addCapsule(void *data,
+			           glm::vec3 position,
+			           float mass,
+			           float radius,
+			           float height);
 
 		// map of submesh name to physics object ID
 		// TODO: multimap?
 		virtual std::map<sceneMesh::ptr, physicsObject::ptr>
 			addModelMeshBoxes(sceneModel::ptr mod);
 		virtual void remove(physicsObject::ptr obj);
+		virtual void remove(impObject *obj);
 		virtual void clear(void);
 
 		virtual size_t numObjects(void);
 		virtual void filterCollisions(void);
 		virtual void stepSimulation(float delta);
 
-		std::list<collision> findCollisions(float delta);
+		virtual void raycast(const std::vector<physicsRay>& rays,
+		                     std::vector<physicsHit>& hits,
+		                     jobQueue *jobs = nullptr);
+		virtual void sweepSpheres(const std::vector<physicsSweep>& sweeps,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr);
+		virtual void overlapSpheres(const std::vector<physicsSphere>& spheres,
+		                            std::vector<physicsHit>& hits,
+		                            jobQueue *jobs = nullptr);
+		virtual void overlapBoxes(const std::vector<physicsBox>& boxes,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr);
+
+		void wake(impObject *obj);
+
+		// fixed step, variable frame times are split up into these
+		float stepRate = 60;
+		unsigned solverIterations = 8;
+		// bodies slower than this for sleepDelay seconds, along with
+		// everything touching them, are put to sleep
+		float sleepVelocity = 0.1f;
+		float sleepDelay = 0.5f;
 
-		std::set<physicsObject::ptr> objects;
 		octree static_geom;
+
+	private:
+		struct contact {
+			// indices into bodies, normal points from a to b
+			uint32_t  a, b;
+			glm::vec3 normal;
+			float     depth;
+			// velocity along the normal to aim for, for bouncing
+			float     bounce;
+			float     friction;
+			// direction of the sliding velocity when the contact was found
+			glm::vec3 tangent;
+			// accumulated over solver iterations
+			float     impulse;
+			float     tangentImpulse;
+		};
+
+		// touching pair for contact events, ids ordered so idA < idB,
+		// bodies are nulled when removed, see filterCollisions()
+		struct contactPair {
+			uint64_t   key;
+			impObject *objA, *objB;
+			glm::vec3  positionA, positionB;
+			// from b towards a, depth negative, same as bullet
+			glm::vec3  normalB;
+			float      depth;
+		};
+
+		physicsObject::ptr addBody(impObject::ptr obj, float mass);
+		void step(float dt);
+		void updateBounds(impObject *obj);
+		void broadphase(void);
+		void narrowphase(void);
+		void solve(void);
+		void correctPositions(void);
+		void updateIslands(float dt);
+		void recordContacts(void);
+
+		// moves a sphere through the static geometry, sliding along
+		// whatever it hits
+		void moveSphere(impObject *obj, float delta);
+		void moveBox(impObject *obj, float delta);
+
+		// all bodies, static ones included, owned by whoever holds
+		// the pointer returned from add*()
+		std::vector<impObject*> bodies;
+		// indices of awake dynamic bodies, the only ones stepped
+		std::vector<uint32_t>   awake;
+		std::vector<AABB>       bounds;
+		// sweep and prune, body indices sorted by bounds min x, mostly
+		// sorted already between steps so an insertion sort is cheap
+		std::vector<uint32_t>   sapOrder;
+
+		std::vector<std::pair<uint32_t, uint32_t>> pairs;
+		std::vector<contact>    manifold;
+		// every pair touching in steps since the last filterCollisions(),
+		// and the pairs reported then
+		std::vector<contactPair> touching;
+		std::vector<contactPair> lastTouching;
+		bool contactsPending = false;
+		// union-find, by impObject::island, only awake bodies
+		std::vector<uint32_t>   islands;
+		std::vector<float>      islandRest;
+
+		uint32_t nextID = 1;
+		float    accumulated = 0;
 };
 
 // namespace grendx
@@ -92,8 +92,24 @@ loadMapData(std::string name="save.map") noexcept;
 result<sceneImport::ptr>
 loadMapCompiled(std::string name="save.map") noexcept;
 
+/**
+ * Load a map, importing the models it references in the background.
+ *
+ * The map file itself is parsed before returning, model and imported file
+ * nodes start out empty and are filled in from the main thread as each
+ * source finishes loading (see modelCache.hpp and updateMapLoads()).
+ *
+ * @param game Game context pointer.
+ * @param name The file path of the map to be loaded.
+ *
+ * @return The map's root node.
+ */
 result<sceneImport::ptr>
 loadMapAsyncCompiled(gameMain *game, std::string name="save.map") noexcept;
 
+// fills in nodes of maps loaded with loadMapAsyncCompiled() whose sources
+// have finished importing, called once per frame from the main thread
+void updateMapLoads(void);
+
 // namespace grendx
 };
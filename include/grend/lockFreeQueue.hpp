@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <stddef.h>
+
+namespace grendx {
+
+/**
+ * Bounded multi-producer multi-consumer queue, without locks (Vyukov's
+ * bounded MPMC queue). push() fails instead of blocking when the queue is
+ * full, it's up to the caller whether to drop, retry or drain it.
+ *
+ * Values are moved into preallocated cells, so nothing is allocated after
+ * construction unless T itself allocates.
+ */
+template <typename T>
+class lockFreeQueue {
+	public:
+		// capacity is rounded up to a power of two
+		lockFreeQueue(size_t capacity = 1024) {
+			size_t size = 2;
+			while (size < capacity) size <<= 1;
+
+			mask  = size - 1;
+			cells = std::make_unique<cell[]>(size);
+
+			for (size_t i = 0; i < size; i++) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		template <typename U>
+		bool push(U&& value) {
+			cell *c;
+			size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+			for (;;) {
+				c = &cells[pos & mask];
+				size_t seq = c->sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos);
+
+				if (diff == 0) {
+					if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+					                                     std::memory_order_relaxed))
+						break;
+
+				} else if (diff < 0) {
+					// full
+					return false;
+
+				} else {
+					pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			c->data = std::forward<U>(value);
+			c->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool pop(T& value) {
+			cell *c;
+			size_t pos = dequeuePos.load(std::memory_order_relaxed);
+
+			for (;;) {
+				c = &cells[pos & mask];
+				size_t seq = c->sequence.load(std::memory_order_acquire);
+				ptrdiff_t diff = ptrdiff_t(seq) - ptrdiff_t(pos + 1);
+
+				if (diff == 0) {
+					if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+					                                     std::memory_order_relaxed))
+						break;
+
+				} else if (diff < 0) {
+					// empty
+					return false;
+
+				} else {
+					pos = dequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			value = std::move(c->data);
+			c->sequence.store(pos + mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		size_t capacity(void) const { return mask + 1; };
+
+	private:
+		struct cell {
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		std::unique_ptr<cell[]> cells;
+		size_t mask;
+
+		// on separate cache lines, producers and consumers
+		// shouldn't be fighting over the same one
+		alignas(64) std::atomic<size_t> enqueuePos = 0;
+		alignas(64) std::atomic<size_t> dequeuePos = 0;
+};
+
+// namespace grendx
+}
@@ -7,6 +7,8 @@
 #include <map>
 #include <memory>
 
+#include <stdint.h>
+
 namespace grendx {
 
 // TODO: need a material cache, having a way to lazily load/unload texture
@@ -26,6 +28,36 @@ class materialTexture {
 		size_t size;
 		std::vector<uint8_t> pixels;
 
+		// precomputed mip chain, offsets are into `pixels` and level 0 is
+		// the full-size image. empty if only the base image was loaded,
+		// in which case mipmaps are generated on the GPU
+		struct mipLevel {
+			int width, height;
+			size_t offset;
+			size_t size;
+		};
+
+		std::vector<mipLevel> mips;
+		// container file the mip chain was loaded from, if any, used to
+		// read it again after the pixels have been released, or to reload
+		// levels that were evicted from GPU memory
+		std::string sourceFile;
+
+		// drop CPU-side image data once it's been uploaded, dimensions and
+		// format info are kept around so loaded() still works
+		void releasePixels(void) {
+			pixels.clear();
+			pixels.shrink_to_fit();
+			mips.clear();
+			released = true;
+		}
+
+		bool released = false;
+		// set by texcache(), needed to look up textures after
+		// their pixels have been released
+		bool hashed = false;
+		uint32_t hash = 0;
+
 		// XXX: could use GL enums directly here, seems like that might
 		//      be tying it too closely to the OpenGL api though... idk,
 		//      if this is too unwieldy can always remove it later
@@ -57,6 +89,16 @@ class materialTexture {
 			VecTex,
 		};
 
+		// GPU block compression formats, mip sizes are computed from these
+		enum blockFormat {
+			Uncompressed,
+			ETC2_RGB,
+			ETC2_RGBA,
+			BC1,
+			BC3,
+			BC7,
+		};
+
 		// higher quality defaults, tweakable settings can be done in loading
 		enum filter minFilter = filter::LinearMipmapLinear;
 		enum filter magFilter = filter::Linear;
@@ -65,6 +107,11 @@ class materialTexture {
 		enum wrap wrapT = wrap::Repeat;
 
 		enum imageType type = imageType::Plain;
+		enum blockFormat format = blockFormat::Uncompressed;
+
+		bool compressed(void) const {
+			return format != blockFormat::Uncompressed;
+		}
 };
 
 // namespace grendx
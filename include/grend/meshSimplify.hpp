@@ -0,0 +1,33 @@
+#pragma once
+
+#include <grend/sceneModel.hpp>
+#include <vector>
+
+namespace grendx {
+
+/**
+ * Simplify a triangle list with quadric error metric edge collapses.
+ *
+ * Collapses only move vertices onto their neighbors, so the result indexes
+ * into the same vertex array and can share the model's vertex buffer.
+ * Vertices on open edges (including UV and normal seams, which show up as
+ * split vertices) are never removed, to avoid cracks.
+ *
+ * @param vertices      Vertex array the faces index into.
+ * @param faces         Triangle list to simplify.
+ * @param targetIndices Stop once there's this many indices left.
+ * @param maxError      Stop before collapses that would move the surface
+ *                      more than this distance, in model units.
+ * @param resultError   If non-null, set to the largest error of any
+ *                      collapse that was done.
+ *
+ * @return The simplified triangle list.
+ */
+std::vector<GLuint> simplifyMesh(const std::vector<sceneModel::vertex>& vertices,
+                                 const std::vector<GLuint>& faces,
+                                 size_t targetIndices,
+                                 float maxError,
+                                 float *resultError = nullptr);
+
+// namespace grendx
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <grend/sceneNode.hpp>
+#include <grend/sceneModel.hpp>
+
+#include <memory>
+#include <string>
+
+namespace grendx {
+
+// Process-wide cache of imported model and scene files, shared between map
+// loads so that assets used by several maps are only imported once.
+//
+// The cache only keeps weak references to what it loaded, so a source stays
+// cached as long as something still uses all of its models (and the nodes of
+// the scene, for scene imports). After that, the next lookup imports the
+// file again.
+//
+// Lookups are thread-safe, if another thread is already importing a source,
+// the lookup waits for that import to finish instead of starting another,
+// unless that thread is (eventually) waiting on the calling thread.
+struct cachedSource {
+	typedef std::shared_ptr<cachedSource> ptr;
+
+	modelMap models;
+	// only set for sources imported as scenes, this is a new import node
+	// for each lookup, with the cached scene nodes under it
+	sceneImport::ptr scene;
+};
+
+/**
+ * Look up a model or scene file, importing it on the calling thread if it
+ * isn't cached.
+ *
+ * @param path  Path to the file.
+ * @param scene Import the file as a scene (see loadSceneData()) rather
+ *              than as a set of models (see loadModel()).
+ *
+ * @return The loaded source, or nullptr if the file couldn't be imported,
+ *         or if it includes itself, either further up the calling thread
+ *         or through imports running on other threads.
+ */
+cachedSource::ptr loadCachedSource(const std::string& path, bool scene);
+
+// number of sources currently held in the cache
+size_t cachedSourceCount(void);
+
+// namespace grendx
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <grend/renderQueue.hpp>
+#include <grend/renderFramebuffer.hpp>
+#include <grend/camera.hpp>
+
+#include <vector>
+
+namespace grendx {
+
+// Hierarchical depth buffer, each level holds the farthest depth of the
+// 2x2 texels it covers in the level below. Depths are window space, [0, 1]
+// with 1 being the far plane, and rows start from the bottom of the screen,
+// same as the depth buffer.
+//
+// Nothing here touches GL, so the CPU path can be used (and tested) without
+// a context.
+class depthPyramid {
+	public:
+		struct level {
+			unsigned width, height;
+			std::vector<float> depth;
+		};
+
+		void build(const float *depth, unsigned width, unsigned height);
+		void clear(void) { levels.clear(); };
+		bool empty(void) const { return levels.empty(); };
+
+		// min and max are screen coordinates in [0, 1], nearest is the
+		// closest depth of whatever is being tested
+		bool rectVisible(glm::vec2 min, glm::vec2 max, float nearest) const;
+		// mvp transforms the box into clip space
+		bool boxVisible(const glm::mat4& mvp, const AABB& box) const;
+
+		std::vector<level> levels;
+};
+
+// Small software rasterizer for occluders, only writes pixels that are
+// completely covered, with the farthest depth of the triangle inside the
+// pixel, so what it draws never hides more than the real geometry would.
+class occluderRasterizer {
+	public:
+		occluderRasterizer(unsigned w = 256, unsigned h = 128) {
+			resize(w, h);
+		}
+
+		void resize(unsigned w, unsigned h);
+		void clear(void);
+		void drawTriangles(const glm::mat4& mvp,
+		                   const std::vector<sceneModel::vertex>& vertices,
+		                   const std::vector<GLuint>& faces,
+		                   bool inverted = false);
+
+		unsigned width, height;
+		std::vector<float> depth;
+		// number of triangles drawn since the last clear()
+		unsigned triangles = 0;
+};
+
+/**
+ * Draw the opaque meshes of a (culled) queue as occluders, largest on screen
+ * first, at the level of detail they're drawn with.
+ *
+ * @param maxTriangles Stop after drawing this many triangles.
+ */
+void drawOccluders(occluderRasterizer& raster,
+                   renderQueue& occluders,
+                   camera::ptr cam,
+                   unsigned maxTriangles);
+
+/**
+ * Remove meshes with bounding boxes completely hidden in the pyramid.
+ *
+ * @return The number of meshes removed.
+ */
+unsigned occlusionCull(renderQueue& queue,
+                       const depthPyramid& pyramid,
+                       const glm::mat4& viewProj);
+
+/**
+ * Occlusion culling stage for drawMultiQueue(), run after the depth prepass.
+ *
+ * On GL 4.3+ this builds the pyramid from fb's depth buffer and tests boxes
+ * with compute shaders, culling with the newest results that have finished
+ * (usually the last frame's) while the camera is still close to where they
+ * were tested from. Without compute shaders it software rasterizes the
+ * meshes in occluders and tests on the CPU.
+ *
+ * @return The number of meshes removed from que.
+ */
+unsigned occlusionCull(multiRenderQueue& que,
+                       renderQueue& occluders,
+                       camera::ptr cam,
+                       renderFramebuffer::ptr fb);
+
+// namespace grendx
+}
@@ -2,55 +2,102 @@
 #include <grend/glmIncludes.hpp>
 #include <grend/sceneModel.hpp>
 #include <utility>
-#include <set>
+#include <vector>
 
 #include <stdint.h>
 
 namespace grendx {
 
+/**
+ * Sparse voxel octree for static collision geometry.
+ *
+ * Triangles are collected with add_tri()/add_model(), and voxelized
+ * (conservatively, every voxel a triangle touches is filled) when build()
+ * is called. Nodes are kept in one array, breadth first, each with a mask
+ * of which children exist and the index of its first child, the rest of
+ * the children following it in octant order.
+ *
+ * Queries are read only, and can run from any number of threads once the
+ * tree is built.
+ */
 class octree {
 	public:
-		// // (not yet) 'double' is depth of collision (0 for non-colliding),
-		// 'bool' is whether there's a collision
+		// 'float' is depth of collision (0 for non-colliding),
 		// 'vec3' is the normal for the colliding node
 		typedef std::pair<float, glm::vec3> collision;
-		class node;
+
+		struct node {
+			// first child, or for leaves, index into leaf_normals
+			uint32_t children = 0;
+			// bit for each octant that has a child, 0 for leaves
+			uint8_t  mask = 0;
+		};
 
 		octree(double _leaf_size=0.1 /* meters */) {
 			leaf_size = _leaf_size;
 		};
 		~octree() {};
 
-
-		// TODO: clear()
-		void grow(double size);
+		void clear(void);
 		void add_tri(const glm::vec3 tri[3], const glm::vec3 normals[3]);
 		void add_model(sceneModel::ptr mod, glm::mat4 transform);
-		void set_leaf(glm::vec3 location, glm::vec3 normal);
-		node *get_leaf(glm::vec3 location);
-		uint32_t count_nodes(void);
+		void add_mesh(sceneModel::ptr mod, sceneMesh::ptr mesh, glm::mat4 transform);
+		// voxelizes everything added so far, in parallel
+		void build(void);
+		// have triangles that haven't been built yet
+		bool dirty(void) const { return built_tris != tri_normals.size(); };
+
+		bool get_leaf(glm::vec3 location, glm::vec3 *normal = nullptr) const;
+		uint32_t count_nodes(void) const { return nodes.size(); };
+
+		// first voxel hit along the segment, fraction from begin to end
+		bool raycast(glm::vec3 begin, glm::vec3 end,
+		             float& fraction, glm::vec3& normal) const;
+		// XXX: voxels are grown by radius as boxes, so rounded corners
+		//      are hit a bit early
+		bool sweep_sphere(glm::vec3 begin, glm::vec3 end, float radius,
+		                  float& fraction, glm::vec3& normal) const;
 
-		collision collides(glm::vec3 begin, glm::vec3 end);
-		collision collides_sphere(glm::vec3 position, float radius);
+		// how far past the surface the segment ends
+		collision collides(glm::vec3 begin, glm::vec3 end) const;
+		// deepest penetration, normal pushing the sphere out
+		collision collides_sphere(glm::vec3 position, float radius) const;
+		// same for axis aligned boxes
+		collision collides_box(glm::vec3 center, glm::vec3 extent) const;
 
-		node *root = nullptr;
+		// breadth first, root at 0, leaves at the end
+		std::vector<node>      nodes;
+		// averaged triangle normals per leaf
+		std::vector<glm::vec3> leaf_normals;
 		unsigned levels = 0;
 		double leaf_size;
-};
+		// min corner of the root node
+		glm::vec3 origin = {0, 0, 0};
 
-class octree::node {
-	public:
-		node() {
-			for (unsigned i = 0; i < 8; i++) {
-				subnodes[!!(i&1)][!!(i&2)][!!(i&4)] = nullptr;
-			}
-		}
-		uint32_t count_nodes(void);
-		node *subnodes[2][2][2]; /* [x][y][z] */
-		unsigned level = 0;
-
-		glm::vec3 normals = {0, 0, 0};
-		size_t normal_samples = 0;
+	private:
+		struct ray {
+			glm::vec3 origin;
+			glm::vec3 dir;
+			glm::vec3 inv;
+			float     radius;
+		};
+
+		bool traverse(const ray& r, uint32_t idx, unsigned level,
+		              glm::vec3 min, float size, float t0, float t1,
+		              int axis, float& fraction, glm::vec3& normal) const;
+		bool sweep(const ray& r, uint32_t idx, unsigned level,
+		           glm::vec3 min, float size,
+		           float& fraction, glm::vec3& normal) const;
+		void sphere(uint32_t idx, unsigned level, glm::vec3 min, float size,
+		            glm::vec3 position, float radius, collision& ret) const;
+		void box(uint32_t idx, unsigned level, glm::vec3 min, float size,
+		         glm::vec3 center, glm::vec3 extent, collision& ret) const;
+
+		// pending triangles, kept so later additions can rebuild
+		// the whole tree
+		std::vector<glm::vec3> tri_positions;
+		std::vector<glm::vec3> tri_normals;
+		size_t built_tris = 0;
 };
 
 // namespace grendx
@@ -21,15 +21,97 @@ class sceneModel;
 class sceneMesh;
 
 class physicsObject;
+class jobQueue;
 
+// one contact event, as seen from object a
 struct collision {
-	std::shared_ptr<physicsObject> a, b;
+	enum type : uint8_t {
+		// first step a pair is touching
+		Begin,
+		// still touching
+		Persist,
+		// stopped touching, or one of the objects was removed (in which
+		// case its data is null), position etc are from the last contact
+		End,
+	};
+
+	enum type type;
+	// physicsObject::getID()
+	uint32_t a, b;
 	void *adata, *bdata;
+	// deepest point of the contact, on a
 	glm::vec3 position;
+	// from a towards b
 	glm::vec3 normal;
 	float depth;
 };
 
+/**
+ * Contact events since the last filterCollisions(), one per touching pair,
+ * in parallel arrays. Buffers are reused, so once they've grown to fit
+ * the scene nothing is allocated per contact.
+ */
+struct contactEvents {
+	std::vector<uint8_t>   types;
+	std::vector<uint32_t>  idA, idB;
+	std::vector<void*>     dataA, dataB;
+	std::vector<glm::vec3> positionA, positionB;
+	// bullet convention, pointing from b towards a
+	std::vector<glm::vec3> normalB;
+	std::vector<float>     depth;
+
+	size_t size(void) const { return types.size(); };
+
+	void clear(void) {
+		types.clear();
+		idA.clear();
+		idB.clear();
+		dataA.clear();
+		dataB.clear();
+		positionA.clear();
+		positionB.clear();
+		normalB.clear();
+		depth.clear();
+	}
+
+	void push(uint8_t type, uint32_t a, uint32_t b, void *adata, void *bdata,
+	          glm::vec3 posA, glm::vec3 posB, glm::vec3 normal, float d)
+	{
+		types.push_back(type);
+		idA.push_back(a);
+		idB.push_back(b);
+		dataA.push_back(adata);
+		dataB.push_back(bdata);
+		positionA.push_back(posA);
+		positionB.push_back(posB);
+		normalB.push_back(normal);
+		depth.push_back(d);
+	}
+
+	// event i from a's side, or b's side if flipped
+	collision get(size_t i, bool flipped = false) const {
+		if (flipped) {
+			return {
+				.type = (enum collision::type)types[i],
+				.a = idB[i], .b = idA[i],
+				.adata = dataB[i], .bdata = dataA[i],
+				.position = positionB[i],
+				.normal = normalB[i],
+				.depth = depth[i],
+			};
+		}
+
+		return {
+			.type = (enum collision::type)types[i],
+			.a = idA[i], .b = idB[i],
+			.adata = dataA[i], .bdata = dataB[i],
+			.position = positionA[i],
+			.normal = -normalB[i],
+			.depth = depth[i],
+		};
+	}
+};
+
 class physicsObject {
 	public:
 		typedef std::shared_ptr<physicsObject> ptr;
@@ -55,7 +137,47 @@ class physicsObject {
 
 		virtual void removeSelf(void) = 0;
 
-		std::shared_ptr<std::vector<collision>> collisionQueue = nullptr;
+		// identifies the object in contact events, unique for the
+		// lifetime of the physics service
+		virtual uint32_t getID(void) { return 0; };
+};
+
+// queries for physics::raycast() and friends, objects with ignore as their
+// user data pointer are skipped (eg. the entity doing the query)
+struct physicsRay {
+	glm::vec3 from;
+	glm::vec3 to;
+	void *ignore = nullptr;
+};
+
+struct physicsSweep {
+	glm::vec3 from;
+	glm::vec3 to;
+	float radius;
+	void *ignore = nullptr;
+};
+
+struct physicsSphere {
+	glm::vec3 position;
+	float radius;
+	void *ignore = nullptr;
+};
+
+struct physicsBox {
+	AABBExtent box;
+	void *ignore = nullptr;
+};
+
+struct physicsHit {
+	// index of the query in the batch
+	uint32_t  query;
+	// user data of the object hit, nullptr for static geometry
+	// that wasn't given any
+	void     *data;
+	glm::vec3 position;
+	glm::vec3 normal;
+	// how far along the ray/sweep, 0 for overlaps
+	float     fraction;
 };
 
 class physics : public IoC::Service {
@@ -129,8 +251,45 @@ class physics : public IoC::Service {
 		virtual void remove(physicsObject::ptr obj) = 0;
 		virtual void clear(void) = 0;
 
+		// updates the contact events, call once per frame
 		virtual void filterCollisions(void) = 0;
 		virtual void stepSimulation(float delta) = 0;
+
+		const contactEvents& getContacts(void) { return contacts; };
+
+		/**
+		 * Batched scene queries. Hits are written to hits (which is cleared
+		 * first) in query order, each tagged with the index of its query.
+		 * Rays and sweeps report the closest hit, overlaps report every
+		 * object overlapping.
+		 *
+		 * @param jobs If not null, the batch is split up across the job
+		 *             queue, the calling thread still helps and waits
+		 *             for all of it.
+		 */
+		virtual void raycast(const std::vector<physicsRay>& rays,
+		                     std::vector<physicsHit>& hits,
+		                     jobQueue *jobs = nullptr) = 0;
+		virtual void sweepSpheres(const std::vector<physicsSweep>& sweeps,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr) = 0;
+		virtual void overlapSpheres(const std::vector<physicsSphere>& spheres,
+		                            std::vector<physicsHit>& hits,
+		                            jobQueue *jobs = nullptr) = 0;
+		virtual void overlapBoxes(const std::vector<physicsBox>& boxes,
+		                          std::vector<physicsHit>& hits,
+		                          jobQueue *jobs = nullptr) = 0;
+
+	protected:
+		contactEvents contacts;
+
+		// runs query(i, out) for every query index, chunked over jobs if
+		// given, hits are gathered in order
+		typedef std::function<void(size_t, std::vector<physicsHit>&)> queryFunc;
+		static void runQueries(size_t count,
+		                       std::vector<physicsHit>& hits,
+		                       jobQueue *jobs,
+		                       const queryFunc& query);
 };
 
 // namespace grendx
@@ -5,9 +5,12 @@
 #include <grend/renderFramebuffer.hpp>
 
 #include <grend/sceneNode.hpp>
+#include <grend/transformHierarchy.hpp>
 
 namespace grendx {
 
+class jobQueue;
+
 class renderQueue {
 	public:
 		renderQueue() {};
@@ -27,6 +30,8 @@ class renderQueue {
 			bool      inverted;
 			T         data;
 			uint32_t  renderID;
+			// level of detail to draw, set by cullQueue()
+			unsigned  lod = 0;
 		};
 
 		void add(sceneNode::ptr obj,
@@ -34,8 +39,21 @@ class renderQueue {
 		         glm::mat4 trans = glm::mat4(1),
 		         bool inverted = false);
 
+		// same as add(transforms.root, ...), using cached world transforms
+		void add(transformHierarchy& transforms,
+		         uint32_t renderID = 0,
+		         const glm::mat4& trans = glm::mat4(1),
+		         bool inverted = false);
+
 		void add(renderQueue& other);
 
+		// queue obj itself, adjTrans already includes its transform,
+		// returns whether the sub-nodes still need to be added
+		bool addNode(sceneNode::ptr obj,
+		             uint32_t renderID,
+		             const glm::mat4& adjTrans,
+		             bool inverted);
+
 		void addMesh(sceneNode::ptr obj,
 		             uint32_t renderID = 0,
 		             const glm::mat4& trans = glm::mat4(1),
@@ -100,6 +118,12 @@ struct multiRenderQueue {
 		         const glm::mat4& trans = glm::mat4(1),
 		         bool inverted = false);
 
+		void add(const renderFlags& shader,
+		         transformHierarchy& transforms,
+		         uint32_t renderID = 0,
+		         const glm::mat4& trans = glm::mat4(1),
+		         bool inverted = false);
+
 		// TODO:
 		//void add(multiRenderQueue& other);
 
@@ -110,10 +134,15 @@ void updateLights(renderContext *rctx, renderQueue& lights);
 void updateReflections(renderContext *rctx, renderQueue& refs);
 void updateReflectionProbe(renderContext *rctx, renderQueue& que, camera::ptr cam);
 void sortQueue(renderQueue& queue, camera::ptr cam);
-void cullQueue(renderQueue& queue, camera::ptr cam, unsigned width, unsigned height, float lightext);
+// lodError is the largest error allowed from mesh simplification, in pixels,
+// 0 draws everything at full detail
+void cullQueue(renderQueue& queue, camera::ptr cam, unsigned width, unsigned height, float lightext, float lodError = 0.f);
 void sortQueue(multiRenderQueue& queue, camera::ptr cam);
-void cullQueue(multiRenderQueue& queue, camera::ptr cam, unsigned width, unsigned height, float lightext);
+void cullQueue(multiRenderQueue& queue, camera::ptr cam, unsigned width, unsigned height, float lightext, float lodError = 0.f);
 void batchQueue(renderQueue& queue);
+// computes joint palettes for the skins in the queue, on worker threads if
+// jobs is given, so that flush() only has to upload them
+void updateSkins(renderQueue& queue, jobQueue *jobs = nullptr);
 
 void shaderSync(Program::ptr program, renderContext *rctx, renderQueue& que);
 
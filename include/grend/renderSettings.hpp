@@ -31,6 +31,18 @@ struct renderSettings {
 	unsigned targetResY = 1080;
 	unsigned msaaLevel              = 4; /* 0 is off */
 	unsigned anisotropicFilterLevel = 2; /* 0 is off */
+	unsigned textureBudgetMB        = 0; /* 0 is unlimited */
+
+	// mesh level of detail, largest error from simplification allowed
+	// on screen, in pixels (0 always draws full detail)
+	float lodError        = 1.0;
+	float lodErrorShadows = 4.0; /* shadow maps and reflection probes */
+
+	// skip meshes hidden behind what's already in the depth prepass
+	bool occlusionCulling = true;
+	// skin meshes once per frame with compute shaders (core 4.3+) rather
+	// than in the vertex shader of every pass
+	bool computeSkinning = true;
 
 	bool postprocessing = true;
 
@@ -37,6 +37,17 @@ class sceneMesh : public sceneNode {
 		material::ptr meshMaterial;
 		std::vector<GLuint> faces;
 
+		// lower detail versions of faces, indexing the same model vertices,
+		// from most to least detailed (see sceneModel::genLODs())
+		struct lodLevel {
+			std::vector<GLuint> faces;
+			// maximum distance the surface is moved by simplification,
+			// relative to the bounding sphere diameter
+			float error;
+		};
+
+		std::vector<lodLevel> lods;
+
 		struct AABB    boundingBox;
 		struct BSphere boundingSphere;
 };
@@ -62,6 +73,8 @@ class sceneModel : public sceneNode {
 		void genTexcoords(void);
 		void genTangents(void);
 		void genAABBs(void);
+		// needs bounding spheres, call after genAABBs()
+		void genLODs(void);
 
 		std::string modelName = "unit_cube";
 		// TODO: some sort of specifier for generated meshes
@@ -56,10 +56,16 @@ class sceneNode {
 			return strm.str();
 		}
 
-		TRS getTransformTRS();
-		TRS getOrigTransform();
+		const TRS& getTransformTRS(void) const { return transform; }
+		const TRS& getOrigTransform(void) const { return origTransform; }
 		glm::mat4 getTransformMatrix();
 		bool hasDefaultTransform(void) const { return isDefault; }
+		// incremented on every setTransform(), for caches that need to
+		// know whether a node moved since they last looked at it
+		unsigned getTransformVersion(void) const { return transformVersion; }
+		// same, for adding or removing sub-nodes, see setNode()
+		unsigned getStructureVersion(void) const { return structureVersion; }
+		void markStructureChanged(void) { structureVersion++; }
 
 		void setTransform(const TRS& t);
 		void setPosition(const glm::vec3& position);
@@ -104,6 +110,8 @@ class sceneNode {
 
 		bool updated = true;
 		bool isDefault = true;
+		unsigned transformVersion = 0;
+		unsigned structureVersion = 0;
 		glm::mat4 cachedTransformMatrix;
 };
 
@@ -112,6 +120,7 @@ void setNode(std::string name, sceneNode::ptr obj, sceneNode::ptr sub) {
 	assert(obj != nullptr && sub != nullptr);
 
 	obj->nodes[name] = sub;
+	obj->markStructureChanged();
 	sub->parent = obj;
 }
 
@@ -120,6 +129,7 @@ void setNodeXXX(std::string name, sceneNode::ptr obj, sceneNode::ptr sub) {
 	assert(obj != nullptr && sub != nullptr);
 
 	obj->nodes[name] = sub;
+	obj->markStructureChanged();
 }
 
 
@@ -157,6 +167,9 @@ class sceneImport : public sceneNode {
 // ugh, this is becoming a maze of forward declarations...
 class Buffer;
 class Program;
+class Vao;
+class compiledModel;
+class compiledMesh;
 
 class sceneSkin : public sceneNode {
 	public:
@@ -170,14 +183,60 @@ class sceneSkin : public sceneNode {
 			return "Skin";
 		}
 
+		// flattens the nodes between the skin and its joints into
+		// hierarchy, needs to be called again if joints are changed or
+		// reparented (done when loading and copying skins)
+		void buildHierarchy(void);
+		// recompute transforms if any node in the hierarchy moved, doesn't
+		// touch GL state so it can run on worker threads, as long as nothing
+		// else is modifying the joints at the same time
+		// returns true if the palette changed
+		bool update(void);
+		// update() if needed, and upload the palette
 		void sync(std::shared_ptr<Program> prog);
+		// incremented whenever update() changes the palette
+		unsigned getPaletteVersion(void) const { return paletteVersion; }
 
 		std::vector<glm::mat4> inverseBind;
 		std::vector<glm::mat4> transforms;
 		// keep internal pointers to joints, same nodes as in the tree
 		std::vector<sceneNode::ptr> joints;
 
+		// joints and the nodes between them and the skin, parents always
+		// come before their children so world transforms can be computed
+		// in one pass from the front
+		struct {
+			std::vector<sceneNode::ptr> nodes;
+			// index into nodes, -1 if the parent is the skin
+			std::vector<int32_t>   parents;
+			// transform versions from the last update()
+			std::vector<unsigned>  versions;
+			std::vector<glm::mat4> world;
+			// index into nodes for each joint, -1 for missing joints
+			std::vector<int32_t>   jointNodes;
+		} hierarchy;
+
 		std::shared_ptr<Buffer> ubuffer = nullptr;
+
+		// vertices skinned on the GPU by skinMeshes(), per model,
+		// see computeSkinning.hpp. Dropped once the model is freed.
+		struct skinnedModel {
+			std::weak_ptr<compiledModel> model;
+			std::shared_ptr<Buffer> vertices;
+			std::map<compiledMesh*, std::shared_ptr<Vao>> vaos;
+			// palette the vertices were skinned with, never matches
+			// until the first dispatch
+			unsigned paletteVersion = ~0u;
+			// last frame this was skinned (or found still up to date)
+			uint64_t frame = 0;
+		};
+
+		std::map<compiledModel*, skinnedModel> skinned;
+
+	private:
+		bool paletteValid = false;
+		bool uploaded = false;
+		unsigned paletteVersion = 0;
 };
 
 class sceneParticles : public sceneNode {
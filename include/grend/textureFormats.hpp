@@ -0,0 +1,32 @@
+#pragma once
+
+#include <grend/materialTexture.hpp>
+#include <string>
+
+namespace grendx {
+
+// Loaders for GPU-ready texture containers, these keep the precomputed
+// mip chain and block compression from the file, so nothing needs to be
+// decoded or generated at load time.
+//
+// Return false if the file doesn't exist, is malformed, or uses a format
+// the GPU can't sample directly (see haveCompressedFormat()).
+bool loadKTX2(materialTexture& tex, const std::string& filename);
+bool loadDDS(materialTexture& tex, const std::string& filename);
+
+/**
+ * Load a texture image, preferring precompressed containers.
+ *
+ * Looks for <filename>.ktx2 and <filename>.dds next to the source image
+ * first, then falls back to decoding the image itself with stb_image.
+ * Safe to call from worker threads.
+ *
+ * @param tex      Texture to load into, should be empty.
+ * @param filename Path to the source image.
+ *
+ * @return True if anything was loaded.
+ */
+bool loadImageFile(materialTexture& tex, const std::string& filename);
+
+// namespace grendx
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <grend/glManager.hpp>
+#include <grend/jobQueue.hpp>
+
+namespace grendx {
+
+// Texture residency management
+//
+// Textures loaded from containers with precomputed mips (see
+// textureFormats.hpp) are registered here when they're buffered. Each
+// frame, the mip level each texture needs is estimated from the largest
+// on-screen size it was drawn at, levels that are needed get streamed back
+// in from the source file, and when GPU memory is over budget, unneeded
+// levels and then least-recently-used textures are dropped down to their
+// small tail levels.
+//
+// Textures with GPU-generated mipmaps can't be reloaded level by level,
+// so they're always fully resident.
+
+// done by Texture::buffer()
+void manageTextureResidency(Texture::ptr tex);
+
+/**
+ * Update texture residency, should be called once per frame from the main
+ * thread, before rendering.
+ *
+ * @param jobs   Job queue used to reload evicted levels.
+ * @param budget Texture memory budget, in bytes. 0 for unlimited.
+ */
+void updateTextureResidency(jobQueue *jobs, size_t budget);
+
+struct textureResidencyStats {
+	size_t managed = 0;
+	size_t evicted = 0;   // textures not at their full resolution
+	size_t reloading = 0;
+};
+
+textureResidencyStats getTextureResidencyStats(void);
+
+// namespace grendx
+}
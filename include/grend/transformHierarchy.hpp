@@ -0,0 +1,76 @@
+#pragma once
+
+#include <grend/sceneNode.hpp>
+#include <grend/glmIncludes.hpp>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace grendx {
+
+/**
+ * Flattened copy of a node tree, with local and world transforms kept in
+ * contiguous arrays, parents before children (same order renderQueue::add()
+ * walks the tree in).
+ *
+ * update() only recomputes subtrees under nodes that had setTransform()
+ * called since the last update, and rebuilds the arrays when nodes were
+ * added or removed (through setNode()/unlink()/removeNode()). World
+ * transforms are relative to the root's parent, so the root's own transform
+ * is included.
+ *
+ * Only a weak reference to the root is kept, so a hierarchy doesn't keep the
+ * tree it was built from alive, the arrays are emptied by update() once the
+ * root is freed.
+ */
+class transformHierarchy {
+	public:
+		typedef std::shared_ptr<transformHierarchy> ptr;
+		typedef std::weak_ptr<transformHierarchy>   weakptr;
+
+		transformHierarchy(sceneNode::ptr r) : root(r) { build(); };
+
+		void build(void);
+		// returns the number of world transforms recomputed
+		size_t update(void);
+
+		// index of node, -1 if it isn't in the hierarchy
+		int32_t find(sceneNode *node) const;
+		// cached world transform of node, as of the last update(), or
+		// the node's local transform if it isn't in the hierarchy
+		glm::mat4 worldTransform(sceneNode *node) const;
+
+		sceneNode::weakptr root;
+
+		// the root's entry doesn't own it, see above
+		std::vector<sceneNode::ptr> nodes;
+		// index into nodes, -1 for the root
+		std::vector<int32_t>   parents;
+		// one past the last node in each subtree, for skipping subtrees
+		std::vector<uint32_t>  ends;
+		std::vector<glm::mat4> local;
+		std::vector<glm::mat4> world;
+		// whether face order is flipped, from an odd number of negative
+		// scales along the path from the root
+		std::vector<uint8_t>   inverted;
+
+	private:
+		uint32_t add(sceneNode::ptr node, int32_t parent);
+
+		std::vector<unsigned> versions;
+		std::vector<unsigned> structureVersions;
+		std::vector<uint8_t>  dirty;
+		std::unordered_map<sceneNode*, int32_t> indices;
+};
+
+/**
+ * Hierarchy for a node that's drawn (or otherwise looked at) every frame,
+ * created on first use and dropped some time after the root is freed.
+ * Not thread safe, meant for the main thread.
+ */
+transformHierarchy::ptr cachedTransforms(sceneNode::ptr root);
+
+// namespace grendx
+}
@@ -1,8 +1,16 @@
 #include <grend/animation.hpp>
+#include <grend/sceneNode.hpp>
+#include <grend/jobQueue.hpp>
 #include <grend/utility.hpp>
 #include <math.h>
 #include <cstdio>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <thread>
+
 using namespace grendx;
 
 //#define DUMP_ANIMATION_INFO
@@ -23,42 +31,16 @@ size_t animation::findKeyframe(float delta) {
 	assert(frametimes.size() != 0);
 	assert(delta >= 0);
 
-	/*
-	for (size_t n = 0; n < frametimes.size(); n++) {
-		if (delta <= frametimes[n]) {
-			return n;
-		}
-	}
-
-	return frametimes.size() - 1;
-	*/
-
-	size_t lower = 0;
-	size_t upper = frametimes.size() - 1;
-	size_t mid = (upper + lower)/2;
-
-	while (lower != upper) {
-		float dp = delta - (1.f/60);
-		FERR("frame: mid: %lu, lower: %lu, upper: %lu\n",
-		     mid, lower, upper);
-
-		if (dp <= frametimes[mid] && (mid == 0 || dp > frametimes[mid-1])) {
-			FERR("frame %lu (%p)\n", mid, this);
-			return mid;
-		}
-
-		if (delta < frametimes[mid]) {
-			upper = mid - 1;
-			mid = (upper + lower)/2;
+	// first keyframe at or after delta
+	auto it = std::lower_bound(frametimes.begin(), frametimes.end(), delta);
 
-		} else {
-			lower = mid + 1;
-			mid = (upper + lower)/2;
-		}
+	if (it == frametimes.end()) {
+		FERR("frame %lu (%p) (f)\n", frametimes.size() - 1, this);
+		return frametimes.size() - 1;
 	}
 
-	FERR("frame %lu (%p) (f)\n", mid, this);
-	return mid;
+	FERR("frame %lu (%p)\n", size_t(it - frametimes.begin()), this);
+	return it - frametimes.begin();
 }
 
 std::tuple<size_t, size_t, float>
@@ -69,7 +51,7 @@ animation::interpFrames(float delta, float end) {
 
 	float adj = fmod(delta, end);
 	size_t frame = findKeyframe(adj);
-	size_t idx = (frame - 1) % frametimes.size();
+	size_t idx = frame? frame - 1 : frametimes.size() - 1;
 	size_t kdx = frame;
 
 	assert(idx < frametimes.size());
@@ -77,12 +59,13 @@ animation::interpFrames(float delta, float end) {
 
 	if (kdx) {
 		float range = frametimes[kdx] - frametimes[idx];
-		interp = (frametimes[kdx] - adj)/range;
+		// past the last keyframe, hold it rather than extrapolating
+		interp = (range > 0)? glm::clamp((frametimes[kdx] - adj)/range, 0.f, 1.f) : 0;
 	}
 
 	else if (frametimes[0] == 0 && idx > 0) {
 		float range = frametimes[idx] - frametimes[idx-1];
-		interp = (end - adj)/range;
+		interp = (range > 0)? (end - adj)/range : 0;
 	}
 
 	FERR("d: %f, end time: %f, interp: %f, idx: %lu, kdx: %lu, "
@@ -94,7 +77,8 @@ animation::interpFrames(float delta, float end) {
 
 void animationChannel::applyTransform(struct TRS& thing,
                                       float delta,
-                                      float endtime)
+                                      float endtime,
+                                      float weight)
 {
 	//assert(group != nullptr);
 	struct TRS asdf = thing;
@@ -102,12 +86,10 @@ void animationChannel::applyTransform(struct TRS& thing,
 	for (auto& ptr : animations) {
 		FERR("anim: delta: %f, endtime %f\n", delta, endtime);
 		ptr->applyTransform(asdf, delta, endtime);
-		// TODO: reimplement animation weighting, could take weight as a parameter
-		//asdf = mixtrs(asdf, foo, group->weight);
 	}
 
 	// or could return the resulting transform
-	thing = asdf;
+	thing = (weight >= 1.f)? asdf : mixtrs(thing, asdf, weight);
 }
 
 void animationTranslation::applyTransform(struct TRS& thing, float delta, float end) {
@@ -124,3 +106,558 @@ void animationScale::applyTransform(struct TRS& thing, float delta, float end) {
 	auto [idx, kdx, interp] = interpFrames(delta, end);
 	thing.scale = glm::mix(scales[kdx], scales[idx], interp);
 }
+
+std::shared_ptr<animationClip> animationMap::clip(void) {
+	// instances can be created from several threads, eg. while loading
+	std::call_once(compiledOnce, [this] () {
+		compiled = std::make_shared<animationClip>(*this);
+	});
+
+	return compiled;
+}
+
+animationClip::animationClip(const animationMap& anim) {
+	endtime = anim.endtime;
+
+	auto addTrack = [&] (std::vector<track>& tracks,
+	                     auto& values,
+	                     const auto& keyframes,
+	                     const std::vector<float>& frametimes,
+	                     uint32_t target)
+	{
+		uint32_t count = min(frametimes.size(), keyframes.size());
+
+		if (count == 0) {
+			return;
+		}
+
+		tracks.push_back({target, (uint32_t)times.size(), (uint32_t)values.size(), count});
+		times.insert(times.end(), frametimes.begin(), frametimes.begin() + count);
+		values.insert(values.end(), keyframes.begin(), keyframes.begin() + count);
+	};
+
+	for (auto& [hash, chans] : anim) {
+		uint32_t target = channels.size();
+		channels.push_back(hash);
+
+		for (auto& chan : chans) {
+			for (auto& ptr : chan->animations) {
+				if (auto p = std::dynamic_pointer_cast<animationTranslation>(ptr)) {
+					addTrack(translations, vectors, p->translations, p->frametimes, target);
+
+				} else if (auto p = std::dynamic_pointer_cast<animationRotation>(ptr)) {
+					addTrack(rotations, quats, p->rotations, p->frametimes, target);
+
+				} else if (auto p = std::dynamic_pointer_cast<animationScale>(ptr)) {
+					addTrack(scales, vectors, p->scales, p->frametimes, target);
+				}
+			}
+		}
+	}
+}
+
+// last keyframe at or before t, starting from the previous one
+static inline uint32_t seekKeyframe(const float *keys,
+                                    uint32_t count,
+                                    uint32_t cursor,
+                                    float t)
+{
+	if (cursor >= count || keys[cursor] > t) {
+		// went backwards (looped or seeked), search for it
+		const float *it = std::upper_bound(keys, keys + count, t);
+		return (it == keys)? 0 : uint32_t(it - keys - 1);
+	}
+
+	while (cursor + 1 < count && keys[cursor + 1] <= t) {
+		cursor++;
+	}
+
+	return cursor;
+}
+
+// interpolation amount from keyframe cursor to the next one
+static inline float keyframeAmount(const float *keys,
+                                   uint32_t count,
+                                   uint32_t cursor,
+                                   float t)
+{
+	if (cursor + 1 >= count) {
+		return 0.f;
+	}
+
+	float range = keys[cursor + 1] - keys[cursor];
+	return (range > 0.f)? glm::clamp((t - keys[cursor])/range, 0.f, 1.f) : 0.f;
+}
+
+static void collectChannels(std::unordered_map<uint32_t, sceneNode::ptr>& out,
+                            sceneNode::ptr node)
+{
+	if (node->animChannel && !out.count(node->animChannel)) {
+		out[node->animChannel] = node;
+	}
+
+	for (auto& [name, ptr] : node->nodes) {
+		collectChannels(out, ptr);
+	}
+}
+
+animationInstance::animationInstance(animationClip::ptr _clip,
+                                     sceneNode::ptr root)
+	: clip(_clip)
+{
+	std::unordered_map<uint32_t, sceneNode::ptr> found;
+
+	if (root) {
+		collectChannels(found, root);
+	}
+
+	size_t n = clip->channels.size();
+	positions.resize(n);
+	rotations.resize(n);
+	scales.resize(n, glm::vec3(1));
+	nodes.resize(n);
+
+	for (size_t i = 0; i < n; i++) {
+		auto it = found.find(clip->channels[i]);
+
+		if (it != found.end()) {
+			TRS rest = it->second->getOrigTransform();
+
+			nodes[i]     = it->second;
+			positions[i] = rest.position;
+			rotations[i] = rest.rotation;
+			scales[i]    = rest.scale;
+		}
+	}
+
+	cursors.resize(clip->translations.size()
+	               + clip->rotations.size()
+	               + clip->scales.size(), 0);
+}
+
+void animationInstance::advance(float delta) {
+	if (playing) {
+		seek(time + delta*speed);
+	}
+}
+
+void animationInstance::seek(float newtime) {
+	float end = clip->endtime;
+
+	if (end <= 0) {
+		time = 0;
+
+	} else if (loop) {
+		time = fmod(newtime, end);
+		time += (time < 0)? end : 0;
+
+	} else {
+		time = glm::clamp(newtime, 0.f, end);
+	}
+}
+
+void animationInstance::sample(void) {
+	const animationClip& c = *clip;
+	uint32_t *cursor = cursors.data();
+	float t = time;
+
+	for (auto& tr : c.translations) {
+		const float *keys = c.times.data() + tr.keys;
+		const glm::vec3 *v = c.vectors.data() + tr.values;
+		uint32_t k = *cursor = seekKeyframe(keys, tr.count, *cursor, t);
+		uint32_t next = min(k + 1, tr.count - 1);
+
+		positions[tr.target] = glm::mix(v[k], v[next], keyframeAmount(keys, tr.count, k, t));
+		cursor++;
+	}
+
+	for (auto& tr : c.rotations) {
+		const float *keys = c.times.data() + tr.keys;
+		const glm::quat *v = c.quats.data() + tr.values;
+		uint32_t k = *cursor = seekKeyframe(keys, tr.count, *cursor, t);
+		uint32_t next = min(k + 1, tr.count - 1);
+
+		rotations[tr.target] = glm::slerp(v[k], v[next], keyframeAmount(keys, tr.count, k, t));
+		cursor++;
+	}
+
+	for (auto& tr : c.scales) {
+		const float *keys = c.times.data() + tr.keys;
+		const glm::vec3 *v = c.vectors.data() + tr.values;
+		uint32_t k = *cursor = seekKeyframe(keys, tr.count, *cursor, t);
+		uint32_t next = min(k + 1, tr.count - 1);
+
+		scales[tr.target] = glm::mix(v[k], v[next], keyframeAmount(keys, tr.count, k, t));
+		cursor++;
+	}
+}
+
+void animationInstance::apply(void) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i]) {
+			nodes[i]->setTransform({positions[i], rotations[i], scales[i]});
+		}
+	}
+}
+
+animationMixer::animationMixer(sceneNode::ptr _root)
+	: root(_root)
+{
+	if (root) {
+		collectChannels(bound, root);
+	}
+}
+
+uint32_t animationMixer::channelFor(uint32_t hash) {
+	auto it = channelIndex.find(hash);
+
+	if (it != channelIndex.end()) {
+		return it->second;
+	}
+
+	auto nodeit = bound.find(hash);
+	sceneNode::ptr node = (nodeit != bound.end())? nodeit->second : nullptr;
+	uint32_t idx = channels.size();
+
+	channelIndex[hash] = idx;
+	channels.push_back(hash);
+	nodes.push_back(node);
+	rest.push_back(node? node->getOrigTransform() : TRS());
+
+	positions.resize(channels.size());
+	rotations.resize(channels.size());
+	scales.resize(channels.size());
+	weights.resize(channels.size());
+
+	return idx;
+}
+
+animationMixer::layer *animationMixer::find(const animationInstance::ptr& inst) {
+	for (auto& l : layers) {
+		if (l.instance == inst) {
+			return &l;
+		}
+	}
+
+	return nullptr;
+}
+
+animationInstance::ptr animationMixer::add(animationClip::ptr clip,
+                                           float weight,
+                                           blendMode mode)
+{
+	layer l;
+	l.instance = std::make_shared<animationInstance>(clip, root);
+	l.mode     = mode;
+	l.weight   = l.target = weight;
+	l.mask.resize(clip->channels.size(), 1.f);
+
+	for (uint32_t hash : clip->channels) {
+		l.remap.push_back(channelFor(hash));
+	}
+
+	layers.push_back(std::move(l));
+	return layers.back().instance;
+}
+
+void animationMixer::remove(animationInstance::ptr inst) {
+	layers.erase(std::remove_if(layers.begin(), layers.end(),
+	                            [&] (layer& l) { return l.instance == inst; }),
+	             layers.end());
+}
+
+void animationMixer::fade(animationInstance::ptr inst,
+                          float target,
+                          float duration,
+                          bool removeFaded)
+{
+	if (layer *l = find(inst)) {
+		l->target      = target;
+		l->removeFaded = removeFaded;
+
+		if (duration > 0) {
+			l->rate = fabs(target - l->weight) / duration;
+
+		} else {
+			l->weight = target;
+			l->rate   = 0;
+		}
+	}
+}
+
+void animationMixer::crossfade(animationInstance::ptr inst, float duration) {
+	for (auto& l : layers) {
+		if (l.mode != blendMode::Blend) {
+			continue;
+		}
+
+		if (l.instance == inst) {
+			fade(l.instance, 1.f, duration);
+		} else {
+			fade(l.instance, 0.f, duration, true);
+		}
+	}
+}
+
+void animationMixer::setMask(animationInstance::ptr inst,
+                             const std::unordered_map<uint32_t, float>& mask,
+                             float defaultWeight)
+{
+	if (layer *l = find(inst)) {
+		auto& chans = l->instance->clip->channels;
+
+		for (size_t i = 0; i < chans.size(); i++) {
+			auto it = mask.find(chans[i]);
+			l->mask[i] = (it != mask.end())? it->second : defaultWeight;
+		}
+	}
+}
+
+// scale of a pose relative to the rest pose, axes scaled to zero at rest
+// have nothing to be relative to, so they're left alone
+static inline glm::vec3 relativeScale(const glm::vec3& scale, const glm::vec3& rest) {
+	return {
+		(rest.x != 0.f)? scale.x / rest.x : 1.f,
+		(rest.y != 0.f)? scale.y / rest.y : 1.f,
+		(rest.z != 0.f)? scale.z / rest.z : 1.f,
+	};
+}
+
+void animationMixer::update(float delta) {
+	for (auto& l : layers) {
+		if (l.rate > 0) {
+			float step = l.rate * delta;
+
+			l.weight = (l.weight < l.target)
+				? min(l.weight + step, l.target)
+				: max(l.weight - step, l.target);
+
+			if (l.weight == l.target) {
+				l.rate = 0;
+			}
+		}
+	}
+
+	layers.erase(std::remove_if(layers.begin(), layers.end(),
+		[] (layer& l) {
+			return l.removeFaded && l.rate == 0 && l.weight <= 0;
+		}),
+		layers.end());
+
+	size_t n = channels.size();
+	std::fill(positions.begin(), positions.end(), glm::vec3(0));
+	std::fill(rotations.begin(), rotations.end(), glm::quat(0, 0, 0, 0));
+	std::fill(scales.begin(),    scales.end(),    glm::vec3(0));
+	std::fill(weights.begin(),   weights.end(),   0.f);
+
+	// every layer keeps time, even at zero weight, so layers fading back
+	// in stay in sync
+	for (auto& l : layers) {
+		l.instance->advance(delta);
+
+		if (l.weight > 0) {
+			l.instance->sample();
+		}
+	}
+
+	for (auto& l : layers) {
+		if (l.mode != blendMode::Blend || l.weight <= 0) {
+			continue;
+		}
+
+		auto& inst = *l.instance;
+
+		for (size_t i = 0; i < l.remap.size(); i++) {
+			float w = l.weight * l.mask[i];
+			uint32_t c = l.remap[i];
+
+			if (w <= 0) continue;
+
+			// keep quaternions in the same hemisphere before summing
+			glm::quat q = inst.rotations[i];
+			q = (glm::dot(rotations[c], q) < 0)? -q : q;
+
+			positions[c] += w*inst.positions[i];
+			rotations[c] += w*q;
+			scales[c]    += w*inst.scales[i];
+			weights[c]   += w;
+		}
+	}
+
+	for (size_t c = 0; c < n; c++) {
+		float left = 1.f - weights[c];
+
+		// rest pose for whatever weight is left
+		if (left > 0) {
+			glm::quat q = rest[c].rotation;
+			q = (glm::dot(rotations[c], q) < 0)? -q : q;
+
+			positions[c] += left*rest[c].position;
+			rotations[c] += left*q;
+			scales[c]    += left*rest[c].scale;
+			weights[c]   = 1.f;
+		}
+
+		positions[c] /= weights[c];
+		scales[c]    /= weights[c];
+		rotations[c]  = glm::normalize(rotations[c]);
+	}
+
+	for (auto& l : layers) {
+		if (l.mode != blendMode::Additive || l.weight <= 0) {
+			continue;
+		}
+
+		auto& inst = *l.instance;
+
+		for (size_t i = 0; i < l.remap.size(); i++) {
+			float w = l.weight * l.mask[i];
+			uint32_t c = l.remap[i];
+
+			if (w <= 0) continue;
+
+			const TRS& ref = rest[c];
+			glm::quat diff = inst.rotations[i] * glm::inverse(ref.rotation);
+
+			positions[c] += w*(inst.positions[i] - ref.position);
+			rotations[c]  = glm::normalize(nlerp(glm::quat(1, 0, 0, 0), diff, w)
+			                               * rotations[c]);
+			scales[c]    *= glm::mix(glm::vec3(1), relativeScale(inst.scales[i], ref.scale), w);
+		}
+	}
+
+	for (size_t c = 0; c < n; c++) {
+		if (nodes[c]) {
+			nodes[c]->setTransform({positions[c], rotations[c], scales[c]});
+		}
+	}
+}
+
+static void collectMask(std::unordered_map<uint32_t, float>& mask,
+                        sceneNode::ptr node,
+                        float weight)
+{
+	if (node->animChannel) {
+		mask[node->animChannel] = weight;
+	}
+
+	for (auto& [name, ptr] : node->nodes) {
+		collectMask(mask, ptr, weight);
+	}
+}
+
+std::unordered_map<uint32_t, float>
+grendx::jointMask(sceneNode::ptr joint, float weight) {
+	std::unordered_map<uint32_t, float> ret;
+
+	if (joint) {
+		collectMask(ret, joint, weight);
+	}
+
+	return ret;
+}
+
+void animationPlayer::add(animationInstance::ptr inst) {
+	instances.push_back(inst);
+}
+
+void animationPlayer::add(animationMixer::ptr mixer) {
+	mixers.push_back(mixer);
+}
+
+void animationPlayer::remove(animationInstance::ptr inst) {
+	instances.erase(std::remove(instances.begin(), instances.end(), inst),
+	                instances.end());
+}
+
+void animationPlayer::remove(animationMixer::ptr mixer) {
+	mixers.erase(std::remove(mixers.begin(), mixers.end(), mixer),
+	             mixers.end());
+}
+
+// instances per job, sampling one is cheap, so hand them out in chunks
+#define ANIMATION_BATCH_SIZE 16
+
+void animationPlayer::update(float delta, jobQueue *jobs) {
+	struct batch {
+		std::vector<animationInstance*> instances;
+		std::vector<animationMixer*> mixers;
+		size_t total;
+		float delta;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+		// set by whoever finishes the last chunk
+		std::promise<void> finished;
+
+		// returns false once there's nothing left to claim
+		bool runChunk(void) {
+			size_t start = next.fetch_add(ANIMATION_BATCH_SIZE);
+
+			if (start >= total) {
+				return false;
+			}
+
+			size_t end = min(start + ANIMATION_BATCH_SIZE, total);
+
+			for (size_t i = start; i < end; i++) {
+				if (i < instances.size()) {
+					instances[i]->advance(delta);
+					instances[i]->sample();
+					instances[i]->apply();
+
+				} else {
+					mixers[i - instances.size()]->update(delta);
+				}
+			}
+
+			if ((done += end - start) == total) {
+				finished.set_value();
+			}
+
+			return true;
+		}
+	};
+
+	auto state = std::make_shared<batch>();
+	state->delta = delta;
+	state->total = instances.size() + mixers.size();
+	state->instances.reserve(instances.size());
+	state->mixers.reserve(mixers.size());
+
+	for (auto& inst : instances) {
+		state->instances.push_back(inst.get());
+	}
+
+	for (auto& mixer : mixers) {
+		state->mixers.push_back(mixer.get());
+	}
+
+	size_t chunks = (state->total + ANIMATION_BATCH_SIZE - 1)/ANIMATION_BATCH_SIZE;
+
+	if (chunks == 0) {
+		return;
+	}
+
+	auto finished = state->finished.get_future();
+
+	if (jobs) {
+		// helpers that start after everything's been claimed just return,
+		// the state is shared so that's fine even after update() returns
+		size_t threads = max(1u, std::thread::hardware_concurrency());
+		size_t helpers = (chunks > 1)? min(chunks - 1, threads) : 0;
+
+		for (size_t i = 0; i < helpers; i++) {
+			jobs->addAsync([state] () {
+				while (state->runChunk());
+				return true;
+			});
+		}
+	}
+
+	while (state->runChunk());
+
+	// wait for chunks other threads are still working on, rather than for
+	// the jobs themselves, workers might be busy with something else
+	// entirely, and on emscripten jobs don't run until the next frame
+	finished.wait();
+}
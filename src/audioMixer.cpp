@@ -2,9 +2,17 @@
 #include <grend/sdlContext.hpp>
 #include <grend/utility.hpp>
 #include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
 
 using namespace grendx;
 
+// fraction of the way the limiter gain moves back up to unity per block
+#define LIMITER_RELEASE 0.05f
+
 // non-pure virtual destructors for rtti
 audioChannel::~audioChannel() {};
 stereoAudioChannel::~stereoAudioChannel() {};
@@ -12,9 +20,36 @@ spatialAudioChannel::~spatialAudioChannel() {};
 
 void audioChannel::restart(void) {
 	audioPosition = 0;
+	positionFrac = 0;
 	playState = state::Playing;
 }
 
+float audioChannel::audibility(camera::ptr cam) {
+	return volume;
+}
+
+void audioChannel::skip(size_t frames) {
+	float left[AUDIO_BLOCK_SIZE];
+	float right[AUDIO_BLOCK_SIZE];
+
+	for (size_t i = 0; i < frames; i += AUDIO_BLOCK_SIZE) {
+		// camera isn't used by anything that doesn't override skip()
+		getBlock(left, right, min(frames - i, AUDIO_BLOCK_SIZE), nullptr);
+	}
+}
+
+void audioChannel::getBlock(float *left,
+                            float *right,
+                            size_t frames,
+                            camera::ptr cam)
+{
+	for (size_t i = 0; i < frames; i++) {
+		auto sample = getSample(cam);
+		left[i]  = sample.first;
+		right[i] = sample.second;
+	}
+}
+
 stereoAudioChannel::stereoAudioChannel(channelBuffers_ptr channels,
                                        enum audioChannel::mode m)
 	: audioChannel(m)
@@ -33,85 +68,251 @@ stereoAudioChannel::stereoAudioChannel(channelBuffers_ptr channels,
 
 std::pair<int16_t, int16_t>
 stereoAudioChannel::getSample(camera::ptr cam) {
-	if (audioPosition >= bufs.first->size()
-	    || audioPosition >= bufs.second->size())
-	{
-		if (loopMode == mode::Loop) {
-			restart();
+	float left, right;
+	getBlock(&left, &right, 1, cam);
+	return {left, right};
+}
+
+void stereoAudioChannel::getBlock(float *left,
+                                  float *right,
+                                  size_t frames,
+                                  camera::ptr cam)
+{
+	size_t len = min(bufs.first->size(), bufs.second->size());
+	bool loop  = loopMode == mode::Loop && len > 0;
+	// left and right should always be the same rate
+	float rate = pitch * bufs.first->sampleRate / float(outputRate);
+	double limit = loop? HUGE_VAL : double(len);
+	double pos   = audioPosition + positionFrac;
+	double start = pos;
+
+	size_t n = resampler.resample(left, frames, pos, rate, rate, limit,
+		[&] (ptrdiff_t i) { return bufs.first->sampleAt(i, loop); });
+	resampler.resample(right, n, start, rate, rate, limit,
+		[&] (ptrdiff_t i) { return bufs.second->sampleAt(i, loop); });
+
+	// plain loops over float arrays, these vectorize
+	for (size_t i = 0; i < n; i++) {
+		left[i]  *= 0.8f;
+		right[i] *= 0.8f;
+	}
+
+	if (n < frames) {
+		playState = state::Ended;
+		std::fill(left + n,  left + frames,  0.f);
+		std::fill(right + n, right + frames, 0.f);
+	}
+
+	if (loop) {
+		pos = fmod(pos, len);
+	}
 
+	audioPosition = pos;
+	positionFrac  = pos - audioPosition;
+}
+
+void stereoAudioChannel::skip(size_t frames) {
+	size_t len = min(bufs.first->size(), bufs.second->size());
+	double pos = audioPosition + positionFrac
+		+ frames * pitch * bufs.first->sampleRate / double(outputRate);
+
+	if (pos >= len) {
+		if (loopMode == mode::Loop && len > 0) {
+			pos = fmod(pos, len);
 		} else {
 			playState = state::Ended;
-			return {0, 0};
 		}
 	}
 
-	size_t p = audioPosition++;
-	return {0.8*(*bufs.first)[p], 0.8*(*bufs.second)[p]};
+	audioPosition = pos;
+	positionFrac  = pos - audioPosition;
 }
 
 static void mixCallback(void *userdata, uint8_t *stream, int len) {
 	audioMixer *mix = reinterpret_cast<audioMixer*>(userdata);
 	assert(mix != nullptr);
 
-	if (mix->currentCam == nullptr) {
-		puts("nullptr!");
-		memset(stream, 0, len);
-		return;
-	}
+	// device is opened as AUDIO_S16 stereo, see context::context()
+	mix->mixBlock(reinterpret_cast<int16_t*>(stream),
+	              len / (2*sizeof(int16_t)));
+}
+
+audioMixer::audioMixer(context& ctx) {
+	// SDL might have given us something other than what was asked for,
+	// mixing at the device rate saves having SDL resample it again
+	outputRate = ctx.audioHave.freq;
+	SDL_Log("audioMixer: mixing at %u Hz", outputRate);
+
+	// music and dialogue should never be cut off by effects
+	setCategory(audioChannel::categories::Effects,  1.f,  24);
+	setCategory(audioChannel::categories::Ambience, 1.f,  8);
+	setCategory(audioChannel::categories::Music,    10.f, 2);
+	setCategory(audioChannel::categories::Dialogue, 5.f,  4);
+
+	ctx.setAudioCallback(this, mixCallback);
+}
 
-	float div = 1.0 / 44100.0;
-	int16_t *s16strm = reinterpret_cast<int16_t*>(stream);
+void audioMixer::setCategory(unsigned category,
+                             float priority,
+                             unsigned maxVoices)
+{
+	std::lock_guard<std::mutex> lock(mtx);
 
-	for (int i = 0; i < len/2; i += 2) {
-		// TODO: interpolate over velocity
-		auto sample = mix->getSample(mix->currentCam);
-		s16strm[i]   = sample.first;
-		s16strm[i+1] = sample.second;
+	if (category >= categories.size()) {
+		categories.resize(category + 1);
 	}
+
+	categories[category] = {priority, maxVoices};
 }
 
-audioMixer::audioMixer(context& ctx) {
-	ctx.setAudioCallback(this, mixCallback);
+void audioMixer::assignVoices(camera::ptr cam) {
+	voices.clear();
+
+	for (auto& chan : mixing) {
+		if (chan->playState != audioChannel::state::Playing) {
+			continue;
+		}
+
+		unsigned c = chan->category;
+		float catPriority = (c < activeCategories.size())
+			? activeCategories[c].priority
+			: 1.f;
+
+		float audible = chan->audibility(cam);
+		voices.push_back({chan.get(), audible, audible*catPriority*chan->priority, false});
+	}
+
+	std::sort(voices.begin(), voices.end(),
+		[] (const voice& a, const voice& b) { return a.score > b.score; });
+
+	categoryVoices.assign(activeCategories.size(), 0);
+	unsigned real = 0;
+
+	for (auto& v : voices) {
+		unsigned c = v.chan->category;
+		bool known = c < activeCategories.size();
+
+		v.real = real < activeMaxVoices
+		         && v.audibility >= activeMinAudibility
+		         && (!known || categoryVoices[c] < activeCategories[c].maxVoices);
+
+		if (v.real) {
+			real++;
+			if (known) categoryVoices[c]++;
+		}
+	}
 }
 
 void audioMixer::setCamera(camera::ptr cam) {
+	std::lock_guard<std::mutex> lock(mtx);
 	currentCam = cam;
 }
 
-std::pair<int16_t, int16_t>
-audioMixer::getSample(camera::ptr cam) {
-	std::pair<int32_t, int32_t> accum;
-	std::lock_guard<std::mutex> lock(mtx);
+void audioMixer::mixBlock(int16_t *out, size_t frames) {
+	camera::ptr cam;
 
-	for (auto it = channels.begin(); it != channels.end();) {
-		auto& [id, chan] = *it;
-		auto sample = chan->getSample(cam);
+	{
+		// only place the audio thread takes the lock, channels are
+		// mixed from a copy of the list so add() doesn't have to wait
+		std::lock_guard<std::mutex> lock(mtx);
+
+		for (auto it = channels.begin(); it != channels.end();) {
+			if (it->second->playState == audioChannel::state::Ended) {
+				it = channels.erase(it);
+			} else {
+				it++;
+			}
+		}
 
-		accum.first  += sample.first;
-		accum.second += sample.second;
+		mixing.clear();
+		for (auto& [id, chan] : channels) {
+			mixing.push_back(chan);
+		}
 
-		if (chan->playState == audioChannel::state::Ended) {
-			channels.erase(it++);
+		cam = currentCam;
+		activeCategories    = categories;
+		activeMaxVoices     = maxVoices;
+		activeMinAudibility = minAudibility;
+	}
 
-		} else {
-			it++;
-		}
+	if (cam == nullptr) {
+		memset(out, 0, frames * 2 * sizeof(int16_t));
+		return;
 	}
 
-	// TODO: limiter in case of clipping
-	return {accum.first, accum.second};
+	for (size_t offset = 0; offset < frames; offset += AUDIO_BLOCK_SIZE) {
+		size_t n = min(frames - offset, AUDIO_BLOCK_SIZE);
+
+		std::fill(mixLeft,  mixLeft + n,  0.f);
+		std::fill(mixRight, mixRight + n, 0.f);
+
+		assignVoices(cam);
+
+		for (auto& v : voices) {
+			audioChannel *chan = v.chan;
+
+			if (!v.real && chan->virtualized) {
+				chan->skip(n);
+				continue;
+			}
+
+			chan->getBlock(chanLeft, chanRight, n, cam);
+
+			// voices becoming real fade in, voices being virtualized
+			// get one last block to fade out, so there's no clicking
+			float from = chan->virtualized? 0.f : chan->volume;
+			float to   = v.real? chan->volume : 0.f;
+			float step = (to - from) / n;
+			chan->virtualized = !v.real;
+
+			// plain loops over float arrays, these vectorize
+			for (size_t i = 0; i < n; i++) {
+				float gain = from + step*(i + 1);
+				mixLeft[i]  += gain*chanLeft[i];
+				mixRight[i] += gain*chanRight[i];
+			}
+		}
+
+		// limiter, gain drops to keep this block's peak under the
+		// ceiling and recovers slowly over the next blocks
+		float peak = 0;
+		for (size_t i = 0; i < n; i++) {
+			peak = max(peak, max(fabsf(mixLeft[i]), fabsf(mixRight[i])));
+		}
+
+		float ceiling = limiterCeiling * 32767.f;
+		float target  = (peak > ceiling)? ceiling / peak : 1.f;
+		float next    = (target < limiterGain)
+			? target
+			: limiterGain + (target - limiterGain)*LIMITER_RELEASE;
+		float step    = (next - limiterGain) / n;
+		int16_t *dest = out + offset*2;
+
+		for (size_t i = 0; i < n; i++) {
+			float gain = limiterGain + step*(i + 1);
+			// ramping down from the last gain can still overshoot a bit
+			dest[2*i]   = int16_t(std::clamp(mixLeft[i]  * gain, -32768.f, 32767.f));
+			dest[2*i+1] = int16_t(std::clamp(mixRight[i] * gain, -32768.f, 32767.f));
+		}
+
+		limiterGain = next;
+	}
 }
 
 size_t audioMixer::add(audioChannel::ptr channel) {
 	std::lock_guard<std::mutex> lock(mtx);
 
 	size_t ret = chanids++;
+	channel->outputRate = outputRate;
 	channels[ret] = channel;
 	return ret;
 }
 
 void audioMixer::remove(size_t id) {
-	auto it = channels.find(id); if (it != channels.end()) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = channels.find(id);
+
+	if (it != channels.end()) {
 		channels.erase(it);
 	}
 }
@@ -139,15 +340,18 @@ channelBuffers_ptr grendx::openAudio(std::string filename) {
 		auto ret = std::make_shared<channelBuffers>();
 
 		for (int c = 0; c < channels; c++) {
-			ret->push_back(std::make_shared<audioBuffer>());
-		}
+			auto buf = std::make_shared<audioBuffer>();
+			buf->resize(len);
+			buf->sampleRate = rate;
 
-		for (int i = 0; i < len; i++) {
-			for (int c = 0; c < channels; c++) {
-				(*ret)[c]->push_back(ibuf[channels*i+c]);
+			for (int i = 0; i < len; i++) {
+				(*buf)[i] = ibuf[channels*i + c];
 			}
+
+			ret->push_back(buf);
 		}
 
+		free(ibuf);
 		filecache[filename] = ret;
 		return ret;
 	}
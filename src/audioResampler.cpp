@@ -0,0 +1,32 @@
+#include <grend/audioResampler.hpp>
+
+using namespace grendx;
+
+void audioResampler::buildKernel(float cutoff) {
+	for (unsigned p = 0; p <= phases; p++) {
+		float frac = p / float(phases);
+		float sum = 0;
+
+		for (unsigned k = 0; k < taps; k++) {
+			// distance from the read position to this tap, in source frames
+			float x = (float(k) - halfTaps + 1) - frac;
+			float s = cutoff * x;
+			float sinc = (fabsf(s) < 1e-6f)? 1.f : sinf(M_PI*s) / (M_PI*s);
+
+			// blackman window over [-halfTaps, halfTaps]
+			float w = 0.5f + 0.5f*(x / halfTaps);
+			float window = (w <= 0.f || w >= 1.f)? 0.f
+				: 0.42f - 0.5f*cosf(2*M_PI*w) + 0.08f*cosf(4*M_PI*w);
+
+			kernel[p][k] = sinc * window;
+			sum += kernel[p][k];
+		}
+
+		// unity gain at DC for every phase
+		for (unsigned k = 0; k < taps; k++) {
+			kernel[p][k] /= sum;
+		}
+	}
+
+	kernelCutoff = cutoff;
+}
@@ -0,0 +1,204 @@
+#include <grend/audioMixer.hpp>
+#include <grend/utility.hpp>
+#include <stb/stb_vorbis.h>
+
+#include <algorithm>
+#include <chrono>
+
+using namespace grendx;
+
+// frames decoded at a time
+#define STREAM_CHUNK_FRAMES 4096
+// decoder output is [-1, 1], mixer works in 16 bit sample units,
+// same volume as stereoAudioChannel
+#define STREAM_GAIN (0.8f * 32767.f)
+
+streamingAudioChannel::streamingAudioChannel(std::string filename,
+                                             enum audioChannel::mode m)
+	: audioChannel(m)
+{
+	int err = 0;
+	stb_vorbis *vorbis = stb_vorbis_open_filename(filename.c_str(), &err, nullptr);
+
+	if (!vorbis) {
+		SDL_Log("%s: couldn't open audio stream (error %d)", filename.c_str(), err);
+		playState = state::Ended;
+		return;
+	}
+
+	stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+	channels   = info.channels;
+	sampleRate = info.sample_rate;
+	length     = stb_vorbis_stream_length_in_samples(vorbis);
+
+	SDL_Log("%s: streaming audio: %zu, %u, %u\n",
+	        filename.c_str(), length, channels, sampleRate);
+
+	stream = std::make_shared<decoderState>();
+	stream->vorbis   = vorbis;
+	stream->length   = length;
+	stream->channels = channels;
+	stream->loop     = loopMode == mode::Loop;
+	stream->ring.resize(ringSize * 2);
+
+	// the thread frees the state (and closes the file) once it's told to
+	// stop, nothing waits for it
+	std::thread(&streamingAudioChannel::decode, stream).detach();
+}
+
+streamingAudioChannel::~streamingAudioChannel() {
+	if (stream) {
+		stream->stop = true;
+		stream->wake.notify_one();
+	}
+}
+
+streamingAudioChannel::decoderState::~decoderState() {
+	if (vorbis) {
+		stb_vorbis_close(vorbis);
+	}
+}
+
+void streamingAudioChannel::decode(std::shared_ptr<decoderState> state) {
+	decoderState& s = *state;
+	std::vector<float> buf(STREAM_CHUNK_FRAMES * max(1u, s.channels));
+
+	while (!s.stop) {
+		int64_t target = s.seekTarget.exchange(-1);
+
+		if (target >= 0) {
+			stb_vorbis_seek(s.vorbis, min(uint64_t(target), uint64_t(s.length)));
+			s.seekBase     = target;
+			s.discardUntil = s.writePos.load();
+			s.finished     = false;
+		}
+
+		uint64_t w = s.writePos;
+		size_t used = w - s.readPos;
+
+		if (s.finished || s.channels == 0 || ringSize - used < STREAM_CHUNK_FRAMES) {
+			// nothing to do until the audio thread catches up, it doesn't
+			// signal (no locking there), so poll
+			std::unique_lock<std::mutex> lock(s.wakeMtx);
+			s.wake.wait_for(lock, std::chrono::milliseconds(10),
+				[&] () { return s.stop || s.seekTarget >= 0; });
+			continue;
+		}
+
+		int got = stb_vorbis_get_samples_float_interleaved(
+			s.vorbis, s.channels, buf.data(), buf.size());
+
+		if (got == 0) {
+			if (s.loop && s.length > 0) {
+				stb_vorbis_seek_start(s.vorbis);
+			} else {
+				s.finished = true;
+			}
+
+			continue;
+		}
+
+		for (int i = 0; i < got; i++) {
+			size_t idx = ((w + i) & (ringSize - 1)) * 2;
+			float  l   = buf[i*s.channels];
+
+			s.ring[idx]     = l;
+			s.ring[idx + 1] = (s.channels > 1)? buf[i*s.channels + 1] : l;
+		}
+
+		s.writePos = w + got;
+	}
+}
+
+void streamingAudioChannel::getBlock(float *left,
+                                     float *right,
+                                     size_t frames,
+                                     camera::ptr cam)
+{
+	if (!stream) {
+		std::fill(left,  left + frames,  0.f);
+		std::fill(right, right + frames, 0.f);
+		return;
+	}
+
+	decoderState& s = *stream;
+	s.loop = loopMode == mode::Loop;
+
+	// check before looking at writePos, so everything the decoder
+	// wrote is visible if it's done
+	bool done  = s.finished;
+	uint64_t d = s.discardUntil;
+	uint64_t w = s.writePos;
+
+	if (readFrame < d) {
+		readFrame = d;
+	}
+
+	// the resampler reads a few frames ahead, wait for those unless
+	// there's nothing more coming
+	double limit = done? double(w) : double(w) - resampler.lookahead();
+	float  rate  = pitch * sampleRate / float(outputRate);
+	double start = readFrame;
+
+	auto frame = [&] (ptrdiff_t i, unsigned c) {
+		// frames from before a seek, or not decoded yet
+		if (i < ptrdiff_t(d) || i >= ptrdiff_t(w)) {
+			return 0.f;
+		}
+
+		return s.ring[(size_t(i) & (ringSize - 1))*2 + c];
+	};
+
+	size_t n = resampler.resample(left, frames, readFrame, rate, rate, limit,
+		[&] (ptrdiff_t i) { return frame(i, 0); });
+	resampler.resample(right, n, start, rate, rate, limit,
+		[&] (ptrdiff_t i) { return frame(i, 1); });
+
+	for (size_t i = 0; i < n; i++) {
+		left[i]  *= STREAM_GAIN;
+		right[i] *= STREAM_GAIN;
+	}
+
+	// underruns play silence, the decoder will catch up
+	std::fill(left + n,  left + frames,  0.f);
+	std::fill(right + n, right + frames, 0.f);
+
+	// keep the frames the resampler still looks back at
+	uint64_t keep = max(d, uint64_t(readFrame) - min(uint64_t(readFrame), uint64_t(audioResampler::halfTaps)));
+	s.readPos = min(keep, w);
+	audioPosition = s.seekBase + (uint64_t(readFrame) - d);
+
+	if (length > 0) {
+		audioPosition %= length;
+	}
+
+	if (done && readFrame >= w) {
+		playState = state::Ended;
+	}
+}
+
+std::pair<int16_t, int16_t>
+streamingAudioChannel::getSample(camera::ptr cam) {
+	float left, right;
+	getBlock(&left, &right, 1, cam);
+	return {left, right};
+}
+
+void streamingAudioChannel::restart(void) {
+	audioChannel::restart();
+	seek(0);
+}
+
+void streamingAudioChannel::seek(size_t frame) {
+	if (stream) {
+		stream->seekTarget = frame;
+		stream->wake.notify_one();
+	}
+}
+
+streamingAudioChannel::ptr grendx::openAudioStream(std::string filename,
+                                                   enum audioChannel::mode m)
+{
+	auto ret = std::make_shared<streamingAudioChannel>(filename, m);
+	return ret->good()? ret : nullptr;
+}
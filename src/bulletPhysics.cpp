@@ -4,14 +4,44 @@
 #include <grend/physics.hpp>
 #include <grend/bulletPhysics.hpp>
 //#include "btBulletDynamicsCommon.h"
+#include "BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h"
+#include "BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h"
+#include "BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h"
+#include "BulletCollision/NarrowPhaseCollision/btPointCollector.h"
+#include "BulletCollision/CollisionShapes/btTriangleShape.h"
+#include "BulletCollision/CollisionShapes/btTriangleCallback.h"
+
+#include <chrono>
+#include <algorithm>
 
 using namespace grendx;
 
-// non-pure virtual destructors for rtti
-// TODO: move physics* objects to own source file
-physics::~physics() {};
+// most steps taken to catch up in one go, any more time than this is dropped
+#define MAX_STEPS 10
+// contacts kept for the game to pick up, per snapshot
+#define MAX_CONTACTS 8192
+
+static inline glm::vec3 toGlm(const btVector3& v) {
+	return glm::vec3(v.getX(), v.getY(), v.getZ());
+}
+
+static inline glm::quat toGlm(const btQuaternion& q) {
+	// glm quats are wxyz, btquaternion xyzw
+	return glm::quat(q.getW(), q.getX(), q.getY(), q.getZ());
+}
+
+static inline btVector3 toBullet(const glm::vec3& v) {
+	return btVector3(v.x, v.y, v.z);
+}
+
+static inline btTransform toBullet(const glm::vec3& pos, const glm::quat& rot) {
+	btTransform trans;
+	trans.setIdentity();
+	trans.setOrigin(btVector3(pos.x, pos.y, pos.z));
+	trans.setRotation(btQuaternion(rot.x, rot.y, rot.z, rot.w));
+	return trans;
+}
 
-physicsObject::~physicsObject() {};
 bulletObject::~bulletObject() {
 	this->removeSelf();
 }
@@ -26,9 +56,12 @@ bulletPhysics::bulletPhysics() {
 
 	world->setGravity(btVector3(0, -15, 0));
 	world->setDebugDrawer(&debugDrawer);
+
+	startThread();
 }
 
 bulletPhysics::~bulletPhysics() {
+	stopThread();
 	delete world;
 	delete solver;
 	delete pairCache;
@@ -51,78 +84,58 @@ void bulletObject::setTransform(const TRS& transform) {
 	// just in case
 	if (!body) return;
 
-	btTransform trans;
-
-	const auto& t = transform.position;
-	const auto& r = transform.rotation;
-	const auto& s = transform.scale;
+	lastTransform = transform;
 
-	trans.setOrigin(btVector3(t.x, t.y, t.z));
-	trans.setRotation(btQuaternion(r.x, r.y, r.z, r.w));
-
-	/*
-	if (body->getMotionState()) {
-		body->getMotionState()->setWorldTransform(trans);
-
-	} else {
-		body->setWorldTransform(trans);
-	}
-	*/
-	body->setWorldTransform(trans);
+	bulletPhysics::command cmd = {};
+	cmd.type = bulletPhysics::command::SetTransform;
+	cmd.slot = slot;
+	cmd.vec  = transform.position;
+	cmd.rot  = transform.rotation;
+	transformCommand = runtime->submit(cmd);
 }
 
 TRS bulletObject::getTransform(void) {
-	btTransform trans;
-
-	if (body && body->getMotionState()) {
-		body->getMotionState()->getWorldTransform(trans);
-
-	} else {
-		trans = body->getWorldTransform();
-	}
-
-	glm::vec3 position = glm::vec3(
-		float(trans.getOrigin().getX()),
-		float(trans.getOrigin().getY()),
-		float(trans.getOrigin().getZ())
-	);
-
-	btQuaternionFloatData bdata;
-	trans.getRotation().serializeFloat(bdata);
-	glm::quat rotation = glm::quat(
-		// glm quats are wxyz, btquaternion xyzw
-		bdata.m_floats[3], bdata.m_floats[0],
-		bdata.m_floats[1], bdata.m_floats[2]
-	);
-
-	return {
-		.position = position,
-		.rotation = rotation,
-	};
+	return runtime? runtime->interpolate(this) : lastTransform;
 }
 
 void bulletObject::setPosition(glm::vec3 pos) {
 }
 
 void bulletObject::setVelocity(glm::vec3 vel) {
-	body->activate(true);
-	body->setLinearVelocity(btVector3(vel.x, vel.y, vel.z));
+	if (!body) return;
+
+	bulletPhysics::command cmd = {};
+	cmd.type = bulletPhysics::command::SetVelocity;
+	cmd.slot = slot;
+	cmd.vec  = vel;
+	runtime->submit(cmd);
 }
 
 void bulletObject::setAcceleration(glm::vec3 accel) {
-	body->activate(true);
-	body->applyCentralForce(btVector3(accel.x, accel.y, accel.z));
+	if (!body) return;
+
+	bulletPhysics::command cmd = {};
+	cmd.type = bulletPhysics::command::ApplyForce;
+	cmd.slot = slot;
+	cmd.vec  = accel;
+	runtime->submit(cmd);
 }
 
 void bulletObject::setAngularFactor(float amount) {
-	body->setAngularFactor(btScalar(amount));
+	angularFactor = amount;
+	if (!body) return;
+
+	bulletPhysics::command cmd = {};
+	cmd.type   = bulletPhysics::command::SetAngularFactor;
+	cmd.slot   = slot;
+	cmd.amount = amount;
+	runtime->submit(cmd);
 	// TODO: implement impObject::setAngularFactor();
 }
 
 glm::vec3 bulletObject::getVelocity(void) {
-	// TODO
-	auto v = body->getLinearVelocity();
-	return glm::vec3(v.x(), v.y(), v.z());
+	auto state = runtime? runtime->currentState(this) : nullptr;
+	return state? state->velocity : glm::vec3(0);
 }
 
 glm::vec3 bulletObject::getAcceleration(void) {
@@ -131,11 +144,20 @@ glm::vec3 bulletObject::getAcceleration(void) {
 }
 
 float bulletObject::getAngularFactor(void) {
-	return body->getAngularFactor().x();
+	return angularFactor;
 }
 
 void bulletPhysics::drawDebug(glm::mat4 cam) {
-	if (debugDrawer.getDebugMode()) {
+	if (!debugDrawer.getDebugMode()) {
+		return;
+	}
+
+	if (running) {
+		// lines are drawn by the simulation thread after each step
+		std::lock_guard<std::mutex> lock(debugMtx);
+		debugDrawer.flushLines(cam);
+
+	} else {
 		world->debugDrawWorld();
 		debugDrawer.flushLines(cam);
 	}
@@ -179,13 +201,10 @@ physicsObject::ptr
 bulletPhysics::addSphere(void *data, glm::vec3 pos,
                          float mass, float r)
 {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	bulletObject::ptr ret = std::make_shared<bulletObject>();
-	ret->runtime = this;
 	ret->mass = mass;
 	ret->data = data;
-	ret->shape = new btSphereShape(btScalar(r));
+	ret->shape.reset(new btSphereShape(btScalar(r)));
 
 	bool isDynamic = mass != 0.f;
 	btVector3 localInertia(0, 1, 0);
@@ -199,14 +218,9 @@ bulletPhysics::addSphere(void *data, glm::vec3 pos,
 	}
 
 	ret->motionState = new btDefaultMotionState(trans);
-	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape, localInertia);
+	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape.get(), localInertia);
 	ret->body->setLinearFactor(btVector3(1, 1, 1));
-	ret->body->setUserPointer(ret.get());
-	world->addRigidBody(ret->body);
-
-	auto p = std::dynamic_pointer_cast<physicsObject>(ret);
-	objects.insert({ret.get(), p});
-	return p;
+	return addBody(ret, trans);
 }
 
 physicsObject::ptr
@@ -215,13 +229,10 @@ bulletPhysics::addBox(void *data,
                       float mass,
                       AABBExtent& box)
 {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	bulletObject::ptr ret = std::make_shared<bulletObject>();
-	ret->runtime = this;
 	ret->mass = mass;
 	ret->data = data;
-	ret->shape = new btBoxShape(btVector3(box.extent.x, box.extent.y, box.extent.z));
+	ret->shape.reset(new btBoxShape(btVector3(box.extent.x, box.extent.y, box.extent.z)));
 
 	bool isDynamic = mass != 0.f;
 	btVector3 localInertia(0, 0, 0);
@@ -236,16 +247,10 @@ bulletPhysics::addBox(void *data,
 	}
 
 	ret->motionState = new btDefaultMotionState(trans);
-	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape, localInertia);
+	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape.get(), localInertia);
 	ret->body->setLinearFactor(btVector3(1, 1, 1));
 	ret->body->setAngularFactor(btScalar(1));
-	ret->body->setUserPointer(ret.get());
-	world->addRigidBody(ret->body);
-
-	auto p = std::dynamic_pointer_cast<physicsObject>(ret);
-	//obj->physObj = p;
-	objects.insert({ret.get(), p});
-	return p;
+	return addBody(ret, trans);
 }
 
 physicsObject::ptr
@@ -254,13 +259,10 @@ bulletPhysics::addCylinder(void *data,
                            float mass,
                            AABBExtent& box)
 {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	bulletObject::ptr ret = std::make_shared<bulletObject>();
-	ret->runtime = this;
 	ret->mass = mass;
 	ret->data = data;
-	ret->shape = new btCylinderShape(btVector3(box.extent.x, box.extent.y, box.extent.z));
+	ret->shape.reset(new btCylinderShape(btVector3(box.extent.x, box.extent.y, box.extent.z)));
 
 	bool isDynamic = mass != 0.f;
 	btVector3 localInertia(0, 0, 0);
@@ -275,16 +277,10 @@ bulletPhysics::addCylinder(void *data,
 	}
 
 	ret->motionState = new btDefaultMotionState(trans);
-	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape, localInertia);
+	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape.get(), localInertia);
 	ret->body->setLinearFactor(btVector3(1, 1, 1));
 	ret->body->setAngularFactor(btScalar(1));
-	ret->body->setUserPointer(ret.get());
-	world->addRigidBody(ret->body);
-
-	auto p = std::dynamic_pointer_cast<physicsObject>(ret);
-	//obj->physObj = p;
-	objects.insert({ret.get(), p});
-	return p;
+	return addBody(ret, trans);
 }
 
 physicsObject::ptr
@@ -294,13 +290,10 @@ bulletPhysics::addCapsule(void *data,
                           float radius,
                           float height)
 {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	bulletObject::ptr ret = std::make_shared<bulletObject>();
-	ret->runtime = this;
 	ret->mass = mass;
 	ret->data = data;
-	ret->shape = new btCapsuleShape(btScalar(radius), btScalar(height));
+	ret->shape.reset(new btCapsuleShape(btScalar(radius), btScalar(height)));
 
 	bool isDynamic = mass != 0.f;
 	btVector3 localInertia(0, 0, 0);
@@ -315,16 +308,10 @@ bulletPhysics::addCapsule(void *data,
 	}
 
 	ret->motionState = new btDefaultMotionState(trans);
-	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape, localInertia);
+	ret->body = new btRigidBody(btScalar(mass), ret->motionState, ret->shape.get(), localInertia);
 	ret->body->setLinearFactor(btVector3(1, 1, 1));
 	ret->body->setAngularFactor(btScalar(1));
-	ret->body->setUserPointer(ret.get());
-	world->addRigidBody(ret->body);
-
-	auto p = std::dynamic_pointer_cast<physicsObject>(ret);
-	//obj->physObj = p;
-	objects.insert({ret.get(), p});
-	return p;
+	return addBody(ret, trans);
 }
 
 physicsObject::ptr
@@ -333,30 +320,22 @@ bulletPhysics::addStaticMesh(void *data,
                              sceneModel::ptr model,
                              sceneMesh::ptr mesh)
 {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	if (mesh->faces.size() / 3 == 0) {
 		std::cerr << "WARNING: bulletPhysics::addStaticMesh(): "
 			<< "can't add mesh with no elements" << std::endl;
 		return nullptr;
 	}
 
-	btTriangleIndexVertexArray* indexArray =
-		new btTriangleIndexVertexArray(mesh->faces.size() / 3,
-		                               (int*)mesh->faces.data(),
-		                               sizeof(GLuint[3]),
-		                               model->vertices.size(),
-		                               (GLfloat*)model->vertices.data(),
-									   sizeof(sceneModel::vertex));
+	// shared with every other instance of the mesh
+	auto shape = shapeCache.getMesh(model, mesh, transform.scale);
+	if (!shape) {
+		return nullptr;
+	}
 
 	bulletObject::ptr ret = std::make_shared<bulletObject>();
-	ret->runtime = this;
 	ret->mass = 0.f;
 	ret->data = data;
-	ret->shape = new btBvhTriangleMeshShape(indexArray, true /* useQuantizedAabbCompression */ );
-
-	btVector3 scale(transform.scale.x, transform.scale.y, transform.scale.z);
-	ret->shape->setLocalScaling(scale);
+	ret->shape = shape;
 
 	btVector3 localInertia(0, 0, 0);
 	btTransform trans;
@@ -368,14 +347,55 @@ bulletPhysics::addStaticMesh(void *data,
 	trans.setRotation(btQuaternion(rot.x, rot.y, rot.z, rot.w));
 
 	ret->motionState = new btDefaultMotionState(trans);
-	ret->body = new btRigidBody(btScalar(0.f), ret->motionState, ret->shape, localInertia);
+	ret->body = new btRigidBody(btScalar(0.f), ret->motionState, ret->shape.get(), localInertia);
 	ret->body->setLinearFactor(btVector3(1, 1, 1));
 	ret->body->setAngularFactor(btScalar(1));
-	ret->body->setUserPointer(ret.get());
-	world->addRigidBody(ret->body);
+	return addBody(ret, trans);
+}
+
+uint32_t bulletPhysics::allocSlot(bulletObject *obj) {
+	uint32_t slot;
+
+	if (!freeSlots.empty()) {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+
+	} else {
+		slot = objects.size();
+		objects.emplace_back();
+	}
 
-	auto p = std::dynamic_pointer_cast<physicsObject>(ret);
-	objects.insert({ret.get(), p});
+	obj->slot = slot;
+	obj->id   = nextID++;
+	return slot;
+}
+
+physicsObject::ptr bulletPhysics::addBody(bulletObject::ptr obj,
+                                          const btTransform& trans)
+{
+	uint32_t slot = allocSlot(obj.get());
+
+	obj->runtime = this;
+	obj->lastTransform = {
+		.position = toGlm(trans.getOrigin()),
+		.rotation = toGlm(trans.getRotation()),
+	};
+	// queries hand out the user data, they can't safely touch
+	// the object itself from other threads
+	obj->body->setUserPointer(obj->data);
+	obj->body->setUserIndex(slot);
+
+	command cmd = {};
+	cmd.type = command::Add;
+	cmd.slot = slot;
+	cmd.id   = obj->id;
+	cmd.body = obj->body;
+	// transform is new as far as getTransform() is concerned
+	obj->transformCommand = submit(cmd);
+
+	auto p = std::dynamic_pointer_cast<physicsObject>(obj);
+	objects[slot] = {p, obj->data, obj->id};
+	liveObjects++;
 	return p;
 }
 
@@ -388,8 +408,6 @@ bulletPhysics::addModelMeshBoxes(sceneModel::ptr mod) {
 }
 
 void bulletPhysics::remove(physicsObject::ptr obj) {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
 	bulletObject::ptr bobj = std::dynamic_pointer_cast<bulletObject>(obj);
 	std::cerr << "remove(): got here, removing an object" << std::endl;
 
@@ -400,123 +418,649 @@ void bulletPhysics::remove(physicsObject::ptr obj) {
 }
 
 void bulletPhysics::remove(bulletObject *ptr) {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-
-	auto it = objects.find(ptr);
-
-	// XXX: linear search here is terrible, need more efficient solution
-	if (it != objects.end()) {
-		world->removeRigidBody(ptr->body);
-		objects.erase(it);
+	if (!ptr->body) {
+		// already removed (removeSelf() and then the destructor)
+		return;
 	}
+
+	// body is freed by the simulation once it's out of the world
+	command cmd = {};
+	cmd.type = command::Remove;
+	cmd.slot = ptr->slot;
+	cmd.body = ptr->body;
+	cmd.motionState = ptr->motionState;
+	cmd.shape = std::move(ptr->shape);
+	submit(cmd);
+
+	ptr->body = nullptr;
+	ptr->motionState = nullptr;
+	objects[ptr->slot] = {};
+	freeSlots.push_back(ptr->slot);
+	liveObjects--;
 }
 
 void bulletPhysics::clear(void) {
 }
 
 size_t bulletPhysics::numObjects(void) {
-	return objects.size();
+	return liveObjects;
 }
 
-void bulletPhysics::filterCollisions(void) {
-	int manifolds = world->getDispatcher()->getNumManifolds();
+uint64_t bulletPhysics::submit(command cmd) {
+	cmd.seq = ++commandSeq;
 
-	for (int i = 0; i < manifolds; i++) {
-		btPersistentManifold *contact =
-			world->getDispatcher()->getManifoldByIndexInternal(i);
-		const btCollisionObject *a = contact->getBody0();
-		const btCollisionObject *b = contact->getBody1();
+	while (!commands.push(cmd)) {
+		// full, wait for the simulation to make room, or do it here
+		if (running) {
+			wake.notify_one();
+			std::this_thread::yield();
+		} else {
+			applyCommands();
+		}
+	}
+
+	return cmd.seq;
+}
+
+void bulletPhysics::applyCommands(void) {
+	command cmd;
+
+	while (commands.pop(cmd)) {
+		btRigidBody *body = (cmd.slot < simBodies.size())
+			? simBodies[cmd.slot]
+			: nullptr;
+
+		switch (cmd.type) {
+			case command::Add:
+				if (cmd.slot >= simBodies.size()) {
+					simBodies.resize(cmd.slot + 1, nullptr);
+					simIDs.resize(cmd.slot + 1, 0);
+				}
+
+				simBodies[cmd.slot] = cmd.body;
+				simIDs[cmd.slot]    = cmd.id;
+				world->addRigidBody(cmd.body);
+				break;
+
+			case command::Remove:
+				world->removeRigidBody(cmd.body);
+				simBodies[cmd.slot] = nullptr;
+				simIDs[cmd.slot]    = 0;
+				delete cmd.body;
+				delete cmd.motionState;
+				cmd.shape.reset();
+				break;
+
+			case command::SetTransform:
+				if (body) body->setWorldTransform(toBullet(cmd.vec, cmd.rot));
+				break;
+
+			case command::SetVelocity:
+				if (body) {
+					body->activate(true);
+					body->setLinearVelocity(btVector3(cmd.vec.x, cmd.vec.y, cmd.vec.z));
+				}
+				break;
+
+			case command::ApplyForce:
+				if (body) {
+					body->activate(true);
+					body->applyCentralForce(btVector3(cmd.vec.x, cmd.vec.y, cmd.vec.z));
+				}
+				break;
+
+			case command::SetAngularFactor:
+				if (body) body->setAngularFactor(btScalar(cmd.amount));
+				break;
+		}
+
+		simCommandsApplied = cmd.seq;
+	}
+}
+
+void bulletPhysics::tick(void) {
+	float dt = 1.f / stepRate;
+	std::unique_lock<std::shared_mutex> lock(worldMtx);
+
+	applyCommands();
+	// fixed step, no substeps or interpolation on bullet's end
+	world->stepSimulation(dt, 0);
+	simTime += dt;
+	publish();
+
+	if (running && debugDrawer.getDebugMode()) {
+		std::lock_guard<std::mutex> lock(debugMtx);
+		debugDrawer.clearLines();
+		world->debugDrawWorld();
+	}
+}
+
+void bulletPhysics::publish(void) {
+	snapshot& snap = snapshots[back];
+	size_t numBodies = simBodies.size();
+
+	snap.bodies.resize(numBodies);
+
+	for (size_t i = 0; i < numBodies; i++) {
+		bodyState&   state = snap.bodies[i];
+		btRigidBody *body  = simBodies[i];
+
+		if (!body) {
+			state.id = 0;
+			continue;
+		}
+
+		const btTransform& trans = body->getWorldTransform();
+		glm::vec3 position = toGlm(trans.getOrigin());
+		glm::quat rotation = toGlm(trans.getRotation());
+
+		// previous step's state, from the sim side copy since this
+		// buffer was last filled a few steps ago
+		if (i < lastStates.size() && lastStates[i].id == simIDs[i]) {
+			state.lastPosition = lastStates[i].position;
+			state.lastRotation = lastStates[i].rotation;
+		} else {
+			state.lastPosition = position;
+			state.lastRotation = rotation;
+		}
+
+		state.id       = simIDs[i];
+		state.position = position;
+		state.rotation = rotation;
+		state.velocity = toGlm(body->getLinearVelocity());
+	}
+
+	lastStates.assign(snap.bodies.begin(), snap.bodies.end());
 
-		bulletObject *aptr = static_cast<bulletObject*>(a->getUserPointer());
-		bulletObject *bptr = static_cast<bulletObject*>(b->getUserPointer());
+	// contacts the game hasn't picked up yet stay in the buffer
+	if (!carryContacts) {
+		snap.contacts.clear();
+	}
+
+	int manifolds = dispatcher->getNumManifolds();
+	for (int i = 0; i < manifolds; i++) {
+		btPersistentManifold *contact = dispatcher->getManifoldByIndexInternal(i);
+		int a = contact->getBody0()->getUserIndex();
+		int b = contact->getBody1()->getUserIndex();
 
-		if (!objects.count(aptr) || !objects.count(bptr)) {
-			// one of the objects isn't valid, this shouldn't happen
+		if (a < 0 || b < 0 || size_t(a) >= numBodies || size_t(b) >= numBodies) {
+			// not one of ours
 			continue;
 		}
 
 		int numContacts = contact->getNumContacts();
-		for (int k = 0; k < numContacts; k++) {
+		for (int k = 0; k < numContacts && snap.contacts.size() < MAX_CONTACTS; k++) {
 			btManifoldPoint& pt = contact->getContactPoint(k);
-			float depth = pt.getDistance();
 
-			if (depth < 0.f) {
-				physicsObject::weakptr wphysA = objects[aptr];
-				physicsObject::weakptr wphysB = objects[bptr];
+			if (pt.getDistance() < 0.f) {
+				snap.contacts.push_back({
+					.slotA     = uint32_t(a),
+					.slotB     = uint32_t(b),
+					.idA       = simIDs[a],
+					.idB       = simIDs[b],
+					.positionA = toGlm(pt.getPositionWorldOnA()),
+					.positionB = toGlm(pt.getPositionWorldOnB()),
+					.normalB   = toGlm(pt.m_normalWorldOnB),
+					.depth     = pt.getDistance(),
+				});
+			}
+		}
+	}
 
-				physicsObject::ptr physA = wphysA.lock();
-				physicsObject::ptr physB = wphysB.lock();
+	snap.time = simTime;
+	snap.commandsApplied = simCommandsApplied;
 
-				if (!physA || !physB) {
-					// pointer to expired object, which is somehow still in the
-					// world, shouldn't reach here but have to handle this anyway
-					continue;
-				}
+	unsigned prev = middle.exchange(back | snapshotFresh);
+	carryContacts = prev & snapshotFresh;
+	back = prev & ~snapshotFresh;
+}
 
-				const btVector3& ptA = pt.getPositionWorldOnA();
-				const btVector3& ptB = pt.getPositionWorldOnB();
-				const btVector3& normalB =  pt.m_normalWorldOnB;
-				const btVector3& normalA = -pt.m_normalWorldOnB;
-
-				if (physA->collisionQueue) {
-					collision colA = {
-						.a = physA,
-						.b = physB,
-						.adata = aptr->data,
-						.bdata = bptr->data,
-						.position = glm::vec3(ptA.getX(), ptA.getY(), ptA.getZ()),
-						.normal = glm::vec3(normalA.getX(), normalA.getY(), normalA.getZ()),
-						.depth = depth,
-					};
-
-					physA->collisionQueue->push_back(colA);
-				}
+void bulletPhysics::simulationThread(void) {
+	while (running) {
+		float dt = 1.f / stepRate;
+		double requested = requestedTime;
 
-				if (physB->collisionQueue) {
-					collision colB = {
-						.a = physB,
-						.b = physA,
-						.adata = bptr->data,
-						.bdata = aptr->data,
-						.position = glm::vec3(ptB.getX(), ptB.getY(), ptB.getZ()),
-						.normal = glm::vec3(normalB.getX(), normalB.getY(), normalB.getZ()),
-						.depth = depth,
-					};
-
-					physB->collisionQueue->push_back(colB);
-				}
-			}
+		if (requested - simTime > MAX_STEPS*dt) {
+			simTime = requested - MAX_STEPS*dt;
+		}
+
+		if (simTime + dt <= requested) {
+			tick();
+			continue;
+		}
+
+		// keep the queue drained while paused
+		{
+			std::unique_lock<std::shared_mutex> lock(worldMtx);
+			applyCommands();
 		}
+
+		std::unique_lock<std::mutex> lock(wakeMtx);
+		wake.wait_for(lock, std::chrono::milliseconds(2));
 	}
 }
 
-void bulletPhysics::stepSimulation(float delta) {
-	std::lock_guard<std::mutex> lock(bulletMutex);
-	world->stepSimulation(delta, 10);
+void bulletPhysics::startThread(void) {
+#ifdef __EMSCRIPTEN__
+	SDL_Log("bulletPhysics: no threads, simulating in stepSimulation()");
+#else
+	if (!running) {
+		running = true;
+		simThread = std::thread(&bulletPhysics::simulationThread, this);
+	}
+#endif
+}
+
+void bulletPhysics::stopThread(void) {
+	if (running) {
+		running = false;
+		wake.notify_one();
+		simThread.join();
+	}
+}
+
+void bulletPhysics::acquireSnapshot(void) {
+	if (middle.load() & snapshotFresh) {
+		front = middle.exchange(front) & ~snapshotFresh;
+		contactsPending = true;
+	}
+}
+
+const bulletPhysics::bodyState *
+bulletPhysics::currentState(const bulletObject *obj) {
+	const snapshot& snap = snapshots[front];
+
+	if (obj->slot < snap.bodies.size() && snap.bodies[obj->slot].id == obj->id) {
+		return &snap.bodies[obj->slot];
+	}
+
+	return nullptr;
+}
+
+TRS bulletPhysics::interpolate(const bulletObject *obj) {
+	const bodyState *state = currentState(obj);
+
+	if (!state || snapshots[front].commandsApplied < obj->transformCommand) {
+		// not simulated yet, or moved since
+		return obj->lastTransform;
+	}
+
+	return {
+		.position = glm::mix(state->lastPosition, state->position, alpha),
+		.rotation = glm::slerp(state->lastRotation, state->rotation, alpha),
+	};
+}
 
-	for (auto& [rawptr, wphysptr] : objects) {
-		physicsObject::ptr physptr = wphysptr.lock();
+void bulletPhysics::filterCollisions(void) {
+	contacts.clear();
+
+	if (!contactsPending) {
+		// nothing new simulated, pairs stay as they were
+		return;
+	}
+
+	contactsPending = false;
+	pairs.clear();
 
-		if (!physptr) {
+	for (auto& c : snapshots[front].contacts) {
+		if (c.slotA >= objects.size() || c.slotB >= objects.size()
+		    || objects[c.slotA].id != c.idA || objects[c.slotB].id != c.idB)
+		{
+			// removed since the step
 			continue;
 		}
 
-		bulletObject::ptr ptr = std::dynamic_pointer_cast<bulletObject>(physptr);
-		btTransform trans;
+		contactPair p = {
+			.key       = (uint64_t(c.idA) << 32) | c.idB,
+			.slotA     = c.slotA,
+			.slotB     = c.slotB,
+			.positionA = c.positionA,
+			.positionB = c.positionB,
+			.normalB   = c.normalB,
+			.depth     = c.depth,
+		};
+
+		if (c.idA > c.idB) {
+			p.key = (uint64_t(c.idB) << 32) | c.idA;
+			std::swap(p.slotA, p.slotB);
+			std::swap(p.positionA, p.positionB);
+			p.normalB = -p.normalB;
+		}
+
+		pairs.push_back(p);
+	}
+
+	std::sort(pairs.begin(), pairs.end(),
+		[] (const contactPair& a, const contactPair& b) {
+			return a.key < b.key;
+		});
+
+	// one per pair, keeping the deepest point (depth is negative)
+	size_t n = 0;
+	for (size_t i = 0; i < pairs.size(); i++) {
+		if (n > 0 && pairs[n - 1].key == pairs[i].key) {
+			if (pairs[i].depth < pairs[n - 1].depth) {
+				pairs[n - 1] = pairs[i];
+			}
+
+		} else {
+			pairs[n++] = pairs[i];
+		}
+	}
+
+	pairs.resize(n);
+
+	auto emit = [&] (uint8_t type, const contactPair& p) {
+		uint32_t idA = p.key >> 32;
+		uint32_t idB = p.key & 0xffffffff;
+		// objects removed since they stopped touching don't have
+		// any (valid) data left
+		void *dataA = (objects[p.slotA].id == idA)? objects[p.slotA].data : nullptr;
+		void *dataB = (objects[p.slotB].id == idB)? objects[p.slotB].data : nullptr;
+
+		contacts.push(type, idA, idB, dataA, dataB,
+		              p.positionA, p.positionB, p.normalB, p.depth);
+	};
+
+	// both sorted, walk them together
+	size_t i = 0, k = 0;
+	while (i < pairs.size() || k < lastPairs.size()) {
+		if (k == lastPairs.size()
+		    || (i < pairs.size() && pairs[i].key < lastPairs[k].key))
+		{
+			emit(collision::Begin, pairs[i++]);
 
-		if (ptr && ptr->body && ptr->body->getMotionState()) {
-			ptr->body->getMotionState()->getWorldTransform(trans);
+		} else if (i == pairs.size() || lastPairs[k].key < pairs[i].key) {
+			emit(collision::End, lastPairs[k++]);
 
 		} else {
-			trans = ptr->body->getWorldTransform();
+			emit(collision::Persist, pairs[i++]);
+			k++;
 		}
+	}
 
-		if (ptr->mass != 0) {
-			if (auto ref = ptr->obj.lock()) {
-				//ref->transform = ptr->getTransform();
-				ref->setTransform(ptr->getTransform());
-			}
+	std::swap(pairs, lastPairs);
+}
+
+void bulletPhysics::stepSimulation(float delta) {
+	float dt = 1.f / stepRate;
+	double requested = requestedTime + delta;
+	requestedTime = requested;
+
+	if (running) {
+		wake.notify_one();
+
+	} else {
+		// same fixed steps the thread would take
+		if (requested - simTime > MAX_STEPS*dt) {
+			simTime = requested - MAX_STEPS*dt;
+		}
+
+		while (simTime + dt <= requested) {
+			tick();
+		}
+	}
+
+	acquireSnapshot();
+
+	// rendering a step behind the simulation, between the last two steps
+	double t = (requested - snapshots[front].time) / dt;
+	alpha = (t < 0)? 0.f : (t > 1)? 1.f : float(t);
+}
+// broadphase objects whose AABBs are hit, btDbvt's traversals keep their
+// own stacks, unlike btDbvtBroadphase::rayTest(), so queries can run in
+// parallel
+struct candidateCollector : public btDbvt::ICollide {
+	std::vector<const btCollisionObject*>& candidates;
+
+	candidateCollector(std::vector<const btCollisionObject*>& c)
+		: candidates(c) { candidates.clear(); }
+
+	void Process(const btDbvtNode *leaf) {
+		auto proxy = static_cast<btBroadphaseProxy*>(leaf->data);
+		candidates.push_back(static_cast<const btCollisionObject*>(proxy->m_clientObject));
+	}
+};
+
+static thread_local std::vector<const btCollisionObject*> candidates;
+
+static void collectRay(btBroadphaseInterface *pairCache,
+                       const btVector3& from,
+                       const btVector3& to)
+{
+	auto bp = static_cast<btDbvtBroadphase*>(pairCache);
+	candidateCollector collector(candidates);
+
+	// dynamic and static trees
+	for (unsigned i = 0; i < 2; i++) {
+		if (bp->m_sets[i].m_root) {
+			btDbvt::rayTest(bp->m_sets[i].m_root, from, to, collector);
+		}
+	}
+}
+
+static void collectAABB(btBroadphaseInterface *pairCache,
+                        const btVector3& min,
+                        const btVector3& max)
+{
+	auto bp = static_cast<btDbvtBroadphase*>(pairCache);
+	candidateCollector collector(candidates);
+	btDbvtVolume volume = btDbvtVolume::FromMM(min, max);
+
+	for (unsigned i = 0; i < 2; i++) {
+		if (bp->m_sets[i].m_root) {
+			bp->m_sets[i].collideTV(bp->m_sets[i].m_root, volume, collector);
 		}
 	}
 }
+
+static bool convexOverlap(const btConvexShape *a, const btTransform& ta,
+                          const btConvexShape *b, const btTransform& tb)
+{
+	btVoronoiSimplexSolver simplex;
+	btGjkEpaPenetrationDepthSolver epa;
+	btGjkPairDetector gjk(a, b, &simplex, &epa);
+	btGjkPairDetector::ClosestPointInput input;
+	btPointCollector output;
+
+	input.m_transformA = ta;
+	input.m_transformB = tb;
+	gjk.getClosestPoints(input, output, nullptr);
+
+	return output.m_hasResult && output.m_distance <= 0;
+}
+
+static bool overlaps(const btConvexShape *shape,
+                     const btTransform& trans,
+                     const btCollisionObject *obj)
+{
+	const btCollisionShape *other = obj->getCollisionShape();
+	const btTransform& otherTrans = obj->getWorldTransform();
+
+	if (other->isConvex()) {
+		return convexOverlap(shape, trans,
+		                     static_cast<const btConvexShape*>(other), otherTrans);
+	}
+
+	if (other->isConcave()) {
+		// triangle meshes, only the triangles around the query shape
+		struct triangleOverlap : public btTriangleCallback {
+			const btConvexShape *shape;
+			btTransform trans;
+			btTransform otherTrans;
+			bool hit = false;
+
+			virtual void processTriangle(btVector3 *tri, int part, int index) {
+				if (!hit) {
+					btTriangleShape triangle(tri[0], tri[1], tri[2]);
+					hit = convexOverlap(shape, trans, &triangle, otherTrans);
+				}
+			}
+		} callback;
+
+		callback.shape = shape;
+		callback.trans = trans;
+		callback.otherTrans = otherTrans;
+
+		btVector3 min, max;
+		shape->getAabb(otherTrans.inverse() * trans, min, max);
+		static_cast<const btConcaveShape*>(other)->processAllTriangles(&callback, min, max);
+		return callback.hit;
+	}
+
+	// TODO: compound shapes, nothing makes them yet
+	return false;
+}
+
+void bulletPhysics::raycast(const std::vector<physicsRay>& rays,
+                            std::vector<physicsHit>& hits,
+                            jobQueue *jobs)
+{
+	std::shared_lock<std::shared_mutex> lock(worldMtx);
+
+	runQueries(rays.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsRay& ray = rays[i];
+			btVector3 from = toBullet(ray.from);
+			btVector3 to   = toBullet(ray.to);
+			btTransform fromTrans(btQuaternion::getIdentity(), from);
+			btTransform toTrans(btQuaternion::getIdentity(), to);
+			btCollisionWorld::ClosestRayResultCallback result(from, to);
+
+			collectRay(pairCache, from, to);
+
+			for (auto obj : candidates) {
+				if (ray.ignore && obj->getUserPointer() == ray.ignore) {
+					continue;
+				}
+
+				btCollisionWorld::rayTestSingle(fromTrans, toTrans,
+					const_cast<btCollisionObject*>(obj),
+					obj->getCollisionShape(), obj->getWorldTransform(), result);
+			}
+
+			if (result.hasHit()) {
+				out.push_back({
+					.query    = uint32_t(i),
+					.data     = result.m_collisionObject->getUserPointer(),
+					.position = toGlm(result.m_hitPointWorld),
+					.normal   = toGlm(result.m_hitNormalWorld),
+					.fraction = float(result.m_closestHitFraction),
+				});
+			}
+		});
+}
+
+void bulletPhysics::sweepSpheres(const std::vector<physicsSweep>& sweeps,
+                                 std::vector<physicsHit>& hits,
+                                 jobQueue *jobs)
+{
+	std::shared_lock<std::shared_mutex> lock(worldMtx);
+
+	runQueries(sweeps.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsSweep& sweep = sweeps[i];
+			btVector3 from = toBullet(sweep.from);
+			btVector3 to   = toBullet(sweep.to);
+			btVector3 r(sweep.radius, sweep.radius, sweep.radius);
+			btTransform fromTrans(btQuaternion::getIdentity(), from);
+			btTransform toTrans(btQuaternion::getIdentity(), to);
+			btSphereShape sphere(sweep.radius);
+			btCollisionWorld::ClosestConvexResultCallback result(from, to);
+
+			btVector3 min = from, max = from;
+			min.setMin(to);
+			max.setMax(to);
+			collectAABB(pairCache, min - r, max + r);
+
+			for (auto obj : candidates) {
+				if (sweep.ignore && obj->getUserPointer() == sweep.ignore) {
+					continue;
+				}
+
+				btCollisionWorld::objectQuerySingle(&sphere, fromTrans, toTrans,
+					const_cast<btCollisionObject*>(obj),
+					obj->getCollisionShape(), obj->getWorldTransform(),
+					result, 0.f);
+			}
+
+			if (result.hasHit()) {
+				out.push_back({
+					.query    = uint32_t(i),
+					.data     = result.m_hitCollisionObject->getUserPointer(),
+					.position = toGlm(result.m_hitPointWorld),
+					.normal   = toGlm(result.m_hitNormalWorld),
+					.fraction = float(result.m_closestHitFraction),
+				});
+			}
+		});
+}
+
+void bulletPhysics::overlapSpheres(const std::vector<physicsSphere>& spheres,
+                                   std::vector<physicsHit>& hits,
+                                   jobQueue *jobs)
+{
+	std::shared_lock<std::shared_mutex> lock(worldMtx);
+
+	runQueries(spheres.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsSphere& query = spheres[i];
+			btVector3 pos = toBullet(query.position);
+			btVector3 r(query.radius, query.radius, query.radius);
+			btTransform trans(btQuaternion::getIdentity(), pos);
+			btSphereShape sphere(query.radius);
+
+			collectAABB(pairCache, pos - r, pos + r);
+
+			for (auto obj : candidates) {
+				if (query.ignore && obj->getUserPointer() == query.ignore) {
+					continue;
+				}
+
+				if (overlaps(&sphere, trans, obj)) {
+					out.push_back({
+						.query    = uint32_t(i),
+						.data     = obj->getUserPointer(),
+						.position = toGlm(obj->getWorldTransform().getOrigin()),
+						.normal   = glm::vec3(0),
+						.fraction = 0.f,
+					});
+				}
+			}
+		});
+}
+
+void bulletPhysics::overlapBoxes(const std::vector<physicsBox>& boxes,
+                                 std::vector<physicsHit>& hits,
+                                 jobQueue *jobs)
+{
+	std::shared_lock<std::shared_mutex> lock(worldMtx);
+
+	runQueries(boxes.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsBox& query = boxes[i];
+			btVector3 center = toBullet(query.box.center);
+			btVector3 extent = toBullet(query.box.extent);
+			btTransform trans(btQuaternion::getIdentity(), center);
+			btBoxShape box(extent);
+
+			collectAABB(pairCache, center - extent, center + extent);
+
+			for (auto obj : candidates) {
+				if (query.ignore && obj->getUserPointer() == query.ignore) {
+					continue;
+				}
+
+				if (overlaps(&box, trans, obj)) {
+					out.push_back({
+						.query    = uint32_t(i),
+						.data     = obj->getUserPointer(),
+						.position = toGlm(obj->getWorldTransform().getOrigin()),
+						.normal   = glm::vec3(0),
+						.fraction = 0.f,
+					});
+				}
+			}
+		});
+}
 #endif
@@ -0,0 +1,315 @@
+#include <grend/bulletShapeCache.hpp>
+
+#include "BulletCollision/CollisionShapes/btOptimizedBvh.h"
+#include "BulletCollision/CollisionShapes/btScaledBvhTriangleMeshShape.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <stdlib.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace grendx;
+
+// header in front of serialized BVHs, 32 bytes so the BVH after it keeps
+// the 16 byte alignment bullet wants
+struct bvhHeader {
+	char     magic[8];
+	// catches files written on a machine with different endianness,
+	// swapping them isn't worth the trouble
+	uint32_t endian;
+	uint32_t size;
+	uint64_t hash;
+	uint32_t vertices;
+	uint32_t triangles;
+};
+
+static_assert(sizeof(bvhHeader) == 32, "bvhHeader must be 32 bytes");
+
+static const char bvhMagic[8] = "GRBVH01";
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+	auto p = static_cast<const uint8_t*>(data);
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3;
+	}
+
+	return hash;
+}
+
+static std::string bvhPath(sceneModel::ptr model, sceneMesh::ptr mesh) {
+	if (model->sourceFile.empty()) {
+		// generated, nowhere to put it
+		return "";
+	}
+
+	std::string name = mesh->meshName;
+	for (char& c : name) {
+		if (!isalnum((unsigned char)c) && c != '-' && c != '_') {
+			c = '_';
+		}
+	}
+
+	return model->sourceFile + "." + name + ".bvh";
+}
+
+static void *mapFile(const std::string& path, size_t& size) {
+#if defined(_WIN32)
+	// no mmap, read it into an aligned buffer instead
+	std::ifstream input(path, std::ios::binary | std::ios::ate);
+	if (!input.good()) {
+		return nullptr;
+	}
+
+	size = input.tellg();
+	input.seekg(0);
+
+	void *ret = btAlignedAlloc(size, 16);
+	if (!input.read(static_cast<char*>(ret), size)) {
+		btAlignedFree(ret);
+		return nullptr;
+	}
+
+	return ret;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	size = st.st_size;
+	// private and writable, deserializing fixes up pointers in place
+	void *ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	return (ret == MAP_FAILED)? nullptr : ret;
+#endif
+}
+
+static void unmapFile(void *data, size_t size) {
+#if defined(_WIN32)
+	btAlignedFree(data);
+#else
+	munmap(data, size);
+#endif
+}
+
+bulletShapeCache::meshShape::~meshShape() {
+	// shape references the mapped BVH and the index array
+	shape.reset();
+	indexArray.reset();
+
+	if (mapped) {
+		unmapFile(mapped, mappedSize);
+	}
+}
+
+std::shared_ptr<btCollisionShape>
+bulletShapeCache::getMesh(sceneModel::ptr model,
+                          sceneMesh::ptr mesh,
+                          glm::vec3 scale)
+{
+	std::shared_ptr<meshShape> shared;
+	auto key = std::make_pair(model.get(), mesh.get());
+	auto it = cache.find(key);
+
+	if (it != cache.end()
+	    && it->second.model.lock() == model
+	    && it->second.mesh.lock() == mesh)
+	{
+		shared = it->second.shape.lock();
+	}
+
+	if (!shared) {
+		shared = build(model, mesh);
+
+		if (!shared) {
+			return nullptr;
+		}
+
+		purge();
+		cache[key] = {model, mesh, shared};
+	}
+
+	if (scale == glm::vec3(1)) {
+		return std::shared_ptr<btCollisionShape>(shared, shared->shape.get());
+	}
+
+	// the wrapper holds a reference to the shared shape until it's deleted
+	return std::shared_ptr<btCollisionShape>(
+		new btScaledBvhTriangleMeshShape(shared->shape.get(),
+		                                 btVector3(scale.x, scale.y, scale.z)),
+		[shared] (btCollisionShape *shape) { delete shape; });
+}
+
+void bulletShapeCache::purge(void) {
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (it->second.shape.expired()) {
+			it = cache.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+std::shared_ptr<bulletShapeCache::meshShape>
+bulletShapeCache::build(sceneModel::ptr model, sceneMesh::ptr mesh) {
+	if (mesh->faces.size() / 3 == 0) {
+		std::cerr << "WARNING: bulletShapeCache::getMesh(): "
+			<< "can't add mesh with no elements" << std::endl;
+		return nullptr;
+	}
+
+	auto ret = std::make_shared<meshShape>();
+	std::vector<int> remap(model->vertices.size(), -1);
+
+	ret->indices.reserve(mesh->faces.size());
+
+	for (GLuint idx : mesh->faces) {
+		if (idx >= remap.size()) {
+			std::cerr << "WARNING: bulletShapeCache::getMesh(): "
+				<< mesh->meshName << " has out of range indices" << std::endl;
+			return nullptr;
+		}
+
+		if (remap[idx] < 0) {
+			const glm::vec3& pos = model->vertices[idx].position;
+			remap[idx] = ret->positions.size() / 3;
+			ret->positions.push_back(pos.x);
+			ret->positions.push_back(pos.y);
+			ret->positions.push_back(pos.z);
+		}
+
+		ret->indices.push_back(remap[idx]);
+	}
+
+	size_t numVertices  = ret->positions.size() / 3;
+	size_t numTriangles = ret->indices.size() / 3;
+
+	ret->hash = fnv1a(ret->positions.data(),
+	                  ret->positions.size()*sizeof(btScalar),
+	                  0xcbf29ce484222325);
+	ret->hash = fnv1a(ret->indices.data(),
+	                  ret->indices.size()*sizeof(int),
+	                  ret->hash);
+
+	ret->indexArray = std::make_unique<btTriangleIndexVertexArray>(
+		numTriangles, ret->indices.data(), sizeof(int[3]),
+		numVertices, ret->positions.data(), sizeof(btScalar[3]));
+
+	std::string path = useDiskCache? bvhPath(model, mesh) : "";
+
+	if (path.empty() || !loadBVH(ret.get(), path)) {
+		ret->shape = std::make_unique<btBvhTriangleMeshShape>(
+			ret->indexArray.get(), true /* useQuantizedAabbCompression */);
+
+		if (!path.empty()) {
+			saveBVH(ret.get(), path);
+		}
+	}
+
+	return ret;
+}
+
+bool bulletShapeCache::loadBVH(meshShape *shape, const std::string& path) {
+	size_t size = 0;
+	void *data = mapFile(path, size);
+
+	if (!data) {
+		return false;
+	}
+
+	auto header = static_cast<bvhHeader*>(data);
+
+	if (size < sizeof(bvhHeader)
+	    || memcmp(header->magic, bvhMagic, sizeof(bvhMagic)) != 0
+	    || header->endian    != 0x01020304
+	    || header->size      != size - sizeof(bvhHeader)
+	    || header->hash      != shape->hash
+	    || header->vertices  != shape->positions.size() / 3
+	    || header->triangles != shape->indices.size() / 3)
+	{
+		// stale or from somewhere else, gets rebuilt and overwritten
+		unmapFile(data, size);
+		return false;
+	}
+
+	btOptimizedBvh *bvh =
+		btOptimizedBvh::deSerializeInPlace(header + 1, header->size, false);
+
+	if (!bvh) {
+		unmapFile(data, size);
+		return false;
+	}
+
+	shape->mapped = data;
+	shape->mappedSize = size;
+	shape->shape = std::make_unique<btBvhTriangleMeshShape>(
+		shape->indexArray.get(),
+		true  /* useQuantizedAabbCompression */,
+		false /* buildBvh */);
+	// not owned, freed with the mapping
+	shape->shape->setOptimizedBvh(bvh);
+
+	return true;
+}
+
+void bulletShapeCache::saveBVH(meshShape *shape, const std::string& path) {
+	btOptimizedBvh *bvh = shape->shape->getOptimizedBvh();
+	unsigned size = bvh->calculateSerializeBufferSize();
+	void *buffer = btAlignedAlloc(size, 16);
+
+	if (!bvh->serializeInPlace(buffer, size, false)) {
+		btAlignedFree(buffer);
+		return;
+	}
+
+	bvhHeader header = {};
+	memcpy(header.magic, bvhMagic, sizeof(bvhMagic));
+	header.endian    = 0x01020304;
+	header.size      = size;
+	header.hash      = shape->hash;
+	header.vertices  = shape->positions.size() / 3;
+	header.triangles = shape->indices.size() / 3;
+
+	// written to a temporary file first, so a partial write never
+	// gets loaded
+	std::string temp = path + ".tmp";
+	std::ofstream out(temp, std::ios::binary);
+
+	if (out.good()) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(static_cast<const char*>(buffer), size);
+		out.close();
+	}
+
+#if defined(_WIN32)
+	// rename() won't replace existing files here
+	remove(path.c_str());
+#endif
+
+	if (!out.good() || rename(temp.c_str(), path.c_str()) != 0) {
+		// read-only asset directories are fine, just slower to load
+		std::cerr << "NOTE: bulletShapeCache: couldn't write " << path << std::endl;
+		remove(temp.c_str());
+	}
+
+	btAlignedFree(buffer);
+}
@@ -251,3 +251,20 @@ bool camera::boxInFrustum(const struct OBB& box) {
 
 	return anyIn;
 }
+
+float camera::screenSize(const BSphere& sphere, unsigned height) {
+	if (projection_ == projection::Orthographic) {
+		// one pixel covers `scale_` units
+		return 2.f * sphere.extent / scale_;
+	}
+
+	float dist = glm::distance(position_, sphere.center);
+
+	if (dist <= sphere.extent) {
+		// inside the sphere, covers the whole screen
+		return height;
+	}
+
+	float halfView = dist * tan(glm::radians(fovy_) * 0.5f);
+	return min(float(height), height * sphere.extent / halfView);
+}
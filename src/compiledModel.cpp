@@ -9,10 +9,52 @@ compiledMaterial::~compiledMaterial() {
 	//SDL_Log("Freeing a compiledMaterial");
 }
 
+void compiledMaterial::markUsed(float size) {
+	if (lastUsed != glmanCurrentFrame) {
+		lastUsed   = glmanCurrentFrame;
+		screenSize = size;
+
+	} else if (size > screenSize) {
+		screenSize = size;
+
+	} else {
+		return;
+	}
+
+	Texture *texs[] = {
+		textures.diffuse.get(),
+		textures.metalRoughness.get(),
+		textures.normal.get(),
+		textures.ambientOcclusion.get(),
+		textures.emissive.get(),
+		textures.lightmap.get(),
+	};
+
+	for (Texture *tex : texs) {
+		if (tex) {
+			tex->markUsed(screenSize);
+		}
+	}
+}
+
 compiledMesh::~compiledMesh() {
 	//SDL_Log("Freeing a compiledMesh");
 }
 
+unsigned compiledMesh::selectLOD(float screenSize, float maxError) const {
+	unsigned ret = 0;
+
+	for (unsigned i = 1; i < lods.size(); i++) {
+		if (lods[i].error * screenSize > maxError) {
+			break;
+		}
+
+		ret = i;
+	}
+
+	return ret;
+}
+
 compiledModel::~compiledModel() {
 	//SDL_Log("Freeing a compiledModel");
 }
@@ -85,8 +127,23 @@ compiledMesh::ptr compileMesh(sceneMesh::ptr& mesh) {
 	mesh->compiled = true;
 
 	foo->elements = genBuffer(GL_ELEMENT_ARRAY_BUFFER);
-	foo->elements->buffer(mesh->faces.data(),
-						  mesh->faces.size() * sizeof(GLuint));
+	foo->lods.push_back({0, mesh->faces.size(), 0.f});
+
+	if (mesh->lods.empty()) {
+		foo->elements->buffer(mesh->faces.data(),
+		                      mesh->faces.size() * sizeof(GLuint));
+
+	} else {
+		// all levels in one element buffer, so they can share the VAO
+		std::vector<GLuint> indices = mesh->faces;
+
+		for (auto& level : mesh->lods) {
+			foo->lods.push_back({indices.size(), level.faces.size(), level.error});
+			indices.insert(indices.end(), level.faces.begin(), level.faces.end());
+		}
+
+		foo->elements->buffer(indices.data(), indices.size() * sizeof(GLuint));
+	}
 
 	// TODO: more consistent naming here
 	foo->mat   = matcache(mesh->meshMaterial);
@@ -104,6 +161,7 @@ compiledModel::ptr compileModel(std::string name, sceneModel::ptr model) {
 	obj->vertices = genBuffer(GL_ARRAY_BUFFER);
 	obj->vertices->buffer(model->vertices.data(),
 	                      model->vertices.size() * sizeof(sceneModel::vertex));
+	obj->numVertices = model->vertices.size();
 
 	if (model->haveJoints) {
 		obj->haveJoints = true;
@@ -127,11 +185,17 @@ compiledModel::ptr compileModel(std::string name, sceneModel::ptr model) {
 
 void compileModels(const modelMap& models) {
 	for (const auto& x : models) {
-		compileModel(x.first, x.second);
+		// models can be shared through the model cache, only compile once
+		if (!x.second->compiled) {
+			compileModel(x.first, x.second);
+		}
 	}
 }
 
-Vao::ptr preloadMeshVao(compiledModel::ptr obj, compiledMesh::ptr mesh) {
+Vao::ptr preloadMeshVao(compiledModel::ptr obj,
+                        compiledMesh::ptr mesh,
+                        Buffer::ptr vertices)
+{
 	if (mesh == nullptr || !mesh->elements) {
 		SDL_Log("/!\\ Have broken mesh...");
 		return getCurrentVao();
@@ -144,7 +208,7 @@ Vao::ptr preloadMeshVao(compiledModel::ptr obj, compiledMesh::ptr mesh) {
 	glEnableVertexAttribArray(VAO_ELEMENTS);
 	glVertexAttribPointer(VAO_ELEMENTS, 3, GL_UNSIGNED_INT, GL_FALSE, 0, 0);
 
-	obj->vertices->bind();
+	(vertices? vertices : obj->vertices)->bind();
 	glEnableVertexAttribArray(VAO_VERTICES);
 	SET_VAO_ENTRY(VAO_VERTICES, sceneModel::vertex, position);
 
@@ -163,7 +227,7 @@ Vao::ptr preloadMeshVao(compiledModel::ptr obj, compiledMesh::ptr mesh) {
 	glEnableVertexAttribArray(VAO_LIGHTMAP);
 	SET_VAO_ENTRY(VAO_LIGHTMAP, sceneModel::vertex, lightmap);
 
-	if (obj->haveJoints) {
+	if (obj->haveJoints && !vertices) {
 		obj->joints->bind();
 		glEnableVertexAttribArray(VAO_JOINTS);
 		SET_VAO_ENTRY(VAO_JOINTS, sceneModel::jointWeights, joints);
@@ -0,0 +1,152 @@
+#include <grend/computeSkinning.hpp>
+#include <grend/compiledModel.hpp>
+#include <grend/utility.hpp>
+
+#include <iterator>
+
+namespace grendx {
+
+// skinning.comp reads vertices as a plain float array
+static_assert(sizeof(sceneModel::vertex) == 17*sizeof(GLfloat),
+              "sceneModel::vertex layout doesn't match skinning.comp");
+
+static compiledModel::ptr meshModel(sceneMesh::ptr mesh) {
+	auto parent = mesh->parent.lock();
+
+	if (parent && parent->type == sceneNode::objType::Model) {
+		return std::static_pointer_cast<sceneModel>(parent)->comped_model;
+	}
+
+	return nullptr;
+}
+
+#if GLSL_VERSION >= 430
+static struct {
+	bool loaded = false;
+	Program::ptr skin;
+} gpu;
+
+static bool loadGpuSkinning(void) {
+	if (gpu.loaded) {
+		return gpu.skin != nullptr;
+	}
+
+	gpu.loaded = true;
+
+	Shader::parameters opts;
+	gpu.skin = loadComputeProgram(GR_PREFIX "shaders/baked/skinning.comp", opts);
+
+	if (!gpu.skin->good()) {
+		SDL_Log("skinMeshes(): couldn't load skinning shader, "
+		        "skinning in vertex shaders");
+		gpu.skin = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+unsigned skinMeshes(renderQueue& queue) {
+	if (!loadGpuSkinning()) {
+		return 0;
+	}
+
+	unsigned skinned = 0;
+	bool bound = false;
+
+	for (auto& [skin, drawinfo] : queue.skinnedMeshes) {
+		// no-op if updateSkins() already ran
+		skin->update();
+
+		// free output for models that are gone, also keeps a new model
+		// allocated at the same address from finding the old entry
+		for (auto it = skin->skinned.begin(); it != skin->skinned.end();) {
+			it = it->second.model.expired()? skin->skinned.erase(it) : std::next(it);
+		}
+
+		for (auto& ent : drawinfo) {
+			compiledModel::ptr model = meshModel(ent.data);
+			compiledMesh::ptr  mesh  = ent.data->comped_mesh;
+
+			if (!model || !mesh || !model->haveJoints || model->numVertices == 0) {
+				continue;
+			}
+
+			auto& out = skin->skinned[model.get()];
+
+			if (!out.vertices) {
+				out.model    = model;
+				out.vertices = genBuffer(GL_ARRAY_BUFFER, GL_DYNAMIC_COPY);
+				out.vertices->allocate(model->numVertices * sizeof(sceneModel::vertex));
+			}
+
+			auto& vao = out.vaos[mesh.get()];
+			if (!vao) {
+				vao = preloadMeshVao(model, mesh, out.vertices);
+			}
+
+			out.frame = glmanCurrentFrame;
+
+			// same pose as last time (or another mesh of the same
+			// model already did it), output is still good
+			if (out.paletteVersion == skin->getPaletteVersion()) {
+				continue;
+			}
+
+			if (!bound) {
+				gpu.skin->bind();
+				bound = true;
+			}
+
+			// uploads the palette and binds jointTransforms, the UBO is
+			// shared with the vertex shader path
+			skin->sync(gpu.skin);
+			gpu.skin->set("numVertices", GLint(model->numVertices));
+			gpu.skin->setStorageBlock("vertexBuffer",  model->vertices, 0);
+			gpu.skin->setStorageBlock("jointBuffer",   model->joints,   1);
+			gpu.skin->setStorageBlock("skinnedBuffer", out.vertices,    2);
+			glDispatchCompute((model->numVertices + 63) / 64, 1, 1);
+			DO_ERROR_CHECK();
+
+			out.paletteVersion = skin->getPaletteVersion();
+			skinned++;
+		}
+	}
+
+	if (skinned) {
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	}
+
+	return skinned;
+}
+
+#else
+unsigned skinMeshes(renderQueue& queue) {
+	// no compute shaders
+	return 0;
+}
+#endif
+
+Vao::ptr skinnedMeshVao(sceneSkin::ptr skin, sceneMesh::ptr mesh) {
+	if (skin->skinned.empty() || !mesh->comped_mesh) {
+		return nullptr;
+	}
+
+	compiledModel::ptr model = meshModel(mesh);
+	if (!model) {
+		return nullptr;
+	}
+
+	auto it = skin->skinned.find(model.get());
+	if (it == skin->skinned.end() || it->second.frame != glmanCurrentFrame
+	    || it->second.model.lock() != model)
+	{
+		return nullptr;
+	}
+
+	auto vit = it->second.vaos.find(mesh->comped_mesh.get());
+	return (vit != it->second.vaos.end())? vit->second : nullptr;
+}
+
+// namespace grendx
+}
@@ -1,5 +1,8 @@
 #include <grend/ecs/ecs.hpp>
 #include <grend/ecs/collision.hpp>
+#include <grend/physics.hpp>
+
+#include <algorithm>
 
 namespace grendx::ecs {
 
@@ -36,50 +39,61 @@ nlohmann::json collisionHandler::serialize(entityManager *manager) {
 }
 
 void entitySystemCollision::update(entityManager *manager, float delta) {
-	for (auto& col : *manager->collisions) {
-		if (!col.adata && !col.bdata) {
-			// two collision events outside the ECS, nothing to do
-			continue;
+	auto phys = manager->engine->services.resolve<physics>();
+	const contactEvents& events = phys->getContacts();
+
+	queue.clear();
+
+	for (size_t i = 0; i < events.size(); i++) {
+		// TODO: maaaaaaybe dynamic cast... if we really don't care about
+		//       performance :P
+		//       (but would make other coexisting object systems possible...
+		//        particularly a simpler lua scripting system, ECS is great
+		//        but it does actually kinda suck for rapid prototyping (jams))
+		entity *a = static_cast<entity*>(events.dataA[i]);
+		entity *b = static_cast<entity*>(events.dataB[i]);
+
+		// allow collisions with things outside the ECS, handlers
+		// only run for the side that's an entity
+		// TODO: documentation noting that 'other' may be null!
+		if (a) queue.push_back({a, b, uint32_t(i), false});
+		if (b) queue.push_back({b, a, uint32_t(i), true});
+	}
+
+	// grouped by entity, so components are only looked up once per entity,
+	// and in event order within each
+	std::sort(queue.begin(), queue.end(),
+		[] (const dispatch& a, const dispatch& b) {
+			return (a.self != b.self)? a.self < b.self : a.index < b.index;
+		});
+
+	for (size_t i = 0; i < queue.size();) {
+		entity *self = queue[i].self;
+		size_t end = i;
+
+		while (end < queue.size() && queue[end].self == self) {
+			end++;
 		}
 
-		entity *ents[2] = {
-			// TODO: maaaaaaybe dynamic cast... if we really don't care about
-			//       performance :P
-			//       (but would make other coexisting object systems possible...
-			//        particularly a simpler lua scripting system, ECS is great
-			//        but it does actually kinda suck for rapid prototyping (jams))
-			static_cast<entity*>(col.adata),
-			static_cast<entity*>(col.bdata),
-		};
-
-		for (unsigned i = 0; i < 2; i++) {
-			entity *self  = ents[i];
-			entity *other = ents[!i];
-
-			if (!self) {
-				// allow collisions with things outside the ECS
-				// TODO: documentation noting that 'other' may be null!
-				continue;
-			}
+		if (!manager->hasComponents<collisionHandler, entity>(self)) {
+			i = end;
+			continue;
+		}
 
-			if (manager->hasComponents<collisionHandler, entity>(self)) {
-				//auto entcomps = manager->getEntityComponents(self);
-				auto range = self->getAll<collisionHandler>();
+		auto range = self->getAll<collisionHandler>();
 
-				for (auto it = range.first; it != range.second; it++) {
-					auto& [_, comp] = *it;
+		for (; i < end; i++) {
+			entity *other = queue[i].other;
+			collision col = events.get(queue[i].index, queue[i].flipped);
 
-					collisionHandler *handler = dynamic_cast<collisionHandler*>(comp);
-					if (!handler) {
-						// no collision component...?
-						continue;
-					}
+			for (auto it = range.first; it != range.second; it++) {
+				// only collision handlers are registered under its name
+				auto handler = static_cast<collisionHandler*>(it->second);
 
-					if (handler->tags.empty()
-					    || manager->hasComponents(other, handler->tags))
-					{
-						handler->onCollision(manager, self, other, col);
-					}
+				if (handler->tags.empty()
+				    || (other && manager->hasComponents(other, handler->tags)))
+				{
+					handler->onCollision(manager, self, other, col);
 				}
 			}
 		}
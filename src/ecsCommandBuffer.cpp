@@ -0,0 +1,117 @@
+#include <grend/ecs/ecs.hpp>
+#include <grend/ecs/commandBuffer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <unordered_map>
+
+namespace grendx::ecs {
+
+static std::atomic<uint64_t> managerSerials = 0;
+
+uint64_t entityManager::allocateSerial(void) {
+	return ++managerSerials;
+}
+
+commandBuffer& entityManager::deferred(void) {
+	// keyed by serial rather than pointer, a new manager at the address
+	// of a freed one shouldn't find the old buffer
+	thread_local std::unordered_map<uint64_t, commandBuffer*> buffers;
+
+	auto it = buffers.find(serial);
+	if (it != buffers.end()) {
+		return *it->second;
+	}
+
+	// only taken the first time a thread records anything
+	std::lock_guard lock(commandMtx);
+	commandBuffers.push_back(std::make_unique<commandBuffer>());
+
+	commandBuffer *ret = commandBuffers.back().get();
+	buffers[serial] = ret;
+	return *ret;
+}
+
+void entityManager::playbackCommands(void) {
+	std::vector<commandBuffer::commands> pending;
+
+	{
+		// anything recorded while playing back (eg. from constructors)
+		// goes in the next batch
+		std::lock_guard lock(commandMtx);
+
+		for (auto& buf : commandBuffers) {
+			// the owning thread could still be recording from a job
+			std::lock_guard bufLock(buf->mtx);
+
+			if (!buf->recorded.empty()) {
+				pending.push_back(std::move(buf->recorded));
+				buf->recorded = {};
+			}
+		}
+	}
+
+	std::vector<entity*> created;
+	std::vector<entity*> destroyed;
+	std::vector<std::pair<entity*, commandBuffer::attachFunc>> attaches;
+	std::vector<std::pair<entity*, component*>> detaches;
+
+	for (auto& buf : pending) {
+		// creation runs component constructors, which register themselves,
+		// so it happens here rather than being batched like the rest
+		for (auto& make : buf.creates) {
+			if (entity *ent = make(this)) {
+				created.push_back(ent);
+			}
+		}
+
+		destroyed.insert(destroyed.end(),
+		                 buf.destroys.begin(), buf.destroys.end());
+		detaches.insert(detaches.end(),
+		                buf.detaches.begin(), buf.detaches.end());
+		std::move(buf.attaches.begin(), buf.attaches.end(),
+		          std::back_inserter(attaches));
+	}
+
+	auto byEntity = [] (const auto& a, const auto& b) {
+		return a.first < b.first;
+	};
+
+	std::sort(destroyed.begin(), destroyed.end());
+	destroyed.erase(std::unique(destroyed.begin(), destroyed.end()),
+	                destroyed.end());
+
+	auto isDestroyed = [&] (entity *ent) {
+		return std::binary_search(destroyed.begin(), destroyed.end(), ent);
+	};
+
+	for (entity *ent : created) {
+		add(ent);
+	}
+
+	// stable, attachments to the same entity keep the order they
+	// were recorded in
+	std::stable_sort(attaches.begin(), attaches.end(), byEntity);
+	for (auto& [ent, attach] : attaches) {
+		if (valid(ent) && !isDestroyed(ent)) {
+			attach(this, ent);
+		}
+	}
+
+	std::sort(detaches.begin(), detaches.end());
+	detaches.erase(std::unique(detaches.begin(), detaches.end()),
+	               detaches.end());
+
+	for (auto& [ent, comp] : detaches) {
+		// freed with the entity anyway
+		if (!isDestroyed(ent)) {
+			unregisterComponent(ent, comp);
+		}
+	}
+
+	condemned.insert(destroyed.begin(), destroyed.end());
+}
+
+// namespace grendx::ecs
+};
@@ -1,6 +1,10 @@
 #include <grend/ecs/ecs.hpp>
 #include <grend/ecs/search.hpp>
 #include <grend/ecs/sceneComponent.hpp>
+#include <grend/ecs/commandBuffer.hpp>
+#include <grend/ecs/message.hpp>
+
+#include <algorithm>
 
 namespace grendx::ecs {
 
@@ -56,7 +60,13 @@ entity::entity(entityManager *manager, entity *ent, regArgs t)
 }
 */
 
+entityManager::entityManager(gameMain *_engine)
+	: messages(std::make_shared<messaging::endpoint>()),
+	  engine(_engine) {}
+
 void entityManager::update(float delta) {
+	spatial.refresh();
+
 	for (auto& [name, system] : systems) {
 		if (system) {
 			// TODO: should also consider having an 'active' flag in systems
@@ -82,6 +92,12 @@ void entityManager::update(float delta) {
 		}
 	}
 
+	// sync point, nothing else should be iterating entities here
+	playbackCommands();
+	// nothing publishing either, and anything constructed above has
+	// had a chance to subscribe
+	messages->deliver();
+
 	/*
 	for (auto& ent : entities) {
 		if (ent->active) {
@@ -110,7 +126,6 @@ void entityManager::update(float delta) {
 		}
 	}
 
-	collisions->clear();
 	added.clear();
 	clearFreedEntities();
 }
@@ -126,6 +141,7 @@ void entityManager::add(entity *ent) {
 	//setNode("entity["+std::to_string((uintptr_t)ent)+"]", root, ent->getNode());
 	entities.insert(ent);
 	added.insert(ent);
+	spatial.insert(ent);
 }
 
 void entityManager::remove(entity *ent) {
@@ -196,6 +212,8 @@ void entityManager::freeEntity(entity *ent) {
 	}
 
 	//root->removeNode("entity["+std::to_string((uintptr_t)ent)+"]");
+	spatial.remove(ent);
+	removeFromViews(ent);
 
 	// first free component objects
 	auto comps = entityComponents[ent];
@@ -269,25 +287,64 @@ std::set<entity*> searchEntities(entityManager *manager,
 		(manager, {tags.begin(), tags.end()}, tags.size());
 }
 
-entity *findNearest(entityManager *manager,
-                    glm::vec3 position,
-                    std::initializer_list<const char *> tags)
-{
-	float curmin = HUGE_VALF;
-	entity *ret = nullptr;
+queryView::ptr entityManager::getView(std::vector<const char *> tags) {
+	// same view for the same set of components, whatever order
+	// they're given in
+	std::sort(tags.begin(), tags.end());
+	tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+	auto it = views.find(tags);
+	if (it != views.end()) {
+		return it->second;
+	}
+
+	auto view = std::make_shared<queryView>(tags);
+	views[tags] = view;
+
+	for (const char *tag : tags) {
+		tagViews[tag].push_back(view.get());
+	}
+
+	if (tags.empty()) {
+		return view;
+	}
 
-	auto ents = searchEntities(manager, tags);
-	for (auto& ent : ents) {
-		sceneNode::ptr node = ent->getNode();
-		float dist = glm::distance(position, node->getTransformTRS().position);
+	// fill it from the most exclusive component
+	const char *smallest = tags.front();
+	for (const char *tag : tags) {
+		if (getComponents(tag).size() < getComponents(smallest).size()) {
+			smallest = tag;
+		}
+	}
 
-		if (ent->active && dist < curmin) {
-			curmin = dist;
-			ret = ent;
+	for (component *comp : getComponents(smallest)) {
+		entity *ent = getEntity(comp);
+
+		if (ent && intersects(getEntityComponents(ent), tags)) {
+			view->insert(ent);
 		}
 	}
 
-	return ret;
+	return view;
+}
+
+void entityManager::removeFromViews(entity *ent) {
+	for (auto& [name, _] : getEntityComponents(ent)) {
+		auto views = tagViews.find(name);
+
+		if (views != tagViews.end()) {
+			for (queryView *view : views->second) {
+				view->erase(ent);
+			}
+		}
+	}
+}
+
+entity *findNearest(entityManager *manager,
+                    glm::vec3 position,
+                    std::initializer_list<const char *> tags)
+{
+	return manager->spatial.nearest(position, tags);
 }
 
 entity *findFirst(entityManager *manager,
@@ -345,6 +402,17 @@ regArgs entityManager::registerComponent(const char *name,
 	componentTypes[ptr].insert(name);
 	entityComponents[ent].insert({name, ptr});
 
+	auto views = tagViews.find(name);
+	if (ent && views != tagViews.end()) {
+		auto& compmap = entityComponents[ent];
+
+		for (queryView *view : views->second) {
+			if (!view->contains(ent) && intersects(compmap, view->tags)) {
+				view->insert(ent);
+			}
+		}
+	}
+
 	return regArgs(t.manager, t.ent, {regArgs::you_should_not_construct_this_directly::magic::OK});
 	//return t;
 }
@@ -399,6 +467,15 @@ void entityManager::unregisterComponent(entity *ent, component *ptr) {
 		}
 
 		components[name].erase(ptr);
+
+		// entities can have more than one of the same component, only
+		// leaves views once the last one is gone
+		auto views = tagViews.find(name);
+		if (views != tagViews.end() && !comps.contains(name)) {
+			for (queryView *view : views->second) {
+				view->erase(ent);
+			}
+		}
 	}
 
 	componentEntities.erase(ptr);
@@ -0,0 +1,183 @@
+#include <grend/ecs/message.hpp>
+#include <grend/sdlContext.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace grendx::ecs::messaging {
+
+// names are only looked up when channels are first used, a lock is fine
+static std::mutex channelMtx;
+static std::unordered_map<std::string, channelID> channelIDs;
+static std::vector<std::string> channelNames = {"undefined"};
+
+channelID getChannel(const std::string& name) {
+	std::lock_guard lock(channelMtx);
+
+	auto it = channelIDs.find(name);
+	if (it != channelIDs.end()) {
+		return it->second;
+	}
+
+	channelID id = channelNames.size();
+	channelNames.push_back(name);
+	channelIDs[name] = id;
+	return id;
+}
+
+const std::string& getChannelName(channelID id) {
+	std::lock_guard lock(channelMtx);
+	return (id < channelNames.size())? channelNames[id] : channelNames[0];
+}
+
+void *frameArena::allocate(size_t size, size_t align) {
+	// over-allocate by the alignment so any offset can be aligned up
+	size_t offset = used.fetch_add(size + align - 1, std::memory_order_relaxed);
+	size_t start  = (offset + align - 1) & ~(align - 1);
+
+	if (start + size > capacity) {
+		return nullptr;
+	}
+
+	return reinterpret_cast<char*>(buffer.get()) + start;
+}
+
+void endpoint::subscribe(mailbox::ptr mbox, channelID type) {
+	if (type >= subscribers.size()) {
+		subscribers.resize(type + 1);
+	}
+
+	subscribers[type].push_back(mbox);
+	subscribedTypes[mbox.get()].push_back(type);
+
+	if (debug) {
+		SDL_Log("[SUB] %s", getChannelName(type).c_str());
+	}
+}
+
+void endpoint::unsubscribe(const mailbox *mbox, channelID type) {
+	if (type >= subscribers.size()) {
+		return;
+	}
+
+	auto& subs = subscribers[type];
+	subs.erase(std::remove_if(subs.begin(), subs.end(),
+		[&] (mailbox::weakptr& w) {
+			auto ptr = w.lock();
+			return !ptr || ptr.get() == mbox;
+		}),
+		subs.end());
+
+	auto it = subscribedTypes.find(mbox);
+	if (it != subscribedTypes.end()) {
+		auto& types = it->second;
+		types.erase(std::remove(types.begin(), types.end(), type), types.end());
+
+		if (types.empty()) {
+			subscribedTypes.erase(it);
+		}
+	}
+}
+
+void endpoint::unsubscribe(const mailbox *mbox) {
+	auto it = subscribedTypes.find(mbox);
+	if (it == subscribedTypes.end()) {
+		return;
+	}
+
+	// copied, unsubscribing erases the entry
+	std::vector<channelID> types = it->second;
+
+	for (channelID type : types) {
+		unsubscribe(mbox, type);
+	}
+}
+
+bool endpoint::publish(const message& m) {
+	if (debug) {
+		SDL_Log("[PUB] (%s:%s) %s",
+				m.ent?  m.ent->typeString()  : "_",
+				m.comp? m.comp->typeString() : "_",
+				getChannelName(m.type).c_str());
+	}
+
+	if (!queued.push(m)) {
+		// TODO: warning
+		//       (what happened to the TODO about implementing
+		//        a proper logger? Need todo that)
+		return false;
+	}
+
+	return true;
+}
+
+void endpoint::deliver(void) {
+	message m;
+	bool pruned = false;
+
+	while (queued.pop(m)) {
+		if (m.type >= subscribers.size() || subscribers[m.type].empty()) {
+			// no mailboxes waiting for this message type,
+			// nothing to do
+			if (debug) {
+				SDL_Log("      (%s: no subscribers, dropped)",
+				        getChannelName(m.type).c_str());
+			}
+			continue;
+		}
+
+		auto& subs = subscribers[m.type];
+		bool expired = false;
+
+		for (auto& mbox : subs) {
+			if (auto ptr = mbox.lock()) {
+				if (!ptr->add(m) && debug) {
+					SDL_Log("      -> mailbox full, dropped");
+				}
+
+			} else {
+				expired = true;
+			}
+		}
+
+		if (expired) {
+			// mailbox was freed without unsubscribing, forget about it
+			subs.erase(std::remove_if(subs.begin(), subs.end(),
+				[] (mailbox::weakptr& w) { return w.expired(); }),
+				subs.end());
+			pruned = true;
+		}
+	}
+
+	// anything from last frame has been read by now, reuse its arena
+	unsigned next = !current.load(std::memory_order_relaxed);
+	arenas[next].reset();
+	current.store(next, std::memory_order_release);
+
+	if (!pruned) {
+		return;
+	}
+
+	// subscribedTypes still has entries for freed mailboxes, only
+	// looked for when some were found, which should be rare
+	for (auto it = subscribedTypes.begin(); it != subscribedTypes.end();) {
+		bool live = false;
+
+		for (channelID type : it->second) {
+			for (auto& w : subscribers[type]) {
+				if (auto ptr = w.lock(); ptr && ptr.get() == it->first) {
+					live = true;
+					break;
+				}
+			}
+
+			if (live) break;
+		}
+
+		it = live? std::next(it) : subscribedTypes.erase(it);
+	}
+}
+
+// namespace grendx::ecs::messaging
+}
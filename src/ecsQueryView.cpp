@@ -0,0 +1,108 @@
+#include <grend/ecs/ecs.hpp>
+#include <grend/ecs/queryView.hpp>
+#include <grend/jobQueue.hpp>
+#include <grend/utility.hpp>
+
+#include <atomic>
+#include <future>
+
+namespace grendx::ecs {
+
+// members per chunk handed to a job
+#define VIEW_CHUNK 64
+
+void queryView::insert(entity *ent) {
+	if (index.count(ent)) {
+		return;
+	}
+
+	index[ent] = members.size();
+	members.push_back(ent);
+}
+
+void queryView::erase(entity *ent) {
+	auto it = index.find(ent);
+	if (it == index.end()) {
+		return;
+	}
+
+	uint32_t idx = it->second;
+	index.erase(it);
+
+	if (idx != members.size() - 1) {
+		members[idx] = members.back();
+		index[members[idx]] = idx;
+	}
+
+	members.pop_back();
+}
+
+void queryView::forEach(jobQueue *jobs, const std::function<void(entity*)>& func) {
+	size_t count = members.size();
+
+	if (!jobs || count <= VIEW_CHUNK) {
+		for (entity *ent : members) {
+			func(ent);
+		}
+
+		return;
+	}
+
+	struct batch {
+		const std::function<void(entity*)> *func;
+		entity **members;
+		size_t count;
+		size_t chunks;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+		// set by whoever finishes the last chunk
+		std::promise<void> finished;
+
+		bool runOne(void) {
+			size_t i = next++;
+
+			if (i >= chunks) {
+				return false;
+			}
+
+			size_t end = min(count, (i + 1)*VIEW_CHUNK);
+			for (size_t k = i*VIEW_CHUNK; k < end; k++) {
+				(*func)(members[k]);
+			}
+
+			if (++done == chunks) {
+				finished.set_value();
+			}
+
+			return true;
+		}
+	};
+
+	auto state = std::make_shared<batch>();
+	state->func = &func;
+	state->members = members.data();
+	state->count = count;
+	state->chunks = (count + VIEW_CHUNK - 1) / VIEW_CHUNK;
+	auto finished = state->finished.get_future();
+
+	size_t threads = max(1u, std::thread::hardware_concurrency());
+	size_t helpers = min(state->chunks - 1, threads);
+
+	for (size_t i = 0; i < helpers; i++) {
+		// late helpers find nothing left to claim, and never
+		// touch func or members after this returns
+		jobs->addAsync([state] () {
+			while (state->runOne());
+			return true;
+		});
+	}
+
+	while (state->runOne());
+
+	// helpers may still be on their last chunk, func and members have
+	// to outlive that
+	finished.wait();
+}
+
+// namespace grendx::ecs
+};
@@ -25,7 +25,6 @@ rigidBody::rigidBody(regArgs t)
 {
 	manager->registerInterface<activatable>(t.ent, this);
 	manager->registerInterface<transformUpdatable>(t.ent, this);
-	registerCollisionQueue(manager->collisions);
 }
 
 rigidBody::rigidBody(regArgs t, float _mass)
@@ -43,7 +42,6 @@ rigidBodySphere::rigidBodySphere(regArgs t)
 
 	/*
 	phys = manager->engine->phys->addSphere(ent, position, 1.f, properties["radius"]);
-	registerCollisionQueue(manager->collisions);
 	*/
 }
 
@@ -68,7 +66,6 @@ rigidBodyBox::rigidBodyBox(regArgs t)
 	};
 
 	phys = manager->engine->phys->addBox(ent, position, 1.f, box);
-	registerCollisionQueue(manager->collisions);
 	*/
 }
 
@@ -87,7 +84,6 @@ rigidBodyCylinder::rigidBodyCylinder(regArgs t)
 	};
 
 	phys = manager->engine->phys->addCylinder(ent, position, 1.f, box);
-	registerCollisionQueue(manager->collisions);
 	*/
 }
 
@@ -100,7 +96,6 @@ rigidBodyCapsule::rigidBodyCapsule(regArgs t)
 	float height = properties["height"];
 
 	phys = manager->engine->phys->addCapsule(ent, position, 1.f, radius, height);
-	registerCollisionQueue(manager->collisions);
 	*/
 }
 
@@ -153,18 +148,20 @@ void syncRigidBodyXZVelocity::sync(entityManager *manager, entity *ent) {
 
 void syncRigidBodySystem::update(entityManager *manager, float delta) {
 	//std::set<component*> syncers = manager->getComponents("syncRigidBody");
-	std::set<component*> syncers = manager->getComponents<syncRigidBody>();
+	auto syncers = manager->view<syncRigidBody>();
 
-	for (auto& comp : syncers) {
-		syncRigidBody *syncer = static_cast<syncRigidBody*>(comp);
-		entity *ent = manager->getEntity(comp);
-
-		if (!syncer || !ent || !ent->active) {
-			// TODO: warning
+	for (entity *ent : *syncers) {
+		if (!ent->active) {
 			continue;
 		}
 
-		syncer->sync(manager, ent);
+		// can have more than one, eg. position and velocity syncers
+		auto all = ent->getAll<syncRigidBody>();
+
+		for (auto it = all.first; it != all.second; it++) {
+			syncRigidBody *syncer = static_cast<syncRigidBody*>(it->second);
+			syncer->sync(manager, ent);
+		}
 	}
 }
 
@@ -0,0 +1,324 @@
+#include <grend/ecs/ecs.hpp>
+#include <grend/ecs/spatialIndex.hpp>
+
+#include <algorithm>
+
+namespace grendx::ecs {
+
+// 21 bits per axis, biased so negative cells pack into the key
+#define CELL_BITS 21
+#define CELL_BIAS (1 << (CELL_BITS - 1))
+#define CELL_MASK ((1ull << CELL_BITS) - 1)
+
+uint64_t spatialIndex::cellKey(glm::ivec3 cell) const {
+	return  (uint64_t(cell.x + CELL_BIAS) & CELL_MASK)
+	     | ((uint64_t(cell.y + CELL_BIAS) & CELL_MASK) << CELL_BITS)
+	     | ((uint64_t(cell.z + CELL_BIAS) & CELL_MASK) << (2*CELL_BITS));
+}
+
+glm::ivec3 spatialIndex::cellCoord(glm::vec3 position) const {
+	return glm::ivec3(glm::floor(position / cellSize));
+}
+
+void spatialIndex::addToCell(uint32_t idx) {
+	cells[entries[idx].cell].push_back(idx);
+}
+
+void spatialIndex::removeFromCell(uint32_t idx) {
+	auto it = cells.find(entries[idx].cell);
+
+	if (it == cells.end()) {
+		return;
+	}
+
+	auto& members = it->second;
+	auto found = std::find(members.begin(), members.end(), idx);
+
+	if (found != members.end()) {
+		*found = members.back();
+		members.pop_back();
+	}
+
+	if (members.empty()) {
+		cells.erase(it);
+	}
+}
+
+void spatialIndex::insert(entity *ent) {
+	if (!ent || lookup.count(ent)) {
+		return;
+	}
+
+	sceneNode::ptr node = ent->getNode();
+	glm::vec3 pos = node->getTransformTRS().position;
+	uint32_t idx = entries.size();
+
+	entries.push_back({
+		.ent      = ent,
+		.node     = node.get(),
+		.version  = node->getTransformVersion(),
+		.position = pos,
+		.cell     = cellKey(cellCoord(pos)),
+	});
+
+	lookup[ent] = idx;
+	addToCell(idx);
+}
+
+void spatialIndex::remove(entity *ent) {
+	auto it = lookup.find(ent);
+	if (it == lookup.end()) {
+		return;
+	}
+
+	uint32_t idx  = it->second;
+	uint32_t last = entries.size() - 1;
+
+	removeFromCell(idx);
+	lookup.erase(it);
+
+	if (idx != last) {
+		// move the last entry into the hole, and point its cell at
+		// the new index
+		auto& members = cells[entries[last].cell];
+		std::replace(members.begin(), members.end(), last, idx);
+
+		entries[idx] = entries[last];
+		lookup[entries[idx].ent] = idx;
+	}
+
+	entries.pop_back();
+}
+
+void spatialIndex::refresh(void) {
+	for (uint32_t i = 0; i < entries.size(); i++) {
+		entry& e = entries[i];
+		sceneNode::ptr node = e.ent->getNode();
+
+		if (node.get() == e.node && node->getTransformVersion() == e.version) {
+			continue;
+		}
+
+		e.node     = node.get();
+		e.version  = node->getTransformVersion();
+		e.position = node->getTransformTRS().position;
+
+		uint64_t cell = cellKey(cellCoord(e.position));
+
+		if (cell != e.cell) {
+			removeFromCell(i);
+			e.cell = cell;
+			addToCell(i);
+		}
+	}
+}
+
+void spatialIndex::clear(void) {
+	entries.clear();
+	lookup.clear();
+	cells.clear();
+}
+
+bool spatialIndex::matches(const entry& e, tagList tags) {
+	return e.ent->active && manager->hasComponents(e.ent, tags);
+}
+
+entity *spatialIndex::nearest(glm::vec3 position, tagList tags, float maxDist) {
+	std::vector<entity*> found;
+	nearest(position, 1, tags, found, maxDist);
+
+	return found.empty()? nullptr : found.front();
+}
+
+void spatialIndex::nearest(glm::vec3 position,
+                           unsigned k,
+                           tagList tags,
+                           std::vector<entity*>& out,
+                           float maxDist)
+{
+	if (k == 0 || entries.empty()) {
+		return;
+	}
+
+	// max heap of the closest k so far, farthest on top
+	std::vector<std::pair<float, entity*>> best;
+	float maxDist2 = maxDist*maxDist;
+	size_t visited = 0;
+
+	auto consider = [&] (uint32_t idx) {
+		const entry& e = entries[idx];
+		glm::vec3 diff = e.position - position;
+		float dist2 = glm::dot(diff, diff);
+
+		visited++;
+
+		if (dist2 > maxDist2
+		    || (best.size() == k && dist2 >= best.front().first)
+		    || !matches(e, tags))
+		{
+			return;
+		}
+
+		if (best.size() == k) {
+			std::pop_heap(best.begin(), best.end());
+			best.pop_back();
+		}
+
+		best.push_back({dist2, e.ent});
+		std::push_heap(best.begin(), best.end());
+	};
+
+	auto visitCell = [&] (glm::ivec3 cell) {
+		auto it = cells.find(cellKey(cell));
+
+		if (it != cells.end()) {
+			for (uint32_t idx : it->second) {
+				consider(idx);
+			}
+		}
+	};
+
+	glm::ivec3 center = cellCoord(position);
+	// distance from the position to the nearest face of its own cell,
+	// everything in ring r is at least this plus r - 1 cells away
+	glm::vec3 local = position - glm::vec3(center)*cellSize;
+	float margin = std::min({local.x, local.y, local.z,
+	                         cellSize - local.x,
+	                         cellSize - local.y,
+	                         cellSize - local.z});
+
+	// expanding shells of cells around the position
+	for (int r = 0; visited < entries.size(); r++) {
+		float reach = (r == 0)? 0.f : margin + (r - 1)*cellSize;
+
+		if (reach*reach > maxDist2
+		    || (best.size() == k && reach*reach >= best.front().first))
+		{
+			// everything unvisited is farther than what we have
+			break;
+		}
+
+		size_t side = 2*r + 1;
+		if (side*side*side > 8*cells.size()) {
+			// sparse enough that checking every cell is cheaper than
+			// walking more empty ones, restart with a plain scan
+			best.clear();
+
+			for (uint32_t i = 0; i < entries.size(); i++) {
+				consider(i);
+			}
+
+			break;
+		}
+
+		if (r == 0) {
+			visitCell(center);
+			continue;
+		}
+
+		// top and bottom faces, then the sides between them, then the
+		// front and back without the edges already visited
+		for (int x = -r; x <= r; x++) {
+			for (int z = -r; z <= r; z++) {
+				visitCell(center + glm::ivec3(x, -r, z));
+				visitCell(center + glm::ivec3(x,  r, z));
+			}
+		}
+
+		for (int y = -r + 1; y <= r - 1; y++) {
+			for (int z = -r; z <= r; z++) {
+				visitCell(center + glm::ivec3(-r, y, z));
+				visitCell(center + glm::ivec3( r, y, z));
+			}
+
+			for (int x = -r + 1; x <= r - 1; x++) {
+				visitCell(center + glm::ivec3(x, y, -r));
+				visitCell(center + glm::ivec3(x, y,  r));
+			}
+		}
+	}
+
+	std::sort_heap(best.begin(), best.end());
+
+	for (auto& [_, ent] : best) {
+		out.push_back(ent);
+	}
+}
+
+void spatialIndex::radius(glm::vec3 position,
+                          float dist,
+                          tagList tags,
+                          std::vector<entity*>& out)
+{
+	float dist2 = dist*dist;
+
+	auto consider = [&] (uint32_t idx) {
+		const entry& e = entries[idx];
+		glm::vec3 diff = e.position - position;
+
+		if (glm::dot(diff, diff) <= dist2 && matches(e, tags)) {
+			out.push_back(e.ent);
+		}
+	};
+
+	// counted in floats first, huge radii would overflow the cell coordinates
+	glm::vec3 lof = glm::floor((position - glm::vec3(dist)) / cellSize);
+	glm::vec3 hif = glm::floor((position + glm::vec3(dist)) / cellSize);
+	glm::vec3 span = hif - lof + glm::vec3(1);
+
+	if (span.x*span.y*span.z > cells.size()) {
+		// more cells in range than there are occupied ones
+		for (auto& [_, members] : cells) {
+			for (uint32_t idx : members) {
+				consider(idx);
+			}
+		}
+
+		return;
+	}
+
+	glm::ivec3 lo(lof);
+	glm::ivec3 hi(hif);
+
+	for (int x = lo.x; x <= hi.x; x++) {
+		for (int y = lo.y; y <= hi.y; y++) {
+			for (int z = lo.z; z <= hi.z; z++) {
+				auto it = cells.find(cellKey({x, y, z}));
+
+				if (it != cells.end()) {
+					for (uint32_t idx : it->second) {
+						consider(idx);
+					}
+				}
+			}
+		}
+	}
+}
+
+void spatialIndex::frustum(camera::ptr cam,
+                           tagList tags,
+                           std::vector<entity*>& out)
+{
+	for (auto& [_, members] : cells) {
+		// cells are culled as a whole by the position of their first member,
+		// all members share the same cell bounds
+		glm::vec3 min = glm::vec3(cellCoord(entries[members.front()].position))
+		              * cellSize;
+		AABB box = { .min = min, .max = min + glm::vec3(cellSize) };
+
+		if (!cam->boxInFrustum(box)) {
+			continue;
+		}
+
+		for (uint32_t idx : members) {
+			const entry& e = entries[idx];
+
+			if (cam->sphereInFrustum({e.position, 0.f}) && matches(e, tags)) {
+				out.push_back(e.ent);
+			}
+		}
+	}
+}
+
+// namespace grendx::ecs
+};
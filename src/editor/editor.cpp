@@ -144,12 +144,12 @@ buildClickableQueue(gameMain *game,
 	using namespace ecs;
 
 	auto entities = game->services.resolve<ecs::entityManager>();
-	auto drawable = entities->search<abstractShader>();
+	auto drawable = entities->view<abstractShader>();
 
 	multiRenderQueue que;
 	uint32_t renderID = 10;
 
-	for (entity *ent : drawable) {
+	for (entity *ent : *drawable) {
 		auto flags = ent->get<abstractShader>();
 		auto trans = ent->node->getTransformMatrix();
 		auto scenes = ent->getAll<sceneComponent>();
@@ -420,8 +420,8 @@ result<importPair> grendx::loadSceneData(std::string path) noexcept {
 
 	} else if (ext == ".map") {
 		std::cerr << "load_scene(): loading map: " << path << std::endl;
-		// TODO: need to detect and avoid recursive map loads,
-		//       otherwise this will loop and consume all memory
+		// maps loading other maps go through loadCachedSource(), which
+		// catches maps that include themselves
 		return loadMapData(path);
 	}
 
@@ -197,7 +197,7 @@ void gameEditor::loadInputBindings(gameMain *game) {
 
 				switch (ev.key.keysym.sym) {
 					case SDLK_i:
-						if (auto node = loadMapCompiled()) {
+						if (auto node = loadMapAsyncCompiled(game)) {
 							clear(game);
 							selectedNode = state->rootnode = *node;
 							runCallbacks(selectedNode, editAction::NewScene);
@@ -1,8 +1,15 @@
 #include <grend/gameEditor.hpp>
 #include <grend/loadScene.hpp>
+#include <grend/modelCache.hpp>
+#include <grend/jobQueue.hpp>
 #include <grend/utility.hpp>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <chrono>
 
 #include <imgui/imgui.h>
 #include <imgui/backends/imgui_impl_sdl.h>
@@ -39,73 +46,86 @@ static inline T parse_vec(std::string& str) {
 	return ret;
 }
 
-static modelMap xxx_load_model(std::string filename, std::string objName) {
-	auto ext = filename_extension(filename);
-	modelMap models;
+// (path, imported as a scene)
+using sourceKey = std::pair<std::string, bool>;
 
-	if (ext == ".obj") {
-		auto model = load_object(filename);
-		models[objName] = model;
+// Model and imported file nodes start out as empty placeholders while their
+// sources are imported, placeholders are filled in with the loaded nodes once
+// their source is ready.
+struct mapPlaceholder {
+	std::string    name;
+	sceneNode::ptr node;
+};
 
-	} else if (ext == ".gltf") {
-		models = load_gltf_models(filename);
-	}
+struct mapLoader {
+	typedef std::shared_ptr<mapLoader> ptr;
 
-	return models;
-}
+	// sources referenced by the map, in the order the parser found them
+	std::vector<sourceKey> sources;
+	std::map<sourceKey, std::vector<mapPlaceholder>> placeholders;
 
-// XXX: TODO: move to model loading code
-class modelCache {
-	public:
-		sceneModel::ptr getModel(std::string source, std::string name) {
-			if (sources.find(source) == sources.end()) {
-				sources[source] = xxx_load_model(source, name);
-			}
+	// called from the parser as soon as a new source is found, so imports
+	// can start while the rest of the map is still being read
+	std::function<void(const sourceKey&)> onSource;
+
+	json parse(std::istream& in);
+	sceneImport::ptr build(const std::string& filename, json& jay);
+
+	private:
+		void addSource(const json& obj, bool scene);
+		sceneNode::ptr loadNodes(const std::string& name, json& jay);
+};
 
-			modelMap& models = sources[source];
+void mapLoader::addSource(const json& obj, bool scene) {
+	auto it = obj.find("sourceFile");
 
-			// hmm... just added it to the map no?
-			return (models.find(name) != models.end())
-				? models[name]
-				: nullptr;
+	if (it == obj.end() || !it->is_string()) {
+		return;
+	}
+
+	sourceKey key = {it->get<std::string>(), scene};
+
+	if (placeholders.find(key) == placeholders.end()) {
+		placeholders[key] = {};
+		sources.push_back(key);
+
+		if (onSource) {
+			onSource(key);
 		}
+	}
+}
 
-		sceneImport::ptr getScene(std::string source) {
-			if (scenes.find(source) == scenes.end()) {
-				if (auto scene = loadSceneData(source)) {
-					auto [objs, models] = *scene;
-					scenes[source]  = objs;
-					sources[source] = models;
+json mapLoader::parse(std::istream& in) {
+	return json::parse(in,
+		[this] (int depth, json::parse_event_t event, json& parsed) {
+			// objects are complete at object_end, so the node type is known
+			// regardless of key order
+			if (event == json::parse_event_t::object_end && parsed.is_object()) {
+				auto type = parsed.find("type");
 
-				} else {
-					printError(scene);
-					scenes[source] = nullptr;
+				if (type != parsed.end() && *type == "Model") {
+					addSource(parsed, false);
+
+				} else if (type != parsed.end() && *type == "Imported file") {
+					addSource(parsed, true);
 				}
 			}
 
-			return scenes[source];
-		}
-
-		std::map<std::string, modelMap> sources;
-		std::map<std::string, sceneImport::ptr> scenes;
-};
+			return true;
+		});
+}
 
-// TODO: set to keep track of map files already being loaded to avoid
-//       recursive map loads
-sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
+sceneNode::ptr mapLoader::loadNodes(const std::string& name, json& jay) {
 	sceneNode::ptr ret = nullptr;
-	std::vector<std::string> modelFiles;
 	bool recurse = true;
 
 	if (jay["type"] == "Imported file") {
 		if (!jay["sourceFile"].is_null()) {
+			std::string source = jay["sourceFile"];
 			recurse = false;
 
-			if ((ret = cache.getScene(jay["sourceFile"])) == nullptr) {
-				std::cerr << "loadMap(): Unknown model "
-					<< jay["sourceFile"] << std::endl;
-				ret = std::make_shared<sceneNode>();
-			}
+			ret = std::make_shared<sceneImport>(source);
+			placeholders[{source, true}].push_back({name, ret});
 
 		} else {
 			// XXX: top-level map import nodes are exported without a sourceFile,
@@ -115,12 +135,15 @@ sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
 		}
 
 	} else if (jay["type"] == "Model") {
+		std::string source = jay["sourceFile"];
+		auto model = std::make_shared<sceneModel>();
 		recurse = false;
 
-		if ((ret = cache.getModel(jay["sourceFile"], name)) == nullptr) {
-			std::cerr << "loadMap(): Unknown model " << name << std::endl;
-			ret = std::make_shared<sceneNode>();
-		}
+		// sourceFile set so that saving before the model is loaded
+		// doesn't lose it
+		model->sourceFile = source;
+		ret = model;
+		placeholders[{source, false}].push_back({name, ret});
 
 	} else if (jay["type"] == "Point light") {
 		auto light = std::make_shared<sceneLightPoint>();
@@ -160,10 +183,10 @@ sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
 
 	} else if (jay["type"] == "Reflection probe"){
 		auto probe = std::make_shared<sceneReflectionProbe>();
-		auto bbox = jay["boundingBox"];
+		auto& bbox = jay["boundingBox"];
 
-		auto bmin = bbox["min"];
-		auto bmax = bbox["max"];
+		auto& bmin = bbox["min"];
+		auto& bmax = bbox["max"];
 
 		probe->is_static = jay["is_static"];
 		probe->boundingBox.min = glm::vec3(bmin[0], bmin[1], bmin[2]);
@@ -172,10 +195,10 @@ sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
 
 	} else if (jay["type"] == "Irradiance probe"){
 		auto probe = std::make_shared<sceneIrradianceProbe>();
-		auto bbox = jay["boundingBox"];
+		auto& bbox = jay["boundingBox"];
 
-		auto bmin = bbox["min"];
-		auto bmax = bbox["max"];
+		auto& bmin = bbox["min"];
+		auto& bmax = bbox["max"];
 
 		probe->is_static = jay["is_static"];
 		probe->boundingBox.min = glm::vec3(bmin[0], bmin[1], bmin[2]);
@@ -190,8 +213,6 @@ sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
 	auto& scale = jay["scale"];
 	auto& rot   = jay["rotation"];
 
-	//std::cerr << jay.dump(3) << std::endl;
-
 	TRS newtrans = ret->getTransformTRS();
 	newtrans.position = glm::vec3(pos[0], pos[1], pos[2]);
 	newtrans.scale    = glm::vec3(scale[0], scale[1], scale[2]);
@@ -201,9 +222,132 @@ sceneNode::ptr loadNodes(modelCache& cache, std::string name, json jay) {
 	if (recurse && !jay["nodes"].is_null()) {
 		for (auto& [name, ptr] : jay["nodes"].items()) {
 			if (!ptr.is_null()) {
-				setNode(name, ret, loadNodes(cache, name, ptr));
+				setNode(name, ret, loadNodes(name, ptr));
+			}
+		}
+	}
+
+	return ret;
+}
+
+sceneImport::ptr mapLoader::build(const std::string& filename, json& jay) {
+	sceneImport::ptr ret = std::make_shared<sceneImport>(filename);
+	sceneNode::ptr temp = loadNodes("", jay["root"]);
+
+	ret->setTransform(temp->getTransformTRS());
+
+	for (auto& [name, ptr] : temp->nodes) {
+		setNode(name, ret, ptr);
+	}
+
+	return ret;
+}
+
+// Fill in a placeholder with the contents of its loaded source, returns
+// false if there's nothing to fill it with, or if the placeholder was
+// removed from the tree in the meantime.
+//
+// Cached sources are shared between every placement (and every map) using
+// them, so the placeholder stays in the tree as the placement's own node,
+// holding its transform, and the source's nodes are linked under it without
+// changing their parent.
+static bool resolvePlaceholder(const mapPlaceholder& holder,
+                               const sourceKey& key,
+                               cachedSource::ptr source)
+{
+	auto parent = holder.node->parent.lock();
+
+	if (!parent) {
+		return false;
+	}
+
+	auto it = parent->nodes.find(holder.name);
+	if (it == parent->nodes.end() || it->second != holder.node) {
+		return false;
+	}
+
+	sceneNode::ptr node = nullptr;
+
+	if (source && key.second) {
+		auto imported = std::static_pointer_cast<sceneImport>(holder.node);
+		imported->animations = source->scene->animations;
+		node = source->scene;
+
+	} else if (source) {
+		sceneModel::ptr model = nullptr;
+		auto found = source->models.find(holder.name);
+
+		if (found != source->models.end()) {
+			model = found->second;
+
+		} else if (source->models.size() == 1) {
+			// .obj models get names made up from the filename, which
+			// won't match the node name
+			model = source->models.begin()->second;
+		}
+
+		if (model) {
+			auto placed = std::static_pointer_cast<sceneModel>(holder.node);
+			placed->modelName    = model->modelName;
+			placed->compiled     = model->compiled;
+			placed->comped_model = model->comped_model;
+			node = model;
+		}
+	}
+
+	if (!node) {
+		std::cerr << "loadMap(): Unknown model " << key.first
+			<< " (" << holder.name << ")" << std::endl;
+		return false;
+	}
+
+	for (auto& [name, ptr] : node->nodes) {
+		// meshes keep the cached model as their parent, which is what
+		// physics and skinning look up model data through
+		setNodeXXX(name, holder.node, ptr);
+	}
+
+	return true;
+}
+
+static bool isMapFile(const std::string& path) {
+	return filename_extension(path) == ".map";
+}
+
+static std::map<sourceKey, cachedSource::ptr>
+importSources(const std::vector<sourceKey>& keys) {
+	std::vector<cachedSource::ptr> loaded(keys.size());
+	std::vector<std::future<void>> workers;
+	std::atomic<size_t> next(0);
+
+	auto worker = [&] () {
+		for (size_t i; (i = next++) < keys.size();) {
+			if (!isMapFile(keys[i].first)) {
+				loaded[i] = loadCachedSource(keys[i].first, keys[i].second);
 			}
 		}
+	};
+
+	unsigned threads = max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < min(size_t(threads), keys.size()); i++) {
+		workers.push_back(std::async(std::launch::async, worker));
+	}
+
+	// maps can include other maps, these are loaded from this thread
+	// so that loadCachedSource() can catch maps that include themselves
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (isMapFile(keys[i].first)) {
+			loaded[i] = loadCachedSource(keys[i].first, keys[i].second);
+		}
+	}
+
+	for (auto& w : workers) {
+		w.wait();
+	}
+
+	std::map<sourceKey, cachedSource::ptr> ret;
+	for (size_t i = 0; i < keys.size(); i++) {
+		ret[keys[i]] = loaded[i];
 	}
 
 	return ret;
@@ -220,20 +364,19 @@ grendx::loadMapData(std::string name) noexcept {
 	}
 
 	try {
-		sceneImport::ptr ret = std::make_shared<sceneImport>(name);
-		json j;
-		foo >> j;
-
-		// XXX: again TODO
-		modelCache cache;
+		mapLoader loader;
+		json j = loader.parse(foo);
+		sceneImport::ptr ret = loader.build(name, j);
 		modelMap retmodels;
 
-		sceneNode::ptr temp = loadNodes(cache, "", j["root"]);
-		ret->setTransform(temp->getTransformTRS());
-		ret->nodes = temp->nodes;
+		for (auto& [key, source] : importSources(loader.sources)) {
+			for (auto& holder : loader.placeholders[key]) {
+				resolvePlaceholder(holder, key, source);
+			}
 
-		for (auto& [name, ptr] : cache.sources) {
-			retmodels.insert(ptr.begin(), ptr.end());
+			if (source) {
+				retmodels.insert(source->models.begin(), source->models.end());
+			}
 		}
 
 		return importPair {ret, retmodels};
@@ -258,6 +401,83 @@ grendx::loadMapCompiled(std::string name) noexcept {
 	}
 }
 
+// sources being imported for loadMapAsyncCompiled(), finished ones are
+// picked up from the main thread by updateMapLoads() rather than having the
+// import job queue a deferred job, which takes the job queue lock from
+// inside a job
+struct pendingSource {
+	mapLoader::ptr loader;
+	sourceKey key;
+	std::shared_ptr<cachedSource::ptr> source;
+	std::future<bool> done;
+};
+
+static std::vector<pendingSource> pendingSources;
+
+void grendx::updateMapLoads(void) {
+	for (auto it = pendingSources.begin(); it != pendingSources.end();) {
+		auto status = it->done.wait_for(std::chrono::seconds(0));
+
+		if (status != std::future_status::ready) {
+			it++;
+			continue;
+		}
+
+		// placeholders are all in place by now, loadMapAsyncCompiled()
+		// builds the tree before returning
+		cachedSource::ptr source = *it->source;
+
+		if (source) {
+			compileModels(source->models);
+		}
+
+		for (auto& holder : it->loader->placeholders[it->key]) {
+			resolvePlaceholder(holder, it->key, source);
+		}
+
+		it = pendingSources.erase(it);
+	}
+}
+
+grendx::result<sceneImport::ptr>
+grendx::loadMapAsyncCompiled(gameMain *game, std::string name) noexcept {
+	std::ifstream foo(name);
+	std::cerr << "loading map (async) " << name << std::endl;
+
+	if (!foo.good()) {
+		std::string asdf = "couldn't open map file: " + name;
+		return invalidResult(asdf);
+	}
+
+	auto jobs   = game->services.resolve<jobQueue>();
+	auto loader = std::make_shared<mapLoader>();
+
+	std::weak_ptr<mapLoader> weakLoader = loader;
+
+	loader->onSource = [=] (const sourceKey& key) {
+		auto source = std::make_shared<cachedSource::ptr>();
+
+		auto done = jobs->addAsync([=] () {
+			*source = loadCachedSource(key.first, key.second);
+			return *source != nullptr;
+		});
+
+		// keeps the loader alive until all placeholders are resolved
+		pendingSources.push_back({weakLoader.lock(), key, source, std::move(done)});
+	};
+
+	try {
+		json j = loader->parse(foo);
+		return loader->build(name, j);
+
+	} catch (std::exception& e) {
+		std::cerr << "loadMap(): couldn't parse " << name
+			<< ": " << e.what() << std::endl;
+
+		return invalidResult(e.what());
+	}
+}
+
 template <typename T>
 static inline std::string format_vec(T& vec) {
 	std::string ret = "";
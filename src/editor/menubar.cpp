@@ -32,7 +32,7 @@ static void handle_prompts(gameEditor *editor, gameMain *game) {
 		std::cout << "Opening a file here! at " << open_dialog.selection <<  std::endl;
 		open_dialog.clear();
 
-		if (auto node = loadMapCompiled(open_dialog.selection)) {
+		if (auto node = loadMapAsyncCompiled(game, open_dialog.selection)) {
 			editor->clear(game);
 			editor->selectedNode = state->rootnode = *node;
 		} else printError(node);
@@ -77,7 +77,7 @@ static void handle_prompts(gameEditor *editor, gameMain *game) {
 		          << import_map_dialog.selection << std::endl;
 		import_map_dialog.clear();
 
-		if (auto res = loadMapCompiled(import_map_dialog.selection)) {
+		if (auto res = loadMapAsyncCompiled(game, import_map_dialog.selection)) {
 			auto obj = *res;
 			std::string name = "map["+std::to_string(obj->id)+"]";
 			setNode(name, editor->selectedNode, obj);
@@ -1,4 +1,5 @@
 #include <grend/gameEditor.hpp>
+#include <grend/textureResidency.hpp>
 
 #include <imgui/imgui.h>
 #include <imgui/backends/imgui_impl_sdl.h>
@@ -23,7 +24,8 @@ void gameEditor::metricsWindow(gameMain *game) {
 
 	std::string meshes =
 		std::to_string(game->metrics.drawnMeshes)
-		+ " meshes drawn";
+		+ " meshes drawn ("
+		+ std::to_string(game->metrics.occludedMeshes) + " occluded)";
 
 	float bufmb = dbgGlmanBuffered/1048576.f;
 	float texmb = dbgGlmanTexturesBuffered/1048576.f;
@@ -33,6 +35,12 @@ void gameEditor::metricsWindow(gameMain *game) {
 	std::string textures = "Textures: " + std::to_string(texmb) + "MiB";
 	std::string total = "Total: " + std::to_string(totalmb) + "MiB";
 
+	auto residency = getTextureResidencyStats();
+	std::string streamed =
+		"Streamed textures: " + std::to_string(residency.managed)
+		+ " (" + std::to_string(residency.evicted) + " evicted, "
+		+ std::to_string(residency.reloading) + " reloading)";
+
 #if GREND_ERROR_CHECK
 	std::string devbuild = "Debug build";
 	if (GL_ERROR_CHECK_ENABLED()) {
@@ -47,6 +55,7 @@ void gameEditor::metricsWindow(gameMain *game) {
 	ImGui::Text("%s", buffered.c_str());
 	ImGui::Text("%s", textures.c_str());
 	ImGui::Text("%s", total.c_str());
+	ImGui::Text("%s", streamed.c_str());
 
 	ImGui::End();
 }
@@ -32,6 +32,11 @@ void gameEditor::settingsWindow(gameMain *game) {
 	ImGui::InputScalar("Resolution (Y)", ImGuiDataType_U32, &settings.targetResY, &showSteps);
 	ImGui::InputScalar("MSAA level", ImGuiDataType_U32, &settings.msaaLevel, &showSteps);
 	ImGui::InputScalar("Anisotropic filtering samples", ImGuiDataType_U32, &settings.anisotropicFilterLevel, &showSteps);
+	ImGui::InputScalar("Texture memory budget (MiB, 0 = unlimited)", ImGuiDataType_U32, &settings.textureBudgetMB, &showSteps);
+	ImGui::InputFloat("LOD error (pixels)", &settings.lodError);
+	ImGui::InputFloat("Shadow/probe LOD error (pixels)", &settings.lodErrorShadows);
+	ImGui::Checkbox("Occlusion culling", &settings.occlusionCulling);
+	ImGui::Checkbox("Compute skinning", &settings.computeSkinning);
 
 	if (ImGui::Button("Apply")) {
 		rend->applySettings(settings);
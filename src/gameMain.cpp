@@ -9,6 +9,8 @@
 #include <grend/glManager.hpp>
 #include <grend/gameView.hpp>
 #include <grend/jobQueue.hpp>
+#include <grend/textureResidency.hpp>
+#include <grend/loadScene.hpp>
 #include <grend/audioMixer.hpp>
 
 #include <grend/ecs/ecs.hpp>
@@ -74,6 +76,7 @@ void gameMain::applySettings(const renderSettings& newSettings) {
 
 void gameMain::clearMetrics(void) {
 	metrics.drawnMeshes = 0;
+	metrics.occludedMeshes = 0;
 }
 
 int gameMain::step(void) {
@@ -111,6 +114,7 @@ int gameMain::step(void) {
 		profile::endGroup();
 
 		profile::startGroup("Syncronous jobs");
+		updateMapLoads();
 
 		{
 			// spread long-running syncronous job batches across multiple frames
@@ -137,6 +141,11 @@ int gameMain::step(void) {
 		}
 		profile::endGroup();
 
+		profile::startGroup("Texture streaming");
+		updateTextureResidency(jobs, size_t(rend->settings.textureBudgetMB) << 20);
+		streamTextures();
+		profile::endGroup();
+
 		profile::startGroup("Render");
 		setDefaultGlFlags();
 		rend->framebuffer->clear();
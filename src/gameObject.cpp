@@ -3,6 +3,9 @@
 #include <grend/utility.hpp>
 #include <math.h>
 
+#include <unordered_map>
+#include <functional>
+
 using namespace grendx;
 
 sceneNode::~sceneNode() {
@@ -28,16 +31,6 @@ size_t grendx::allocateObjID(void) {
 	return ++counter;
 }
 
-// TODO: should have this return a const ref
-TRS sceneNode::getTransformTRS() {
-	return transform;
-}
-
-// TODO: should have this return a const ref
-TRS sceneNode::getOrigTransform() {
-	return origTransform;
-}
-
 // TODO: also const ref
 glm::mat4 sceneNode::getTransformMatrix() {
 	if (updated) {
@@ -57,6 +50,7 @@ void sceneNode::setTransform(const TRS& t) {
 	updated = true;
 	queueCache.updated = true;
 	isDefault = false;
+	transformVersion++;
 	transform = t;
 }
 
@@ -89,6 +83,7 @@ sceneNode::ptr grendx::unlink(sceneNode::ptr node) {
 				if (node == ptr) {
 					sceneNode::ptr ret = p;
 					p->nodes.erase(key);
+					p->markStructureChanged();
 					node->parent.reset();
 					return ret;
 				}
@@ -113,6 +108,7 @@ sceneNode::ptr grendx::clone(sceneNode::ptr node) {
 
 static animationMap::ptr copyAnimationMap(animationMap::ptr anim) {
 	auto ret = std::make_shared<animationMap>();
+	ret->endtime = anim->endtime;
 
 	for (auto& p : *anim) {
 		ret->insert(p);
@@ -192,6 +188,8 @@ static void copySkin(sceneSkin::ptr target, sceneSkin::ptr skin) {
 	for (auto& [name, ptr] : skin->nodes) {
 		setNode(name, target, copySkinNodes(target, skin, ptr));
 	}
+
+	target->buildHierarchy();
 }
 
 sceneNode::ptr grendx::duplicate(sceneNode::ptr node) {
@@ -271,6 +269,7 @@ void sceneNode::removeNode(std::string name) {
 
 	if (it != nodes.end()) {
 		nodes.erase(it);
+		markStructureChanged();
 	}
 }
 
@@ -291,62 +290,110 @@ float sceneLightDirectional::extent(float threshold) {
 	return HUGE_VALF;
 }
 
-// TODO: better name
-static glm::mat4 lookup(std::map<sceneNode*, glm::mat4>& cache,
-                        sceneNode *root,
-                        sceneNode *ptr)
-{
-	auto it = cache.find(ptr);
+void sceneSkin::buildHierarchy(void) {
+	hierarchy.nodes.clear();
+	hierarchy.parents.clear();
+	hierarchy.jointNodes.clear();
 
-	if (it == cache.end()) {
-		sceneNode::ptr parent = ptr->parent.lock();
-		glm::mat4 mat(1);
+	std::unordered_map<sceneNode*, int32_t> indices;
 
-		if (ptr != root && parent) {
-			mat = lookup(cache, root, parent.get()) * ptr->getTransformMatrix();
-		}
+	// adds ancestors before the node, so parents end up in front
+	std::function<int32_t(sceneNode::ptr)> addNode =
+		[&] (sceneNode::ptr node) -> int32_t {
+			if (node.get() == this) {
+				return -1;
+			}
+
+			auto it = indices.find(node.get());
+			if (it != indices.end()) {
+				return it->second;
+			}
+
+			sceneNode::ptr parent = node->parent.lock();
+			if (!parent) {
+				// not attached to anything, identity like the skin itself
+				return -1;
+			}
+
+			int32_t p = addNode(parent);
+			int32_t idx = hierarchy.nodes.size();
 
-		cache[ptr] = mat;
-		return mat;
+			hierarchy.nodes.push_back(node);
+			hierarchy.parents.push_back(p);
+			indices[node.get()] = idx;
+			return idx;
+		};
 
-	} else {
-		return it->second;
+	for (auto& jnt : joints) {
+		hierarchy.jointNodes.push_back(jnt? addNode(jnt) : -1);
 	}
+
+	hierarchy.versions.assign(hierarchy.nodes.size(), 0);
+	hierarchy.world.resize(hierarchy.nodes.size());
+	paletteValid = false;
 }
 
-void sceneSkin::sync(Program::ptr program) { 
-	size_t numjoints = min(inverseBind.size(), 256);
+bool sceneSkin::update(void) {
+	if (hierarchy.jointNodes.size() != joints.size()) {
+		buildHierarchy();
+	}
 
-	if (transforms.size() != inverseBind.size()) {
-		transforms.resize(inverseBind.size());
+	auto& h = hierarchy;
+	bool changed = !paletteValid || transforms.size() != inverseBind.size();
+
+	for (size_t i = 0; i < h.nodes.size(); i++) {
+		unsigned version = h.nodes[i]->getTransformVersion();
+
+		if (version != h.versions[i]) {
+			h.versions[i] = version;
+			changed = true;
+		}
 	}
 
-#if GLSL_VERSION >= 300
-	// use UBOs on gles3, core profiles
-	if (!ubuffer) {
-		ubuffer = genBuffer(GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
-		//ubuffer->allocate(sizeof(GLfloat[16*numjoints]));
-		ubuffer->allocate(sizeof(GLfloat[16*256]));
+	if (!changed) {
+		return false;
+	}
+
+	transforms.resize(inverseBind.size());
+
+	for (size_t i = 0; i < h.nodes.size(); i++) {
+		// XXX: getTransformMatrix() writes its cache, computing the matrix
+		//      here keeps this safe to run on other threads
+		glm::mat4 local = h.nodes[i]->getTransformTRS().getTransform();
+		int32_t p = h.parents[i];
+
+		h.world[i] = (p < 0)? local : h.world[p] * local;
 	}
-#endif
 
-	std::map<sceneNode*, glm::mat4> accumTransforms;
+	for (size_t i = 0; i < inverseBind.size(); i++) {
+		int32_t idx = (i < h.jointNodes.size())? h.jointNodes[i] : -1;
 
-	for (unsigned i = 0; i < inverseBind.size(); i++) {
-		if (!joints[i]) {
+		if (i >= joints.size() || !joints[i]) {
 			transforms[i] = glm::mat4(1);
-			continue;
+		} else if (idx < 0) {
+			transforms[i] = inverseBind[i];
+		} else {
+			transforms[i] = h.world[idx] * inverseBind[i];
 		}
-
-		glm::mat4 accum = lookup(accumTransforms, this, joints[i].get());
-		transforms[i] = accum*inverseBind[i];
 	}
 
+	paletteValid = true;
+	uploaded = false;
+	paletteVersion++;
+	return true;
+}
+
+void sceneSkin::sync(Program::ptr program) { 
+	size_t numjoints = min(inverseBind.size(), 256);
+
+	// no-op if the palette was already updated this frame, see updateSkins()
+	update();
+
 #if GLSL_VERSION < 300
-	// no UBOs on gles2
+	// no UBOs on gles2, uniforms are per-program so always need to be set
 	for (unsigned i = 0; i < transforms.size(); i++) {
 		std::string sloc = "joints["+std::to_string(i)+"]";
-		if (!prog->set(sloc, transforms[i])) {
+		if (!program->set(sloc, transforms[i])) {
 			std::cerr <<
 				"NOTE: couldn't set joint matrix " << i
 				<< ", too many joints/wrong shader?" << std::endl;
@@ -354,7 +401,19 @@ void sceneSkin::sync(Program::ptr program) {
 		}
 	}
 #else
-	ubuffer->update(transforms.data(), 0, sizeof(GLfloat[16*numjoints]));
+	// use UBOs on gles3, core profiles
+	if (!ubuffer) {
+		ubuffer = genBuffer(GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+		//ubuffer->allocate(sizeof(GLfloat[16*numjoints]));
+		ubuffer->allocate(sizeof(GLfloat[16*256]));
+		uploaded = false;
+	}
+
+	if (!uploaded) {
+		ubuffer->update(transforms.data(), 0, sizeof(GLfloat[16*numjoints]));
+		uploaded = true;
+	}
+
 	program->setUniformBlock("jointTransforms", ubuffer, UBO_JOINTS);
 #endif
 }
@@ -1,5 +1,6 @@
 #include <grend/glManager.hpp>
 #include <grend/sceneModel.hpp>
+#include <grend/textureFormats.hpp>
 #include <SDL.h>
 #include <string.h>
 
@@ -27,6 +28,9 @@ static std::map<uint32_t, Texture::weakptr>           textureCache;
 
 static bool enabled_float_buffers = false;
 static bool enabled_halffloat_buffers = false;
+static bool enabled_etc2_textures = false;
+static bool enabled_s3tc_textures = false;
+static bool enabled_bptc_textures = false;
 
 bool haveFloatBuffers(void) {
 #if defined(CORE_FLOATING_POINT_BUFFERS)
@@ -36,6 +40,27 @@ bool haveFloatBuffers(void) {
 #endif
 }
 
+bool haveCompressedFormat(materialTexture::blockFormat format) {
+	switch (format) {
+		case materialTexture::blockFormat::Uncompressed:
+			return true;
+
+		case materialTexture::blockFormat::ETC2_RGB:
+		case materialTexture::blockFormat::ETC2_RGBA:
+			return enabled_etc2_textures;
+
+		case materialTexture::blockFormat::BC1:
+		case materialTexture::blockFormat::BC3:
+			return enabled_s3tc_textures;
+
+		case materialTexture::blockFormat::BC7:
+			return enabled_bptc_textures;
+
+		default:
+			return false;
+	}
+}
+
 void initializeOpengl(void) {
 	int maxImageUnits = 0;
 	int maxCombined = 0;
@@ -85,8 +110,23 @@ void initializeOpengl(void) {
 
 		if (strcmp(str, "EXT_color_buffer_half_float") == 0)
 			enabled_halffloat_buffers = true;
+
+		if (strcmp(str, "GL_ARB_ES3_compatibility") == 0)
+			enabled_etc2_textures = true;
+
+		if (strcmp(str, "GL_EXT_texture_compression_s3tc") == 0)
+			enabled_s3tc_textures = true;
+
+		if (strcmp(str, "GL_ARB_texture_compression_bptc") == 0
+		    || strcmp(str, "GL_EXT_texture_compression_bptc") == 0)
+			enabled_bptc_textures = true;
 	}
 
+#if GLSL_VERSION == 300 || GLSL_VERSION >= 430
+	// ETC2 is core in GLES 3.0 and OpenGL 4.3
+	enabled_etc2_textures = true;
+#endif
+
 	if (maxImageUnits < TEXU_MAX) {
 		throw std::logic_error("This GPU doesn't allow enough texture bindings!");
 	}
@@ -172,7 +212,12 @@ Texture::ptr texcache(materialTexture::ptr tex, bool srgb) {
 		return nullptr;
 	}
 
-	uint32_t hash = dumbhash(tex->pixels);
+	if (!tex->hashed) {
+		tex->hash   = dumbhash(tex->pixels);
+		tex->hashed = true;
+	}
+
+	uint32_t hash = tex->hash;
 	auto it = textureCache.find(hash);
 
 	if (it != textureCache.end()) {
@@ -183,6 +228,23 @@ Texture::ptr texcache(materialTexture::ptr tex, bool srgb) {
 		}
 	}
 
+	if (tex->released) {
+		// only container textures are released, read the file again
+		materialTexture reloaded;
+
+		if (tex->sourceFile.empty()
+		    || !loadImageFile(reloaded, tex->sourceFile))
+		{
+			SDL_Log("texcache(): texture %08x was released before it could be rebuffered", hash);
+			return nullptr;
+		}
+
+		tex->pixels   = std::move(reloaded.pixels);
+		tex->mips     = std::move(reloaded.mips);
+		tex->size     = reloaded.size;
+		tex->released = false;
+	}
+
 	Texture::ptr ret = genTexture();
 
 	textureCache[hash] = ret;
@@ -117,6 +117,23 @@ Program::ptr loadProgram(std::string vert,
 	return prog;
 }
 
+#if GLSL_VERSION >= 430
+Program::ptr loadComputeProgram(std::string comp,
+                                const Shader::parameters& opts)
+{
+	Program::ptr prog = genProgram();
+
+	prog->compute = genShader(GL_COMPUTE_SHADER);
+	prog->compute->load(comp, opts);
+
+	glAttachShader(prog->obj, prog->compute->obj);
+	DO_ERROR_CHECK();
+
+	prog->link();
+	return prog;
+}
+#endif
+
 bool Program::link(void) {
 	glLinkProgram(obj);
 	glGetProgramiv(obj, GL_LINK_STATUS, &linked);
@@ -144,7 +161,16 @@ std::string Program::log(void) {
 }
 
 bool Program::reload(void) {
-	if (vertex && fragment) {
+	if (compute) {
+		if (compute->reload()) {
+			uniforms.clear();
+			storageBlocks.clear();
+			valueCache.clear();
+
+			return link();
+		}
+
+	} else if (vertex && fragment) {
 		if (vertex->reload() && fragment->reload()) {
 			for (auto& [attr, location] : attributes) {
 				glBindAttribLocation(obj, location, attr.c_str());
@@ -283,8 +309,17 @@ bool Program::setUniformBlock(std::string name, Buffer::ptr buf, GLuint binding)
 bool Program::setStorageBlock(std::string name, Buffer::ptr buf, GLuint binding) {
 	GLuint loc = lookupStorageBlock(name);
 	DO_ERROR_CHECK();
-	// TODO:
-	//glUniformBlockBinding(obj, loc, buf->obj);
+
+#if GLSL_VERSION >= 430
+	if (loc != GL_INVALID_INDEX) {
+		glShaderStorageBlockBinding(obj, loc, binding);
+		DO_ERROR_CHECK();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buf->obj);
+		DO_ERROR_CHECK();
+		return true;
+	}
+#endif
+
 	return false;
 }
 
@@ -330,14 +365,21 @@ GLuint Program::lookupStorageBlock(std::string name) {
 		return it->second;
 
 	} else {
-		/*
-		GLuint temp = glGetUniformBlockIndex(obj, name.c_str());
-		uniformBlocks[name] = temp;
+#if GLSL_VERSION >= 430
+		GLuint temp = glGetProgramResourceIndex(obj, GL_SHADER_STORAGE_BLOCK,
+		                                        name.c_str());
+		storageBlocks[name] = temp;
 		DO_ERROR_CHECK();
+
+		if (temp == GL_INVALID_INDEX) {
+			SDL_Log("Could not find storage block index for %s", name.c_str());
+		}
+
 		return temp;
-		*/
-		// TODO:
-		return 0;
+#else
+		// no storage buffers before 4.3
+		return GL_INVALID_INDEX;
+#endif
 	}
 }
 
@@ -1,5 +1,7 @@
 #include <grend/glManager.hpp>
 #include <grend/glmIncludes.hpp>
+#include <grend/utility.hpp>
+#include <grend/textureResidency.hpp>
 
 #include <stb/stb_image.h>
 #include <stb/stb_image_write.h>
@@ -7,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
 
 #include <fstream>
 #include <iostream>
@@ -31,9 +34,220 @@ static inline void srgb_to_linear(std::vector<uint8_t>& pixels) {
 	}
 }
 
+// block compression enums, may be missing from GLES headers
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT        0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT       0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       0x83F3
+#endif
+
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM          0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM    0x8E8D
+#endif
+
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2                0x9274
+#define GL_COMPRESSED_SRGB8_ETC2               0x9275
+#define GL_COMPRESSED_RGBA8_ETC2_EAC           0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC    0x9279
+#endif
+
+static GLenum compressedGlFormat(const materialTexture& tex, bool srgb) {
+	switch (tex.format) {
+		case materialTexture::blockFormat::ETC2_RGB:
+			return srgb? GL_COMPRESSED_SRGB8_ETC2 : GL_COMPRESSED_RGB8_ETC2;
+
+		case materialTexture::blockFormat::ETC2_RGBA:
+			return srgb? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+			           : GL_COMPRESSED_RGBA8_ETC2_EAC;
+
+		case materialTexture::blockFormat::BC1:
+			if (tex.channels == 3) {
+				return srgb? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+				           : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+			}
+
+			return srgb? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+			           : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+
+		case materialTexture::blockFormat::BC3:
+			return srgb? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+			           : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+		case materialTexture::blockFormat::BC7:
+			return srgb? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+			           : GL_COMPRESSED_RGBA_BPTC_UNORM;
+
+		default:
+			return GL_RGBA;
+	}
+}
+
+// textures with levels left to upload, see streamTextures()
+static std::list<Texture::weakptr> streamingTextures;
+
+void Texture::uploadLevel(unsigned level) {
+	auto& mip = pending->mips[level];
+	const uint8_t *data = pending->pixels.data() + mip.offset;
+
+	blockCompressed = pending->compressed();
+	dataFormat      = surfaceGlFormat(pending->channels);
+
+	if (blockCompressed) {
+		internalFormat = compressedGlFormat(*pending, pendingSrgb);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat,
+		                       mip.width, mip.height, 0, mip.size, data);
+
+	} else {
+#ifdef NO_FORMAT_CONVERSION
+		std::vector<uint8_t> temp(data, data + mip.size);
+
+		if (pendingSrgb) {
+			srgb_to_linear(temp);
+		}
+
+		internalFormat = dataFormat;
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, mip.width, mip.height,
+		             0, dataFormat, GL_UNSIGNED_BYTE, temp.data());
+#else
+		internalFormat = pendingSrgb? GL_SRGB_ALPHA : GL_RGBA;
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, mip.width, mip.height,
+		             0, dataFormat, GL_UNSIGNED_BYTE, data);
+#endif
+	}
+
+	DO_ERROR_CHECK();
+
+	baseLevel = level;
+#if GLSL_VERSION > 100
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+	DO_ERROR_CHECK();
+#endif
+
+	currentSize = glmanDbgUpdateTextures(currentSize,
+	                                     currentSize - levelSizes[level] + mip.size);
+	levelSizes[level] = mip.size;
+}
+
+bool Texture::streamNextLevel(void) {
+	if (!pending) {
+		return false;
+	}
+
+	if (baseLevel > targetLevel) {
+		bind();
+		uploadLevel(baseLevel - 1);
+	}
+
+	if (baseLevel <= targetLevel) {
+		pending->releasePixels();
+		pending.reset();
+		return false;
+	}
+
+	return true;
+}
+
+void Texture::streamFrom(materialTexture::ptr tex, unsigned level) {
+	reloading = false;
+
+	if (!tex || tex->mips.size() != levels()
+	    || tex->width != width || tex->height != height)
+	{
+		// source changed on disk, stop managing this one
+		SDL_Log("Texture::streamFrom(): %s doesn't match the loaded texture",
+		        sourceFile.c_str());
+		sourceFile.clear();
+		return;
+	}
+
+	if (level >= baseLevel) {
+		// already resident
+		return;
+	}
+
+	pending     = tex;
+	targetLevel = level;
+	streamingTextures.push_back(weak_from_this());
+}
+
+void Texture::dropLevels(unsigned level) {
+#if GLSL_VERSION > 100
+	if (level >= levels()) {
+		return;
+	}
+
+	if (pending) {
+		targetLevel = max(targetLevel, level);
+
+		if (baseLevel <= targetLevel) {
+			pending->releasePixels();
+			pending.reset();
+		}
+	}
+
+	if (level <= baseLevel) {
+		return;
+	}
+
+	glActiveTexture(TEX_GL_SCRATCH);
+	bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+	// respecifying a level with no size frees it
+	for (unsigned i = baseLevel; i < level; i++) {
+		if (blockCompressed) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat,
+			                       0, 0, 0, 0, nullptr);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, i, internalFormat, 0, 0,
+			             0, dataFormat, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		currentSize = glmanDbgUpdateTextures(currentSize,
+		                                     currentSize - levelSizes[i]);
+		levelSizes[i] = 0;
+	}
+
+	DO_ERROR_CHECK();
+	baseLevel = level;
+#endif
+}
+
+void streamTextures(size_t maxBytes) {
+	size_t uploaded = 0;
+	// avoid clobbering material texture bindings
+	glActiveTexture(TEX_GL_SCRATCH);
+
+	// round-robin over streaming textures, so that everything gets to the
+	// next mip level before anything gets to full resolution
+	while (!streamingTextures.empty() && uploaded < maxBytes) {
+		Texture::ptr tex = streamingTextures.front().lock();
+		streamingTextures.pop_front();
+
+		if (!tex || !tex->streaming()) {
+			continue;
+		}
+
+		size_t before = tex->currentSize;
+		if (tex->streamNextLevel()) {
+			streamingTextures.push_back(tex);
+		}
+
+		uploaded += tex->currentSize - before;
+	}
+}
+
 void Texture::buffer(materialTexture::ptr tex, bool srgb) {
-	SDL_Log(" > buffering image: w = %u, h = %u, bytesperpixel: %u\n",
-	        tex->width, tex->height, tex->channels);
+	SDL_Log(" > buffering image: w = %u, h = %u, bytesperpixel: %u, mips: %lu\n",
+	        tex->width, tex->height, tex->channels, tex->mips.size());
 
 	GLenum texformat = surfaceGlFormat(tex->channels);
 	bind();
@@ -44,33 +258,37 @@ void Texture::buffer(materialTexture::ptr tex, bool srgb) {
 		srgb = false;
 	}
 
+	bool precomputedMips = !tex->mips.empty();
+
+	if (!precomputedMips) {
 #ifdef NO_FORMAT_CONVERSION
-	// XXX: need something more efficient
-	std::vector<uint8_t> temp = tex->pixels;
+		// XXX: need something more efficient
+		std::vector<uint8_t> temp = tex->pixels;
 
-	if (srgb) {
-		srgb_to_linear(temp);
-	}
+		if (srgb) {
+			srgb_to_linear(temp);
+		}
 
-	// TODO: fallback SRBG conversion
-	glTexImage2D(GL_TEXTURE_2D,
-	             //0, srgb? GL_SRGB_ALPHA : GL_RGBA, tex.width, tex.height,
-	             0, texformat, tex->width, tex->height,
-	             0, texformat, GL_UNSIGNED_BYTE, temp.data());
+		// TODO: fallback SRBG conversion
+		glTexImage2D(GL_TEXTURE_2D,
+		             //0, srgb? GL_SRGB_ALPHA : GL_RGBA, tex.width, tex.height,
+		             0, texformat, tex->width, tex->height,
+		             0, texformat, GL_UNSIGNED_BYTE, temp.data());
 
-	/*
-	glTexImage2D(GL_TEXTURE_2D,
-	             0, texformat, tex->width, tex->height,
-	             0, texformat, GL_UNSIGNED_BYTE, tex->pixels.data());
-				 */
+		/*
+		glTexImage2D(GL_TEXTURE_2D,
+		             0, texformat, tex->width, tex->height,
+		             0, texformat, GL_UNSIGNED_BYTE, tex->pixels.data());
+					 */
 
 #else
-	glTexImage2D(GL_TEXTURE_2D,
-	             0, srgb? GL_SRGB_ALPHA : GL_RGBA, tex->width, tex->height,
-	             0, texformat, GL_UNSIGNED_BYTE, tex->pixels.data());
+		glTexImage2D(GL_TEXTURE_2D,
+		             0, srgb? GL_SRGB_ALPHA : GL_RGBA, tex->width, tex->height,
+		             0, texformat, GL_UNSIGNED_BYTE, tex->pixels.data());
 #endif
 
-	DO_ERROR_CHECK();
+		DO_ERROR_CHECK();
+	}
 
 	// initialize with defaults just in case, should never be needed
 	GLenum min = GL_LINEAR_MIPMAP_LINEAR;
@@ -149,6 +367,50 @@ void Texture::buffer(materialTexture::ptr tex, bool srgb) {
 // defined(GL_TEXTURE_MAX_ANISOTROPY_EXT)
 #endif
 
+	if (precomputedMips) {
+		unsigned levels = tex->mips.size();
+		pending     = tex;
+		pendingSrgb = srgb;
+		baseLevel   = levels;
+		targetLevel = 0;
+		width       = tex->width;
+		height      = tex->height;
+		sourceFile  = tex->sourceFile;
+		levelSizes.assign(levels, 0);
+
+#if GLSL_VERSION > 100
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+#endif
+
+		// upload from the smallest level up, so there's something to
+		// show right away, larger levels are left to streamTextures()
+		while (baseLevel > 0) {
+			auto& next = tex->mips[baseLevel - 1];
+			bool immediate = max(next.width, next.height) <= TEXTURE_STREAM_IMMEDIATE_SIZE;
+
+#if GLSL_VERSION > 100
+			if (!immediate && baseLevel < levels) {
+				break;
+			}
+#endif
+			uploadLevel(baseLevel - 1);
+		}
+
+		if (baseLevel == 0) {
+			tex->releasePixels();
+			pending.reset();
+
+		} else {
+			streamingTextures.push_back(weak_from_this());
+		}
+
+		if (!sourceFile.empty()) {
+			manageTextureResidency(shared_from_this());
+		}
+
+		return;
+	}
+
 	// if format uses mipmap filtering, generate mipmaps
 	if (tex->minFilter >= materialTexture::filter::NearestMipmaps) {
 		glGenerateMipmap(GL_TEXTURE_2D);
@@ -157,6 +419,12 @@ void Texture::buffer(materialTexture::ptr tex, bool srgb) {
 	// debug info
 	size_t roughsize = tex->pixels.size() * 1.33;
 	currentSize = glmanDbgUpdateTextures(currentSize, roughsize);
+
+	// decoded images have nothing to reload them from once the texture
+	// cache entry expires, so only containers drop their pixels
+	if (!tex->sourceFile.empty()) {
+		tex->releasePixels();
+	}
 }
 
 void Texture::cubemap(std::string directory, std::string extension) {
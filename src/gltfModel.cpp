@@ -1,6 +1,7 @@
 #include <grend/sceneModel.hpp>
 #include <grend/utility.hpp>
 #include <grend/animation.hpp>
+#include <grend/textureFormats.hpp>
 #include <tinygltf/tiny_gltf.h>
 
 #include <stb/stb_image.h>
@@ -8,12 +9,15 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <exception>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <optional>
+#include <future>
+#include <thread>
 
 #include <stdint.h>
 
@@ -30,6 +34,8 @@ class gltfModel {
 
 		std::map<int, materialTexture::weakptr> texcache;
 		std::map<int, material::weakptr>        matcache;
+		// external images decoded ahead of time, see gltf_prefetch_textures()
+		std::map<int, materialTexture::ptr>     prefetched;
 };
 
 namespace grendx {
@@ -272,38 +278,71 @@ void gltf_load_external(gltfModel& gltf, materialTexture::ptr tex, std::string u
 	std::string dir  = dirnameStr(gltf.filename);
 	std::string texname = dir + "/" + uri;
 	std::string vecname = texname + ".vectex";
-	// TODO: pkm, ktx, uuuuuuhhhhh.....
-	std::string pkmname = texname + ".pkm";
-
-	uint8_t *px = nullptr;
 
 	// try vector texture first
 	// TODO: might want to split these into multiple functions
-	px = stbi_load(vecname.c_str(), &tex->width, &tex->height,
-	               &tex->channels, 0);
-	tex->type = materialTexture::imageType::VecTex;
-
-	if (!px) {
-		// otherwise try plain image
-		px = stbi_load(texname.c_str(), &tex->width, &tex->height,
-		               &tex->channels, 0);
-		tex->type = materialTexture::imageType::Plain;
-	}
-
-	if (!px) {
+	stbi_set_flip_vertically_on_load_thread(false);
+	uint8_t *px = stbi_load(vecname.c_str(), &tex->width, &tex->height,
+	                        &tex->channels, 0);
+
+	if (px) {
+		size_t size = (tex->channels * tex->width) * tex->height;
+		tex->pixels.assign(px, px + size);
+		tex->size = size;
+		tex->type = materialTexture::imageType::VecTex;
+		stbi_image_free(px);
+
+	// otherwise try compressed containers/plain image
+	} else if (!loadImageFile(*tex, texname)) {
 		SDL_Log("Couldn't load texture: uri: %s, location: %s\n",
 				uri.c_str(), texname.c_str());
 		return;
 	}
 
-	size_t size = (tex->channels * tex->width) * tex->height;
-	tex->pixels.insert(tex->pixels.end(), px, px + size);
-	tex->size = size;
-
 	SDL_Log("Loaded external texture: uri: %s, size: %lu, location: %s\n",
-	        uri.c_str(), size, texname.c_str());
+	        uri.c_str(), tex->size, texname.c_str());
+}
+
+// decode external images on worker threads before materials are loaded,
+// decoding is by far the slowest part of loading textures
+static void gltf_prefetch_textures(gltfModel& gltf) {
+	std::vector<std::pair<int, std::future<materialTexture::ptr>>> jobs;
+	unsigned maxJobs = max(1u, std::thread::hardware_concurrency());
+
+	auto finish = [&] () {
+		for (auto& [idx, fut] : jobs) {
+			gltf.prefetched[idx] = fut.get();
+		}
+
+		jobs.clear();
+	};
+
+	for (size_t i = 0; i < gltf.data.textures.size(); i++) {
+		auto& tex = gltf.data.textures[i];
+
+		if (tex.source < 0 || (size_t)tex.source >= gltf.data.images.size()) {
+			continue;
+		}
+
+		auto& img = gltf.data.images[tex.source];
+		if (!(img.component < 0 || img.height < 0 || img.width < 0)) {
+			// already decoded by tinygltf
+			continue;
+		}
+
+		std::string uri = img.uri;
+		jobs.push_back({(int)i, std::async(std::launch::async, [&gltf, uri] () {
+			auto ret = std::make_shared<materialTexture>();
+			gltf_load_external(gltf, ret, uri);
+			return ret;
+		})});
+
+		if (jobs.size() >= maxJobs) {
+			finish();
+		}
+	}
 
-	stbi_image_free(px);
+	finish();
 }
 
 static materialTexture::ptr gltf_load_texture(gltfModel& gltf, int tex_idx) {
@@ -313,12 +352,21 @@ static materialTexture::ptr gltf_load_texture(gltfModel& gltf, int tex_idx) {
 		return ret;
 	}
 
-	gltf.texcache[tex_idx] = ret = std::make_shared<materialTexture>();
-
 	auto& tex = gltf_texture(gltf, tex_idx);
 	//std::cerr << "        + texture source: " << tex.source << std::endl;
 
-	if (tex.source >= 0) {
+	auto it = gltf.prefetched.find(tex_idx);
+	bool prefetched = it != gltf.prefetched.end();
+
+	if (prefetched) {
+		gltf.texcache[tex_idx] = ret = it->second;
+		gltf.prefetched.erase(it);
+
+	} else {
+		gltf.texcache[tex_idx] = ret = std::make_shared<materialTexture>();
+	}
+
+	if (tex.source >= 0 && !prefetched) {
 		auto& img = gltf_image(gltf, tex.source);
 		std::cerr << "        + texture image source: " << img.uri << ", "
 			<< img.width << "x" << img.height << ":" << img.component << std::endl;
@@ -466,9 +514,122 @@ materialTexture::ptr load_gltf_lightmap(gltfModel& gltf) {
 	return nullptr;
 }
 
+static std::string gltf_primitive_name(tinygltf::Mesh& mesh, size_t i) {
+	std::string suffix = ":[p"+std::to_string(i)+"]";
+	return mesh.name + suffix + ":" + std::to_string(mesh.primitives[i].material);
+}
+
+static bool gltf_have_lods(sceneModel::ptr model) {
+	for (auto& [name, ptr] : model->nodes) {
+		if (ptr->type == sceneNode::objType::Mesh
+		    && !std::static_pointer_cast<sceneMesh>(ptr)->lods.empty())
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// error estimate for LODs from files, simplification error isn't known so
+// go by the average edge length, which scales with 1/sqrt(triangles)
+static float gltf_lod_error(size_t baseIndices, size_t lodIndices) {
+	return max(0.f, 1.f/sqrtf(max(1.f, lodIndices/3.f))
+	              - 1.f/sqrtf(max(1.f, baseIndices/3.f)));
+}
+
+// MSFT_lod: nodes list lower detail versions of their mesh in the extension,
+// those meshes get merged into the base model as LOD levels rather than
+// being loaded as separate models
+static void gltf_load_lods(gltfModel& gltf, modelMap& models) {
+	std::set<int> merged;
+	std::set<int> lodMeshes;
+
+	for (auto& node : gltf.data.nodes) {
+		auto ext = node.extensions.find("MSFT_lod");
+
+		if (node.mesh < 0 || ext == node.extensions.end()
+		    || merged.count(node.mesh))
+		{
+			continue;
+		}
+
+		check_index(gltf.data.meshes, node.mesh);
+		auto& baseMesh = gltf.data.meshes[node.mesh];
+		auto base = models.find(baseMesh.name);
+		auto& ids = ext->second.Get("ids");
+
+		if (base == models.end() || !ids.IsArray() || base->second->haveJoints) {
+			continue;
+		}
+
+		merged.insert(node.mesh);
+		sceneModel::ptr model = base->second;
+
+		for (size_t i = 0; i < ids.ArrayLen(); i++) {
+			int id = (int)ids.Get(i).GetNumberAsDouble();
+			check_index(gltf.data.nodes, id);
+
+			int meshIdx = gltf.data.nodes[id].mesh;
+			if (meshIdx < 0) {
+				// empty LOD, not supported
+				break;
+			}
+
+			check_index(gltf.data.meshes, meshIdx);
+			auto& lodMesh = gltf.data.meshes[meshIdx];
+			auto lod = models.find(lodMesh.name);
+
+			if (lod == models.end()
+			    || lodMesh.primitives.size() != baseMesh.primitives.size())
+			{
+				SDL_Log("MSFT_lod: LOD %s doesn't match %s, ignoring",
+				        lodMesh.name.c_str(), baseMesh.name.c_str());
+				break;
+			}
+
+			size_t offset = model->vertices.size();
+			model->vertices.insert(model->vertices.end(),
+			                       lod->second->vertices.begin(),
+			                       lod->second->vertices.end());
+
+			for (size_t p = 0; p < baseMesh.primitives.size(); p++) {
+				auto basePrim = model->getNode(gltf_primitive_name(baseMesh, p));
+				auto lodPrim  = lod->second->getNode(gltf_primitive_name(lodMesh, p));
+
+				if (!basePrim || !lodPrim) {
+					continue;
+				}
+
+				auto bm = std::static_pointer_cast<sceneMesh>(basePrim);
+				auto lm = std::static_pointer_cast<sceneMesh>(lodPrim);
+				sceneMesh::lodLevel level;
+
+				for (GLuint idx : lm->faces) {
+					level.faces.push_back(idx + offset);
+				}
+
+				level.error = gltf_lod_error(bm->faces.size(), level.faces.size());
+				if (!bm->lods.empty()) {
+					level.error = max(level.error, bm->lods.back().error);
+				}
+
+				bm->lods.push_back(std::move(level));
+			}
+
+			lodMeshes.insert(meshIdx);
+		}
+	}
+
+	for (int idx : lodMeshes) {
+		models.erase(gltf.data.meshes[idx].name);
+	}
+}
+
 grendx::modelMap grendx::load_gltf_models(gltfModel& gltf) {
 	modelMap ret;
 	materialTexture::ptr lightmap = load_gltf_lightmap(gltf);
+	gltf_prefetch_textures(gltf);
 
 	for (auto& mesh : gltf.data.meshes) {
 		grendx::sceneModel::ptr curModel =
@@ -482,9 +643,7 @@ grendx::modelMap grendx::load_gltf_models(gltfModel& gltf) {
 
 		for (size_t i = 0; i < mesh.primitives.size(); i++) {
 			auto& prim = mesh.primitives[i];
-			std::string suffix = ":[p"+std::to_string(i)+"]";
-			std::string temp_name = mesh.name + suffix
-				+ ":" + std::to_string(prim.material);
+			std::string temp_name = gltf_primitive_name(mesh, i);
 
 			/*
 			std::cerr << "        primitive: " << temp_name << std::endl;
@@ -792,6 +951,15 @@ grendx::modelMap grendx::load_gltf_models(gltfModel& gltf) {
 		*/
 	}
 
+	gltf_load_lods(gltf, ret);
+
+	for (auto& [name, model] : ret) {
+		// skinned meshes are drawn at full detail
+		if (!model->haveJoints && !gltf_have_lods(model)) {
+			model->genLODs();
+		}
+	}
+
 	return ret;
 }
 
@@ -922,6 +1090,7 @@ load_gltf_skin_nodes(gltfModel& gltf, int nodeidx) {
 	assert_componentType(gltf.data, skin.inverseBindMatrices,
 	                      TINYGLTF_COMPONENT_TYPE_FLOAT);
 	gltf_unpack_buffer(gltf, skin.inverseBindMatrices, obj->inverseBind);
+	obj->buildHierarchy();
 
 	return obj;
 }
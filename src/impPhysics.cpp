@@ -1,28 +1,67 @@
 #include <grend/physics.hpp>
 #include <grend/impPhysics.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 // TODO: physics abstract class with derived implementations
 //#include <bullet/btBulletDynamicsCommon.h>
 
 using namespace grendx;
 
-void impObject::setTransform(TRS& transform) {
+// kept between spheres and what they're resting on, so sliding along a
+// surface doesn't catch on the edges of the voxels under it
+#define CONTACT_SKIN 0.001f
+// surfaces a sphere can slide along per step
+#define MAX_SLIDES 3
+// fixed steps run per stepSimulation() call at most, time past that is
+// dropped rather than trying to catch up forever
+#define MAX_STEPS 4
+// approaching slower than this, contacts don't bounce
+#define BOUNCE_THRESHOLD 1.f
+// penetration left alone by positional correction, and how much of the
+// rest is corrected per step, keeps stacks from jittering
+#define PENETRATION_SLOP 0.01f
+#define CORRECTION_FACTOR 0.2f
+
+impObject::~impObject() {
+	if (runtime) {
+		runtime->remove(this);
+	}
+}
+
+void impObject::removeSelf(void) {
+	if (runtime) {
+		runtime->remove(this);
+	}
+}
+
+void impObject::setTransform(const TRS& transform) {
 	position = transform.position;
 	rotation = transform.rotation;
+
+	if (runtime) runtime->wake(this);
 }
 
 TRS impObject::getTransform(void) {
-	return (TRS) {};
+	return (TRS) {
+		.position = position,
+		.rotation = rotation,
+	};
 }
 
 void impObject::setPosition(glm::vec3 pos) {
 	//objects[id].position = pos;
 	position = pos;
+
+	if (runtime) runtime->wake(this);
 }
 
 void impObject::setVelocity(glm::vec3 vel) {
 	//objects[id].velocity = vel;
 	velocity = vel;
+
+	if (runtime) runtime->wake(this);
 }
 
 glm::vec3 impObject::getVelocity(void) {
@@ -31,37 +70,90 @@ glm::vec3 impObject::getVelocity(void) {
 
 void impObject::setAcceleration(glm::vec3 accel) {
 	acceleration = accel;
+
+	if (runtime) runtime->wake(this);
 }
 
 void impObject::setAngularFactor(float amount) {
 	// TODO: implement impObject::setAngularFactor();
 }
 
+float impObject::getAngularFactor(void) {
+	return 1.f;
+}
+
 glm::vec3 impObject::getAcceleration(void) {
 	return acceleration;
 }
 
-physicsObject::ptr
+impPhysics::~impPhysics() {
+	// objects can outlive the runtime, don't let them reach back into it
+	for (impObject *obj : bodies) {
+		obj->runtime = nullptr;
+	}
+}
+
+void
 impPhysics::addStaticModels(void *data,
                             sceneNode::ptr obj,
-                            glm::mat4 transform)
+                            const TRS& transform,
+                            std::vector<physicsObject::ptr>& collector,
+                            std::string propFilter)
 {
-	glm::mat4 adjTrans = transform*obj->getTransform(0);
+	if (obj->type == sceneNode::objType::Mesh) {
+		if (!propFilter.empty() && !obj->extraProperties.count(propFilter)) {
+			// have filter and this mesh doesn't match it
+			return;
+		}
 
-	// XXX: for now, don't allocate an object for static meshes,
-	//      although it may be a useful thing in the future
-	physicsObject::ptr ret = 0;
+		if (auto p = obj->parent.lock()) {
+			sceneMesh::ptr mesh = std::dynamic_pointer_cast<sceneMesh>(obj);
+			sceneModel::ptr model = std::dynamic_pointer_cast<sceneModel>(p);
 
-	if (obj->type == sceneNode::objType::Model) {
-		sceneModel::ptr model = std::dynamic_pointer_cast<sceneModel>(obj);
-		static_geom.add_model(model, adjTrans);
+			if (mesh && model) {
+				addStaticMesh(data, transform, model, mesh);
+			}
+		}
 	}
 
 	for (auto& [name, node] : obj->nodes) {
-		addStaticModels(data, node, adjTrans);
+		TRS adjTrans = addTRS(transform, node->getTransformTRS());
+		addStaticModels(data, node, adjTrans, collector, propFilter);
+	}
+}
+
+physicsObject::ptr
+impPhysics::addStaticMesh(void *data,
+                          const TRS& transform,
+                          sceneModel::ptr model,
+                          sceneMesh::ptr mesh)
+{
+	// XXX: for now, don't allocate an object for static meshes,
+	//      although it may be a useful thing in the future
+	//      (the octree is rebuilt before the next step or query)
+	static_geom.add_mesh(model, mesh, transform.getTransform());
+	return nullptr;
+}
+
+physicsObject::ptr impPhysics::addBody(impObject::ptr obj, float mass) {
+	obj->runtime = this;
+	obj->id = nextID++;
+	obj->index = bodies.size();
+	obj->inverseMass = (mass > 0)? 1.f/mass : 0.f;
+	// static bodies never go in the awake list, they only get solved
+	// against when something awake touches them
+	obj->awake = obj->inverseMass > 0;
+
+	bodies.push_back(obj.get());
+	bounds.push_back({});
+	sapOrder.push_back(obj->index);
+	updateBounds(obj.get());
+
+	if (obj->awake) {
+		awake.push_back(obj->index);
 	}
 
-	return ret;
+	return obj;
 }
 
 physicsObject::ptr
@@ -74,14 +166,10 @@ impPhysics::addSphere(void *data,
 
 	impobj->data = data;
 	impobj->type = impObject::type::Sphere;
-	impobj->usphere.radius = r;
+	impobj->radius = r;
 	impobj->position = pos;
-	impobj->inverseMass = mass;
-
-	auto pobj = std::dynamic_pointer_cast<physicsObject>(impobj);
-	objects.insert(pobj);
 
-	return pobj;
+	return addBody(impobj, mass);
 }
 
 physicsObject::ptr
@@ -90,10 +178,38 @@ impPhysics::addBox(void *data,
                    float mass,
                    AABBExtent& box)
 {
-	impObject::ptr ret = std::make_shared<impObject>();
-	// TODO: add_box()
+	impObject::ptr impobj = std::make_shared<impObject>();
+
+	impobj->data = data;
+	impobj->type = impObject::type::Box;
+	impobj->extent = box.extent;
+	impobj->position = position + box.center;
+
+	return addBody(impobj, mass);
+}
+
+physicsObject::ptr
+impPhysics::addCylinder(void *data,
+                        glm::vec3 position,
+                        float mass,
+                        AABBExtent& box)
+{
+	return addBox(data, position, mass, box);
+}
+
+physicsObject::ptr
+impPhysics::addCapsule(void *data,
+                       glm::vec3 position,
+                       float mass,
+                       float radius,
+                       float height)
+{
+	AABBExtent box = {
+		.center = glm::vec3(0),
+		.extent = glm::vec3(radius, height*0.5f + radius, radius),
+	};
 
-	return std::dynamic_pointer_cast<physicsObject>(ret);
+	return addBox(data, position, mass, box);
 }
 
 // TODO: implement add_model_mesh_boxes()
@@ -103,71 +219,242 @@ impPhysics::addModelMeshBoxes(sceneModel::ptr mod) {
 }
 
 void impPhysics::remove(physicsObject::ptr obj) {
-	objects.erase(obj);
+	if (obj) {
+		remove(static_cast<impObject*>(obj.get()));
+	}
 }
 
-void impPhysics::clear(void) {
+// drops index 'from' from a list of body indices, and renames 'to' (the
+// body swapped into its place) to 'from'
+static void renameIndex(std::vector<uint32_t>& indices,
+                        uint32_t from, uint32_t to)
+{
+	for (size_t i = 0; i < indices.size(); i++) {
+		if (indices[i] == from) {
+			indices.erase(indices.begin() + i);
+			break;
+		}
+	}
+
+	for (uint32_t& idx : indices) {
+		if (idx == to) {
+			idx = from;
+		}
+	}
+}
+
+void impPhysics::remove(impObject *obj) {
+	if (obj->runtime != this) {
+		return;
+	}
+
+	uint32_t idx  = obj->index;
+	uint32_t last = bodies.size() - 1;
+	AABB removed  = bounds[idx];
+
+	// swap the last body into the hole
+	bodies[idx] = bodies[last];
+	bounds[idx] = bounds[last];
+	bodies[idx]->index = idx;
+	bodies.pop_back();
+	bounds.pop_back();
+
+	renameIndex(sapOrder, idx, last);
+	renameIndex(awake,    idx, last);
+
+	// rebuilt every step anyway, indices in them are stale now
+	pairs.clear();
+	manifold.clear();
+
+	// pairs already reported still end, just without its data
+	touching.erase(std::remove_if(touching.begin(), touching.end(),
+		[obj] (const contactPair& p) {
+			return p.objA == obj || p.objB == obj;
+		}),
+		touching.end());
 
+	for (auto& p : lastTouching) {
+		if (p.objA == obj) p.objA = nullptr;
+		if (p.objB == obj) p.objB = nullptr;
+	}
+
+	obj->runtime = nullptr;
+	obj->awake = false;
+
+	// anything resting on it has to start falling
+	for (impObject *other : bodies) {
+		const AABB& b = bounds[other->index];
+
+		if (b.min.x <= removed.max.x && b.max.x >= removed.min.x
+		    && b.min.y <= removed.max.y && b.max.y >= removed.min.y
+		    && b.min.z <= removed.max.z && b.max.z >= removed.min.z)
+		{
+			wake(other);
+		}
+	}
+}
+
+void impPhysics::clear(void) {
+	static_geom.clear();
 }
 
 size_t impPhysics::numObjects(void) {
-	return objects.size();
+	return bodies.size();
 }
 
 void impPhysics::filterCollisions(void) {
-	for (auto& pobj : objects) {
-		impObject::ptr obj = std::dynamic_pointer_cast<impObject>(pobj);
-
-		glm::vec3 end =
-			obj->position
-			+ obj->velocity
-			// XXX: radius for sphere collisions only
-			+ glm::normalize(obj->velocity)*obj->usphere.radius*2.f;
-
-		auto [depth, normal] = static_geom.collides(obj->position, end);
-
-		if (depth > 0) {
-			// TODO: call collision handler
-			/*
-			({
-				obj, nullptr,
-				obj->position,
-				normal,
-				depth,
+	contacts.clear();
+
+	if (!contactsPending) {
+		// nothing new simulated, pairs stay as they were
+		return;
+	}
+
+	contactsPending = false;
+
+	// sleeping bodies aren't in the broadphase, but they're still
+	// resting on whatever they were touching when they fell asleep
+	size_t found = touching.size();
+	size_t i = 0, k = 0;
+	while (k < lastTouching.size()) {
+		const contactPair& p = lastTouching[k];
+
+		if (i < found && touching[i].key < p.key) {
+			i++;
+
+		} else if (i < found && touching[i].key == p.key) {
+			i++, k++;
+
+		} else {
+			if (p.objA && p.objB && !p.objA->awake && !p.objB->awake) {
+				touching.push_back(p);
+			}
+
+			k++;
+		}
+	}
+
+	if (touching.size() != found) {
+		std::inplace_merge(touching.begin(), touching.begin() + found,
+		                   touching.end(),
+			[] (const contactPair& a, const contactPair& b) {
+				return a.key < b.key;
 			});
-			*/
+	}
+
+	auto emit = [&] (uint8_t type, const contactPair& p) {
+		uint32_t idA = p.key >> 32;
+		uint32_t idB = p.key & 0xffffffff;
+
+		contacts.push(type, idA, idB,
+		              p.objA? p.objA->data : nullptr,
+		              p.objB? p.objB->data : nullptr,
+		              p.positionA, p.positionB, p.normalB, p.depth);
+	};
+
+	// both sorted, walk them together
+	i = k = 0;
+	while (i < touching.size() || k < lastTouching.size()) {
+		if (k == lastTouching.size()
+		    || (i < touching.size() && touching[i].key < lastTouching[k].key))
+		{
+			emit(collision::Begin, touching[i++]);
+
+		} else if (i == touching.size() || lastTouching[k].key < touching[i].key) {
+			emit(collision::End, lastTouching[k++]);
+
+		} else {
+			emit(collision::Persist, touching[i++]);
+			k++;
 		}
 	}
+
+	std::swap(touching, lastTouching);
+	touching.clear();
 }
 
-std::list<collision> impPhysics::findCollisions(float delta) {
-	std::list<collision> ret;
+void impPhysics::wake(impObject *obj) {
+	updateBounds(obj);
+	obj->restingTime = 0;
 
-	for (auto& pobj : objects) {
-		impObject::ptr obj = std::dynamic_pointer_cast<impObject>(pobj);
+	if (!obj->awake && obj->inverseMass > 0) {
+		obj->awake = true;
+		awake.push_back(obj->index);
+	}
+}
 
-		glm::vec3 end =
-			obj->position
-			+ obj->velocity*delta
-			// XXX: radius for sphere collisions only
-			+ glm::normalize(obj->velocity)*obj->usphere.radius*2.f;
+void impPhysics::updateBounds(impObject *obj) {
+	glm::vec3 extent = (obj->type == impObject::type::Sphere)
+		? glm::vec3(obj->radius)
+		: obj->extent;
 
-		auto [depth, normal] = static_geom.collides(obj->position, end);
+	bounds[obj->index] = {
+		.min = obj->position - extent,
+		.max = obj->position + extent,
+	};
+}
 
-		if (depth > 0) {
-			// TODO:
-			/*
-			ret.push_back({
-				obj, nullptr,
-				obj->position,
-				normal,
-				depth,
-			});
-			*/
+void impPhysics::moveSphere(impObject *obj, float delta) {
+	float radius = obj->radius;
+
+	// push out of anything it's already in, objects set inside walls,
+	// or geometry added on top of them
+	auto [depth, normal] = static_geom.collides_sphere(obj->position, radius);
+
+	if (depth > 0) {
+		obj->position += normal*(depth + CONTACT_SKIN);
+
+		float into = glm::dot(obj->velocity, normal);
+		if (into < 0) {
+			obj->velocity -= normal*into;
 		}
 	}
 
-	return ret;
+	// swept, so fast objects can't tunnel through thin geometry
+	glm::vec3 motion = obj->velocity*delta;
+
+	for (unsigned i = 0; i < MAX_SLIDES && motion != glm::vec3(0); i++) {
+		float fraction;
+		glm::vec3 normal;
+
+		if (!static_geom.sweep_sphere(obj->position, obj->position + motion,
+		                              radius, fraction, normal))
+		{
+			obj->position += motion;
+			return;
+		}
+
+		obj->position += motion*fraction + normal*CONTACT_SKIN;
+		motion *= 1.f - fraction;
+
+		// slide along the surface for the rest of the step,
+		// bouncing a bit off of it
+		float into = glm::dot(obj->velocity, normal);
+		if (into < 0) {
+			obj->velocity -= normal*into*(1.f + obj->restitution);
+		}
+
+		float remaining = glm::dot(motion, normal);
+		if (remaining < 0) {
+			motion -= normal*remaining;
+		}
+	}
+}
+
+void impPhysics::moveBox(impObject *obj, float delta) {
+	// XXX: not swept, fast boxes can tunnel through thin geometry
+	obj->position += obj->velocity*delta;
+
+	auto [depth, normal] = static_geom.collides_box(obj->position, obj->extent);
+
+	if (depth > 0) {
+		obj->position += normal*(depth + CONTACT_SKIN);
+
+		float into = glm::dot(obj->velocity, normal);
+		if (into < 0) {
+			obj->velocity -= normal*into*(1.f + obj->restitution);
+		}
+	}
 }
 
 void impPhysics::stepSimulation(float delta) {
@@ -176,33 +463,654 @@ void impPhysics::stepSimulation(float delta) {
 		return;
 	}
 
-	for (unsigned i = 0; i < 1; i++) {
-		const auto& collisions = findCollisions(delta);
+	if (static_geom.dirty()) {
+		static_geom.build();
+	}
+
+	float dt = 1.f / stepRate;
+	accumulated = std::min(accumulated + delta, dt*MAX_STEPS);
+
+	while (accumulated >= dt) {
+		step(dt);
+		accumulated -= dt;
+	}
+}
+
+void impPhysics::step(float dt) {
+	// only awake bodies are integrated, sleeping ones and everything
+	// static are left where they are
+	for (uint32_t idx : awake) {
+		impObject *obj = bodies[idx];
+
+		obj->velocity += obj->acceleration*dt
+		               + glm::vec3(0, obj->gravity, 0)*dt;
+		obj->velocity *= powf(0.5, dt);
+		updateBounds(obj);
+	}
+
+	broadphase();
+	narrowphase();
+	recordContacts();
+	solve();
+	correctPositions();
+
+	for (uint32_t idx : awake) {
+		impObject *obj = bodies[idx];
+
+		if (obj->type == impObject::type::Sphere) {
+			moveSphere(obj, dt);
+		} else {
+			moveBox(obj, dt);
+		}
+	}
+
+	updateIslands(dt);
+}
+
+void impPhysics::broadphase(void) {
+	pairs.clear();
+
+	// sweep and prune along x, bodies barely move between steps so the
+	// order from last time is nearly sorted already
+	for (size_t i = 1; i < sapOrder.size(); i++) {
+		uint32_t idx = sapOrder[i];
+		float x = bounds[idx].min.x;
+		size_t k = i;
+
+		for (; k > 0 && bounds[sapOrder[k - 1]].min.x > x; k--) {
+			sapOrder[k] = sapOrder[k - 1];
+		}
+
+		sapOrder[k] = idx;
+	}
+
+	for (size_t i = 0; i < sapOrder.size(); i++) {
+		uint32_t a = sapOrder[i];
+		const AABB& ab = bounds[a];
+
+		for (size_t k = i + 1; k < sapOrder.size(); k++) {
+			uint32_t b = sapOrder[k];
+			const AABB& bb = bounds[b];
+
+			if (bb.min.x > ab.max.x) {
+				break;
+			}
+
+			// static bodies are never awake, so this also skips
+			// static-static pairs
+			if (!bodies[a]->awake && !bodies[b]->awake) {
+				continue;
+			}
+
+			if (ab.min.y <= bb.max.y && ab.max.y >= bb.min.y
+			    && ab.min.z <= bb.max.z && ab.max.z >= bb.min.z)
+			{
+				pairs.push_back({a, b});
+			}
+		}
+	}
+}
+
+// normal points from the sphere to the box
+static bool sphereBox(glm::vec3 sphere, float radius,
+                      glm::vec3 center, glm::vec3 extent,
+                      glm::vec3& normal, float& depth)
+{
+	glm::vec3 closest = glm::clamp(sphere, center - extent, center + extent);
+	glm::vec3 diff = closest - sphere;
+	float dist2 = glm::dot(diff, diff);
+
+	if (dist2 > 0) {
+		if (dist2 >= radius*radius) {
+			return false;
+		}
+
+		float dist = sqrtf(dist2);
+		normal = diff / dist;
+		depth  = radius - dist;
+		return true;
+	}
+
+	// center is inside the box, push out through the nearest face
+	glm::vec3 rel = sphere - center;
+	glm::vec3 faces = extent - glm::abs(rel);
+	int axis = (faces.x < faces.y)
+		? ((faces.x < faces.z)? 0 : 2)
+		: ((faces.y < faces.z)? 1 : 2);
+
+	normal = glm::vec3(0);
+	normal[axis] = (rel[axis] < 0)? 1.f : -1.f;
+	depth = radius + faces[axis];
+	return true;
+}
+
+// normal points from box a to box b
+static bool boxBox(glm::vec3 ca, glm::vec3 ea,
+                   glm::vec3 cb, glm::vec3 eb,
+                   glm::vec3& normal, float& depth)
+{
+	glm::vec3 rel = cb - ca;
+	glm::vec3 overlap = ea + eb - glm::abs(rel);
+
+	if (overlap.x <= 0 || overlap.y <= 0 || overlap.z <= 0) {
+		return false;
+	}
+
+	int axis = (overlap.x < overlap.y)
+		? ((overlap.x < overlap.z)? 0 : 2)
+		: ((overlap.y < overlap.z)? 1 : 2);
+
+	normal = glm::vec3(0);
+	normal[axis] = (rel[axis] < 0)? -1.f : 1.f;
+	depth = overlap[axis];
+	return true;
+}
+
+void impPhysics::narrowphase(void) {
+	manifold.clear();
+
+	for (auto& [a, b] : pairs) {
+		impObject *A = bodies[a];
+		impObject *B = bodies[b];
+		glm::vec3 normal;
+		float depth;
+		bool hit;
+
+		bool sphereA = A->type == impObject::type::Sphere;
+		bool sphereB = B->type == impObject::type::Sphere;
+
+		if (sphereA && sphereB) {
+			glm::vec3 diff = B->position - A->position;
+			float r = A->radius + B->radius;
+			float dist2 = glm::dot(diff, diff);
+
+			hit = dist2 < r*r;
+			if (hit) {
+				float dist = sqrtf(dist2);
+				normal = (dist > 0)? diff/dist : glm::vec3(0, 1, 0);
+				depth  = r - dist;
+			}
+
+		} else if (sphereA) {
+			hit = sphereBox(A->position, A->radius, B->position, B->extent,
+			                normal, depth);
+
+		} else if (sphereB) {
+			hit = sphereBox(B->position, B->radius, A->position, A->extent,
+			                normal, depth);
+			normal = -normal;
+
+		} else {
+			hit = boxBox(A->position, A->extent, B->position, B->extent,
+			             normal, depth);
+		}
+
+		if (!hit) {
+			continue;
+		}
+
+		// something awake ran into it, the pair gets solved together
+		if (!A->awake) wake(A);
+		if (!B->awake) wake(B);
+
+		glm::vec3 rel = B->velocity - A->velocity;
+		float approach = glm::dot(rel, normal);
+		glm::vec3 sliding = rel - normal*approach;
+		float slideLen = glm::length(sliding);
+
+		contact c;
+		c.a = a;
+		c.b = b;
+		c.normal = normal;
+		c.depth = depth;
+		c.bounce = (approach < -BOUNCE_THRESHOLD)
+			? -approach*std::max(A->restitution, B->restitution)
+			: 0.f;
+		c.friction = sqrtf(A->friction * B->friction);
+		c.tangent = (slideLen > 1e-5f)? sliding/slideLen : glm::vec3(0);
+		c.impulse = 0;
+		c.tangentImpulse = 0;
+
+		manifold.push_back(c);
+	}
+}
+
+void impPhysics::recordContacts(void) {
+	// even with nothing touching, pairs from before have ended
+	contactsPending = true;
+
+	// points on the surface of each body, along the normal
+	auto support = [] (impObject *obj, glm::vec3 dir) {
+		return (obj->type == impObject::type::Sphere)
+			? obj->position + dir*obj->radius
+			: obj->position + dir*glm::dot(glm::abs(dir), obj->extent);
+	};
+
+	for (auto& c : manifold) {
+		impObject *A = bodies[c.a];
+		impObject *B = bodies[c.b];
 
-		for (const auto& x : collisions) {
-			auto& pobj = x.a;
-			impObject::ptr obj = std::dynamic_pointer_cast<impObject>(pobj);
+		contactPair p = {
+			.key       = (uint64_t(A->id) << 32) | B->id,
+			.objA      = A,
+			.objB      = B,
+			.positionA = support(A, c.normal),
+			.positionB = support(B, -c.normal),
+			.normalB   = -c.normal,
+			.depth     = -c.depth,
+		};
 
-			obj->velocity = glm::reflect(obj->velocity, x.normal);
-			obj->position += x.normal*x.depth;
+		if (A->id > B->id) {
+			p.key = (uint64_t(B->id) << 32) | A->id;
+			std::swap(p.objA, p.objB);
+			std::swap(p.positionA, p.positionB);
+			p.normalB = -p.normalB;
 		}
+
+		touching.push_back(p);
+	}
+
+	// kept to one per pair as steps go, the deepest point (depth is
+	// negative), so this doesn't grow if nothing filters for a while
+	std::sort(touching.begin(), touching.end(),
+		[] (const contactPair& a, const contactPair& b) {
+			return a.key < b.key;
+		});
+
+	size_t n = 0;
+	for (size_t i = 0; i < touching.size(); i++) {
+		if (n > 0 && touching[n - 1].key == touching[i].key) {
+			if (touching[i].depth < touching[n - 1].depth) {
+				touching[n - 1] = touching[i];
+			}
+
+		} else {
+			touching[n++] = touching[i];
+		}
+	}
+
+	touching.resize(n);
+}
+
+void impPhysics::solve(void) {
+	for (unsigned iter = 0; iter < solverIterations; iter++) {
+		for (auto& c : manifold) {
+			impObject *A = bodies[c.a];
+			impObject *B = bodies[c.b];
+			float invMass = A->inverseMass + B->inverseMass;
+
+			if (invMass == 0) {
+				continue;
+			}
+
+			// normal impulse, accumulated and clamped so contacts only
+			// ever push apart
+			glm::vec3 rel = B->velocity - A->velocity;
+			float lambda = (c.bounce - glm::dot(rel, c.normal)) / invMass;
+			float total = std::max(c.impulse + lambda, 0.f);
+			lambda = total - c.impulse;
+			c.impulse = total;
+
+			A->velocity -= c.normal*lambda*A->inverseMass;
+			B->velocity += c.normal*lambda*B->inverseMass;
+
+			if (c.tangent == glm::vec3(0)) {
+				continue;
+			}
+
+			// friction, bounded by the normal impulse so far
+			rel = B->velocity - A->velocity;
+			float limit = c.friction*c.impulse;
+			lambda = -glm::dot(rel, c.tangent) / invMass;
+			total = glm::clamp(c.tangentImpulse + lambda, -limit, limit);
+			lambda = total - c.tangentImpulse;
+			c.tangentImpulse = total;
+
+			A->velocity -= c.tangent*lambda*A->inverseMass;
+			B->velocity += c.tangent*lambda*B->inverseMass;
+		}
+	}
+}
+
+void impPhysics::correctPositions(void) {
+	// velocities alone let resting bodies sink into each other slowly,
+	// push them apart a bit each step
+	for (auto& c : manifold) {
+		impObject *A = bodies[c.a];
+		impObject *B = bodies[c.b];
+		float invMass = A->inverseMass + B->inverseMass;
+		float amount = std::max(c.depth - PENETRATION_SLOP, 0.f);
+
+		if (invMass == 0 || amount == 0) {
+			continue;
+		}
+
+		glm::vec3 correction = c.normal*(amount*CORRECTION_FACTOR/invMass);
+		A->position -= correction*A->inverseMass;
+		B->position += correction*B->inverseMass;
 	}
+}
+
+static uint32_t findIsland(std::vector<uint32_t>& islands, uint32_t x) {
+	while (islands[x] != x) {
+		islands[x] = islands[islands[x]];
+		x = islands[x];
+	}
+
+	return x;
+}
+
+void impPhysics::updateIslands(float dt) {
+	islands.resize(awake.size());
+	islandRest.assign(awake.size(), sleepDelay);
 
-	for (auto& pobj : objects) {
-		impObject::ptr obj = std::dynamic_pointer_cast<impObject>(pobj);
-		float d = pow(obj->drag_s, delta);
+	for (size_t i = 0; i < awake.size(); i++) {
+		impObject *obj = bodies[awake[i]];
 
-		//obj.position += obj.velocity * delta;
-		obj->position += obj->velocity*delta + obj->acceleration*((delta*delta)/2);
-		obj->velocity += obj->acceleration*delta + glm::vec3(0, -15, 0)*delta;
-		obj->velocity *= powf(0.5, delta);
+		obj->island = i;
+		islands[i] = i;
 
-		if (obj->position.y < -25) {
-			// XXX: prevent objects from disappearing into the void
-			//obj.position = {0, 10, 0};
-			obj->position.y = 10;
+		if (glm::length(obj->velocity) < sleepVelocity) {
+			obj->restingTime += dt;
+		} else {
+			obj->restingTime = 0;
 		}
+	}
 
-		///obj->obj->transform.position = obj->position;
+	// static bodies don't join islands, otherwise everything on the
+	// same floor would only ever sleep together
+	for (auto& c : manifold) {
+		impObject *A = bodies[c.a];
+		impObject *B = bodies[c.b];
+
+		if (A->awake && B->awake) {
+			uint32_t x = findIsland(islands, A->island);
+			uint32_t y = findIsland(islands, B->island);
+			islands[x] = y;
+		}
 	}
+
+	for (size_t i = 0; i < awake.size(); i++) {
+		uint32_t root = findIsland(islands, i);
+		islandRest[root] = std::min(islandRest[root],
+		                            bodies[awake[i]]->restingTime);
+	}
+
+	// islands sleep all at once, when everything in them has been
+	// resting long enough
+	size_t kept = 0;
+	for (size_t i = 0; i < awake.size(); i++) {
+		impObject *obj = bodies[awake[i]];
+
+		if (islandRest[findIsland(islands, i)] >= sleepDelay) {
+			obj->awake = false;
+			obj->velocity = glm::vec3(0);
+			updateBounds(obj);
+
+		} else {
+			awake[kept++] = awake[i];
+		}
+	}
+
+	awake.resize(kept);
+}
+
+// closest point where the segment from + t*(to - from) comes within radius
+// of center, t in [0, 1], negative if it never does
+static float sweepSphere(glm::vec3 from, glm::vec3 to, float radius,
+                         glm::vec3 center)
+{
+	glm::vec3 d = to - from;
+	glm::vec3 m = from - center;
+	float a = glm::dot(d, d);
+	float b = glm::dot(m, d);
+	float c = glm::dot(m, m) - radius*radius;
+
+	if (c <= 0) {
+		// starts inside
+		return 0;
+	}
+
+	if (a == 0 || b > 0) {
+		return -1;
+	}
+
+	float disc = b*b - a*c;
+	if (disc < 0) {
+		return -1;
+	}
+
+	float t = (-b - sqrtf(disc)) / a;
+	return (t <= 1.f)? t : -1;
+}
+
+// same for boxes, slab test against the box grown by radius
+static float sweepBox(glm::vec3 from, glm::vec3 to, float radius,
+                      glm::vec3 center, glm::vec3 extent, glm::vec3& normal)
+{
+	glm::vec3 d = to - from;
+	glm::vec3 min = center - extent - glm::vec3(radius);
+	glm::vec3 max = center + extent + glm::vec3(radius);
+	float t0 = 0, t1 = 1;
+	int axis = -1;
+
+	for (int i = 0; i < 3; i++) {
+		if (d[i] == 0) {
+			if (from[i] < min[i] || from[i] > max[i]) {
+				return -1;
+			}
+
+			continue;
+		}
+
+		float enter = (((d[i] > 0)? min[i] : max[i]) - from[i]) / d[i];
+		float exit  = (((d[i] > 0)? max[i] : min[i]) - from[i]) / d[i];
+
+		if (enter > t0) {
+			t0 = enter;
+			axis = i;
+		}
+
+		t1 = std::min(t1, exit);
+
+		if (t0 > t1) {
+			return -1;
+		}
+	}
+
+	normal = glm::vec3(0);
+	if (axis >= 0) {
+		normal[axis] = (d[axis] > 0)? -1.f : 1.f;
+	}
+
+	return t0;
+}
+
+void impPhysics::raycast(const std::vector<physicsRay>& rays,
+                         std::vector<physicsHit>& hits,
+                         jobQueue *jobs)
+{
+	std::vector<physicsSweep> sweeps;
+	sweeps.reserve(rays.size());
+
+	for (auto& ray : rays) {
+		sweeps.push_back({ray.from, ray.to, 0.f, ray.ignore});
+	}
+
+	sweepSpheres(sweeps, hits, jobs);
+}
+
+void impPhysics::sweepSpheres(const std::vector<physicsSweep>& sweeps,
+                              std::vector<physicsHit>& hits,
+                              jobQueue *jobs)
+{
+	// queries only read the octree, it has to be built beforehand
+	if (static_geom.dirty()) {
+		static_geom.build();
+	}
+
+	runQueries(sweeps.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsSweep& sweep = sweeps[i];
+			physicsHit hit = { .query = uint32_t(i), .data = nullptr };
+			bool found = false;
+			float closest = 1.f;
+			glm::vec3 normal;
+
+			if (static_geom.sweep_sphere(sweep.from, sweep.to, sweep.radius,
+			                             closest, normal))
+			{
+				found = true;
+				hit.normal = normal;
+			}
+
+			for (impObject *obj : bodies) {
+				if (sweep.ignore && obj->data == sweep.ignore) {
+					continue;
+				}
+
+				float t;
+
+				if (obj->type == impObject::type::Sphere) {
+					float r = obj->radius + sweep.radius;
+					t = sweepSphere(sweep.from, sweep.to, r, obj->position);
+
+					if (t >= 0) {
+						glm::vec3 pos = sweep.from + (sweep.to - sweep.from)*t;
+						normal = glm::normalize(pos - obj->position);
+					}
+
+				} else {
+					t = sweepBox(sweep.from, sweep.to, sweep.radius,
+					             obj->position, obj->extent, normal);
+				}
+
+				if (t >= 0 && (!found || t < closest)) {
+					found = true;
+					closest = t;
+					hit.data = obj->data;
+					hit.normal = normal;
+				}
+			}
+
+			if (found) {
+				glm::vec3 pos = sweep.from + (sweep.to - sweep.from)*closest;
+				hit.position = pos - hit.normal*sweep.radius;
+				hit.fraction = closest;
+				out.push_back(hit);
+			}
+		});
+}
+
+void impPhysics::overlapSpheres(const std::vector<physicsSphere>& spheres,
+                                std::vector<physicsHit>& hits,
+                                jobQueue *jobs)
+{
+	// queries only read the octree, it has to be built beforehand
+	if (static_geom.dirty()) {
+		static_geom.build();
+	}
+
+	runQueries(spheres.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsSphere& query = spheres[i];
+			auto [depth, normal] =
+				static_geom.collides_sphere(query.position, query.radius);
+
+			if (depth > 0) {
+				out.push_back({
+					.query    = uint32_t(i),
+					.data     = nullptr,
+					.position = query.position,
+					.normal   = normal,
+					.fraction = 0.f,
+				});
+			}
+
+			for (impObject *obj : bodies) {
+				if (query.ignore && obj->data == query.ignore) {
+					continue;
+				}
+
+				glm::vec3 n;
+				float d;
+				bool hit;
+
+				if (obj->type == impObject::type::Sphere) {
+					float r = obj->radius + query.radius;
+					glm::vec3 diff = query.position - obj->position;
+					hit = glm::dot(diff, diff) <= r*r;
+
+				} else {
+					hit = sphereBox(query.position, query.radius,
+					                obj->position, obj->extent, n, d);
+				}
+
+				if (hit) {
+					out.push_back({
+						.query    = uint32_t(i),
+						.data     = obj->data,
+						.position = obj->position,
+						.normal   = glm::vec3(0),
+						.fraction = 0.f,
+					});
+				}
+			}
+		});
+}
+
+void impPhysics::overlapBoxes(const std::vector<physicsBox>& boxes,
+                              std::vector<physicsHit>& hits,
+                              jobQueue *jobs)
+{
+	// queries only read the octree, it has to be built beforehand
+	if (static_geom.dirty()) {
+		static_geom.build();
+	}
+
+	runQueries(boxes.size(), hits, jobs,
+		[&] (size_t i, std::vector<physicsHit>& out) {
+			const physicsBox& query = boxes[i];
+			auto [depth, normal] =
+				static_geom.collides_box(query.box.center, query.box.extent);
+
+			if (depth > 0) {
+				out.push_back({
+					.query    = uint32_t(i),
+					.data     = nullptr,
+					.position = query.box.center,
+					.normal   = normal,
+					.fraction = 0.f,
+				});
+			}
+
+			for (impObject *obj : bodies) {
+				if (query.ignore && obj->data == query.ignore) {
+					continue;
+				}
+
+				glm::vec3 n;
+				float d;
+				bool hit;
+
+				if (obj->type == impObject::type::Sphere) {
+					hit = sphereBox(obj->position, obj->radius,
+					                query.box.center, query.box.extent, n, d);
+
+				} else {
+					hit = boxBox(query.box.center, query.box.extent,
+					             obj->position, obj->extent, n, d);
+				}
+
+				if (hit) {
+					out.push_back({
+						.query    = uint32_t(i),
+						.data     = obj->data,
+						.position = obj->position,
+						.normal   = glm::vec3(0),
+						.fraction = 0.f,
+					});
+				}
+			}
+		});
 }
@@ -0,0 +1,285 @@
+#include <grend/meshSimplify.hpp>
+#include <grend/utility.hpp>
+#include <SDL.h>
+
+#include <unordered_map>
+#include <queue>
+#include <math.h>
+
+namespace grendx {
+
+// symmetric 4x4 matrix, sum of squared distances to a set of planes
+struct quadric {
+	// xx xy xz xw yy yz yw zz zw ww
+	double q[10] = {0};
+
+	quadric() {};
+	quadric(const glm::dvec4& p) {
+		q[0] = p.x*p.x; q[1] = p.x*p.y; q[2] = p.x*p.z; q[3] = p.x*p.w;
+		q[4] = p.y*p.y; q[5] = p.y*p.z; q[6] = p.y*p.w;
+		q[7] = p.z*p.z; q[8] = p.z*p.w;
+		q[9] = p.w*p.w;
+	}
+
+	quadric& operator+=(const quadric& other) {
+		for (unsigned i = 0; i < 10; i++) {
+			q[i] += other.q[i];
+		}
+
+		return *this;
+	}
+
+	double error(const glm::vec3& v) const {
+		double x = v.x, y = v.y, z = v.z;
+
+		return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+		     + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+		     + q[7]*z*z + 2*q[8]*z
+		     + q[9];
+	}
+};
+
+struct collapse {
+	double   cost;
+	uint32_t from, to;
+	// vertex versions when this was queued, quadrics change on collapse
+	unsigned fromVersion, toVersion;
+
+	bool operator<(const collapse& other) const {
+		// std::priority_queue is a max heap
+		return cost > other.cost;
+	}
+};
+
+static inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return (uint64_t(min(a, b)) << 32) | max(a, b);
+}
+
+std::vector<GLuint> simplifyMesh(const std::vector<sceneModel::vertex>& vertices,
+                                 const std::vector<GLuint>& faces,
+                                 size_t targetIndices,
+                                 float maxError,
+                                 float *resultError)
+{
+	size_t numTris = faces.size() / 3;
+
+	if (resultError) {
+		*resultError = 0.f;
+	}
+
+	// work on compact local vertex indices, meshes usually only use
+	// part of the model's vertices
+	std::unordered_map<GLuint, uint32_t> local;
+	std::vector<GLuint>    global;
+	std::vector<uint32_t>  tris(numTris * 3);
+	std::vector<glm::vec3> positions;
+
+	for (size_t i = 0; i < numTris * 3; i++) {
+		if (faces[i] >= vertices.size()) {
+			SDL_Log("simplifyMesh(): invalid face index, not simplifying");
+			return faces;
+		}
+
+		auto [it, added] = local.insert({faces[i], (uint32_t)global.size()});
+
+		if (added) {
+			global.push_back(faces[i]);
+			positions.push_back(vertices[faces[i]].position);
+		}
+
+		tris[i] = it->second;
+	}
+
+	size_t numVerts = global.size();
+	std::vector<quadric> quadrics(numVerts);
+	std::vector<std::vector<uint32_t>> adjacent(numVerts);
+	std::unordered_map<uint64_t, unsigned> edges;
+
+	for (size_t t = 0; t < numTris; t++) {
+		uint32_t *v = &tris[t*3];
+		glm::vec3 n = glm::cross(positions[v[1]] - positions[v[0]],
+		                         positions[v[2]] - positions[v[0]]);
+		float len = glm::length(n);
+
+		if (len > 0) {
+			n /= len;
+			quadric plane(glm::dvec4(n, -glm::dot(n, positions[v[0]])));
+
+			for (unsigned k = 0; k < 3; k++) {
+				quadrics[v[k]] += plane;
+			}
+		}
+
+		for (unsigned k = 0; k < 3; k++) {
+			adjacent[v[k]].push_back(t);
+			edges[edgeKey(v[k], v[(k+1)%3])]++;
+		}
+	}
+
+	// edges that aren't shared by exactly two triangles are borders, seams
+	// or non-manifold, keep the vertices on them in place
+	std::vector<bool> locked(numVerts, false);
+
+	for (auto& [key, count] : edges) {
+		if (count != 2) {
+			locked[key >> 32] = locked[key & 0xffffffff] = true;
+		}
+	}
+
+	std::vector<uint32_t> remap(numVerts);
+	std::vector<unsigned> version(numVerts, 0);
+	std::vector<bool>     dead(numTris, false);
+	std::priority_queue<collapse> heap;
+
+	for (uint32_t i = 0; i < numVerts; i++) {
+		remap[i] = i;
+	}
+
+	auto find = [&] (uint32_t v) {
+		while (remap[v] != v) {
+			v = remap[v] = remap[remap[v]];
+		}
+
+		return v;
+	};
+
+	auto push = [&] (uint32_t from, uint32_t to) {
+		if (locked[from]) {
+			return;
+		}
+
+		quadric q = quadrics[from];
+		q += quadrics[to];
+
+		heap.push({
+			max(0.0, q.error(positions[to])),
+			from, to,
+			version[from], version[to]
+		});
+	};
+
+	for (auto& [key, _] : edges) {
+		uint32_t a = key >> 32, b = key & 0xffffffff;
+		push(a, b);
+		push(b, a);
+	}
+
+	size_t liveTris = numTris;
+	double maxCost  = double(maxError) * maxError;
+	double worst    = 0;
+
+	while (liveTris * 3 > targetIndices && !heap.empty()) {
+		collapse c = heap.top();
+		heap.pop();
+
+		if (c.cost > maxCost) {
+			break;
+		}
+
+		if (remap[c.from] != c.from || remap[c.to] != c.to
+		    || version[c.from] != c.fromVersion
+		    || version[c.to]   != c.toVersion)
+		{
+			// stale entry
+			continue;
+		}
+
+		// reject collapses that would flip triangles around the vertex
+		bool flips = false;
+
+		for (uint32_t t : adjacent[c.from]) {
+			if (dead[t]) continue;
+
+			uint32_t v[3] = { find(tris[t*3]), find(tris[t*3+1]), find(tris[t*3+2]) };
+
+			if (v[0] == c.to || v[1] == c.to || v[2] == c.to) {
+				// becomes degenerate, removed
+				continue;
+			}
+
+			glm::vec3 p[3], moved[3];
+			for (unsigned k = 0; k < 3; k++) {
+				p[k] = positions[v[k]];
+				moved[k] = (v[k] == c.from)? positions[c.to] : p[k];
+			}
+
+			glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::vec3 after  = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+
+			if (glm::dot(before, after) <= 0) {
+				flips = true;
+				break;
+			}
+		}
+
+		if (flips) {
+			continue;
+		}
+
+		remap[c.from] = c.to;
+		quadrics[c.to] += quadrics[c.from];
+		version[c.to]++;
+		worst = max(worst, c.cost);
+
+		for (uint32_t t : adjacent[c.from]) {
+			if (dead[t]) continue;
+
+			uint32_t a = find(tris[t*3]);
+			uint32_t b = find(tris[t*3+1]);
+			uint32_t d = find(tris[t*3+2]);
+
+			if (a == b || b == d || a == d) {
+				dead[t] = true;
+				liveTris--;
+
+			} else {
+				adjacent[c.to].push_back(t);
+			}
+		}
+
+		adjacent[c.from].clear();
+
+		// drop dead triangles while requeueing the edges around the
+		// merged vertex, its quadric changed
+		auto& adj = adjacent[c.to];
+		size_t kept = 0;
+
+		for (size_t i = 0; i < adj.size(); i++) {
+			uint32_t t = adj[i];
+			if (dead[t]) continue;
+
+			adj[kept++] = t;
+
+			for (unsigned k = 0; k < 3; k++) {
+				uint32_t v = find(tris[t*3 + k]);
+
+				if (v != c.to) {
+					push(c.to, v);
+					push(v, c.to);
+				}
+			}
+		}
+
+		adj.resize(kept);
+	}
+
+	std::vector<GLuint> ret;
+	ret.reserve(liveTris * 3);
+
+	for (size_t t = 0; t < numTris; t++) {
+		if (dead[t]) continue;
+
+		for (unsigned k = 0; k < 3; k++) {
+			ret.push_back(global[find(tris[t*3 + k])]);
+		}
+	}
+
+	if (resultError) {
+		*resultError = sqrt(worst);
+	}
+
+	return ret;
+}
+
+// namespace grendx
+}
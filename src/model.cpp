@@ -1,4 +1,5 @@
 #include <grend/sceneModel.hpp>
+#include <grend/meshSimplify.hpp>
 #include <grend/utility.hpp>
 
 #include <stb/stb_image.h>
@@ -119,6 +120,57 @@ void sceneModel::genAABBs(void) {
 	}
 }
 
+// meshes smaller than this aren't worth the extra draw setup
+#define LOD_MIN_TRIANGLES 256
+#define LOD_MAX_LEVELS    4
+// largest simplification error for any level, relative to mesh diameter
+#define LOD_MAX_ERROR     0.1f
+
+void sceneModel::genLODs(void) {
+	for (auto& [name, ptr] : nodes) {
+		if (ptr->type != sceneNode::objType::Mesh) {
+			continue;
+		}
+
+		sceneMesh::ptr mesh = std::dynamic_pointer_cast<sceneMesh>(ptr);
+		float diameter = 2.f*mesh->boundingSphere.extent;
+
+		mesh->lods.clear();
+
+		if (mesh->faces.size()/3 < LOD_MIN_TRIANGLES || diameter <= 0) {
+			continue;
+		}
+
+		float error = 0.f;
+
+		// each level halves the triangle count of the previous one, errors
+		// add up since each is simplified from the last
+		for (unsigned i = 0; i < LOD_MAX_LEVELS; i++) {
+			const auto& prev = mesh->lods.empty()? mesh->faces : mesh->lods.back().faces;
+			float levelError;
+
+			auto faces = simplifyMesh(vertices, prev, (prev.size()/6)*3,
+			                          (LOD_MAX_ERROR - error)*diameter,
+			                          &levelError);
+
+			// stop once simplification stalls, not worth another level
+			if (faces.size() > prev.size()*3/4) {
+				break;
+			}
+
+			error += levelError / diameter;
+			mesh->lods.push_back({std::move(faces), error});
+
+			if (mesh->lods.back().faces.size()/3 < LOD_MIN_TRIANGLES/4) {
+				break;
+			}
+		}
+
+		std::cerr << " > generated " << mesh->lods.size()
+			<< " LODs for " << name << std::endl;
+	}
+}
+
 void sceneModel::genTangents(void) {
 	std::cerr << " > generating tangents... " << vertices.size() << std::endl;
 	unsigned mod = 3;
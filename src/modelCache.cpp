@@ -0,0 +1,236 @@
+#include <grend/modelCache.hpp>
+#include <grend/loadScene.hpp>
+
+#include <map>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <utility>
+
+namespace grendx {
+
+struct cacheEntry {
+	std::map<std::string, sceneModel::weakptr> models;
+	// scene imports are instanced per use (see loadMapData()), so track the
+	// scene contents rather than the import node
+	std::map<std::string, sceneNode::weakptr> sceneNodes;
+	animationCollection::ptr animations;
+	TRS transform;
+	bool loaded = false;
+
+	// valid while the source is being imported
+	std::shared_future<cachedSource::ptr> pending;
+	std::thread::id importer;
+};
+
+using cacheKey = std::pair<std::string, bool>;
+
+static std::mutex cacheMtx;
+static std::map<cacheKey, cacheEntry> cache;
+// sources threads are waiting on another thread to finish importing,
+// to find includes that loop back through several threads
+static std::map<std::thread::id, cacheKey> waiting;
+
+// whether waiting on the entry would end up waiting on this thread,
+// directly or through the imports other threads are waiting on
+static bool waitLoops(const cacheEntry& entry) {
+	std::thread::id self = std::this_thread::get_id();
+	std::thread::id importer = entry.importer;
+
+	// each thread waits on at most one source, so this ends after
+	// visiting every waiting thread at most once
+	for (size_t i = 0; i <= waiting.size(); i++) {
+		if (importer == self) {
+			return true;
+		}
+
+		auto it = waiting.find(importer);
+		if (it == waiting.end()) {
+			// importer is still working
+			return false;
+		}
+
+		auto next = cache.find(it->second);
+		if (next == cache.end() || !next->second.pending.valid()) {
+			// finished, importer is about to wake up
+			return false;
+		}
+
+		importer = next->second.importer;
+	}
+
+	return false;
+}
+
+static bool expired(const cacheEntry& entry) {
+	if (!entry.loaded) {
+		return true;
+	}
+
+	for (auto& [name, model] : entry.models) {
+		if (model.expired()) {
+			return true;
+		}
+	}
+
+	for (auto& [name, node] : entry.sceneNodes) {
+		if (node.expired()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static cachedSource::ptr lockEntry(const cacheEntry& entry,
+                                   const std::string& path,
+                                   bool scene)
+{
+	if (!entry.loaded) {
+		return nullptr;
+	}
+
+	auto ret = std::make_shared<cachedSource>();
+
+	for (auto& [name, weak] : entry.models) {
+		if (auto model = weak.lock()) {
+			ret->models[name] = model;
+		} else {
+			return nullptr;
+		}
+	}
+
+	if (scene) {
+		ret->scene = std::make_shared<sceneImport>(path);
+		ret->scene->animations = entry.animations;
+		ret->scene->setTransform(entry.transform);
+
+		for (auto& [name, weak] : entry.sceneNodes) {
+			if (auto node = weak.lock()) {
+				// leave the parent alone, the node is still in use elsewhere
+				setNodeXXX(name, ret->scene, node);
+			} else {
+				return nullptr;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static cachedSource::ptr importSource(const std::string& path, bool scene) {
+	auto ret = std::make_shared<cachedSource>();
+
+	if (scene) {
+		auto res = loadSceneData(path);
+
+		if (!res) {
+			printError(res);
+			return nullptr;
+		}
+
+		auto [obj, models] = *res;
+		ret->scene  = obj;
+		ret->models = models;
+
+	} else {
+		auto res = loadModel(path);
+
+		if (!res) {
+			printError(res);
+			return nullptr;
+		}
+
+		ret->models = res->second;
+	}
+
+	return ret;
+}
+
+cachedSource::ptr loadCachedSource(const std::string& path, bool scene) {
+	std::unique_lock<std::mutex> lock(cacheMtx);
+	cacheKey key = {path, scene};
+
+	// drop entries for sources that aren't used anymore
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (it->first != key && !it->second.pending.valid()
+		    && expired(it->second))
+		{
+			it = cache.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	// std::map references stay valid across inserts, and entries that are
+	// being imported are never erased
+	cacheEntry& entry = cache[key];
+
+	if (entry.pending.valid()) {
+		if (waitLoops(entry)) {
+			SDL_Log("loadCachedSource(): %s includes itself, not loading it again",
+			        path.c_str());
+			return nullptr;
+		}
+
+		auto pending = entry.pending;
+		waiting[std::this_thread::get_id()] = key;
+		lock.unlock();
+
+		auto ret = pending.get();
+
+		lock.lock();
+		waiting.erase(std::this_thread::get_id());
+		return ret;
+	}
+
+	if (auto ret = lockEntry(entry, path, scene)) {
+		return ret;
+	}
+
+	std::promise<cachedSource::ptr> promise;
+	entry.pending  = promise.get_future().share();
+	entry.importer = std::this_thread::get_id();
+	entry.loaded   = false;
+	entry.models.clear();
+	entry.sceneNodes.clear();
+	entry.animations = nullptr;
+	lock.unlock();
+
+	auto ret = importSource(path, scene);
+
+	lock.lock();
+	entry.pending  = {};
+	entry.importer = {};
+
+	// don't cache failed imports, so they're retried on the next load
+	if (ret && (scene || !ret->models.empty())) {
+		for (auto& [name, model] : ret->models) {
+			entry.models[name] = model;
+		}
+
+		if (ret->scene) {
+			for (auto& [name, node] : ret->scene->nodes) {
+				entry.sceneNodes[name] = node;
+			}
+
+			entry.animations = ret->scene->animations;
+			entry.transform  = ret->scene->getTransformTRS();
+		}
+
+		entry.loaded = true;
+	}
+
+	lock.unlock();
+	promise.set_value(ret);
+
+	return ret;
+}
+
+size_t cachedSourceCount(void) {
+	std::lock_guard<std::mutex> lock(cacheMtx);
+	return cache.size();
+}
+
+// namespace grendx
+}
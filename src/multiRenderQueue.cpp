@@ -20,14 +20,30 @@ void multiRenderQueue::add(const renderFlags& shader,
 	queues[h].add(obj, renderID, trans, inverted);
 }
 
+void multiRenderQueue::add(const renderFlags& shader,
+                           transformHierarchy& transforms,
+                           uint32_t renderID,
+                           const glm::mat4& trans,
+                           bool inverted)
+{
+	size_t h = std::hash<renderFlags>{}(shader);
+
+	if (shadermap.find(h) == shadermap.end()) {
+		shadermap[h] = shader;
+	}
+
+	queues[h].add(transforms, renderID, trans, inverted);
+}
+
 void grendx::cullQueue(multiRenderQueue& renque,
                        camera::ptr       cam,
                        unsigned          width,
                        unsigned          height,
-                       float             lightext)
+                       float             lightext,
+                       float             lodError)
 {
 	for (auto& [id, que] : renque.queues) {
-		cullQueue(que, cam, width, height, lightext);
+		cullQueue(que, cam, width, height, lightext, lodError);
 	}
 }
 
@@ -167,6 +167,7 @@ sceneModel::ptr load_object(std::string filename) {
 
 	ret->genTangents();
 	ret->genAABBs();
+	ret->genLODs();
 
 	return ret;
 }
@@ -0,0 +1,704 @@
+#include <grend/occlusionCulling.hpp>
+#include <grend/utility.hpp>
+
+#include <algorithm>
+#include <unordered_set>
+#include <float.h>
+#include <math.h>
+
+namespace grendx {
+
+// width of the software occluder buffer, height follows the framebuffer
+#define OCCLUSION_RASTER_WIDTH  256
+#define OCCLUDER_MAX_TRIANGLES  50000
+// meshes smaller than this (in occluder buffer pixels) can't cover enough
+// to be worth drawing
+#define OCCLUDER_MIN_SIZE       8.f
+// small bias so surfaces don't hide their own bounding boxes after
+// depth buffer quantization, same as in hiz-cull.comp
+#define OCCLUSION_DEPTH_BIAS    1.0e-5f
+// GPU test results in flight before testing is skipped for a frame
+#define OCCLUSION_READBACK_FRAMES 3
+// how far the camera can move, and the cosine of how far it can turn, from
+// where GPU results were tested before they're too stale to cull with
+#define OCCLUSION_MAX_MOVE      0.05f
+#define OCCLUSION_MAX_TURN      0.9998f
+
+void depthPyramid::build(const float *depth, unsigned width, unsigned height) {
+	levels.clear();
+
+	if (!depth || width == 0 || height == 0) {
+		return;
+	}
+
+	levels.push_back({width, height, std::vector<float>(depth, depth + width*height)});
+
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		const level& prev = levels.back();
+		level next;
+
+		// round up, so every texel in the previous level is covered
+		next.width  = (prev.width  + 1) / 2;
+		next.height = (prev.height + 1) / 2;
+		next.depth.resize(next.width * next.height);
+
+		for (unsigned y = 0; y < next.height; y++) {
+			unsigned y0 = y*2, y1 = min(y*2 + 1, prev.height - 1);
+
+			for (unsigned x = 0; x < next.width; x++) {
+				unsigned x0 = x*2, x1 = min(x*2 + 1, prev.width - 1);
+
+				next.depth[y*next.width + x] =
+					max(max(prev.depth[y0*prev.width + x0],
+					        prev.depth[y0*prev.width + x1]),
+					    max(prev.depth[y1*prev.width + x0],
+					        prev.depth[y1*prev.width + x1]));
+			}
+		}
+
+		levels.push_back(std::move(next));
+	}
+}
+
+bool depthPyramid::rectVisible(glm::vec2 min, glm::vec2 max, float nearest) const {
+	if (levels.empty()) {
+		return true;
+	}
+
+	// off screen, that's up to frustum culling
+	if (max.x < 0.f || max.y < 0.f || min.x > 1.f || min.y > 1.f) {
+		return true;
+	}
+
+	const level& base = levels[0];
+	int x0 = glm::clamp(int(min.x * base.width),  0, int(base.width)  - 1);
+	int x1 = glm::clamp(int(max.x * base.width),  0, int(base.width)  - 1);
+	int y0 = glm::clamp(int(min.y * base.height), 0, int(base.height) - 1);
+	int y1 = glm::clamp(int(max.y * base.height), 0, int(base.height) - 1);
+	unsigned lvl = 0;
+
+	// smallest level where the rect covers at most 2x2 texels
+	while (lvl + 1 < levels.size()
+	       && ((x1 >> lvl) - (x0 >> lvl) > 1 || (y1 >> lvl) - (y0 >> lvl) > 1))
+	{
+		lvl++;
+	}
+
+	const level& l = levels[lvl];
+	float farthest = 0.f;
+
+	for (int y = y0 >> lvl; y <= (y1 >> lvl) && y < int(l.height); y++) {
+		for (int x = x0 >> lvl; x <= (x1 >> lvl) && x < int(l.width); x++) {
+			farthest = grendx::max(farthest, l.depth[y*l.width + x]);
+		}
+	}
+
+	return nearest <= farthest + OCCLUSION_DEPTH_BIAS;
+}
+
+bool depthPyramid::boxVisible(const glm::mat4& mvp, const AABB& box) const {
+	glm::vec2 lo(FLT_MAX);
+	glm::vec2 hi(-FLT_MAX);
+	float nearest = 1.f;
+
+	for (unsigned i = 0; i < 8; i++) {
+		glm::vec3 corner = {
+			(i & 1)? box.max.x : box.min.x,
+			(i & 2)? box.max.y : box.min.y,
+			(i & 4)? box.max.z : box.min.z,
+		};
+
+		glm::vec4 clip = mvp * glm::vec4(corner, 1.f);
+
+		// crosses the near plane, can't say anything useful about it
+		if (clip.w <= 0.f || clip.z < -clip.w) {
+			return true;
+		}
+
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 screen = glm::vec2(ndc)*0.5f + 0.5f;
+
+		lo = glm::min(lo, screen);
+		hi = glm::max(hi, screen);
+		nearest = grendx::min(nearest, ndc.z*0.5f + 0.5f);
+	}
+
+	return rectVisible(lo, hi, nearest);
+}
+
+void occluderRasterizer::resize(unsigned w, unsigned h) {
+	width  = w;
+	height = h;
+	depth.resize(w * h);
+	clear();
+}
+
+void occluderRasterizer::clear(void) {
+	std::fill(depth.begin(), depth.end(), 1.f);
+	triangles = 0;
+}
+
+void occluderRasterizer::drawTriangles(const glm::mat4& mvp,
+                                       const std::vector<sceneModel::vertex>& vertices,
+                                       const std::vector<GLuint>& faces,
+                                       bool inverted)
+{
+	for (size_t i = 0; i + 2 < faces.size(); i += 3) {
+		glm::vec3 s[3];
+		bool skip = false;
+
+		for (unsigned k = 0; k < 3 && !skip; k++) {
+			if (faces[i + k] >= vertices.size()) {
+				skip = true;
+				break;
+			}
+
+			glm::vec4 clip = mvp * glm::vec4(vertices[faces[i + k]].position, 1.f);
+
+			// partly in front of the near plane, dropping the triangle
+			// (rather than clipping it) only means less is occluded
+			if (clip.w <= 0.f || clip.z < -clip.w) {
+				skip = true;
+				break;
+			}
+
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			s[k] = {
+				(ndc.x*0.5f + 0.5f) * width,
+				(ndc.y*0.5f + 0.5f) * height,
+				ndc.z*0.5f + 0.5f,
+			};
+		}
+
+		if (skip) {
+			continue;
+		}
+
+		float area = (s[1].x - s[0].x)*(s[2].y - s[0].y)
+		           - (s[2].x - s[0].x)*(s[1].y - s[0].y);
+
+		// only front faces, whatever's behind a culled back face is visible
+		if ((inverted? -area : area) <= 0.f) {
+			continue;
+		}
+
+		if (area < 0.f) {
+			std::swap(s[1], s[2]);
+			area = -area;
+		}
+
+		// depth is linear in screen space
+		float dzdx = ((s[1].z - s[0].z)*(s[2].y - s[0].y)
+		            - (s[2].z - s[0].z)*(s[1].y - s[0].y)) / area;
+		float dzdy = ((s[2].z - s[0].z)*(s[1].x - s[0].x)
+		            - (s[1].z - s[0].z)*(s[2].x - s[0].x)) / area;
+		// from the pixel center to the farthest corner
+		float zslope = 0.5f*(fabs(dzdx) + fabs(dzdy));
+
+		// edge functions, positive inside
+		float ea[3], eb[3], ec[3], emargin[3];
+		for (unsigned k = 0; k < 3; k++) {
+			const glm::vec3& a = s[k];
+			const glm::vec3& b = s[(k + 1) % 3];
+
+			ea[k] = a.y - b.y;
+			eb[k] = b.x - a.x;
+			ec[k] = -(ea[k]*a.x + eb[k]*a.y);
+			// only count pixels that are completely inside
+			emargin[k] = 0.5f*(fabs(ea[k]) + fabs(eb[k]));
+		}
+
+		float minx = grendx::min(s[0].x, grendx::min(s[1].x, s[2].x));
+		float maxx = grendx::max(s[0].x, grendx::max(s[1].x, s[2].x));
+		float miny = grendx::min(s[0].y, grendx::min(s[1].y, s[2].y));
+		float maxy = grendx::max(s[0].y, grendx::max(s[1].y, s[2].y));
+
+		int x0 = grendx::max(0, int(floor(minx)));
+		int x1 = grendx::min(int(width)  - 1, int(ceil(maxx)));
+		int y0 = grendx::max(0, int(floor(miny)));
+		int y1 = grendx::min(int(height) - 1, int(ceil(maxy)));
+
+		for (int y = y0; y <= y1; y++) {
+			float py = y + 0.5f;
+
+			for (int x = x0; x <= x1; x++) {
+				float px = x + 0.5f;
+				bool inside = true;
+
+				for (unsigned k = 0; k < 3; k++) {
+					if (ea[k]*px + eb[k]*py + ec[k] < emargin[k]) {
+						inside = false;
+						break;
+					}
+				}
+
+				if (!inside) {
+					continue;
+				}
+
+				float z = s[0].z + dzdx*(px - s[0].x) + dzdy*(py - s[0].y) + zslope;
+				float& d = depth[y*width + x];
+				d = grendx::min(d, z);
+			}
+		}
+
+		triangles++;
+	}
+}
+
+void drawOccluders(occluderRasterizer& raster,
+                   renderQueue& occluders,
+                   camera::ptr cam,
+                   unsigned maxTriangles)
+{
+	struct candidate {
+		float size;
+		const renderQueue::queueEnt<sceneMesh::ptr> *ent;
+		sceneModel::ptr model;
+	};
+
+	std::vector<candidate> candidates;
+	glm::mat4 viewProj = cam->viewProjTransform();
+
+	// only opaque meshes, masked ones have holes
+	for (auto& ent : occluders.meshes) {
+		auto sphere = ent.transform * ent.data->boundingSphere;
+		float size = cam->screenSize(sphere, raster.height);
+
+		if (size < OCCLUDER_MIN_SIZE) {
+			continue;
+		}
+
+		auto model = std::dynamic_pointer_cast<sceneModel>(ent.data->parent.lock());
+
+		if (model) {
+			candidates.push_back({size, &ent, model});
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[] (const candidate& a, const candidate& b) {
+			return a.size > b.size;
+		});
+
+	for (auto& c : candidates) {
+		auto& mesh = c.ent->data;
+		// same level of detail as what's drawn
+		auto& faces = (c.ent->lod > 0 && c.ent->lod <= mesh->lods.size())
+			? mesh->lods[c.ent->lod - 1].faces
+			: mesh->faces;
+
+		if (raster.triangles + faces.size()/3 > maxTriangles) {
+			break;
+		}
+
+		raster.drawTriangles(viewProj * c.ent->transform,
+		                     c.model->vertices, faces, c.ent->inverted);
+	}
+}
+
+// keeps entries where visible() is true, in order
+template <typename F>
+static unsigned filterMeshes(renderQueue& queue, F visible) {
+	unsigned culled = 0;
+
+	auto doFilter = [&] (renderQueue::MeshQ& que) {
+		size_t kept = 0;
+
+		for (size_t i = 0; i < que.size(); i++) {
+			if (visible(que[i])) {
+				if (kept != i) {
+					que[kept] = std::move(que[i]);
+				}
+
+				kept++;
+			}
+		}
+
+		culled += que.size() - kept;
+		que.erase(que.begin() + kept, que.end());
+	};
+
+	doFilter(queue.meshes);
+	doFilter(queue.meshesMasked);
+	doFilter(queue.meshesBlend);
+
+	return culled;
+}
+
+unsigned occlusionCull(renderQueue& queue,
+                       const depthPyramid& pyramid,
+                       const glm::mat4& viewProj)
+{
+	if (pyramid.empty()) {
+		return 0;
+	}
+
+	return filterMeshes(queue,
+		[&] (const renderQueue::queueEnt<sceneMesh::ptr>& ent) {
+			return pyramid.boxVisible(viewProj * ent.transform,
+			                          ent.data->boundingBox);
+		});
+}
+
+#if GLSL_VERSION >= 430
+// std430 layout, see hiz-cull.comp
+struct gpuOccludee {
+	glm::mat4 transform;
+	glm::vec4 boxMin;
+	glm::vec4 boxMax;
+};
+
+// where the camera was when boxes were tested
+struct gpuView {
+	glm::vec3 position;
+	glm::vec3 direction;
+	float fov = 0;
+};
+
+// test results in flight, read back once their fence has passed
+struct gpuReadback {
+	Buffer::ptr results;
+	GLsync fence = nullptr;
+	// identifies the mesh each result is for, see occludeeKey()
+	std::vector<uint64_t> keys;
+	gpuView view;
+};
+
+static struct {
+	bool loaded = false;
+
+	Program::ptr copy;
+	Program::ptr copyMultisample;
+	Program::ptr downsample;
+	Program::ptr test;
+
+	Texture::ptr pyramid;
+	int width = 0, height = 0;
+	unsigned levels = 0;
+
+	Buffer::ptr boxes;
+	std::vector<gpuOccludee> boxData;
+	std::vector<GLuint> visible;
+
+	gpuReadback readbacks[OCCLUSION_READBACK_FRAMES];
+	unsigned nextReadback = 0;
+	// meshes found hidden by the latest results that were read back
+	std::unordered_set<uint64_t> hidden;
+	gpuView hiddenView;
+} gpu;
+
+// meshes are matched to results from earlier frames by mesh and transform,
+// anything that moved doesn't match, and is drawn until results for where
+// it is now come back
+static uint64_t occludeeKey(const renderQueue::queueEnt<sceneMesh::ptr>& ent) {
+	uint64_t hash = 14695981039346656037ull;
+	uintptr_t mesh = reinterpret_cast<uintptr_t>(ent.data.get());
+	auto mix = [&] (const void *data, size_t size) {
+		const uint8_t *bytes = static_cast<const uint8_t*>(data);
+
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+
+	mix(&mesh, sizeof(mesh));
+	mix(glm::value_ptr(ent.transform), sizeof(ent.transform));
+	return hash;
+}
+
+static bool loadGpuOcclusion(void) {
+	if (gpu.loaded) {
+		return gpu.test != nullptr;
+	}
+
+	gpu.loaded = true;
+
+	Shader::parameters opts;
+	gpu.copy = loadComputeProgram(GR_PREFIX "shaders/baked/hiz-copy.comp", opts);
+	gpu.copyMultisample =
+		loadComputeProgram(GR_PREFIX "shaders/baked/hiz-copy-multisample.comp", opts);
+	gpu.downsample =
+		loadComputeProgram(GR_PREFIX "shaders/baked/hiz-downsample.comp", opts);
+	gpu.test = loadComputeProgram(GR_PREFIX "shaders/baked/hiz-cull.comp", opts);
+
+	if (!gpu.copy->good() || !gpu.copyMultisample->good()
+	    || !gpu.downsample->good() || !gpu.test->good())
+	{
+		SDL_Log("occlusionCull(): couldn't load Hi-Z shaders, "
+		        "using the software rasterizer");
+		gpu.test = nullptr;
+		return false;
+	}
+
+	gpu.boxes = genBuffer(GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW);
+
+	for (auto& rb : gpu.readbacks) {
+		rb.results = genBuffer(GL_SHADER_STORAGE_BUFFER, GL_STREAM_READ);
+	}
+
+	return true;
+}
+
+static unsigned workGroups(unsigned n, unsigned size) {
+	return (n + size - 1) / size;
+}
+
+static void resizePyramid(int width, int height) {
+	gpu.width  = width;
+	gpu.height = height;
+	gpu.levels = 1;
+
+	// GL level sizes round down, see hiz-downsample.comp
+	while ((max(width, height) >> gpu.levels) > 0) {
+		gpu.levels++;
+	}
+
+	gpu.pyramid = genTexture();
+	gpu.pyramid->bind();
+	glTexStorage2D(GL_TEXTURE_2D, gpu.levels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	DO_ERROR_CHECK();
+}
+
+static void buildGpuPyramid(Texture::ptr depth, unsigned samples) {
+	Program::ptr copy = samples? gpu.copyMultisample : gpu.copy;
+
+	// base level from the depth buffer...
+	copy->bind();
+	glActiveTexture(GL_TEXTURE0 + TEXU_SCRATCH);
+	depth->bind(samples? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D);
+	copy->set("depthMap", TEXU_SCRATCH);
+
+	if (samples) {
+		copy->set("samples", GLint(samples));
+	}
+
+	glBindImageTexture(0, gpu.pyramid->obj, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute(workGroups(gpu.width, 8), workGroups(gpu.height, 8), 1);
+	DO_ERROR_CHECK();
+
+	// ... then each level from the one below
+	gpu.downsample->bind();
+
+	for (unsigned i = 1; i < gpu.levels; i++) {
+		unsigned w = max(1, gpu.width  >> i);
+		unsigned h = max(1, gpu.height >> i);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(0, gpu.pyramid->obj, i - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, gpu.pyramid->obj, i, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute(workGroups(w, 8), workGroups(h, 8), 1);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	DO_ERROR_CHECK();
+}
+
+static gpuView currentView(camera::ptr cam) {
+	return {cam->position(), cam->direction(), cam->fovx()};
+}
+
+// the prepass draws everything that passed frustum culling, so culling
+// something from the lighting pass that's come into view since the results
+// were tested leaves a hole where the GL_EQUAL depth test never passes
+static bool sameView(const gpuView& a, const gpuView& b) {
+	return glm::distance(a.position, b.position) <= OCCLUSION_MAX_MOVE
+	    && glm::dot(a.direction, b.direction) >= OCCLUSION_MAX_TURN
+	    && a.fov == b.fov;
+}
+
+static unsigned cullHidden(multiRenderQueue& que, camera::ptr cam) {
+	if (gpu.hidden.empty() || !sameView(gpu.hiddenView, currentView(cam))) {
+		return 0;
+	}
+
+	unsigned culled = 0;
+
+	for (auto& [id, q] : que.queues) {
+		culled += filterMeshes(q,
+			[&] (const renderQueue::queueEnt<sceneMesh::ptr>& ent) {
+				return !gpu.hidden.count(occludeeKey(ent));
+			});
+	}
+
+	return culled;
+}
+
+// 1 is the most recently submitted
+static gpuReadback& submittedAgo(unsigned age) {
+	unsigned idx = gpu.nextReadback + OCCLUSION_READBACK_FRAMES - age;
+	return gpu.readbacks[idx % OCCLUSION_READBACK_FRAMES];
+}
+
+// picks up the newest results the GPU has finished with, without waiting
+static void collectReadbacks(void) {
+	for (unsigned age = 1; age <= OCCLUSION_READBACK_FRAMES; age++) {
+		gpuReadback& rb = submittedAgo(age);
+
+		if (!rb.fence) {
+			continue;
+		}
+
+		GLenum status = glClientWaitSync(rb.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			continue;
+		}
+
+		size_t n = rb.keys.size();
+		gpu.visible.resize(n);
+		rb.results->bind();
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, n*sizeof(GLuint),
+		                   gpu.visible.data());
+		DO_ERROR_CHECK();
+
+		gpu.hidden.clear();
+		gpu.hiddenView = rb.view;
+		for (size_t i = 0; i < n; i++) {
+			if (!gpu.visible[i]) {
+				gpu.hidden.insert(rb.keys[i]);
+			}
+		}
+
+		// older results are superseded by these
+		for (unsigned k = age; k <= OCCLUSION_READBACK_FRAMES; k++) {
+			gpuReadback& old = submittedAgo(k);
+
+			if (old.fence) {
+				glDeleteSync(old.fence);
+				old.fence = nullptr;
+			}
+		}
+
+		return;
+	}
+}
+
+// Tests are read back a frame or more later, rather than stalling until the
+// GPU catches up, so meshes are culled with results from the last frame that
+// finished. Those are only used while the camera is still about where it was
+// then, anything that moved is keyed differently and drawn regardless, and
+// nothing is culled while the camera moves faster than that.
+static unsigned gpuOcclusionCull(multiRenderQueue& que,
+                                 camera::ptr cam,
+                                 Texture::ptr depth,
+                                 unsigned samples,
+                                 int width,
+                                 int height)
+{
+	if (gpu.width != width || gpu.height != height || !gpu.pyramid) {
+		resizePyramid(width, height);
+	}
+
+	collectReadbacks();
+
+	gpuReadback& rb = gpu.readbacks[gpu.nextReadback];
+
+	if (rb.fence) {
+		// all slots still in flight, skip testing this frame rather than
+		// overwriting results the GPU may still be writing
+		return cullHidden(que, cam);
+	}
+
+	buildGpuPyramid(depth, samples);
+
+	gpu.boxData.clear();
+	rb.keys.clear();
+	rb.view = currentView(cam);
+
+	for (auto& [id, q] : que.queues) {
+		for (auto *list : {&q.meshes, &q.meshesMasked, &q.meshesBlend}) {
+			for (auto& ent : *list) {
+				auto& box = ent.data->boundingBox;
+				gpu.boxData.push_back({
+					ent.transform,
+					glm::vec4(box.min, 1.f),
+					glm::vec4(box.max, 1.f),
+				});
+				rb.keys.push_back(occludeeKey(ent));
+			}
+		}
+	}
+
+	size_t n = gpu.boxData.size();
+
+	if (n == 0) {
+		return 0;
+	}
+
+	gpu.boxes->buffer(gpu.boxData.data(), n*sizeof(gpuOccludee));
+	rb.results->buffer(nullptr, n*sizeof(GLuint));
+
+	gpu.test->bind();
+	glActiveTexture(GL_TEXTURE0 + TEXU_SCRATCH);
+	gpu.pyramid->bind();
+	gpu.test->set("hizMap",    TEXU_SCRATCH);
+	gpu.test->set("viewProj",  cam->viewProjTransform());
+	gpu.test->set("numBoxes",  GLint(n));
+	gpu.test->set("hizLevels", GLint(gpu.levels));
+	gpu.test->setStorageBlock("occludeeBuffer",   gpu.boxes,   0);
+	gpu.test->setStorageBlock("visibilityBuffer", rb.results,  1);
+
+	glDispatchCompute(workGroups(n, 64), 1, 1);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	gpu.nextReadback = (gpu.nextReadback + 1) % OCCLUSION_READBACK_FRAMES;
+	DO_ERROR_CHECK();
+
+	return cullHidden(que, cam);
+}
+#endif
+
+static occluderRasterizer raster;
+static depthPyramid pyramid;
+
+unsigned occlusionCull(multiRenderQueue& que,
+                       renderQueue& occluders,
+                       camera::ptr cam,
+                       renderFramebuffer::ptr fb)
+{
+	if (fb->width <= 0 || fb->height <= 0) {
+		return 0;
+	}
+
+#if GLSL_VERSION >= 430
+	Texture::ptr depth = fb->depth;
+	unsigned samples = 0;
+
+#if defined(HAVE_MULTISAMPLE)
+	if (fb->multisample) {
+		depth   = fb->depthMultisampled;
+		samples = fb->multisample;
+	}
+#endif
+
+	if (depth && loadGpuOcclusion()) {
+		return gpuOcclusionCull(que, cam, depth, samples, fb->width, fb->height);
+	}
+#endif
+
+	unsigned w = OCCLUSION_RASTER_WIDTH;
+	unsigned h = max(1u, unsigned(w * fb->height / fb->width));
+
+	if (raster.width != w || raster.height != h) {
+		raster.resize(w, h);
+	} else {
+		raster.clear();
+	}
+
+	drawOccluders(raster, occluders, cam, OCCLUDER_MAX_TRIANGLES);
+	pyramid.build(raster.depth.data(), raster.width, raster.height);
+
+	glm::mat4 viewProj = cam->viewProjTransform();
+	unsigned culled = 0;
+
+	for (auto& [id, q] : que.queues) {
+		culled += occlusionCull(q, pyramid, viewProj);
+	}
+
+	return culled;
+}
+
+// namespace grendx
+}
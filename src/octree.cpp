@@ -1,304 +1,698 @@
 #include <grend/octree.hpp>
 #include <math.h>
+#include <cmath>
+#include <iostream>
 #include <algorithm>
 #include <utility>
+#include <atomic>
+#include <future>
+#include <thread>
 
 using namespace grendx;
 
-void octree::grow(double size) {
-	if (size < leaf_size * (1 << levels)) {
-		// tree is already big enough, nothing to do
-		return;
+// 21 bits per axis fit in a 64 bit morton code
+#define MAX_LEVELS 21
+// triangles per voxelization job
+#define TRI_CHUNK 256
+
+struct voxel {
+	uint64_t  code;
+	glm::vec3 normal;
+};
+
+static inline uint64_t spreadBits(uint64_t x) {
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8)  & 0x100f00f00f00f00f;
+	x = (x | x << 4)  & 0x10c30c30c30c30c3;
+	x = (x | x << 2)  & 0x1249249249249249;
+	return x;
+}
+
+static inline uint64_t morton(uint32_t x, uint32_t y, uint32_t z) {
+	return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+static inline unsigned popcount8(uint8_t x) {
+	x = x - ((x >> 1) & 0x55);
+	x = (x & 0x33) + ((x >> 2) & 0x33);
+	return (x + (x >> 4)) & 0x0f;
+}
+
+static inline uint32_t childIndex(const octree::node& n, unsigned octant) {
+	return n.children + popcount8(n.mask & ((1u << octant) - 1));
+}
+
+// triangle/box separating axis test (Akenine-Möller), true if they overlap
+static bool triBoxOverlap(glm::vec3 center, glm::vec3 half, const glm::vec3 tri[3]) {
+	glm::vec3 v[3] = { tri[0] - center, tri[1] - center, tri[2] - center };
+	glm::vec3 e[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+
+	// box face normals
+	for (unsigned a = 0; a < 3; a++) {
+		float lo = std::min({v[0][a], v[1][a], v[2][a]});
+		float hi = std::max({v[0][a], v[1][a], v[2][a]});
+
+		if (lo > half[a] || hi < -half[a]) {
+			return false;
+		}
+	}
+
+	// box axes crossed with triangle edges
+	for (unsigned i = 0; i < 3; i++) {
+		for (unsigned a = 0; a < 3; a++) {
+			glm::vec3 unit(0);
+			unit[a] = 1;
+
+			glm::vec3 axis = glm::cross(unit, e[i]);
+			float p0 = glm::dot(v[0], axis);
+			float p1 = glm::dot(v[1], axis);
+			float p2 = glm::dot(v[2], axis);
+			float r  = glm::dot(half, glm::abs(axis));
+
+			if (std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r) {
+				return false;
+			}
+		}
 	}
 
-	if (root == nullptr) {
-		// special case, if there currently aren't any nodes,
-		// the level can be bumped up enough to fit the requested size
-		levels = log2(size/leaf_size);
+	// triangle plane
+	glm::vec3 n = glm::cross(e[0], e[1]);
+	return fabs(glm::dot(n, v[0])) <= glm::dot(half, glm::abs(n));
+}
+
+void octree::clear(void) {
+	nodes.clear();
+	leaf_normals.clear();
+	tri_positions.clear();
+	tri_normals.clear();
+	built_tris = 0;
+	levels = 0;
+}
+
+void octree::add_tri(const glm::vec3 tri[3], const glm::vec3 normals[3]) {
+	glm::vec3 n = glm::cross(tri[1] - tri[0], tri[2] - tri[0]);
+	float len = glm::length(n);
+
+	if (len < 1e-12f || std::isnan(len)) {
+		// degenerate, nothing to collide with
 		return;
 	}
 
-	while (size >= leaf_size * (1 << levels)) {
-		for (unsigned i = 0; i < 8; i++) {
-			bool x = i&1;
-			bool y = i&2;
-			bool z = i&4;
+	n /= len;
 
-			if (root->subnodes[x][y][z] == nullptr) {
-				continue;
-			}
+	// face the same way as the vertex normals
+	if (glm::dot(n, normals[0] + normals[1] + normals[2]) < 0) {
+		n = -n;
+	}
 
-			node *subtemp = new node;
-			subtemp->subnodes[!x][!y][!z] = root->subnodes[x][y][z];
-			subtemp->level = levels;
-			root->subnodes[x][y][z] = subtemp;
-		}
+	tri_positions.insert(tri_positions.end(), tri, tri + 3);
+	tri_normals.push_back(n);
+}
 
-		root->level = ++levels;
+void octree::add_model(sceneModel::ptr mod, glm::mat4 transform) {
+	for (auto& [key, ptr] : mod->nodes) {
+		if (ptr->type == sceneNode::objType::Mesh) {
+			add_mesh(mod, std::dynamic_pointer_cast<sceneMesh>(ptr), transform);
+		}
 	}
 }
 
-/*
-// old (stub) function, left here for debugging and comparison
-void octree::add_tri(const glm::vec3 tri[3]) {
-	const glm::vec3& a = tri[0], b = tri[1], c = tri[2];
+void octree::add_mesh(sceneModel::ptr mod, sceneMesh::ptr mesh, glm::mat4 transform) {
+	auto& verts = mod->vertices;
+
+	for (unsigned i = 0; i + 2 < mesh->faces.size(); i += 3) {
+		if (mesh->faces[i]   >= verts.size()
+		 || mesh->faces[i+1] >= verts.size()
+		 || mesh->faces[i+2] >= verts.size())
+		{
+			std::cerr << " > Invalid face index! (octree::add_mesh)"
+				<< std::endl;
+			break;
+		}
+
+		glm::vec3 positions[3];
+		glm::vec3 normals[3];
+
+		for (unsigned k = 0; k < 3; k++) {
+			const sceneModel::vertex& v = verts[mesh->faces[i + k]];
+			glm::vec4 m = transform * glm::vec4(v.position, 1);
 
-	glm::vec3 foo  = (a + b) / 2.f;
-	glm::vec3 bar  = (a + c) / 2.f;
-	glm::vec3 baz  = (b + c) / 2.f;
+			positions[k] = glm::vec3(m) / m.w;
+			normals[k]   = glm::mat3(transform) * v.normal;
+		}
 
-	// XXX: for now just set leaves at the middle of each face
-	set_leaf(foo);
-	set_leaf(bar);
-	set_leaf(baz);
+		add_tri(positions, normals);
+	}
 }
-*/
-
-/*
- *        a
- *        +
- *       /|\
- *   lc / | \ lb
- *     /  |h \
- *    /   |   \
- *   +---------+
- * b     la      c
- *
- */
 
-void octree::add_tri(const glm::vec3 tri[3], const glm::vec3 normals[3]) {
-	// sort vertices so that angle a is opposite from the longest side (la)
-	float dots[3];
-	unsigned idx[3];
+void octree::build(void) {
+	nodes.clear();
+	leaf_normals.clear();
+	levels = 0;
+	built_tris = tri_normals.size();
 
-	for (unsigned i = 0; i < 3; i++) {
-		dots[i] = glm::length(tri[(i+2)%3] - tri[(i+1)%3]);
-		idx[i] = i;
+	if (tri_normals.empty()) {
+		return;
+	}
+
+	glm::vec3 lo = tri_positions[0];
+	glm::vec3 hi = tri_positions[0];
+
+	for (auto& p : tri_positions) {
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
 	}
 
-	// bubble sort, it's good for tiny N
-	for (bool swapped = true; swapped;) {
-		swapped = false;
+	float extent = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
 
-		for (unsigned i = 1; i < 3; i++) {
-			if (dots[i-1] < dots[i]) {
-				std::swap(dots[i-1], dots[i]);
-				std::swap(idx[i-1], idx[i]);
-				swapped = true;
+	levels = 1;
+	while (levels < MAX_LEVELS && leaf_size*(1 << levels) <= extent) {
+		levels++;
+	}
+
+	if (leaf_size*(1 << levels) <= extent) {
+		std::cerr << " > octree::build(): geometry is too large for the leaf "
+			"size, the far side is clipped" << std::endl;
+	}
+
+	origin = lo;
+
+	// voxelize chunks of triangles in parallel, each thread into its own list
+	size_t numTris   = tri_normals.size();
+	size_t numChunks = (numTris + TRI_CHUNK - 1) / TRI_CHUNK;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(size_t(threads), numChunks);
+
+	std::vector<std::vector<voxel>> found(threads);
+	std::atomic<size_t> next = 0;
+	int32_t dim  = 1 << levels;
+	float   leaf = leaf_size;
+	glm::vec3 half(leaf * 0.5f * 1.0001f);
+
+	auto worker = [&] (unsigned id) {
+		auto& out = found[id];
+
+		for (size_t c; (c = next++) < numChunks;) {
+			size_t end = std::min(numTris, (c + 1)*TRI_CHUNK);
+
+			for (size_t t = c*TRI_CHUNK; t < end; t++) {
+				const glm::vec3 *tri = &tri_positions[3*t];
+				glm::vec3 tmin = glm::min(glm::min(tri[0], tri[1]), tri[2]);
+				glm::vec3 tmax = glm::max(glm::max(tri[0], tri[1]), tri[2]);
+
+				glm::ivec3 vlo = glm::clamp(glm::ivec3(glm::floor((tmin - origin) / leaf)),
+				                            glm::ivec3(0), glm::ivec3(dim - 1));
+				glm::ivec3 vhi = glm::clamp(glm::ivec3(glm::floor((tmax - origin) / leaf)),
+				                            glm::ivec3(0), glm::ivec3(dim - 1));
+
+				for (int32_t z = vlo.z; z <= vhi.z; z++) {
+				for (int32_t y = vlo.y; y <= vhi.y; y++) {
+				for (int32_t x = vlo.x; x <= vhi.x; x++) {
+					glm::vec3 center = origin + (glm::vec3(x, y, z) + 0.5f)*leaf;
+
+					if (triBoxOverlap(center, half, tri)) {
+						out.push_back({morton(x, y, z), tri_normals[t]});
+					}
+				}
+				}
+				}
 			}
 		}
+	};
+
+	std::vector<std::future<void>> workers;
+	for (unsigned i = 1; i < threads; i++) {
+		workers.push_back(std::async(std::launch::async, worker, i));
 	}
 
-	const glm::vec3& a = tri[idx[2]], b = tri[idx[1]], c = tri[idx[0]];
-	//const glm::vec3& a = tri[idx[0]], b = tri[idx[1]], c = tri[idx[2]];
+	worker(0);
+
+	for (auto& w : workers) {
+		w.wait();
+	}
+
+	std::vector<voxel> voxels = std::move(found[0]);
+	for (unsigned i = 1; i < threads; i++) {
+		voxels.insert(voxels.end(), found[i].begin(), found[i].end());
+	}
+
+	std::sort(voxels.begin(), voxels.end(),
+		[] (const voxel& a, const voxel& b) { return a.code < b.code; });
+
+	// merge duplicates, averaging normals, then build each level up from
+	// the one below
+	std::vector<std::vector<uint64_t>> codes(levels + 1);
 
-	glm::vec3 plane_normal =
-		glm::normalize(glm::cross(
-			b - a,
-			c - a));
+	for (auto& v : voxels) {
+		if (!codes[0].empty() && codes[0].back() == v.code) {
+			leaf_normals.back() += v.normal;
+		} else {
+			codes[0].push_back(v.code);
+			leaf_normals.push_back(v.normal);
+		}
+	}
 
-	// direction perpendicular to the base in the triangle's plane
-	glm::vec3 perp = glm::normalize(glm::cross(plane_normal, glm::normalize(c - b)));
+	for (auto& n : leaf_normals) {
+		float len = glm::length(n);
+		// opposite faces of thin geometry can cancel out
+		n = (len > 1e-6f)? n / len : glm::vec3(0);
+	}
 
-	float la = glm::length((c - b));
-	float lb = glm::length((c - a));
-	float lc = glm::length((b - a));
+	for (unsigned k = 1; k <= levels; k++) {
+		for (uint64_t code : codes[k - 1]) {
+			if (codes[k].empty() || codes[k].back() != (code >> 3)) {
+				codes[k].push_back(code >> 3);
+			}
+		}
+	}
 
-	// semi-perimeter
-	float s = (la + lb + lc) / 2;
-	// altitude from the BC ("la") side
-	float altitude = 2 * sqrt(s * (s-la) * (s-lb) * (s-lc)) / la;
+	// root first, leaves last
+	std::vector<size_t> offset(levels + 1);
+	size_t total = 0;
 
-	//float B = glm::dot(a - b, c - b);
-	float C = glm::dot(a - c, b - c);
+	for (unsigned k = levels + 1; k--;) {
+		offset[k] = total;
+		total += codes[k].size();
+	}
 
-	float r1 = glm::sec(C);
-	//float r2 = glm::sec(B);
+	nodes.resize(total);
 
-	glm::vec3 basedir = glm::normalize(c - b);
-	float k = la / altitude;
+	for (unsigned k = levels; k > 0; k--) {
+		auto& below = codes[k - 1];
+		size_t q = 0;
 
-	// TODO: interpolate normals
-	for (float i = 0; i < altitude; i += leaf_size) {
-		glm::vec3 center = a - perp*i;
-		set_leaf(center, normals[0]);
+		for (size_t j = 0; j < codes[k].size(); j++) {
+			node& n = nodes[offset[k] + j];
+			n.children = offset[k - 1] + q;
 
-		for (float m = 0; m < i*k*r1; m += leaf_size) {
-			set_leaf(center - basedir*m, normals[0]);
+			for (; q < below.size() && (below[q] >> 3) == codes[k][j]; q++) {
+				n.mask |= 1 << (below[q] & 7);
+			}
 		}
+	}
 
-		/*
-		// ??? don't think the code is doing quite what I thought it does,
-		// but it works without this, so...
-		for (float m = 0; m < i*k*r2; m += leaf_size) {
-			set_leaf(center + basedir*m);
-		}
-		*/
+	for (size_t j = 0; j < codes[0].size(); j++) {
+		nodes[offset[0] + j] = {uint32_t(j), 0};
 	}
+
+	std::cerr << " > octree::build(): " << numTris << " triangles, "
+		<< leaf_normals.size() << " voxels, "
+		<< nodes.size() << " nodes" << std::endl;
 }
 
-void octree::add_model(sceneModel::ptr mod, glm::mat4 transform) {
-	// TODO: range check on vertices
-	auto& verts = mod->vertices;
-	//auto& normals = mod->normals;
+bool octree::get_leaf(glm::vec3 location, glm::vec3 *normal) const {
+	if (nodes.empty()) {
+		return false;
+	}
 
-	for (auto& [key, ptr] : mod->nodes) {
-		if (ptr->type != sceneNode::objType::Mesh) {
-			continue;
+	glm::ivec3 v(glm::floor((location - origin) / float(leaf_size)));
+	int32_t dim = 1 << levels;
+
+	if (glm::any(glm::lessThan(v, glm::ivec3(0)))
+	    || glm::any(glm::greaterThanEqual(v, glm::ivec3(dim))))
+	{
+		return false;
+	}
+
+	uint32_t idx = 0;
+
+	for (unsigned level = levels; level--;) {
+		unsigned octant = ((v.x >> level) & 1)
+		                | ((v.y >> level) & 1) << 1
+		                | ((v.z >> level) & 1) << 2;
+
+		if (!(nodes[idx].mask & (1 << octant))) {
+			return false;
 		}
-		sceneMesh::ptr mesh = std::dynamic_pointer_cast<sceneMesh>(ptr);
-
-		// TODO: what happens when degenerate meshes without a full triangle
-		//       are loaded here? might account for the sporadic bugs this has...
-		//       should check for those here
-		for (unsigned i = 0; i < mesh->faces.size(); i += 3) {
-
-			if (mesh->faces[i] > verts.size()
-			 || mesh->faces[i+1] > verts.size()
-			 || mesh->faces[i+2] > verts.size())
-			{
-				std::cerr << " > Invalid face index! (octree::add_model)"
-					<< std::endl;
-				break;
-			}
 
-			sceneModel::vertex tri[3] = {
-				verts[mesh->faces[i]],
-				verts[mesh->faces[i+1]],
-				verts[mesh->faces[i+2]]
-			};
+		idx = childIndex(nodes[idx], octant);
+	}
 
-			glm::vec3 positions[3];
-			glm::vec3 normals[3];
+	if (normal) {
+		*normal = leaf_normals[nodes[idx].children];
+	}
 
-			for (unsigned i = 0; i < 3; i++) {
-				glm::vec4 m = transform * glm::vec4(tri[i].position, 1);
+	return true;
+}
 
-				positions[i] = glm::vec3(m) / m.w;
-				normals[i]   = glm::mat3(transform) * tri[i].normal;
-				normals[i]   = glm::normalize(normals[i]);
+// slab test against a box, clipped to [t0, t1], axis is the last one the
+// ray entered through, -1 if it starts inside
+static bool slabs(glm::vec3 origin, glm::vec3 inv, glm::vec3 dir,
+                  glm::vec3 lo, glm::vec3 hi,
+                  float& t0, float& t1, int& axis)
+{
+	axis = -1;
+
+	for (unsigned a = 0; a < 3; a++) {
+		if (dir[a] == 0) {
+			if (origin[a] < lo[a] || origin[a] > hi[a]) {
+				return false;
 			}
 
-			add_tri(positions, normals);
+			continue;
 		}
+
+		float tn = (lo[a] - origin[a]) * inv[a];
+		float tf = (hi[a] - origin[a]) * inv[a];
+
+		if (tn > tf) std::swap(tn, tf);
+		if (tn > t0) { t0 = tn; axis = a; }
+		if (tf < t1) { t1 = tf; }
 	}
+
+	return t0 <= t1;
 }
 
-// TODO: move to utilities header
-#define max(A, B) (((A) > (B))? (A) : (B))
+// surface normal facing the ray, or the face it came in through for voxels
+// whose triangles cancelled out
+static glm::vec3 hitNormal(glm::vec3 leafNormal, glm::vec3 dir, int axis) {
+	if (leafNormal != glm::vec3(0)) {
+		return (glm::dot(leafNormal, dir) > 0)? -leafNormal : leafNormal;
+	}
 
-void octree::set_leaf(glm::vec3 location, glm::vec3 normal) {
-	// TODO: this probably gets pretty slow, might as well calculate bounding
-	//       boxes for models so the size only needs to be calculated once
-	double maxsize = max(max(fabs(location.x), fabs(location.y)), fabs(location.z));
-	grow(maxsize);
+	if (axis >= 0) {
+		glm::vec3 ret(0);
+		ret[axis] = (dir[axis] > 0)? -1 : 1;
+		return ret;
+	}
+
+	return -glm::normalize(dir);
+}
 
-	if (!root) {
-		root = new node;
+bool octree::traverse(const ray& r, uint32_t idx, unsigned level,
+                      glm::vec3 min, float size, float t0, float t1,
+                      int axis, float& fraction, glm::vec3& normal) const
+{
+	const node& n = nodes[idx];
+
+	if (level == 0) {
+		fraction = t0;
+		normal = hitNormal(leaf_normals[n.children], r.dir, axis);
+		return true;
 	}
 
-	node *move = root;
-	for (unsigned level = levels; level--;) {
-		assert(move != nullptr);
+	// walk the (at most four) children the ray passes through, in order,
+	// starting with the one containing the entry point
+	float half = size * 0.5f;
+	glm::vec3 mid = min + half;
+	glm::vec3 p = r.origin + r.dir*t0;
+	unsigned bits[3];
+
+	for (unsigned a = 0; a < 3; a++) {
+		bits[a] = (p[a] > mid[a]) || (p[a] == mid[a] && r.dir[a] > 0);
+	}
+
+	for (float t = t0;;) {
+		glm::vec3 cmin = min + glm::vec3(bits[0], bits[1], bits[2])*half;
+		float exit = t1;
+		int exitAxis = -1;
+
+		for (unsigned a = 0; a < 3; a++) {
+			if (r.dir[a] == 0) continue;
+
+			float plane = (r.dir[a] > 0)? cmin[a] + half : cmin[a];
+			float te = (plane - r.origin[a]) * r.inv[a];
+
+			if (te < exit) {
+				exit = te;
+				exitAxis = a;
+			}
+		}
 
-		//printf("%u: %f, %f, %f\n\n", level, location.x, location.y, location.z);
-		bool x = location.x < 0;
-		bool y = location.y < 0;
-		bool z = location.z < 0;
+		unsigned octant = bits[0] | bits[1] << 1 | bits[2] << 2;
 
-		if (move->subnodes[x][y][z] == nullptr) {
-			move->subnodes[x][y][z] = new node;
-			move->subnodes[x][y][z]->level = level;
+		if ((n.mask & (1 << octant))
+		    && traverse(r, childIndex(n, octant), level - 1, cmin, half,
+		                t, exit, axis, fraction, normal))
+		{
+			return true;
 		}
 
-		move->normals += normal;
-		move->normal_samples++;
+		if (exitAxis < 0) {
+			// segment ends in this child
+			return false;
+		}
 
-		location.x -= (x?-1:1) * leaf_size * (1 << level);
-		location.y -= (y?-1:1) * leaf_size * (1 << level);
-		location.z -= (z?-1:1) * leaf_size * (1 << level);
+		// step across the plane, out of this node if it's the outer one
+		if ((r.dir[exitAxis] > 0) == bool(bits[exitAxis])) {
+			return false;
+		}
 
-		move = move->subnodes[x][y][z];
+		bits[exitAxis] ^= 1;
+		axis = exitAxis;
+		t = exit;
 	}
-	//puts("set leaf");
 }
 
-octree::node* octree::get_leaf(glm::vec3 location) {
-	node *ret = nullptr;
-	node *move = root;
+bool octree::raycast(glm::vec3 begin, glm::vec3 end,
+                     float& fraction, glm::vec3& normal) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
 
-	for (unsigned level = levels; move && level--;) {
-		bool x = location.x < 0;
-		bool y = location.y < 0;
-		bool z = location.z < 0;
+	ray r;
+	r.origin = begin;
+	r.dir    = end - begin;
+	r.inv    = 1.f / r.dir;
+	r.radius = 0;
 
-		if (move->subnodes[x][y][z] == nullptr && level == 0) {
-			ret = move;
-			break;
+	float size = leaf_size * (1 << levels);
+	float t0 = 0, t1 = 1;
+	int axis;
+
+	if (!slabs(r.origin, r.inv, r.dir, origin, origin + size, t0, t1, axis)) {
+		return false;
+	}
+
+	return traverse(r, 0, levels, origin, size, t0, t1, axis, fraction, normal);
+}
+
+bool octree::sweep(const ray& r, uint32_t idx, unsigned level,
+                   glm::vec3 min, float size,
+                   float& fraction, glm::vec3& normal) const
+{
+	const node& n = nodes[idx];
+	float t0 = 0, t1 = fraction;
+	int axis;
+
+	if (!slabs(r.origin, r.inv, r.dir, min - r.radius, min + size + r.radius,
+	           t0, t1, axis))
+	{
+		return false;
+	}
+
+	if (level == 0) {
+		glm::vec3 center = min + size*0.5f;
+
+		// already touching, only counts if it's moving towards the voxel,
+		// otherwise spheres resting on something couldn't slide along it
+		if (axis < 0 && glm::dot(r.dir, center - r.origin) <= 0) {
+			return false;
 		}
 
-		location.x -= (x?-1:1) * leaf_size * (1 << level);
-		location.y -= (y?-1:1) * leaf_size * (1 << level);
-		location.z -= (z?-1:1) * leaf_size * (1 << level);
+		fraction = t0;
+		normal = hitNormal(leaf_normals[n.children], r.dir, axis);
+		return true;
+	}
 
-		move = move->subnodes[x][y][z];
+	// grown boxes overlap, so no stepping through them like rays, just
+	// visit children front to back and stop once they're past the best hit
+	struct candidate { float t; unsigned octant; };
+	candidate order[8];
+	unsigned count = 0;
+	float half = size * 0.5f;
+
+	for (unsigned octant = 0; octant < 8; octant++) {
+		if (!(n.mask & (1 << octant))) continue;
+
+		glm::vec3 cmin = min + glm::vec3(octant&1, (octant>>1)&1, (octant>>2)&1)*half;
+		float c0 = 0, c1 = fraction;
+		int caxis;
+
+		if (slabs(r.origin, r.inv, r.dir, cmin - r.radius, cmin + half + r.radius,
+		          c0, c1, caxis))
+		{
+			unsigned k = count++;
+			for (; k > 0 && order[k - 1].t > c0; k--) {
+				order[k] = order[k - 1];
+			}
+
+			order[k] = {c0, octant};
+		}
 	}
 
-	return ret;
+	bool hit = false;
+
+	for (unsigned i = 0; i < count && order[i].t < fraction; i++) {
+		unsigned octant = order[i].octant;
+		glm::vec3 cmin = min + glm::vec3(octant&1, (octant>>1)&1, (octant>>2)&1)*half;
+
+		hit |= sweep(r, childIndex(n, octant), level - 1, cmin, half,
+		             fraction, normal);
+	}
+
+	return hit;
 }
 
-uint32_t octree::count_nodes(void) {
-	if (!root) {
-		return 0;
+bool octree::sweep_sphere(glm::vec3 begin, glm::vec3 end, float radius,
+                          float& fraction, glm::vec3& normal) const
+{
+	if (radius <= 0) {
+		return raycast(begin, end, fraction, normal);
+	}
+
+	if (nodes.empty()) {
+		return false;
 	}
 
-	return 1 + root->count_nodes();
+	ray r;
+	r.origin = begin;
+	r.dir    = end - begin;
+	r.inv    = 1.f / r.dir;
+	r.radius = radius;
+
+	float size = leaf_size * (1 << levels);
+	fraction = 1.f;
+
+	return sweep(r, 0, levels, origin, size, fraction, normal);
 }
 
-uint32_t octree::node::count_nodes(void) {
-	uint32_t sum = 0;
+octree::collision octree::collides(glm::vec3 begin, glm::vec3 end) const {
+	float fraction;
+	glm::vec3 normal;
 
-	for (unsigned i = 0; i < 8; i++) {
-		node *ptr = subnodes[!!(i&1)][!!(i&2)][!!(i&4)];
+	if (raycast(begin, end, fraction, normal)) {
+		return {(1.f - fraction)*glm::distance(begin, end), normal};
+	}
 
-		if (ptr == nullptr) {
-			continue;
+	return {0, {0, 0, 0}};
+}
+
+void octree::sphere(uint32_t idx, unsigned level, glm::vec3 min, float size,
+                    glm::vec3 position, float radius, collision& ret) const
+{
+	glm::vec3 closest = glm::clamp(position, min, min + size);
+	glm::vec3 diff = position - closest;
+	float dist2 = glm::dot(diff, diff);
+
+	if (dist2 >= radius*radius) {
+		return;
+	}
+
+	const node& n = nodes[idx];
+
+	if (level == 0) {
+		float dist = sqrtf(dist2);
+		// center inside the voxel, push out along the surface
+		glm::vec3 normal = (dist > 1e-6f)? diff / dist : leaf_normals[n.children];
+		float depth = radius - dist;
+
+		ret.first   = std::max(ret.first, depth);
+		ret.second += normal*depth;
+		return;
+	}
+
+	float half = size * 0.5f;
+
+	for (unsigned octant = 0; octant < 8; octant++) {
+		if (n.mask & (1 << octant)) {
+			glm::vec3 cmin = min + glm::vec3(octant&1, (octant>>1)&1, (octant>>2)&1)*half;
+			sphere(childIndex(n, octant), level - 1, cmin, half, position, radius, ret);
 		}
+	}
+}
 
-		sum += 1 + ptr->count_nodes();
+octree::collision octree::collides_sphere(glm::vec3 position, float radius) const {
+	collision ret = {0, {0, 0, 0}};
+
+	if (nodes.empty()) {
+		return ret;
 	}
 
-	return sum;
+	sphere(0, levels, origin, leaf_size * (1 << levels), position, radius, ret);
+
+	// depth weighted average of the normals of everything touched
+	float len = glm::length(ret.second);
+	ret.second = (len > 1e-6f)? ret.second / len : glm::vec3(0);
+
+	return ret;
 }
 
-octree::collision octree::collides(glm::vec3 begin, glm::vec3 end) {
-	glm::vec3 line = end - begin;
-	glm::vec3 dir = glm::normalize(line);
+void octree::box(uint32_t idx, unsigned level, glm::vec3 min, float size,
+                 glm::vec3 center, glm::vec3 extent, collision& ret) const
+{
+	glm::vec3 lo = center - extent;
+	glm::vec3 hi = center + extent;
 
-	// TODO: more efficient, less crappy
-	for (glm::vec3 temp = {0, 0, 0};
-	     glm::length(temp) < glm::length(line);
-	     temp += dir*(float)leaf_size*0.5f)
+	if (glm::any(glm::greaterThanEqual(lo, min + size))
+	    || glm::any(glm::lessThanEqual(hi, min)))
 	{
-		node *pleaf = get_leaf(begin + temp);
-
-		if (pleaf) {
-			auto align = [&] (float x) { return floor(x / leaf_size)*leaf_size; };
-			float center_offset = leaf_size*0.5;
-
-			glm::vec3 center = {
-				align(temp.x) + center_offset,
-				align(temp.y) + center_offset,
-				align(temp.z) + center_offset,
-			};
-
-			assert(pleaf->normal_samples != 0);
-			return {
-				center_offset - glm::dot(center, temp)*glm::distance(center, temp),
-				pleaf->normals / (float)pleaf->normal_samples
-			};
+		return;
+	}
+
+	const node& n = nodes[idx];
+
+	if (level == 0) {
+		glm::vec3 half(size * 0.5f);
+		glm::vec3 diff = center - (min + half);
+		glm::vec3 normal = leaf_normals[n.children];
+		float depth;
+
+		if (normal != glm::vec3(0)) {
+			// separating axis along the surface, so boxes sliding over a
+			// floor aren't pushed sideways by the edges of the voxels
+			if (glm::dot(normal, diff) < 0) {
+				normal = -normal;
+			}
+
+			glm::vec3 an = glm::abs(normal);
+			depth = glm::dot(an, extent) + glm::dot(an, half)
+			      - glm::dot(diff, normal);
+
+		} else {
+			// least overlapping axis
+			glm::vec3 overlap = extent + half - glm::abs(diff);
+			unsigned axis = (overlap.x < overlap.y)
+				? ((overlap.x < overlap.z)? 0 : 2)
+				: ((overlap.y < overlap.z)? 1 : 2);
+
+			normal = glm::vec3(0);
+			normal[axis] = (diff[axis] < 0)? -1 : 1;
+			depth = overlap[axis];
 		}
+
+		if (depth > 0) {
+			ret.first   = std::max(ret.first, depth);
+			ret.second += normal*depth;
+		}
+
+		return;
 	}
 
-	return {0, {0, 0, 0}};
+	float half = size * 0.5f;
+
+	for (unsigned octant = 0; octant < 8; octant++) {
+		if (n.mask & (1 << octant)) {
+			glm::vec3 cmin = min + glm::vec3(octant&1, (octant>>1)&1, (octant>>2)&1)*half;
+			box(childIndex(n, octant), level - 1, cmin, half, center, extent, ret);
+		}
+	}
+}
+
+octree::collision octree::collides_box(glm::vec3 center, glm::vec3 extent) const {
+	collision ret = {0, {0, 0, 0}};
+
+	if (nodes.empty()) {
+		return ret;
+	}
+
+	box(0, levels, origin, leaf_size * (1 << levels), center, extent, ret);
+
+	float len = glm::length(ret.second);
+	ret.second = (len > 1e-6f)? ret.second / len : glm::vec3(0);
+
+	return ret;
 }
@@ -0,0 +1,88 @@
+#include <grend/physics.hpp>
+#include <grend/jobQueue.hpp>
+#include <grend/utility.hpp>
+
+#include <atomic>
+#include <future>
+
+using namespace grendx;
+
+// queries per chunk handed to a job
+#define QUERY_CHUNK 64
+
+// non-pure virtual destructors for rtti
+physics::~physics() {};
+physicsObject::~physicsObject() {};
+
+void physics::runQueries(size_t count,
+                         std::vector<physicsHit>& hits,
+                         jobQueue *jobs,
+                         const queryFunc& query)
+{
+	hits.clear();
+
+	if (!jobs || count <= QUERY_CHUNK) {
+		for (size_t i = 0; i < count; i++) {
+			query(i, hits);
+		}
+
+		return;
+	}
+
+	struct batch {
+		const queryFunc *query;
+		size_t count;
+		std::vector<std::vector<physicsHit>> chunks;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+		// set by whoever finishes the last chunk
+		std::promise<void> finished;
+
+		bool runOne(void) {
+			size_t i = next++;
+
+			if (i >= chunks.size()) {
+				return false;
+			}
+
+			size_t end = min(count, (i + 1)*QUERY_CHUNK);
+			for (size_t k = i*QUERY_CHUNK; k < end; k++) {
+				(*query)(k, chunks[i]);
+			}
+
+			if (++done == chunks.size()) {
+				finished.set_value();
+			}
+
+			return true;
+		}
+	};
+
+	auto state = std::make_shared<batch>();
+	state->query = &query;
+	state->count = count;
+	state->chunks.resize((count + QUERY_CHUNK - 1) / QUERY_CHUNK);
+	auto finished = state->finished.get_future();
+
+	size_t threads = max(1u, std::thread::hardware_concurrency());
+	size_t helpers = min(state->chunks.size() - 1, threads);
+
+	for (size_t i = 0; i < helpers; i++) {
+		// late helpers find nothing left to claim, and never
+		// touch query after this returns
+		jobs->addAsync([state] () {
+			while (state->runOne());
+			return true;
+		});
+	}
+
+	while (state->runOne());
+
+	// chunks other threads claimed might still be running, the jobs
+	// themselves could be stuck behind something else on busy workers
+	finished.wait();
+
+	for (auto& chunk : state->chunks) {
+		hits.insert(hits.end(), chunk.begin(), chunk.end());
+	}
+}
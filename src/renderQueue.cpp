@@ -1,8 +1,14 @@
 #include <grend/engine.hpp>
 #include <grend/utility.hpp>
 #include <grend/textureAtlas.hpp>
+#include <grend/jobQueue.hpp>
+#include <grend/computeSkinning.hpp>
 #include <math.h>
 
+#include <atomic>
+#include <future>
+#include <thread>
+
 using namespace grendx;
 
 void renderQueue::add(sceneNode::ptr obj,
@@ -30,6 +36,46 @@ void renderQueue::add(sceneNode::ptr obj,
 		inverted = !inverted;
 	}
 
+	if (addNode(obj, renderID, adjTrans, inverted)) {
+		for (auto& [name, ptr] : obj->nodes) {
+			//std::cerr << "add(): subnode " << name << std::endl;
+			add(ptr, renderID, adjTrans, inverted);
+		}
+	}
+}
+
+void renderQueue::add(transformHierarchy& transforms,
+                      uint32_t renderID,
+                      const glm::mat4& trans,
+                      bool inverted)
+{
+	// entity roots are usually drawn as-is
+	bool identity = trans == glm::mat4(1);
+	size_t i = 0;
+
+	while (i < transforms.nodes.size()) {
+		const sceneNode::ptr& obj = transforms.nodes[i];
+
+		if (!obj->visible) {
+			i = transforms.ends[i];
+			continue;
+		}
+
+		const glm::mat4& world = transforms.world[i];
+		bool inv = inverted != bool(transforms.inverted[i]);
+		bool recurse = identity
+			? addNode(obj, renderID, world, inv)
+			: addNode(obj, renderID, trans*world, inv);
+
+		i = recurse? i + 1 : transforms.ends[i];
+	}
+}
+
+bool renderQueue::addNode(sceneNode::ptr obj,
+                          uint32_t renderID,
+                          const glm::mat4& adjTrans,
+                          bool inverted)
+{
 	if (obj->type == sceneNode::objType::Mesh) {
 		// TODO: addMesh()
 		addMesh(obj, renderID, adjTrans, inverted);
@@ -58,23 +104,20 @@ void renderQueue::add(sceneNode::ptr obj,
 	{
 		auto s = std::static_pointer_cast<sceneSkin>(obj->getNode("skin"));
 		addSkinned(obj->getNode("mesh"), s, renderID, adjTrans, inverted);
+		return false;
 
 	} else if (obj->type == sceneNode::objType::Particles) {
 		auto p = std::static_pointer_cast<sceneParticles>(obj);
 		addInstanced(obj, p, renderID, adjTrans, glm::mat4(1), inverted);
+		return false;
 
 	} else if (obj->type == sceneNode::objType::BillboardParticles) {
 		auto p = std::static_pointer_cast<sceneBillboardParticles>(obj);
 		addBillboards(obj, p, renderID, adjTrans, inverted);
-
-	} else {
-		for (auto& [name, ptr] : obj->nodes) {
-			//std::cerr << "add(): subnode " << name << std::endl;
-			add(ptr, renderID, adjTrans, inverted);
-		}
+		return false;
 	}
 
-	//std::cerr << "add(): pop" << std::endl;
+	return true;
 }
 
 void renderQueue::add(renderQueue& other) {
@@ -394,14 +437,15 @@ void grendx::cullQueue(renderQueue& queue,
                        camera::ptr cam,
                        unsigned width,
                        unsigned height,
-                       float lightext)
+                       float lightext,
+                       float lodError)
 {
 	// TODO: reserve a vector containing indexes and cull on that,
 	//       then copy indexes into the final output vector,
 	//       push_back() here is disgustingly bad
 	// TODO: optional OBB test after testing spheres (maybe separate function)
 	// TODO: maybe multithreaded
-	// TODO: occlusion culling (maybe a seperate function)
+	// occlusion culling is done separately, see occlusionCull()
 	renderQueue::MeshQ tempMeshes, tempMeshesBlend, tempMeshesMasked;
 	//tempMeshes.reserve(queue.meshes.size());
 	//tempMeshesBlend.reserve(queue.meshesBlend.size());
@@ -419,7 +463,19 @@ void grendx::cullQueue(renderQueue& queue,
 
 				// cam->boxInFrustum(obb)
 				if (cam->sphereInFrustum(sphere)) {
+					auto& comped = mesh->comped_mesh;
+					float size = cam->screenSize(sphere, height);
+
 					out.push_back(*it);
+
+					if (comped) {
+						out.back().lod = comped->selectLOD(size, lodError);
+					}
+
+					// feed on-screen size to texture residency
+					if (comped && comped->mat) {
+						comped->mat->markUsed(size);
+					}
 				}
 			}
 		}
@@ -553,6 +609,64 @@ void grendx::batchQueue(renderQueue& queue) {
 	queue.meshes = tempMeshes;
 }
 
+void grendx::updateSkins(renderQueue& queue, jobQueue *jobs) {
+	struct batch {
+		std::vector<sceneSkin*> skins;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> done = 0;
+		// set by whoever updates the last skin
+		std::promise<void> finished;
+
+		bool runOne(void) {
+			size_t i = next++;
+
+			if (i >= skins.size()) {
+				return false;
+			}
+
+			skins[i]->update();
+
+			if (++done == skins.size()) {
+				finished.set_value();
+			}
+
+			return true;
+		}
+	};
+
+	auto state = std::make_shared<batch>();
+
+	for (auto& [skin, _] : queue.skinnedMeshes) {
+		state->skins.push_back(skin.get());
+	}
+
+	if (state->skins.empty()) {
+		return;
+	}
+
+	auto finished = state->finished.get_future();
+
+	if (jobs && state->skins.size() > 1) {
+		size_t threads = max(1u, std::thread::hardware_concurrency());
+		size_t helpers = min(state->skins.size() - 1, threads);
+
+		for (size_t i = 0; i < helpers; i++) {
+			// queue holds references to the skins until everything's done,
+			// late helpers find nothing left to claim
+			jobs->addAsync([state] () {
+				while (state->runOne());
+				return true;
+			});
+		}
+	}
+
+	while (state->runOne());
+
+	// skins other threads are still working on, not the jobs, see
+	// animationPlayer::update()
+	finished.wait();
+}
+
 void renderQueue::clear(void) {
 	meshes.clear();
 	meshesBlend.clear();
@@ -571,7 +685,9 @@ static void drawMesh(const renderOptions& flags,
                      const glm::mat4& transform,
                      bool inverted,
                      uint32_t renderID,
-                     sceneMesh::ptr mesh)
+                     sceneMesh::ptr mesh,
+                     unsigned lod = 0,
+                     Vao::ptr vao = nullptr)
 {
 	/*
 	if (fb != nullptr && hasFlag(flags.features, renderFlags::StencilTest)) {
@@ -598,7 +714,7 @@ static void drawMesh(const renderOptions& flags,
 		setFaceOrder(inverted? GL_CW : GL_CCW);
 	}
 
-	bindVao(mesh->comped_mesh->vao);
+	bindVao(vao? vao : mesh->comped_mesh->vao);
 
 	// TODO: wrappers to draw lines
 	/*
@@ -606,9 +722,11 @@ static void drawMesh(const renderOptions& flags,
 	glLineWidth(2.0);
 	enable(GL_LINE_SMOOTH);
 	*/
-	glDrawElements(GL_TRIANGLES,
-	               mesh->comped_mesh->elements->currentSize / 4 /* sizeof uint */,
-	               GL_UNSIGNED_INT, 0);
+	auto& lods  = mesh->comped_mesh->lods;
+	auto& range = lods[min(size_t(lod), lods.size() - 1)];
+
+	glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+	               (void*)(range.offset * sizeof(GLuint)));
 	DO_ERROR_CHECK();
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
@@ -670,7 +788,7 @@ static void drawMeshInstanced(const renderOptions& flags,
 	                         UBO_INSTANCE_TRANSFORMS);
 	glDrawElementsInstanced(
 		GL_TRIANGLES,
-		mesh->comped_mesh->elements->currentSize / 4 /* sizeof uint */,
+		mesh->comped_mesh->lods[0].count,
 		GL_UNSIGNED_INT, 0, particles->activeInstances);
 	DO_ERROR_CHECK();
 
@@ -718,7 +836,7 @@ static void drawBillboards(const renderOptions& flags,
 	                         UBO_INSTANCE_TRANSFORMS);
 	glDrawElementsInstanced(
 		GL_TRIANGLES,
-		mesh->comped_mesh->elements->currentSize / 4 /* sizeof uint */,
+		mesh->comped_mesh->lods[0].count,
 		GL_UNSIGNED_INT, 0, particles->activeInstances);
 	DO_ERROR_CHECK();
 
@@ -829,22 +947,43 @@ unsigned grendx::flush(renderQueue& que,
 	skinnedProg->bind();
 
 	for (auto& [skin, drawinfo] : que.skinnedMeshes) {
+		bool synced = false;
+
 		for (auto& mesh : drawinfo) {
-			// TODO: check whether this skin is already synced
-			skin->sync(skinnedProg);
+			if (skinnedMeshVao(skin, mesh.data)) {
+				// already skinned, drawn with mainProg below
+				continue;
+			}
+
+			if (!synced) {
+				skin->sync(skinnedProg);
+				synced = true;
+			}
 
 			trySetIrradProbe(que, rctx, options, skinnedProg, mesh.center);
 			drawMesh(options, nullptr, skinnedProg, mesh.transform,
 			         mesh.inverted, mesh.renderID, mesh.data);
+			drawnMeshes++;
 		}
 	}
 
 	mainProg->bind();
 
+	for (auto& [skin, drawinfo] : que.skinnedMeshes) {
+		for (auto& mesh : drawinfo) {
+			if (Vao::ptr vao = skinnedMeshVao(skin, mesh.data)) {
+				trySetIrradProbe(que, rctx, options, mainProg, mesh.center);
+				drawMesh(options, nullptr, mainProg, mesh.transform,
+				         mesh.inverted, mesh.renderID, mesh.data, 0, vao);
+				drawnMeshes++;
+			}
+		}
+	}
+
 	for (auto& mesh : que.meshes) {
 		trySetIrradProbe(que, rctx, options, mainProg, mesh.center);
 		drawMesh(options, nullptr, mainProg, mesh.transform,
-		         mesh.inverted, mesh.renderID, mesh.data);
+		         mesh.inverted, mesh.renderID, mesh.data, mesh.lod);
 		drawnMeshes++;
 	}
 
@@ -897,8 +1036,18 @@ unsigned grendx::flush(renderQueue& que,
 
 	skinnedProg->bind();
 	for (auto& [skin, drawinfo] : que.skinnedMeshes) {
+		bool synced = false;
+
 		for (auto& mesh : drawinfo) {
-			skin->sync(skinnedProg);
+			if (skinnedMeshVao(skin, mesh.data)) {
+				// already skinned, drawn with mainProg below
+				continue;
+			}
+
+			if (!synced) {
+				skin->sync(skinnedProg);
+				synced = true;
+			}
 
 			trySetIrradProbe(que, rctx, options, skinnedProg, mesh.center);
 			drawMesh(options, fb, skinnedProg, mesh.transform,
@@ -906,15 +1055,25 @@ unsigned grendx::flush(renderQueue& que,
 			drawnMeshes++;
 		}
 
-		// TODO: check whether this skin is already synced
 		DO_ERROR_CHECK();
 	}
 
 	mainProg->bind();
+	for (auto& [skin, drawinfo] : que.skinnedMeshes) {
+		for (auto& mesh : drawinfo) {
+			if (Vao::ptr vao = skinnedMeshVao(skin, mesh.data)) {
+				trySetIrradProbe(que, rctx, options, mainProg, mesh.center);
+				drawMesh(options, fb, mainProg, mesh.transform,
+				         mesh.inverted, mesh.renderID, mesh.data, 0, vao);
+				drawnMeshes++;
+			}
+		}
+	}
+
 	for (auto& mesh : que.meshes) {
 		trySetIrradProbe(que, rctx, options, mainProg, mesh.center);
 		drawMesh(options, fb, mainProg, mesh.transform,
-		         mesh.inverted, mesh.renderID, mesh.data);
+		         mesh.inverted, mesh.renderID, mesh.data, mesh.lod);
 		drawnMeshes++;
 	}
 
@@ -922,7 +1081,7 @@ unsigned grendx::flush(renderQueue& que,
 	for (auto& mesh : que.meshesMasked) {
 		trySetIrradProbe(que, rctx, options, maskedMain, mesh.center);
 		drawMesh(options, fb, maskedMain, mesh.transform,
-		         mesh.inverted, mesh.renderID, mesh.data);
+		         mesh.inverted, mesh.renderID, mesh.data, mesh.lod);
 		drawnMeshes++;
 	}
 
@@ -933,7 +1092,7 @@ unsigned grendx::flush(renderQueue& que,
 		for (auto& mesh : que.meshesBlend) {
 			trySetIrradProbe(que, rctx, options, blendMain, mesh.center);
 			drawMesh(options, fb, blendMain, mesh.transform,
-			         mesh.inverted, mesh.renderID, mesh.data);
+			         mesh.inverted, mesh.renderID, mesh.data, mesh.lod);
 			drawnMeshes++;
 		}
 
@@ -943,7 +1102,7 @@ unsigned grendx::flush(renderQueue& que,
 		for (auto& mesh : que.meshesBlend) {
 			trySetIrradProbe(que, rctx, options, mainProg, mesh.center);
 			drawMesh(options, fb, mainProg, mesh.transform,
-			         mesh.inverted, mesh.renderID, mesh.data);
+			         mesh.inverted, mesh.renderID, mesh.data, mesh.lod);
 			drawnMeshes++;
 		}
 		disable(GL_BLEND);
@@ -1,5 +1,8 @@
 #include <grend/renderUtils.hpp>
 #include <grend/engine.hpp>
+#include <grend/occlusionCulling.hpp>
+#include <grend/jobQueue.hpp>
+#include <grend/computeSkinning.hpp>
 
 using namespace grendx;
 
@@ -49,7 +52,8 @@ void grendx::renderWorld(gameMain *game,
 		profile::startGroup("Cull");
 		cullQueue(que, cam, game->rend->framebuffer->width,
 		          game->rend->framebuffer->height,
-		          game->rend->lightThreshold);
+		          game->rend->lightThreshold,
+		          game->rend->settings.lodError);
 		renderQueue& newque = que;
 		profile::endGroup();
 
@@ -97,6 +101,13 @@ void grendx::drawMultiQueue(gameMain *game,
 		hax.add(que);
 	}
 
+	// palettes are shared by every pass below, shadow maps included
+	updateSkins(hax, game->services.resolve<jobQueue>());
+
+	if (rend->settings.computeSkinning) {
+		skinMeshes(hax);
+	}
+
 	updateLights(rend, hax);
 	updateReflections(rend, hax);
 	buildTilemap(hax.lights, cam, rend);
@@ -113,10 +124,12 @@ void grendx::drawMultiQueue(gameMain *game,
 
 	// depth pass
 	renderFlags flags = rend->probeShaders["shadow"];
+	// same LOD error as the lighting pass, depth test is GL_EQUAL
 	cullQueue(hax, cam,
 			  rend->framebuffer->width,
 			  rend->framebuffer->height,
-			  rend->lightThreshold);
+			  rend->lightThreshold,
+			  rend->settings.lodError);
 	sortQueue(hax, cam);
 
 	rend->framebuffer->setOutputEnabled(false);
@@ -132,7 +145,15 @@ void grendx::drawMultiQueue(gameMain *game,
 	cullQueue(que, cam,
 			  rend->framebuffer->width,
 			  rend->framebuffer->height,
-			  rend->lightThreshold);
+			  rend->lightThreshold,
+			  rend->settings.lodError);
+
+	// only drops meshes from the lighting pass, anything hidden behind the
+	// prepass depth wouldn't pass the depth test anyway
+	if (rend->settings.occlusionCulling) {
+		game->metrics.occludedMeshes += occlusionCull(que, hax, cam, fb);
+	}
+
 	sortQueue(que, cam);
 	game->metrics.drawnMeshes += flush(que, cam, fb, rend, regOpts);
 }
@@ -144,22 +165,30 @@ grendx::multiRenderQueue grendx::buildDrawableQueue(gameMain *game, camera::ptr
 	using namespace ecs;
 
 	auto entities = game->services.resolve<entityManager>();
-	auto drawable = entities->search<abstractShader>();
+	auto drawable = entities->view<abstractShader>();
 
 	multiRenderQueue que;
 
-	for (entity *ent : drawable) {
+	for (entity *ent : *drawable) {
 		auto flags = ent->get<abstractShader>();
-		auto trans = ent->node->getTransformMatrix();
 		auto scenes = ent->getAll<sceneComponent>();
 		// TODO: do clicky things
 		uint32_t renderID = 0;
 
-		que.add(flags->getShader(), ent->node, renderID);
+		// world transforms are cached across frames, only subtrees that
+		// moved get recomputed
+		auto transforms = cachedTransforms(ent->node);
+		glm::mat4 trans = transforms->worldTransform(ent->node.get());
+
+		que.add(flags->getShader(), *transforms, renderID);
 
 		for (auto it = scenes.first; it != scenes.second; it++) {
 			sceneComponent *comp = static_cast<sceneComponent*>(it->second);
-			que.add(flags->getShader(), comp->getNode(), renderID, trans);
+
+			if (auto node = comp->getNode()) {
+				que.add(flags->getShader(), *cachedTransforms(node),
+				        renderID, trans);
+			}
 		}
 	}
 
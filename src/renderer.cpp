@@ -422,6 +422,8 @@ void grendx::set_material(Program::ptr program, compiledMaterial::ptr mat) {
 		mat = default_compiledMat;
 	}
 
+	mat->markUsed();
+
 	if (program->cacheObject("current_material", mat.get())) {
 		// TODO: UBOs for materialis
 		program->set("anmaterial.diffuse",     mat->factors.diffuse);
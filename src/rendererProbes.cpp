@@ -87,13 +87,15 @@ void grendx::drawShadowCubeMap(renderQueue& queue,
 		// TODO: texture atlas should have some tree wrappers, just for
 		//       clean encapsulation...
 		quadinfo info = rctx->atlases.shadows->tree.info(light->shadowmap[i]);
-		cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold);
+		cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold,
+		          rctx->settings.lodErrorShadows);
 		sortQueue(porque, cam);
 
 		cam->setDirection(cube_dirs[i], cube_up[i]);
 		cam->setViewport(info.size, info.size);
 
-		cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold);
+		cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold,
+		          rctx->settings.lodErrorShadows);
 		sortQueue(porque, cam);
 
 		flush(porque, cam, info.size, info.size, rctx, flags, opts);
@@ -168,7 +170,8 @@ void grendx::drawSpotlightShadow(renderQueue& queue,
 	profile::endGroup();
 
 	profile::startGroup("Cull + Sort");
-	cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold);
+	cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold,
+	          rctx->settings.lodErrorShadows);
 	sortQueue(porque, cam);
 	renderQueue& newque = porque;
 	profile::endGroup();
@@ -301,6 +304,11 @@ void grendx::drawReflectionProbe(renderQueue& queue,
 		cam->setViewport(info.size, info.size);
 		DO_ERROR_CHECK();
 
+		// mostly for picking levels of detail, but skipping everything
+		// outside the face doesn't hurt either
+		cullQueue(porque, cam, info.size, info.size, rctx->lightThreshold,
+		          rctx->settings.lodErrorShadows);
+
 		flush(porque, cam, info.size, info.size, rctx, flags, opts);
 		DO_ERROR_CHECK();
 
@@ -129,7 +129,10 @@ context::context(const char *progname, const renderSettings& settings) {
 	want.callback = callbackStub;
 	want.userdata = this;
 
-	audioOut = SDL_OpenAudioDevice(NULL, 0, &want, &audioHave, 0);
+	// take whatever rate the device runs at, the mixer resamples
+	// everything to it (see audioMixer)
+	audioOut = SDL_OpenAudioDevice(NULL, 0, &want, &audioHave,
+	                               SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 
 	if (audioOut == 0) {
 		SDL_Die(SDL_GetError());
@@ -8,189 +8,92 @@ using namespace grendx;
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdbool.h>
-#include <unistd.h>
 #include <math.h>
-#include <fcntl.h>
-
-#define BUFSIZE (1 << 16)
-//#define SAMPLE_RATE 96000
-//#define SAMPLE_RATE 48000
-#define SAMPLE_RATE 44100
-
-typedef struct sample_c2 {
-	int16_t left;
-	int16_t right;
-} sample_c2;
-
-static inline
-int16_t cbuf_rindex(audioBuffer& buf, size_t pos, size_t n) {
-	// ptr points to one past the last sample, so -1 to make it so rindex(0)
-	// will get the last sample
-	return buf[(pos - n - 1) % buf.size()];
-}
 
-static inline
-double cbuf_rindex_interpolate(audioBuffer& buf, size_t pos, double n) {
-	int16_t a = cbuf_rindex(buf, pos, ceil(n));
-	int16_t b = cbuf_rindex(buf, pos, floor(n));
-	double mix = n - floor(n);
+#include <algorithm>
 
-	//mix = 1 - mix*mix;
-	mix = 1 - mix;
-	return a*mix + b*(1 - mix);
-}
+// in world units (meters) per second
+#define SPEED_OF_SOUND 343.f
+// time for sound to get from one ear to the other, around the head
+#define MAX_INTERAURAL_DELAY 0.00066f
+// reflection off the shoulders/room, on top of the direct sound
+#define ECHO_DELAY    0.0015f
+#define ECHO_STRENGTH 0.15f
+// how much quieter the far ear is, when the source is directly to the side
+#define HEAD_SHADOW_GAIN 0.4f
 
-static inline
-int16_t cbuf_arindex(audioBuffer& buf, size_t pos, size_t n) {
-	return buf[(pos - n) % buf.size()];
-}
+// low pass cutoffs, in Hz
+#define CUTOFF_OPEN      18000.f
+#define CUTOFF_SHADOWED  4000.f  /* far ear, source directly to the side */
+#define CUTOFF_BEHIND    9000.f  /* both ears, source directly behind */
+#define CUTOFF_OCCLUDED  800.f
 
-static inline
-int16_t cbuf_aindex(audioBuffer& buf, size_t pos, size_t n) {
-	return buf[(pos + n) % buf.size()];
-}
+#define OCCLUSION_GAIN 0.5f  /* gain when fully occluded */
 
-static inline
-int16_t sma(audioBuffer& buf, size_t pos, int32_t level) {
-	int32_t sum = 0;
+// playback rate limits for doppler shift
+#define MIN_RATE 0.5f
+#define MAX_RATE 2.0f
 
-	for (int32_t i = 0; i < level; i++) {
-		sum += cbuf_arindex(buf, pos, i);
-	}
-
-	return sum / max(1, level); 
+static inline float lerp(float a, float b, float t) {
+	return a + (b - a)*t;
 }
 
-static inline
-int16_t sma_rindex(audioBuffer& buf, size_t pos, int32_t level, size_t idx) {
-	int32_t sum = 0;
+// coefficient for y += a*(x - y)
+static inline float onePole(float cutoff, float rate) {
+	return 1.f - expf(-2.f * M_PI * cutoff / rate);
+}
 
-	for (int32_t i = 0; i < level; i++) {
-		sum += cbuf_arindex(buf, pos, i + idx);
-	}
+static inline float mixCutoff(float a, float b, float t) {
+	// interpolate cutoffs logarithmically, sounds more even than linear
+	return a * powf(b / a, t);
+}
 
-	return sum / max(1, level); 
+static inline float distanceGain(float distance, float occlusion) {
+	// TODO: fine-tuned attenuation (can just do constant/linear/quad), volume
+	float atten = min(0.8f, 2.f / distance);
+	return atten * lerp(1.f, OCCLUSION_GAIN, occlusion);
 }
 
+static spatialAudioChannel::spatialParams
+listenerParams(const glm::vec3& position,
+               camera::ptr cam,
+               float distance,
+               float occlusion,
+               float rate)
+{
+	spatialAudioChannel::spatialParams ret;
 
-static inline
-int16_t sma_interpolate(audioBuffer& buf, size_t pos, double amount) {
-	double a = sma(buf, pos, ceil(amount));
-	double b = sma(buf, pos, floor(amount));
-	double mix = amount - floor(amount);
+	glm::vec3 diff = position - cam->position();
+	float forward = 0, side = 0;
 
-	return ((a * (1 - mix)) + (b * mix));
-}
+	if (distance > 1e-4f) {
+		forward = glm::dot(cam->direction(), diff) / distance;
+		// XXX: camera::right() actually points to the listener's left
+		side    = glm::dot(cam->right(), diff) / distance;
+	}
 
-static inline
-int16_t sma_rindex_interpolate(audioBuffer& buf, size_t pos,
-                               double amount, size_t idx)
-{
-	double a = sma_rindex(buf, pos, ceil(amount), idx);
-	double b = sma_rindex(buf, pos, floor(amount), idx);
-	double mix = amount - floor(amount);
+	float atten = distanceGain(distance, occlusion);
 
-	return ((a * (1 - mix)) + (b * mix));
-}
+	float shadow  = fabsf(side);
+	float behind  = max(0.f, -forward);
+	float maxDelay = MAX_INTERAURAL_DELAY * rate;
 
-static uint32_t samples = 0;
-
-static const double sound_speed = 34027;
-static const double inch_to_cm  = 2.54;
-#define INCHES 2.54
-
-static const double direction = -3.1415926;
-static const double driver_radius = 3.0*INCHES;
-static const double front_radius = 6.0*INCHES;
-static const double back_radius = 3.75*INCHES;
-static const double echo_ext_param = (M_PI/2.0);
-static const double echo_int_param = 340.27/1482.0 * ((M_SQRT2/2)/(M_PI/4));
-//static const double echo_int_param = 340.27/1482.0;
-static const double echo_strength = 0.15;
-static const double phase_cof = 8;
-static const double distance_falloff_factor = 8.0;
-
-static inline double sound_dist(double cm) {
-	return cm / sound_speed;
-}
+	// index of the ear closer to the source, 0 = left
+	unsigned nearEar = (side > 0)? 0 : 1;
+	unsigned farEar  = !nearEar;
 
-static inline
-double dist_quad(double x) {
-	double m = x;
-	return driver_radius +
-		fabs(m) * ((x <= 0)
-			? fabs(x)*(back_radius - driver_radius)
-			: fabs(x)*(front_radius - driver_radius));
-}
+	float base = mixCutoff(CUTOFF_OPEN, CUTOFF_BEHIND, behind);
+	base = mixCutoff(base, CUTOFF_OCCLUDED, occlusion);
 
-sample_c2 sample_audio_stream(audioBuffer& buf, size_t pos, glm::vec2 rot) {
-	//double ticks = samples / (double)SAMPLE_RATE / direction;
-	//double it = sin(ticks);
-	//double foo = cos(ticks);
-	glm::vec2 temp = glm::normalize(rot);
-	double it = temp.y;
-	double foo = temp.x;
-
-	double thing =
-		(sound_dist(driver_radius)
-		 + sound_dist((front_radius - driver_radius))*fabs(foo)*(foo>0)
-		 + sound_dist((back_radius - driver_radius))*fabs(foo)*(foo<=0));
-
-	double frig =
-		(sound_dist(driver_radius * echo_int_param)
-		 + sound_dist((front_radius - driver_radius) * echo_int_param)*fabs(foo)*(foo<=0)
-		 + sound_dist((back_radius - driver_radius) * echo_int_param)*fabs(foo)*(foo>0));
-
-	double ext_echo =
-		(sound_dist(driver_radius * echo_ext_param)
-		 + sound_dist((front_radius - driver_radius) * echo_ext_param)*fabs(foo)*(foo<=0)
-		 + sound_dist((back_radius - driver_radius) * echo_ext_param)*fabs(foo)*(foo>0));
-	
-	double offset = thing * SAMPLE_RATE * it;
-	double foobar = frig * SAMPLE_RATE * it;
-	double ext_offset = ext_echo * SAMPLE_RATE * it;
-	double diff = foobar - offset;
-	double ext_diff = ext_offset - offset;
-	double distance = dist_quad(foo);
-	double center = BUFSIZE / 2 + phase_cof*distance /* phase shift */;
-	double rad = distance_falloff_factor/(4*M_PI*distance*distance);
-	//double sqrad = sqrt(rad);
-	double sqrad = rad;
-	double vol = (0.90 + sqrad);
-
-	//double dir = (it > 0.0)? 1.0 : -1.0;
-	double dir = it;
-	//double dir = (it*it*it);
-	double lvol = vol + 0.5*sqrad*dir;
-	double rvol = vol - 0.5*sqrad*dir;
-
-	double foo_lvol = vol + 0.5*sqrad*dir;
-	double foo_rvol = vol - 0.5*sqrad*dir;
-
-	double pre_left  = lvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.01 - rad*dir), center - offset);
-	double pre_right = rvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.01 + rad*dir), center + offset);
-
-	double foo_left  = foo_lvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.15 - rad*dir), center - foobar + diff);
-	double foo_right = foo_rvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.15 + rad*dir), center + foobar - diff);
-
-	double ext_left  = foo_lvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.5 - rad*dir), center - ext_offset + ext_diff);
-	double ext_right = foo_rvol*sma_rindex_interpolate(buf, pos, max(1.0, 1.5 + rad*dir), center + ext_offset - ext_diff);
-
-	int16_t f_left  = (pre_left*(1.0 - echo_strength)
-					   + foo_left*echo_strength*0.50
-					   + ext_left*echo_strength*0.50);
-	int16_t f_right = (pre_right*(1.0 - echo_strength)
-					   + foo_right*echo_strength*0.50
-					   + ext_right*echo_strength*0.50);
-
-	int16_t left = f_left;
-	int16_t right = f_right;
-
-	return (sample_c2) {
-		.left = left,
-		.right = right
-	};
+	ret.gain[nearEar]    = atten;
+	ret.gain[farEar]     = atten * (1.f - HEAD_SHADOW_GAIN*shadow);
+	ret.delay[nearEar]   = 0;
+	ret.delay[farEar]    = maxDelay * shadow;
+	ret.lowpass[nearEar] = onePole(base, rate);
+	ret.lowpass[farEar]  = onePole(mixCutoff(base, min(base, CUTOFF_SHADOWED), shadow), rate);
+	ret.rate             = 1.f;
+
+	return ret;
 }
 
 spatialAudioChannel::spatialAudioChannel(channelBuffers_ptr channels,
@@ -201,27 +104,142 @@ spatialAudioChannel::spatialAudioChannel(channelBuffers_ptr channels,
 	buf = (*channels)[0];
 }
 
-std::pair<int16_t, int16_t>
-spatialAudioChannel::getSample(camera::ptr cam) {
-	if (audioPosition >= buf->size()) {
-		if (loopMode == mode::Loop) {
-			restart();
+float spatialAudioChannel::audibility(camera::ptr cam) {
+	float distance = glm::distance(cam->position(), worldPosition);
+	return volume * distanceGain(distance, occlusion);
+}
+
+void spatialAudioChannel::skip(size_t frames) {
+	size_t len = buf->size();
+	double pos = audioPosition + positionFrac
+		+ frames * pitch * buf->sampleRate / double(outputRate);
 
+	if (pos >= len) {
+		if (loopMode == mode::Loop && len > 0) {
+			pos = fmod(pos, len);
 		} else {
 			playState = state::Ended;
-			return {0, 0};
 		}
 	}
 
-	size_t p = audioPosition++;
-	float r = glm::distance(cam->position(), worldPosition);
+	audioPosition = pos;
+	positionFrac  = pos - audioPosition;
 
-	// TODO: fine-tuned attenuation (can just do constant/linear/quad), volume
-	//float atten = min(1.0, (100.0 / (4*3.1415926*r*r)));
-	float atten = min(0.8f, 2.f / (r));
-	glm::vec3 diff = worldPosition - cam->position();
-	glm::vec2 dir = {glm::dot(cam->direction(), diff), glm::dot(cam->right(), diff)};
+	// delay line and filter state are stale by the time this is mixed
+	// again, start over from silence (the mixer fades voices back in)
+	if (haveLast) {
+		haveLast     = false;
+		historyPos   = 0;
+		std::fill(history, history + historySize, 0.f);
+		filtered[0] = filtered[1] = 0.f;
+	}
+}
+
+std::pair<int16_t, int16_t>
+spatialAudioChannel::getSample(camera::ptr cam) {
+	float left, right;
+	getBlock(&left, &right, 1, cam);
+	return {left, right};
+}
+
+void spatialAudioChannel::getBlock(float *left,
+                                   float *right,
+                                   size_t frames,
+                                   camera::ptr cam)
+{
+	// parameters are only updated per block, keep blocks short
+	while (frames > AUDIO_BLOCK_SIZE) {
+		getBlock(left, right, AUDIO_BLOCK_SIZE, cam);
+		left   += AUDIO_BLOCK_SIZE;
+		right  += AUDIO_BLOCK_SIZE;
+		frames -= AUDIO_BLOCK_SIZE;
+	}
+
+	size_t len = buf->size();
+
+	if (len == 0) {
+		playState = state::Ended;
+		std::fill(left,  left + frames,  0.f);
+		std::fill(right, right + frames, 0.f);
+		return;
+	}
+
+	float distance = glm::distance(cam->position(), worldPosition);
+	spatialParams cur = listenerParams(worldPosition, cam, distance, occlusion, outputRate);
+
+	if (doppler && haveLast && frames > 0) {
+		// positive when moving apart
+		float speed = (distance - lastDistance) * outputRate / frames;
+		cur.rate = std::clamp(SPEED_OF_SOUND / (SPEED_OF_SOUND + speed),
+		                      MIN_RATE, MAX_RATE);
+	}
+
+	if (!haveLast) {
+		last = cur;
+		haveLast = true;
+	}
+
+	lastDistance = distance;
+
+	// source samples for the block, at the output rate, doppler-shifted
+	float src[AUDIO_BLOCK_SIZE];
+	size_t n = frames;
+	bool loop = loopMode == mode::Loop;
+	float rate = pitch * buf->sampleRate / float(outputRate);
+	double pos = audioPosition + positionFrac;
+
+	size_t end = resampler.resample(src, n, pos,
+		rate*last.rate, rate*cur.rate, loop? HUGE_VAL : double(len),
+		[&] (ptrdiff_t i) { return buf->sampleAt(i, loop); });
+
+	if (end < n) {
+		playState = state::Ended;
+		std::fill(src + end, src + n, 0.f);
+	}
+
+	if (loop) {
+		pos = fmod(pos, len);
+	}
+
+	audioPosition = pos;
+	positionFrac  = pos - audioPosition;
+
+	// append to the delay line, in at most two contiguous runs
+	size_t start = historyPos;
+	size_t first = min(n, historySize - start);
+	std::copy(src, src + first, history + start);
+	std::copy(src + first, src + n, history);
+	historyPos = (start + n) & (historySize - 1);
+
+	float echoDelay = ECHO_DELAY * outputRate;
+	float *out[2] = {left, right};
+
+	for (unsigned ear = 0; ear < 2; ear++) {
+		float y = filtered[ear];
+
+		for (size_t i = 0; i < n; i++) {
+			float t     = (i + 1) / float(n);
+			float gain  = lerp(last.gain[ear],    cur.gain[ear],    t);
+			float delay = lerp(last.delay[ear],   cur.delay[ear],   t);
+			float coef  = lerp(last.lowpass[ear], cur.lowpass[ear], t);
+
+			// fractional delay read, linear interpolation
+			auto tap = [&] (float d) {
+				float pos = float(start + i) - d;
+				float base = floorf(pos);
+				float frac = pos - base;
+				size_t k = size_t(ptrdiff_t(base) + historySize) & (historySize - 1);
+
+				return lerp(history[k], history[(k + 1) & (historySize - 1)], frac);
+			};
+
+			float x = tap(delay) + ECHO_STRENGTH*tap(delay + echoDelay);
+			y += coef * (x - y);
+			out[ear][i] = y * gain;
+		}
+
+		filtered[ear] = y;
+	}
 
-	sample_c2 samp = sample_audio_stream(*buf, audioPosition, dir);
-	return {samp.left * atten, samp.right * atten};
+	last = cur;
 }
@@ -0,0 +1,455 @@
+#include <grend/textureFormats.hpp>
+#include <grend/glManager.hpp>
+#include <grend/utility.hpp>
+
+#include <stb/stb_image.h>
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <string.h>
+#include <stdint.h>
+
+namespace grendx {
+
+static bool readFile(const std::string& filename, std::vector<uint8_t>& data) {
+	std::ifstream input(filename, std::ios::binary);
+
+	if (!input.good()) {
+		return false;
+	}
+
+	data.assign(std::istreambuf_iterator<char>(input),
+	            std::istreambuf_iterator<char>());
+	return true;
+}
+
+static size_t blockBytes(materialTexture::blockFormat format) {
+	switch (format) {
+		case materialTexture::blockFormat::ETC2_RGB:
+		case materialTexture::blockFormat::BC1:
+			return 8;
+
+		case materialTexture::blockFormat::ETC2_RGBA:
+		case materialTexture::blockFormat::BC3:
+		case materialTexture::blockFormat::BC7:
+			return 16;
+
+		default:
+			return 0;
+	}
+}
+
+// expected size of one mip level, in bytes
+static size_t levelSize(const materialTexture& tex, int width, int height) {
+	if (tex.compressed()) {
+		size_t bw = max(1, (width  + 3) / 4);
+		size_t bh = max(1, (height + 3) / 4);
+		return bw * bh * blockBytes(tex.format);
+
+	} else {
+		return size_t(width) * height * tex.channels;
+	}
+}
+
+// common checks once a container has been parsed
+static bool finishContainer(materialTexture& tex, const std::string& filename) {
+	if (tex.mips.empty() || !haveCompressedFormat(tex.format)) {
+		SDL_Log("%s: unsupported texture format, skipping", filename.c_str());
+		tex = materialTexture();
+		return false;
+	}
+
+	for (auto& mip : tex.mips) {
+		if (mip.offset > tex.pixels.size()
+		    || mip.size > tex.pixels.size() - mip.offset)
+		{
+			SDL_Log("%s: truncated mip data, skipping", filename.c_str());
+			tex = materialTexture();
+			return false;
+		}
+	}
+
+	// single uncompressed level, may as well generate mipmaps on the GPU
+	if (tex.mips.size() == 1 && !tex.compressed()) {
+		tex.mips.clear();
+	}
+
+	tex.size = tex.pixels.size();
+	tex.sourceFile = filename;
+	SDL_Log("Loaded texture container %s: %dx%d, %lu levels, format %d",
+	        filename.c_str(), tex.width, tex.height, tex.mips.size(), (int)tex.format);
+	return true;
+}
+
+struct ktx2Header {
+	uint8_t  identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct ktx2Level {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+static const uint8_t ktx2Identifier[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+// vulkan format enums, only the ones that map to something we can upload
+static bool ktx2Format(materialTexture& tex, uint32_t vkFormat) {
+	switch (vkFormat) {
+		case 23:  /* R8G8B8_UNORM */
+		case 29:  /* R8G8B8_SRGB */
+			tex.format = materialTexture::blockFormat::Uncompressed;
+			tex.channels = 3;
+			return true;
+
+		case 37:  /* R8G8B8A8_UNORM */
+		case 43:  /* R8G8B8A8_SRGB */
+			tex.format = materialTexture::blockFormat::Uncompressed;
+			tex.channels = 4;
+			return true;
+
+		case 131: /* BC1_RGB_UNORM_BLOCK */
+		case 132: /* BC1_RGB_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::BC1;
+			tex.channels = 3;
+			return true;
+
+		case 133: /* BC1_RGBA_UNORM_BLOCK */
+		case 134: /* BC1_RGBA_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::BC1;
+			tex.channels = 4;
+			return true;
+
+		case 137: /* BC3_UNORM_BLOCK */
+		case 138: /* BC3_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::BC3;
+			tex.channels = 4;
+			return true;
+
+		case 145: /* BC7_UNORM_BLOCK */
+		case 146: /* BC7_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::BC7;
+			tex.channels = 4;
+			return true;
+
+		case 147: /* ETC2_R8G8B8_UNORM_BLOCK */
+		case 148: /* ETC2_R8G8B8_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::ETC2_RGB;
+			tex.channels = 3;
+			return true;
+
+		case 151: /* ETC2_R8G8B8A8_UNORM_BLOCK */
+		case 152: /* ETC2_R8G8B8A8_SRGB_BLOCK */
+			tex.format = materialTexture::blockFormat::ETC2_RGBA;
+			tex.channels = 4;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+bool loadKTX2(materialTexture& tex, const std::string& filename) {
+	ktx2Header header;
+
+	if (!readFile(filename, tex.pixels)) {
+		return false;
+	}
+
+	if (tex.pixels.size() < sizeof(header)) {
+		tex = materialTexture();
+		return false;
+	}
+
+	memcpy(&header, tex.pixels.data(), sizeof(header));
+
+	if (memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0
+	    || header.pixelDepth > 1
+	    || header.layerCount > 1
+	    || header.faceCount != 1
+	    // TODO: basis universal/zstd supercompression
+	    || header.supercompressionScheme != 0
+	    || !ktx2Format(tex, header.vkFormat))
+	{
+		SDL_Log("%s: unsupported KTX2 file", filename.c_str());
+		tex = materialTexture();
+		return false;
+	}
+
+	tex.width  = header.pixelWidth;
+	tex.height = header.pixelHeight;
+	tex.type   = materialTexture::imageType::Plain;
+
+	// level count of 0 means mips should be generated at load time
+	unsigned levels = max(1u, header.levelCount);
+	size_t indexEnd = sizeof(header) + levels*sizeof(ktx2Level);
+
+	if (tex.pixels.size() < indexEnd) {
+		tex = materialTexture();
+		return false;
+	}
+
+	for (unsigned i = 0; i < levels; i++) {
+		ktx2Level level;
+		memcpy(&level, tex.pixels.data() + sizeof(header) + i*sizeof(level),
+		       sizeof(level));
+
+		int w = max(1, tex.width  >> i);
+		int h = max(1, tex.height >> i);
+		size_t expected = levelSize(tex, w, h);
+
+		if (level.byteLength < expected) {
+			SDL_Log("%s: level %u is too small", filename.c_str(), i);
+			tex = materialTexture();
+			return false;
+		}
+
+		// level data is used in place, no need to copy it out of the file
+		tex.mips.push_back({w, h, size_t(level.byteOffset), expected});
+	}
+
+	return finishContainer(tex, filename);
+}
+
+struct ddsPixelFormat {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t rMask;
+	uint32_t gMask;
+	uint32_t bMask;
+	uint32_t aMask;
+};
+
+struct ddsHeader {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	ddsPixelFormat format;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct ddsHeaderDX10 {
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+static constexpr uint32_t fourCC(const char s[5]) {
+	return s[0] | (s[1] << 8) | (s[2] << 16) | (uint32_t(s[3]) << 24);
+}
+
+enum {
+	DDSD_MIPMAPCOUNT  = 0x20000,
+	DDPF_FOURCC       = 0x4,
+	DDPF_RGB          = 0x40,
+	DDSCAPS2_CUBEMAP  = 0x200,
+	DDSCAPS2_VOLUME   = 0x200000,
+};
+
+static bool dxgiFormat(materialTexture& tex, uint32_t format) {
+	switch (format) {
+		case 28: /* R8G8B8A8_UNORM */
+		case 29: /* R8G8B8A8_UNORM_SRGB */
+			tex.format = materialTexture::blockFormat::Uncompressed;
+			tex.channels = 4;
+			return true;
+
+		case 71: /* BC1_UNORM */
+		case 72: /* BC1_UNORM_SRGB */
+			tex.format = materialTexture::blockFormat::BC1;
+			tex.channels = 4;
+			return true;
+
+		case 77: /* BC3_UNORM */
+		case 78: /* BC3_UNORM_SRGB */
+			tex.format = materialTexture::blockFormat::BC3;
+			tex.channels = 4;
+			return true;
+
+		case 98: /* BC7_UNORM */
+		case 99: /* BC7_UNORM_SRGB */
+			tex.format = materialTexture::blockFormat::BC7;
+			tex.channels = 4;
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+static bool ddsFormat(materialTexture& tex, const ddsPixelFormat& pf) {
+	if (pf.flags & DDPF_FOURCC) {
+		if (pf.fourCC == fourCC("DXT1")) {
+			tex.format = materialTexture::blockFormat::BC1;
+			tex.channels = 4;
+			return true;
+		}
+
+		if (pf.fourCC == fourCC("DXT5")) {
+			tex.format = materialTexture::blockFormat::BC3;
+			tex.channels = 4;
+			return true;
+		}
+
+		return false;
+	}
+
+	// only plain RGBA8 for uncompressed data, anything else
+	// would need swizzling
+	if ((pf.flags & DDPF_RGB)
+	    && pf.rgbBitCount == 32
+	    && pf.rMask == 0x000000ff
+	    && pf.gMask == 0x0000ff00
+	    && pf.bMask == 0x00ff0000)
+	{
+		tex.format = materialTexture::blockFormat::Uncompressed;
+		tex.channels = 4;
+		return true;
+	}
+
+	return false;
+}
+
+bool loadDDS(materialTexture& tex, const std::string& filename) {
+	ddsHeader header;
+
+	if (!readFile(filename, tex.pixels)) {
+		return false;
+	}
+
+	if (tex.pixels.size() < sizeof(header)) {
+		tex = materialTexture();
+		return false;
+	}
+
+	memcpy(&header, tex.pixels.data(), sizeof(header));
+	size_t offset = sizeof(header);
+	bool knownFormat = false;
+
+	if (header.magic != fourCC("DDS ")
+	    || (header.caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)))
+	{
+		SDL_Log("%s: unsupported DDS file", filename.c_str());
+		tex = materialTexture();
+		return false;
+	}
+
+	if ((header.format.flags & DDPF_FOURCC)
+	    && header.format.fourCC == fourCC("DX10"))
+	{
+		ddsHeaderDX10 dx10;
+
+		if (tex.pixels.size() < offset + sizeof(dx10)) {
+			tex = materialTexture();
+			return false;
+		}
+
+		memcpy(&dx10, tex.pixels.data() + offset, sizeof(dx10));
+		offset += sizeof(dx10);
+		knownFormat = dx10.arraySize <= 1 && dxgiFormat(tex, dx10.dxgiFormat);
+
+	} else {
+		knownFormat = ddsFormat(tex, header.format);
+	}
+
+	if (!knownFormat) {
+		SDL_Log("%s: unsupported DDS pixel format", filename.c_str());
+		tex = materialTexture();
+		return false;
+	}
+
+	tex.width  = header.width;
+	tex.height = header.height;
+	tex.type   = materialTexture::imageType::Plain;
+
+	unsigned levels = (header.flags & DDSD_MIPMAPCOUNT)
+		? max(1u, header.mipMapCount)
+		: 1;
+
+	// levels are stored back-to-back, largest first
+	for (unsigned i = 0; i < levels; i++) {
+		int w = max(1, tex.width  >> i);
+		int h = max(1, tex.height >> i);
+		size_t size = levelSize(tex, w, h);
+
+		tex.mips.push_back({w, h, offset, size});
+		offset += size;
+	}
+
+	return finishContainer(tex, filename);
+}
+
+static bool loadStbImage(materialTexture& tex, const std::string& filename) {
+	// flip setting is global, other loaders may have changed it
+	stbi_set_flip_vertically_on_load_thread(false);
+
+	uint8_t *px = stbi_load(filename.c_str(), &tex.width, &tex.height,
+	                        &tex.channels, 0);
+
+	if (!px) {
+		tex.channels = 0;
+		return false;
+	}
+
+	size_t size = (tex.channels * tex.width) * tex.height;
+	tex.pixels.assign(px, px + size);
+	tex.size   = size;
+	tex.type   = materialTexture::imageType::Plain;
+	tex.format = materialTexture::blockFormat::Uncompressed;
+
+	stbi_image_free(px);
+	return true;
+}
+
+bool loadImageFile(materialTexture& tex, const std::string& filename) {
+	std::string ext = filename_extension(filename);
+
+	if (ext == ".ktx2") {
+		return loadKTX2(tex, filename);
+
+	} else if (ext == ".dds") {
+		return loadDDS(tex, filename);
+	}
+
+	// precompressed versions of an image take priority, if the GPU can use them
+	return loadKTX2(tex, filename + ".ktx2")
+	    || loadDDS(tex, filename + ".dds")
+	    || loadStbImage(tex, filename);
+}
+
+// namespace grendx
+}
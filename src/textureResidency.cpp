@@ -0,0 +1,171 @@
+#include <grend/textureResidency.hpp>
+#include <grend/textureFormats.hpp>
+#include <grend/utility.hpp>
+
+#include <vector>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+
+namespace grendx {
+
+// allow this many levels more detail than the on-screen size suggests,
+// bounding spheres are a pretty rough estimate of texel density
+#define RESIDENCY_LEVEL_BIAS 1
+
+static std::vector<Texture::weakptr> managedTextures;
+static textureResidencyStats stats;
+
+void manageTextureResidency(Texture::ptr tex) {
+	managedTextures.push_back(tex);
+}
+
+textureResidencyStats getTextureResidencyStats(void) {
+	return stats;
+}
+
+static bool usedLastFrame(const Texture::ptr& tex) {
+	return glmanCurrentFrame - tex->lastUsed <= 1;
+}
+
+// largest level that's always kept resident, same cutoff as the levels
+// Texture::buffer() uploads immediately
+static unsigned tailLevel(const Texture::ptr& tex) {
+	int size = max(tex->width, tex->height);
+	unsigned level = 0;
+
+	while (level + 1 < tex->levels()
+	       && (size >> level) > TEXTURE_STREAM_IMMEDIATE_SIZE)
+	{
+		level++;
+	}
+
+	return level;
+}
+
+static unsigned wantedLevel(const Texture::ptr& tex) {
+	if (tex->screenSize <= 0.f) {
+		// drawn, but without any size info, assume full resolution
+		return 0;
+	}
+
+	float ratio = max(tex->width, tex->height) / max(1.f, tex->screenSize);
+	int level = int(floor(log2(max(1.f, ratio)))) - RESIDENCY_LEVEL_BIAS;
+
+	return min(unsigned(max(0, level)), tailLevel(tex));
+}
+
+// levels being read on a worker, checked for completion each frame rather
+// than handed back with addDeferred(), which would take the job queue lock
+// from inside a job
+struct pendingReload {
+	Texture::weakptr tex;
+	std::shared_ptr<materialTexture> data;
+	unsigned level;
+	std::future<bool> loaded;
+};
+
+static std::vector<pendingReload> reloads;
+
+static void requestReload(jobQueue *jobs, Texture::ptr tex, unsigned level) {
+	auto data = std::make_shared<materialTexture>();
+	std::string path = tex->sourceFile;
+	tex->reloading = true;
+
+	auto loaded = jobs->addAsync([=] () {
+		return loadImageFile(*data, path);
+	});
+
+	reloads.push_back({tex, data, level, std::move(loaded)});
+}
+
+static void finishReloads(void) {
+	for (auto it = reloads.begin(); it != reloads.end();) {
+		auto status = it->loaded.wait_for(std::chrono::seconds(0));
+
+		if (status != std::future_status::ready) {
+			it++;
+			continue;
+		}
+
+		if (auto tex = it->tex.lock()) {
+			tex->streamFrom(it->loaded.get()? it->data : nullptr, it->level);
+		}
+
+		it = reloads.erase(it);
+	}
+}
+
+void updateTextureResidency(jobQueue *jobs, size_t budget) {
+	glmanCurrentFrame++;
+	stats = {};
+	finishReloads();
+
+	std::vector<Texture::ptr> live;
+	live.reserve(managedTextures.size());
+
+	for (auto& weak : managedTextures) {
+		auto tex = weak.lock();
+
+		if (tex && !tex->sourceFile.empty()) {
+			live.push_back(tex);
+		}
+	}
+
+	managedTextures.assign(live.begin(), live.end());
+	bool overBudget = budget && dbgGlmanTexturesBuffered > budget;
+
+	// stream in levels for textures that need more detail than they have,
+	// unless that would just get evicted again
+	for (auto& tex : live) {
+		if (overBudget || !jobs || !usedLastFrame(tex)
+		    || tex->streaming() || tex->reloading)
+		{
+			continue;
+		}
+
+		unsigned want = wantedLevel(tex);
+
+		if (want < tex->residentLevel()) {
+			requestReload(jobs, tex, want);
+		}
+	}
+
+	if (overBudget) {
+		// least recently used first, then smallest on screen
+		std::sort(live.begin(), live.end(),
+			[] (const Texture::ptr& a, const Texture::ptr& b) {
+				return (a->lastUsed == b->lastUsed)
+					? a->screenSize < b->screenSize
+					: a->lastUsed   < b->lastUsed;
+			});
+
+		// first drop detail that's more than visible textures need...
+		for (auto& tex : live) {
+			if (dbgGlmanTexturesBuffered <= budget) break;
+
+			if (usedLastFrame(tex)) {
+				tex->dropLevels(wantedLevel(tex));
+			}
+		}
+
+		// ... then evict anything that wasn't drawn down to its tail levels
+		for (auto& tex : live) {
+			if (dbgGlmanTexturesBuffered <= budget) break;
+
+			if (!usedLastFrame(tex)) {
+				tex->dropLevels(tailLevel(tex));
+			}
+		}
+	}
+
+	for (auto& tex : live) {
+		stats.managed++;
+		stats.evicted   += !tex->streaming() && tex->residentLevel() > 0;
+		stats.reloading += tex->reloading;
+	}
+}
+
+// namespace grendx
+}
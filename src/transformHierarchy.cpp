@@ -0,0 +1,153 @@
+#include <grend/transformHierarchy.hpp>
+
+#include <map>
+
+namespace grendx {
+
+static uint8_t negativeScales(const TRS& transform) {
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < 3; i++) {
+		count += transform.scale[i] < 0;
+	}
+
+	return count & 1;
+}
+
+uint32_t transformHierarchy::add(sceneNode::ptr node, int32_t parent) {
+	uint32_t idx = nodes.size();
+	const TRS& transform = node->getTransformTRS();
+
+	// the root is only borrowed, the hierarchy would keep it alive otherwise
+	nodes.push_back((parent < 0)? sceneNode::ptr(sceneNode::ptr(), node.get()) : node);
+	parents.push_back(parent);
+	ends.push_back(0);
+	local.push_back(transform.getTransform());
+	world.push_back((parent < 0)? local[idx] : world[parent] * local[idx]);
+	inverted.push_back(negativeScales(transform)
+	                   ^ ((parent < 0)? 0 : inverted[parent]));
+	versions.push_back(node->getTransformVersion());
+	structureVersions.push_back(node->getStructureVersion());
+	dirty.push_back(false);
+	indices[node.get()] = idx;
+
+	for (auto& [name, ptr] : node->nodes) {
+		if (ptr) {
+			add(ptr, idx);
+		}
+	}
+
+	ends[idx] = nodes.size();
+	return idx;
+}
+
+void transformHierarchy::build(void) {
+	nodes.clear();
+	parents.clear();
+	ends.clear();
+	local.clear();
+	world.clear();
+	inverted.clear();
+	versions.clear();
+	structureVersions.clear();
+	dirty.clear();
+	indices.clear();
+
+	if (auto r = root.lock()) {
+		add(r, -1);
+	}
+}
+
+size_t transformHierarchy::update(void) {
+	if (root.expired()) {
+		// nodes[0] is dangling now, and nothing else is needed anymore
+		if (!nodes.empty()) {
+			build();
+		}
+
+		return 0;
+	}
+
+	// parents come first, so a changed child list is always found
+	// before looking at any node that might have been removed with it
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i]->getStructureVersion() != structureVersions[i]) {
+			build();
+			return nodes.size();
+		}
+	}
+
+	size_t recomputed = 0;
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		int32_t p = parents[i];
+		sceneNode *node = nodes[i].get();
+		bool moved = node->getTransformVersion() != versions[i];
+
+		if (moved) {
+			const TRS& transform = node->getTransformTRS();
+			versions[i] = node->getTransformVersion();
+			local[i] = transform.getTransform();
+			inverted[i] = negativeScales(transform) ^ ((p < 0)? 0 : inverted[p]);
+
+		} else if (p >= 0 && dirty[p]) {
+			inverted[i] = negativeScales(node->getTransformTRS()) ^ inverted[p];
+		}
+
+		dirty[i] = moved || (p >= 0 && dirty[p]);
+
+		if (dirty[i]) {
+			world[i] = (p < 0)? local[i] : world[p] * local[i];
+			recomputed++;
+		}
+	}
+
+	return recomputed;
+}
+
+int32_t transformHierarchy::find(sceneNode *node) const {
+	auto it = indices.find(node);
+	return (it != indices.end())? it->second : -1;
+}
+
+glm::mat4 transformHierarchy::worldTransform(sceneNode *node) const {
+	int32_t idx = find(node);
+	return (idx >= 0)? world[idx] : node->getTransformTRS().getTransform();
+}
+
+static std::map<sceneNode*, transformHierarchy::ptr> hierarchyCache;
+static size_t lastPruneSize = 0;
+
+transformHierarchy::ptr cachedTransforms(sceneNode::ptr root) {
+	if (!root) {
+		return nullptr;
+	}
+
+	// drop hierarchies of roots that have been freed whenever the cache
+	// has doubled in size
+	if (hierarchyCache.size() > 2*lastPruneSize + 16) {
+		for (auto it = hierarchyCache.begin(); it != hierarchyCache.end();) {
+			if (it->second->root.expired()) {
+				it = hierarchyCache.erase(it);
+			} else {
+				it++;
+			}
+		}
+
+		lastPruneSize = hierarchyCache.size();
+	}
+
+	auto& ret = hierarchyCache[root.get()];
+
+	// entry could also be for a freed root that was at the same address
+	if (!ret || ret->root.lock() != root) {
+		ret = std::make_shared<transformHierarchy>(root);
+	} else {
+		ret->update();
+	}
+
+	return ret;
+}
+
+// namespace grendx
+}